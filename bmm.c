@@ -2,31 +2,329 @@
 /* Block Memory Menagament (lib): A block memory algorithm */
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
 #include "bmm.h"
 
-#define BITS_OF_U32   32
-#define BITMAP_BYTE_OFFSET   5
-#define BITMAP_BIT_OFFSET   0x1F
+#define BITS_PER_WORD	64
+#define WORD_SHIFT	6
+#define WORD_MASK	(BITS_PER_WORD - 1)
+#define FULL_WORD	(~0ULL)
 
 #define __ALIGN_MASK(x, mask)  (((x) + (mask)) & ~(mask))
 #define ALIGN(x, a) __ALIGN_MASK(x, (typeof(x))(a)-1)
 
 #define TAG 0x0a0b0c0d
 
+/*
+ * The pool head, the bitmap and the summary are at the start of the region,
+ * and the blocks follow them. A set bit in the bitmap is a used block, and a
+ * set bit in the summary is a full word of the bitmap. The bits past the
+ * last block are set, so they're never found as free.
+ *
+ * With BMM_CONCURRENT, blocks are claimed and released with atomic operations
+ * on the bitmap words. The summary is only a hint then, a word may be seen
+ * as not full while it's full, but never the other way around for long.
+ * num_free is approximate, and the search starts from a per-thread word.
+ *
+ * The head keeps no pointer, so a pool in shared memory could be used by
+ * processes that map it at different addresses.
+ */
 struct mem_pool {
 	unsigned int tag;
-	void *base;
+	unsigned int flags;
+	unsigned int base_off;	/* from the head to the first block */
 	unsigned int mem_size;
 	unsigned int block_size;
 	unsigned int block_num;
 	unsigned int num_free;
-	unsigned int index;
-	unsigned int *bitmap;
+	unsigned int index;	/* the word to search from */
+	unsigned int word_num;
+	unsigned int sum_num;
+	/* statistics, they're read by bmm_get_stats() without any lock */
+	unsigned int peak_used;	/* in blocks */
+	uint64_t fail_num;
+	uint64_t bitmap[];	/* followed by the summary */
 };
 
+/* the word that the thread searches from in a concurrent pool, plus one */
+static __thread unsigned int bmm_hint;
+static unsigned int bmm_hint_seed;
+
+static inline uint64_t *summary_of(struct mem_pool *mp)
+{
+	return mp->bitmap + mp->word_num;
+}
+
+static inline char *base_of(struct mem_pool *mp)
+{
+	return (char *)mp + mp->base_off;
+}
+
+static inline unsigned int words_of(unsigned int bits)
+{
+	return (bits + BITS_PER_WORD - 1) >> WORD_SHIFT;
+}
+
+/* the mask of bits from start to end - 1 in a word, 0 <= start < end <= 64 */
+static inline uint64_t bits_mask(unsigned int start, unsigned int end)
+{
+	uint64_t m = FULL_WORD << start;
+
+	if (end < BITS_PER_WORD)
+		m &= ~(FULL_WORD << end);
+	return m;
+}
+
+/* the bitmaps may be changed by other threads in a concurrent pool */
+static inline uint64_t load_word(uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void update_summary(struct mem_pool *mp, unsigned int w)
+{
+	uint64_t bit = 1ULL << (w & WORD_MASK);
+
+	if (mp->bitmap[w] == FULL_WORD)
+		summary_of(mp)[w >> WORD_SHIFT] |= bit;
+	else
+		summary_of(mp)[w >> WORD_SHIFT] &= ~bit;
+}
+
+/* set or clear the bits of blocks from start to start + n - 1 */
+static void set_range(struct mem_pool *mp, unsigned int start,
+		      unsigned int n, int used)
+{
+	unsigned int w, end = start + n;
+	unsigned int s, e;
+	uint64_t m;
+
+	for (w = start >> WORD_SHIFT; start < end; w++) {
+		s = start & WORD_MASK;
+		e = (end - (w << WORD_SHIFT)) < BITS_PER_WORD ?
+		    end & WORD_MASK : BITS_PER_WORD;
+		m = bits_mask(s, e);
+		if (used)
+			mp->bitmap[w] |= m;
+		else
+			mp->bitmap[w] &= ~m;
+		update_summary(mp, w);
+		start = (w + 1) << WORD_SHIFT;
+	}
+}
+
+/* return 1 if all the bits of blocks from start to start + n - 1 are set */
+static int range_used(struct mem_pool *mp, unsigned int start, unsigned int n)
+{
+	unsigned int w, end = start + n;
+	unsigned int s, e;
+	uint64_t m;
+
+	for (w = start >> WORD_SHIFT; start < end; w++) {
+		s = start & WORD_MASK;
+		e = (end - (w << WORD_SHIFT)) < BITS_PER_WORD ?
+		    end & WORD_MASK : BITS_PER_WORD;
+		m = bits_mask(s, e);
+		if ((mp->bitmap[w] & m) != m)
+			return 0;
+		start = (w + 1) << WORD_SHIFT;
+	}
+	return 1;
+}
+
+/*
+ * Find the first word that isn't full from word "from" to the last one, by
+ * the summary. Return word_num if all of them are full.
+ */
+static unsigned int find_free_word(struct mem_pool *mp, unsigned int from)
+{
+	unsigned int s = from >> WORD_SHIFT;
+	uint64_t avail;
+
+	if (from >= mp->word_num)
+		return mp->word_num;
+	avail = ~load_word(&summary_of(mp)[s]);
+	avail &= FULL_WORD << (from & WORD_MASK);
+	while (!avail) {
+		if (++s >= mp->sum_num)
+			return mp->word_num;
+		avail = ~load_word(&summary_of(mp)[s]);
+	}
+	return (s << WORD_SHIFT) + __builtin_ctzll(avail);
+}
+
+/* find the first used block from block "from", return block_num if none */
+static unsigned int find_used_bit(struct mem_pool *mp, unsigned int from)
+{
+	unsigned int w = from >> WORD_SHIFT;
+	uint64_t used;
+
+	used = load_word(&mp->bitmap[w]);
+	used &= FULL_WORD << (from & WORD_MASK);
+	while (!used) {
+		if (++w >= mp->word_num)
+			return mp->block_num;
+		used = load_word(&mp->bitmap[w]);
+	}
+	return (w << WORD_SHIFT) + __builtin_ctzll(used);
+}
+
+/* find the first free block from block "from", return block_num if none */
+static unsigned int find_free_bit(struct mem_pool *mp, unsigned int from)
+{
+	unsigned int w = from >> WORD_SHIFT;
+	uint64_t avail;
+
+	if (from >= mp->block_num)
+		return mp->block_num;
+	avail = ~load_word(&mp->bitmap[w]);
+	avail &= FULL_WORD << (from & WORD_MASK);
+	while (!avail) {
+		w = find_free_word(mp, w + 1);
+		if (w >= mp->word_num)
+			return mp->block_num;
+		/* a concurrent pool may fill it after the summary is read */
+		avail = ~load_word(&mp->bitmap[w]);
+	}
+	return (w << WORD_SHIFT) + __builtin_ctzll(avail);
+}
+
+/* find a run of n free blocks from block "from" to the last one */
+static unsigned int find_run(struct mem_pool *mp, unsigned int from,
+			     unsigned int n)
+{
+	unsigned int start, end;
+
+	while (1) {
+		start = find_free_bit(mp, from);
+		if (start + n > mp->block_num)
+			return mp->block_num;
+		end = find_used_bit(mp, start);
+		if (end - start >= n)
+			return start;
+		from = end;
+	}
+}
+
+/* set the summary bit of a word that a claim has filled */
+static void mark_full(struct mem_pool *mp, unsigned int w)
+{
+	uint64_t *sum = &summary_of(mp)[w >> WORD_SHIFT];
+	uint64_t bit = 1ULL << (w & WORD_MASK);
+
+	__atomic_fetch_or(sum, bit, __ATOMIC_SEQ_CST);
+	/* a block of the word may be freed before the bit is set */
+	if (__atomic_load_n(&mp->bitmap[w], __ATOMIC_SEQ_CST) != FULL_WORD)
+		__atomic_fetch_and(sum, ~bit, __ATOMIC_SEQ_CST);
+}
+
+static void mark_avail(struct mem_pool *mp, unsigned int w)
+{
+	__atomic_fetch_and(&summary_of(mp)[w >> WORD_SHIFT],
+			   ~(1ULL << (w & WORD_MASK)), __ATOMIC_SEQ_CST);
+}
+
+/* return the index of the claimed block, or block_num if there's none */
+static unsigned int claim_block(struct mem_pool *mp)
+{
+	unsigned int start, w;
+	uint64_t old, bit;
+	int wrapped = 0;
+
+	if (!bmm_hint)
+		bmm_hint = __atomic_fetch_add(&bmm_hint_seed, 1,
+					      __ATOMIC_RELAXED) * 7919 + 1;
+	start = (bmm_hint - 1) % mp->word_num;
+
+	for (w = start; ; w++) {
+		w = find_free_word(mp, w);
+		if (w >= mp->word_num) {
+			if (wrapped)
+				break;
+			wrapped = 1;
+			w = find_free_word(mp, 0);
+			if (w >= mp->word_num)
+				break;
+		}
+		if (wrapped && w > start)
+			break;
+
+		old = load_word(&mp->bitmap[w]);
+		while (old != FULL_WORD) {
+			bit = 1ULL << __builtin_ctzll(~old);
+			old = __atomic_fetch_or(&mp->bitmap[w], bit,
+						__ATOMIC_ACQ_REL);
+			if (old & bit)
+				continue;
+			if ((old | bit) == FULL_WORD)
+				mark_full(mp, w);
+			bmm_hint = w + 1;
+			return (w << WORD_SHIFT) + __builtin_ctzll(bit);
+		}
+	}
+	return mp->block_num;
+}
+
+/* return the number of the blocks that were used and are freed */
+static unsigned int release_range(struct mem_pool *mp, unsigned int start,
+				  unsigned int n)
+{
+	unsigned int w, end = start + n, freed = 0;
+	unsigned int s, e;
+	uint64_t m, old;
+
+	for (w = start >> WORD_SHIFT; start < end; w++) {
+		s = start & WORD_MASK;
+		e = (end - (w << WORD_SHIFT)) < BITS_PER_WORD ?
+		    end & WORD_MASK : BITS_PER_WORD;
+		m = bits_mask(s, e);
+		old = __atomic_fetch_and(&mp->bitmap[w], ~m, __ATOMIC_ACQ_REL);
+		if (old == FULL_WORD)
+			mark_avail(mp, w);
+		freed += __builtin_popcountll(old & m);
+		start = (w + 1) << WORD_SHIFT;
+	}
+	return freed;
+}
+
+/*
+ * Claim the blocks from start to start + n - 1, which were seen as free.
+ * Return 0 and give back what is claimed if another thread takes a block
+ * of them first.
+ */
+static int claim_range(struct mem_pool *mp, unsigned int start,
+		       unsigned int n)
+{
+	unsigned int w, first = start >> WORD_SHIFT, end = start + n;
+	unsigned int s, e, pos = start;
+	uint64_t m, old;
+
+	for (w = first; pos < end; w++) {
+		s = pos & WORD_MASK;
+		e = (end - (w << WORD_SHIFT)) < BITS_PER_WORD ?
+		    end & WORD_MASK : BITS_PER_WORD;
+		m = bits_mask(s, e);
+		old = __atomic_fetch_or(&mp->bitmap[w], m, __ATOMIC_ACQ_REL);
+		if (old & m) {
+			__atomic_fetch_and(&mp->bitmap[w], ~(m & ~old),
+					   __ATOMIC_ACQ_REL);
+			if (w > first)
+				release_range(mp, start,
+					      (w << WORD_SHIFT) - start);
+			return 0;
+		}
+		pos = (w + 1) << WORD_SHIFT;
+	}
+	for (w = first; w < words_of(end); w++) {
+		if (load_word(&mp->bitmap[w]) == FULL_WORD)
+			mark_full(mp, w);
+	}
+	return 1;
+}
+
 /**
  * Initial a continue memory region to be managed by bmm.
  *
@@ -34,119 +332,280 @@ struct mem_pool {
  * @mem_size: size of the region;
  * @block_size: size of evry block;
  * @align_size: size of block align;
+ * @flags: BMM_CONCURRENT to share the pool between threads;
+ *
+ * The pool head and its bitmaps are kept at the start of the region.
  */
-int bmm_init(void *addr_base, unsigned int mem_size,
-			  unsigned int block_size, unsigned int align_size)
+int bmm_init_ex(void *addr_base, unsigned int mem_size,
+		unsigned int block_size, unsigned int align_size,
+		unsigned int flags)
 {
-	unsigned int bitmap_sz;
-	unsigned int act_blksize;
 	struct mem_pool *mempool = (struct mem_pool *)addr_base;
+	unsigned int act_blksize, max_num, words, sums;
+	uintptr_t meta_end, base, end;
 
 	/* align_size must be 2^N */
 	if ((align_size == 0) || (align_size & (align_size - 1)))
-		return EINVAL;
+		return -EINVAL;
 
-	if (((unsigned long long)addr_base & (align_size - 1)) != 0)
-		return EINVAL;
+	if (((uintptr_t)addr_base & (align_size - 1)) != 0)
+		return -EINVAL;
 
 	/* actual_block_zise is determined by align_size and block_size de */
 	act_blksize = ALIGN(block_size, align_size);
-#ifndef NDEBUG
-	printf("\nact_blksize = %d, 0x%x\n", act_blksize, act_blksize);
-#endif
-	if (mem_size <= act_blksize)
-		return ENOMEM;
+	if (!act_blksize || mem_size <= sizeof(*mempool) + act_blksize)
+		return -ENOMEM;
 
-	memset(mempool, 0, sizeof(*mempool));
+	/* size the bitmaps for the most blocks, the tail bits stay used */
+	max_num = (mem_size - sizeof(*mempool)) / act_blksize;
+	words = words_of(max_num);
+	sums = words_of(words);
+	meta_end = (uintptr_t)addr_base + sizeof(*mempool) +
+		   (words + sums) * sizeof(uint64_t);
+	base = ALIGN(meta_end, (uintptr_t)align_size);
+	end = (uintptr_t)addr_base + mem_size;
+	if (base + act_blksize > end)
+		return -ENOMEM;
 
+	memset(mempool, 0, sizeof(*mempool));
 	mempool->tag = TAG;
+	mempool->flags = flags;
 	mempool->mem_size = mem_size;
 	mempool->block_size = act_blksize;
-	mempool->block_num = mem_size / act_blksize;
-
-	bitmap_sz = ((mempool->block_num-1) / BITS_OF_U32 + 1) *
-				sizeof(unsigned int);
-
-	mempool->base = (void *)(((unsigned long long)(addr_base +
-			sizeof(struct mem_pool) + bitmap_sz) /
-			align_size + 1) * align_size);
+	mempool->block_num = (end - base) / act_blksize;
 	mempool->num_free = mempool->block_num;
-	mempool->bitmap = (unsigned int *)((unsigned long)mempool->base +
-			 (sizeof(struct mem_pool) + 1));
-	memset(mempool->bitmap, 0, bitmap_sz);
+	mempool->word_num = words;
+	mempool->sum_num = sums;
+	mempool->base_off = base - (uintptr_t)addr_base;
 
+	memset(mempool->bitmap, 0, (words + sums) * sizeof(uint64_t));
+	if (words * BITS_PER_WORD > mempool->block_num)
+		set_range(mempool, mempool->block_num,
+			  words * BITS_PER_WORD - mempool->block_num, 1);
+	if (sums * BITS_PER_WORD > words)
+		summary_of(mempool)[sums - 1] |=
+			~bits_mask(0, words & WORD_MASK);
 	return 0;
 }
 
+int bmm_init(void *addr_base, unsigned int mem_size,
+			  unsigned int block_size, unsigned int align_size)
+{
+	return bmm_init_ex(addr_base, mem_size, block_size, align_size, 0);
+}
+
+static inline void *block_addr(struct mem_pool *mp, unsigned int index)
+{
+	return base_of(mp) + (size_t)index * mp->block_size;
+}
+
+/* update the counters after n blocks are taken, or after a failure */
+static void account_alloc(struct mem_pool *mp, unsigned int n)
+{
+	unsigned int nfree, used, peak;
+
+	if (!n) {
+		__atomic_fetch_add(&mp->fail_num, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	/* a free may be counted after its blocks are taken again */
+	nfree = __atomic_sub_fetch(&mp->num_free, n, __ATOMIC_RELAXED);
+	used = nfree > mp->block_num ? mp->block_num : mp->block_num - nfree;
+	peak = __atomic_load_n(&mp->peak_used, __ATOMIC_RELAXED);
+	while (used > peak &&
+	       !__atomic_compare_exchange_n(&mp->peak_used, &peak, used, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
 void *bmm_alloc(void *pool)
 {
 	struct mem_pool *mempool = (struct mem_pool *)pool;
-	unsigned int byte_pos;
-	unsigned short bit_pos;
-	unsigned int *bitmap_t = mempool->bitmap;
-	unsigned long long index_tmp = mempool->index;
+	unsigned int w, bit;
 
 	assert(mempool->tag == TAG);
 
-	/* find the free block from the current index to the last one */
-	for (; mempool->index < mempool->block_num; mempool->index++) {
-		byte_pos = mempool->index >> BITMAP_BYTE_OFFSET;
-		bit_pos = mempool->index & BITMAP_BIT_OFFSET;
-
-		/* find the free block */
-		if (((bitmap_t[byte_pos]) & (0x1 << bit_pos)) == 0) {
-			mempool->index++;
-			mempool->num_free--;
-			bitmap_t[byte_pos] = bitmap_t[byte_pos] |
-				(0x1 << bit_pos);
-			mempool->bitmap = bitmap_t;
-			pool = (void *)mempool;
-			return (void *)((unsigned long long)mempool->base +
-				(mempool->index - 1) * mempool->block_size);
+	if (mempool->flags & BMM_CONCURRENT) {
+		bit = claim_block(mempool);
+		if (bit >= mempool->block_num) {
+			account_alloc(mempool, 0);
+			return NULL;
 		}
+		account_alloc(mempool, 1);
+		return block_addr(mempool, bit);
 	}
 
-	/* find the block from the first one to the current index */
-	for (mempool->index = 0; mempool->index < index_tmp; mempool->index++) {
-		byte_pos = mempool->index >> BITMAP_BYTE_OFFSET;
-		bit_pos = mempool->index & BITMAP_BIT_OFFSET;
+	if (!mempool->num_free) {
+		account_alloc(mempool, 0);
+		return NULL;
+	}
+
+	/* go on from the last word, and wrap around */
+	w = find_free_word(mempool, mempool->index);
+	if (w >= mempool->word_num)
+		w = find_free_word(mempool, 0);
+	assert(w < mempool->word_num);
 
-		/* find the free block */
-		if (((bitmap_t[byte_pos]) & (0x1 << bit_pos)) == 0) {
-			mempool->index++;
-			mempool->num_free--;
-			bitmap_t[byte_pos] = bitmap_t[byte_pos] |
-				(0x01 << bit_pos);
+	bit = __builtin_ctzll(~mempool->bitmap[w]);
+	mempool->bitmap[w] |= 1ULL << bit;
+	update_summary(mempool, w);
+	account_alloc(mempool, 1);
+	mempool->index = w;
+	return block_addr(mempool, (w << WORD_SHIFT) + bit);
+}
+
+/*
+ * Allocate n contiguous blocks. It searches from the first block, so runs
+ * are packed at the start of the pool and large runs are kept at the end.
+ */
+void *bmm_alloc_n(void *pool, unsigned int n)
+{
+	struct mem_pool *mempool = (struct mem_pool *)pool;
+	unsigned int start, from = 0;
+
+	assert(mempool->tag == TAG);
 
-			mempool->bitmap = bitmap_t;
-			pool = (void *)mempool;
-			return (void *)((unsigned long long)mempool->base +
-				(mempool->index - 1) * mempool->block_size);
+	if (!n)
+		return NULL;
+	if (n == 1)
+		return bmm_alloc(pool);
+	if (n > __atomic_load_n(&mempool->num_free, __ATOMIC_RELAXED))
+		goto fail;
+
+	if (mempool->flags & BMM_CONCURRENT) {
+		while (1) {
+			start = find_run(mempool, from, n);
+			if (start >= mempool->block_num)
+				goto fail;
+			if (claim_range(mempool, start, n))
+				break;
+			from = start + 1;
 		}
+		account_alloc(mempool, n);
+		return block_addr(mempool, start);
 	}
 
+	start = find_run(mempool, 0, n);
+	if (start >= mempool->block_num)
+		goto fail;
+	set_range(mempool, start, n, 1);
+	account_alloc(mempool, n);
+	return block_addr(mempool, start);
+fail:
+	account_alloc(mempool, 0);
 	return NULL;
 }
 
-void bmm_free(void *pool, void *buf)
+/*
+ * Take the block of index if it's free, without searching for another one.
+ * It's for walking over the free blocks one by one, so a failure isn't
+ * counted in the statistics.
+ */
+void *bmm_alloc_at(void *pool, unsigned int index)
 {
 	struct mem_pool *mempool = (struct mem_pool *)pool;
-	unsigned int byte_pos;
-	unsigned short bit_pos;
-	unsigned long long addr_offset;
 
 	assert(mempool->tag == TAG);
 
-	addr_offset = ((unsigned long long)(buf - mempool->base)) /
-		mempool->block_size;
-	if ((addr_offset + 1) > mempool->block_num) {
+	if (index >= mempool->block_num)
+		return NULL;
+	if (mempool->flags & BMM_CONCURRENT) {
+		if (!claim_range(mempool, index, 1))
+			return NULL;
+	} else {
+		if (range_used(mempool, index, 1))
+			return NULL;
+		set_range(mempool, index, 1, 1);
+	}
+	__atomic_fetch_sub(&mempool->num_free, 1, __ATOMIC_RELAXED);
+	return block_addr(mempool, index);
+}
+
+void bmm_free_n(void *pool, void *buf, unsigned int n)
+{
+	struct mem_pool *mempool = (struct mem_pool *)pool;
+	unsigned int index, freed;
+	uintptr_t offset;
+
+	assert(mempool->tag == TAG);
+
+	if ((uintptr_t)buf < (uintptr_t)base_of(mempool) || !n) {
+		errno = EINVAL;
+		return;
+	}
+	offset = (uintptr_t)buf - (uintptr_t)base_of(mempool);
+	index = offset / mempool->block_size;
+	if (offset % mempool->block_size || index >= mempool->block_num ||
+	    n > mempool->block_num - index) {
 		errno = EINVAL;
 		return;
 	}
 
-	byte_pos = addr_offset >> BITMAP_BYTE_OFFSET;
-	bit_pos = addr_offset & BITMAP_BIT_OFFSET;
+	if (mempool->flags & BMM_CONCURRENT) {
+		freed = release_range(mempool, index, n);
+		__atomic_fetch_add(&mempool->num_free, freed,
+				   __ATOMIC_RELAXED);
+		if (freed != n)
+			errno = EINVAL;
+		return;
+	}
 
-	mempool->bitmap[byte_pos] = mempool->bitmap[byte_pos] & ~(1 << bit_pos);
-	mempool->num_free++;
+	/* a double free would make num_free wrong */
+	if (!range_used(mempool, index, n)) {
+		errno = EINVAL;
+		return;
+	}
+
+	set_range(mempool, index, n, 0);
+	__atomic_fetch_add(&mempool->num_free, n, __ATOMIC_RELAXED);
+}
+
+void bmm_free(void *pool, void *buf)
+{
+	bmm_free_n(pool, buf, 1);
+}
+
+/* the longest run of free blocks */
+static unsigned int largest_run(struct mem_pool *mp)
+{
+	unsigned int start, end, best = 0;
+
+	for (start = find_free_bit(mp, 0); start < mp->block_num;
+	     start = find_free_bit(mp, end)) {
+		end = find_used_bit(mp, start);
+		if (end - start > best)
+			best = end - start;
+	}
+	return best;
+}
+
+/*
+ * Take a snapshot of the statistics of the pool. It doesn't lock anything,
+ * so the fields may come from slightly different moments when blocks are
+ * allocated at the same time.
+ */
+int bmm_get_stats(void *pool, struct bmm_stats *st)
+{
+	struct mem_pool *mempool = (struct mem_pool *)pool;
+	size_t bsize;
+	unsigned int nfree;
+
+	if (!mempool || mempool->tag != TAG || !st)
+		return -EINVAL;
+
+	bsize = mempool->block_size;
+	nfree = __atomic_load_n(&mempool->num_free, __ATOMIC_RELAXED);
+	if (nfree > mempool->block_num)
+		nfree = 0;
+	st->block_size = bsize;
+	st->size = (size_t)mempool->block_num * bsize;
+	st->free = (size_t)nfree * bsize;
+	st->used = st->size - st->free;
+	st->peak_used = (size_t)__atomic_load_n(&mempool->peak_used,
+						__ATOMIC_RELAXED) * bsize;
+	st->fail_num = __atomic_load_n(&mempool->fail_num, __ATOMIC_RELAXED);
+	st->largest_free = (size_t)largest_run(mempool) * bsize;
+	st->frag = st->free && st->largest_free < st->free ?
+		   100 - st->largest_free * 100 / st->free : 0;
+	return 0;
 }
@@ -1,22 +1,19 @@
 /* SPDX-License-Identifier: Apache-2.0 */
+#include <pthread.h>
+#include <sched.h>
+
 #include "hisi_comp.h"
+#include "wd_buf.h"
+#include "wd_bytes.h"
+#include "wd_crc.h"
 
 #define BLOCK_SIZE	(1 << 19)
 #define CACHE_NUM	1	//4
 
-#define ZLIB_HEADER	"\x78\x9c"
 #define ZLIB_HEADER_SZ	2
-
-/*
- * We use a extra field for gzip block length. So the fourth byte is \x04.
- * This is necessary because our software don't know the size of block when
- * using an hardware decompresser (It is known by hardware). This help our
- * decompresser to work and helpfully, compatible with gzip.
- */
-#define GZIP_HEADER	"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\x03"
 #define GZIP_HEADER_SZ	10
-#define GZIP_EXTRA_SZ	10
 #define GZIP_TAIL_SZ	8
+#define ZLIB_TAIL_SZ	4
 
 #define BLOCK_MIN		(1 << 10)
 #define BLOCK_MIN_MASK		0x3FF
@@ -30,18 +27,100 @@
 #define HISI_SCHED_INPUT	0
 #define HISI_SCHED_OUTPUT	1
 
+#define ASYNC_DEPTH		64	/* requests in flight on a queue */
+#define ASYNC_NOSVA_DEPTH	8	/* each slot needs swap buffers in NOSVA */
+#define ASYNC_PEND		1024	/* requests waiting for a slot */
+/* chunks of a split block that have output buffers */
+#define SPLIT_INFLIGHT		(ASYNC_DEPTH * 2)
+
+
 #define Z_OK            0
 #define Z_STREAM_END    1
 #define Z_ERRNO		(-1)
 #define Z_STREAM_ERROR	(-EIO)
 
-#define swab32(x) \
-	((((x) & 0x000000ff) << 24) | \
-	(((x) & 0x0000ff00) <<  8) | \
-	(((x) & 0x00ff0000) >>  8) | \
-	(((x) & 0xff000000) >> 24))
+/* how the deflate data of the request is framed */
+static inline int hisi_frame(int alg_type, struct wd_comp_arg *arg)
+{
+	return (arg->flag & FLAG_RAW) ? RAW : alg_type;
+}
+
+/* write the header of deflate output, and return the size of it */
+static int hisi_put_head(int alg_type, void *p)
+{
+	const char zip_head[2] = {0x78, 0x9c};
+	const char gzip_head[10] = {0x1f, 0x8b, 0x08, 0x0, 0x0,
+				    0x0, 0x0, 0x0, 0x0, 0x03};
+
+	if (alg_type == ZLIB) {
+		memcpy(p, zip_head, ZLIB_HEADER_SZ);
+		return ZLIB_HEADER_SZ;
+	} else if (alg_type == GZIP) {
+		memcpy(p, gzip_head, GZIP_HEADER_SZ);
+		return GZIP_HEADER_SZ;
+	}
+	return 0;
+}
+
+static inline int hisi_tail_len(int alg_type)
+{
+	if (alg_type == RAW)
+		return 0;
+	return (alg_type == ZLIB) ? ZLIB_TAIL_SZ : GZIP_TAIL_SZ;
+}
+
+/* write the trailer from the checksum of hardware */
+static void hisi_put_tail(int alg_type, unsigned char *p, uint32_t checksum,
+			  uint32_t isize)
+{
+	if (alg_type == ZLIB) {
+		put_be32(p, checksum);
+	} else if (alg_type == GZIP) {
+		put_le32(p, checksum);
+		put_le32(p + 4, isize);
+	}
+}
+
+/*
+ * Check the trailer after deflate data by the checksum of hardware. It's
+ * skipped if the trailer isn't in the left input.
+ */
+static int hisi_check_tail(int alg_type, const unsigned char *p, size_t left,
+			   uint32_t checksum, uint32_t isize)
+{
+	if (alg_type == RAW || left < hisi_tail_len(alg_type))
+		return 0;
+	if (alg_type == ZLIB)
+		return get_be32(p) == checksum ? 0 : -EIO;
+	if (get_le32(p) != checksum || get_le32(p + 4) != isize)
+		return -EIO;
+	return 0;
+}
+
+/* the initial checksum of a frame */
+static inline uint32_t hisi_sum_init(int alg_type)
+{
+	return alg_type == ZLIB ? 1 : 0;
+}
+
+/*
+ * The size of the header that inflate skips, or -EAGAIN if it isn't
+ * complete in len bytes. A gzip header may have optional fields.
+ */
+static int hisi_head_len(int alg_type, const void *buf, size_t len)
+{
+	int	ret;
 
-#define cpu_to_be32(x) swab32(x)
+	if (alg_type == RAW)
+		return 0;
+	if (alg_type == ZLIB)
+		return len >= ZLIB_HEADER_SZ ? ZLIB_HEADER_SZ : -EAGAIN;
+	ret = wd_gzip_head_len(buf, len, NULL);
+	/* not a gzip header, let hardware report the error */
+	if (ret == -EINVAL)
+		return len >= GZIP_HEADER_SZ ? GZIP_HEADER_SZ : -EAGAIN;
+	return ret;
+}
 
 #ifndef container_of
 #define container_of(ptr, type, member) \
@@ -76,6 +155,53 @@ struct hisi_strm_info {
 	int	skipped;	// inflate
 };
 
+/* requests to call back out of lock after a kick */
+struct hisi_async_fails {
+	struct wd_comp_arg	*args[ASYNC_DEPTH];	/* fail to send */
+	int			num;
+	struct wd_comp_arg	*late[ASYNC_DEPTH];	/* past the deadline */
+	int			nlate;
+};
+
+/* an async request on hardware */
+struct hisi_async_slot {
+	struct hisi_zip_sqe	sqe;
+	struct wd_comp_arg	*arg;
+	void	*swap_in;
+	void	*swap_out;
+	int	alg_type;
+	int	head_sz;
+	int	tail_sz;	/* the trailer after deflate data */
+	struct hisi_async_slot	*next;
+};
+
+/* the queue of one operation for async requests */
+struct hisi_async_q {
+	handle_t		h_ctx;
+	struct hisi_qp		*qp;
+	int			nosva;
+	void			*ss_region;
+	struct hisi_async_slot	slots[ASYNC_DEPTH];
+	struct hisi_async_slot	*free;
+	int			depth;
+	int			busy;
+	struct wd_edf_queue	pend;
+};
+
+struct hisi_async {
+	struct wd_comp_sess	*sess;
+	struct hisi_async_q	q[2];	/* DEFLATE and INFLATE */
+	struct wd_poller_sub	*sub;
+	/* submitters and the poller thread may race on the slots */
+	pthread_mutex_t		lock;
+	/*
+	 * Queues are set up out of lock, so completions of the other queue
+	 * aren't held up while a queue is set up.
+	 */
+	pthread_mutex_t		init_lock;
+	int			ready[2];
+};
+
 struct hisi_comp_sess {
 	/* struct hisi_qp must be set in the first property */
 	struct hisi_qp		*qp;
@@ -83,6 +209,9 @@ struct hisi_comp_sess {
 	struct hisi_strm_info	strm;
 	struct hisi_qm_capa	capa;
 	int	inited;
+	struct hisi_async	*async;
+	/* threads of the session may send the first async request at once */
+	pthread_mutex_t		async_lock;
 };
 
 struct hisi_sched {
@@ -101,11 +230,33 @@ struct hisi_sched {
 	int	undrained;
 	int	skipped;
 	int	full;
+	int	last;		// all input is loaded
 	int	stream_pos;
 	int	msg_data_size;
 	int	dir;		// input or output
+	uint32_t	checksum;	// of the frame so far
+	uint32_t	isize;
+	size_t	consumed;	// input of the block, with header and trailer
+	int	end;		// inflate meets the end of the stream
 };
 
+/*
+ * Messages of the scheduler are stateless, so hardware only sums up the
+ * data of one message. Carry the checksum and the size of the frame across
+ * messages, len is the data that checksum covers.
+ */
+static void hisi_sched_sum(struct hisi_sched *hsched, int alg_type,
+			   uint32_t checksum, uint32_t len)
+{
+	if (alg_type == ZLIB)
+		hsched->checksum = wd_adler32_combine(hsched->checksum,
+						      checksum, len);
+	else if (alg_type == GZIP)
+		hsched->checksum = wd_crc32_combine(hsched->checksum,
+						    checksum, len);
+	hsched->isize += len;
+}
+
 static inline int is_nosva(struct wd_comp_sess *sess)
 {
 	struct hisi_comp_sess	*priv = (struct hisi_comp_sess *)sess->priv;
@@ -245,9 +396,7 @@ static int hisi_sched_input(struct wd_msg *msg, void *priv)
 	struct hisi_comp_sess	*hsess = (struct hisi_comp_sess *)sess->priv;
 	struct wd_scheduler	*sched = &hsess->sched;
 	struct wd_comp_arg	*arg = hsched->arg;
-	const char zip_head[2] = {0x78, 0x9c};
-	const char gzip_head[10] = {0x1f, 0x8b, 0x08, 0x0, 0x0,
-				    0x0, 0x0, 0x0, 0x0, 0x03};
+	int frame = hisi_frame(hsched->alg_type, arg);
 	int templen, skipped = 0;
 	handle_t h_ctx;
 	void *addr;
@@ -280,17 +429,13 @@ static int hisi_sched_input(struct wd_msg *msg, void *priv)
 	}
 
 	if (!hsched->load_head && hsched->op_type == DEFLATE) {
-		if (hsched->alg_type == ZLIB) {
-			memcpy(msg->next_out, &zip_head, 2);
-			templen = 2;
-		} else {
-			memcpy(msg->next_out, &gzip_head, 10);
-			templen = 10;
-		}
+		templen = hisi_put_head(frame, msg->next_out);
 		msg->next_out += templen;
 		hsched->avail_out -= templen;
 		hsched->undrained += templen;
 		hsched->stream_pos = STREAM_NEW;
+		hsched->checksum = hisi_sum_init(frame);
+		hsched->isize = 0;
 		hsched->load_head = 1;
 	}
 
@@ -301,6 +446,7 @@ static int hisi_sched_input(struct wd_msg *msg, void *priv)
 		} else {
 			templen = arg->src_len;
 		}
+		hsched->last = (templen == arg->src_len);
 		if (need_swap(sess, arg->src_len)) {
 			memcpy(msg->next_in + hsched->loaded_in,
 			       arg->src,
@@ -309,17 +455,18 @@ static int hisi_sched_input(struct wd_msg *msg, void *priv)
 		hsched->loaded_in += templen;
 		hsched->avail_in -= templen;
 		arg->src += templen;
+		arg->src_len -= templen;
 		m->input_data_length = templen;
 	}
 
 	if (!hsched->load_head && hsched->op_type == INFLATE) {
-		if (hsched->alg_type == ZLIB)
-			skipped = 2;
-		else
-			skipped = 10;
-		if (hsched->loaded_in >= skipped) {
+		skipped = hisi_head_len(frame, msg->next_in,
+					hsched->loaded_in);
+		if (skipped >= 0) {
 			hsched->skipped = skipped;
 			hsched->stream_pos = STREAM_NEW;
+			hsched->checksum = hisi_sum_init(frame);
+			hsched->isize = 0;
 			hsched->load_head = 1;
 			m->input_data_length -= skipped;
 			msg->next_in += skipped;
@@ -338,6 +485,9 @@ static int hisi_sched_input(struct wd_msg *msg, void *priv)
 	m->dest_addr_l = (__u64)addr & 0xffffffff;
 	m->dest_addr_h = (__u64)addr >> 32;
 	m->dest_avail_out = hsched->avail_out;
+	/* room for the trailer */
+	if (hsched->op_type == DEFLATE)
+		m->dest_avail_out -= hisi_tail_len(frame);
 	m->dw9 = hsched->dw9;
 	return 0;
 }
@@ -348,8 +498,9 @@ static int hisi_sched_output(struct wd_msg *msg, void *priv)
 	struct hisi_sched	*hsched = (struct hisi_sched *)priv;
 	struct wd_comp_sess	*sess = hsched->sess;
 	struct wd_comp_arg	*arg = hsched->arg;
+	int	frame = hisi_frame(hsched->alg_type, arg);
 	uint32_t	status, type;
-	int	templen;
+	int	templen, tail = 0;
 
 	status = m->dw3 & 0xff;
 	type = m->dw9 & 0xff;
@@ -358,16 +509,44 @@ static int hisi_sched_output(struct wd_msg *msg, void *priv)
 		msg->next_in += m->consumed;
 		msg->next_out += m->produced;
 		hsched->avail_out -= m->produced;
+		hisi_sched_sum(hsched, frame, m->checksum,
+			       hsched->op_type == DEFLATE ? m->consumed :
+			       m->produced);
+
+		if (hsched->op_type == DEFLATE && hsched->last &&
+		    (arg->flag & FLAG_INPUT_FINISH) &&
+		    m->consumed == m->input_data_length) {
+			hisi_put_tail(frame, msg->next_out, hsched->checksum,
+				      hsched->isize);
+			templen = hisi_tail_len(frame);
+			msg->next_out += templen;
+			hsched->avail_out -= templen;
+			hsched->undrained += templen;
+		} else if (hsched->op_type == INFLATE &&
+			   (m->dw3 & 0x1ff) == 0x113) {
+			/* the end of the stream, the trailer is consumed too */
+			templen = m->input_data_length - m->consumed;
+			if (hisi_check_tail(frame, msg->next_in, templen,
+					    hsched->checksum, hsched->isize)) {
+				WD_ERR("fail to check the trailer\n");
+				return -EIO;
+			}
+			if (templen >= hisi_tail_len(frame))
+				tail = hisi_tail_len(frame);
+			hsched->end = 1;
+		}
 
-		templen = hsched->loaded_in - m->consumed;
+		hsched->consumed += m->consumed + hsched->skipped + tail;
+		templen = hsched->loaded_in - m->consumed - hsched->skipped;
 		hsched->avail_in += templen;
-		if (templen && (arg->status & STATUS_IN_EMPTY)) {
+		/* the rest after the end of the stream isn't loaded again */
+		if (templen && !hsched->end &&
+		    (arg->status & STATUS_IN_EMPTY)) {
 			arg->status &= ~STATUS_IN_EMPTY;
 			arg->status |= STATUS_IN_PART_USE;
 			arg->src -= templen;
-			arg->src_len = m->consumed + hsched->skipped;
-		} else
-			arg->src_len = m->consumed + hsched->skipped;
+			arg->src_len += templen;
+		}
 		hsched->loaded_in = 0;
 		hsched->avail_in = 0;
 		if (hsched->stream_pos == STREAM_NEW) {
@@ -387,15 +566,16 @@ static int hisi_sched_output(struct wd_msg *msg, void *priv)
 			memcpy(arg->dst,
 			       msg->next_out - hsched->undrained,
 			       templen);
-			arg->dst += templen;
-			arg->dst_len = templen;
 			hsched->undrained -= templen;
 		} else {
 			/* drain next_out first */
-			arg->dst += hsched->undrained;
-			arg->dst_len = hsched->undrained;
+			templen = hsched->undrained;
 			hsched->undrained = 0;
 		}
+		/* dst_len is the room left until the block is done */
+		arg->dst += templen;
+		arg->dst_len -= templen;
+		hsched->total_out += templen;
 		arg->status |= STATUS_OUT_READY;
 	}
 	if (!hsched->undrained && ~hsched->loaded_in) {
@@ -429,7 +609,7 @@ static int hisi_comp_block_init(struct wd_comp_sess *sess)
 	sched->hw_send = hisi_qm_send;
 	sched->hw_recv = hisi_qm_recv;
 
-	sched->qs = malloc(sizeof(*sched->qs) * sched->q_num);
+	sched->qs = calloc(sched->q_num, sizeof(*sched->qs));
 	if (!sched->qs)
 		return -ENOMEM;
 
@@ -437,7 +617,8 @@ static int hisi_comp_block_init(struct wd_comp_sess *sess)
 	if (!hsched)
 		goto out_priv;
 	hsched->sess = sess;
-	hsched->msgs = malloc(sizeof(struct hisi_zip_sqe) * CACHE_NUM);
+	hsched->msgs = wd_buf_alloc(sizeof(struct hisi_zip_sqe) * CACHE_NUM,
+				     -1);
 	if (!hsched->msgs)
 		goto out_msg;
 	if (!strncmp(sess->alg_name, "zlib", strlen("zlib"))) {
@@ -448,6 +629,10 @@ static int hisi_comp_block_init(struct wd_comp_sess *sess)
 		hsched->alg_type = GZIP;
 		hsched->dw9 = 3;
 		capa->alg = strdup("gzip");
+	} else if (!strncmp(sess->alg_name, "deflate", strlen("deflate"))) {
+		hsched->alg_type = RAW;
+		hsched->dw9 = 1;
+		capa->alg = strdup("deflate");
 	} else
 		goto out_sched;
 	hsched->msg_data_size = sched->msg_data_size;
@@ -459,7 +644,7 @@ static int hisi_comp_block_init(struct wd_comp_sess *sess)
 		goto out_sched;
 	return 0;
 out_sched:
-	free(hsched->msgs);
+	wd_buf_free(hsched->msgs);
 out_msg:
 	free(hsched);
 out_priv:
@@ -474,7 +659,7 @@ static int hisi_comp_block_prep(struct wd_comp_sess *sess,
 	struct wd_scheduler	*sched;
 	struct hisi_sched	*hsched;
 	struct hisi_qm_priv	*qm_priv;
-	int	i, j, ret = 0;
+	int	i, j, node, ret = 0;
 
 	priv = (struct hisi_comp_sess *)sess->priv;
 	sched = &priv->sched;
@@ -498,7 +683,8 @@ static int hisi_comp_block_prep(struct wd_comp_sess *sess,
 	}
 	if (!sched->ss_region_size)
 		sched->ss_region_size = 4096 + /* add 1 page extra */
-			sched->msg_cache_num * sched->msg_data_size * 2;
+			sched->msg_cache_num *
+			smm_block_size(sched->msg_data_size, 0xF) * 2;
 	if (wd_is_nosva(sched->qs[0])) {
 		sched->ss_region = wd_reserve_mem(sched->qs[0],
 						  sched->ss_region_size);
@@ -527,9 +713,13 @@ static int hisi_comp_block_prep(struct wd_comp_sess *sess,
 			}
 		}
 	} else {
+		/* the device reads and writes them, keep them near it */
+		node = wd_get_numa_node(sched->qs[0]);
 		for (i = 0; i < sched->msg_cache_num; i++) {
-			sched->msgs[i].swap_in = malloc(sched->msg_data_size);
-			sched->msgs[i].swap_out = malloc(sched->msg_data_size);
+			sched->msgs[i].swap_in =
+				wd_buf_alloc(sched->msg_data_size, node);
+			sched->msgs[i].swap_out =
+				wd_buf_alloc(sched->msg_data_size, node);
 			if (!sched->msgs[i].swap_in ||
 			    !sched->msgs[i].swap_out) {
 				dbg("not enough memory for cache %d\n", i);
@@ -541,10 +731,8 @@ static int hisi_comp_block_prep(struct wd_comp_sess *sess,
 	return ret;
 out_swap2:
 	for (j = i; j >= 0; j--) {
-		if (sched->msgs[j].swap_in)
-			free(sched->msgs[j].swap_in);
-		if (sched->msgs[j].swap_out)
-			free(sched->msgs[j].swap_out);
+		wd_buf_free(sched->msgs[j].swap_in);
+		wd_buf_free(sched->msgs[j].swap_out);
 	}
 	for (j = i - 1; j >= 0; j--) {
 		sched->hw_free(sched->qs[j]);
@@ -563,6 +751,7 @@ out_swap:
 	}
 out_smm:
 	if (wd_is_nosva(sched->qs[0]) && sched->ss_region) {
+		smm_fini(sched->ss_region);
 		wd_drv_unmap_qfr(sched->qs[0], UACCE_QFRT_SS, sched->ss_region);
 	}
 out_region:
@@ -588,10 +777,11 @@ static void hisi_comp_block_exit(struct wd_comp_sess *sess)
 	sched = &priv->sched;
 
 	is_nosva = wd_is_nosva(sched->qs[0]);
-	for (i = 0; i < sched->q_num; i++) {
+	/* queues and swap buffers are only there after a successful prep */
+	for (i = 0; priv->inited && i < sched->q_num; i++) {
 		sched->hw_free(sched->qs[i]);
 	}
-	for (i = 0; i < sched->msg_cache_num; i++) {
+	for (i = 0; priv->inited && i < sched->msg_cache_num; i++) {
 		if (is_nosva) {
 			if (sched->msgs[i].swap_in)
 				smm_free(sched->ss_region,
@@ -600,29 +790,58 @@ static void hisi_comp_block_exit(struct wd_comp_sess *sess)
 				smm_free(sched->ss_region,
 					 sched->msgs[i].swap_out);
 		} else {
-			free(sched->msgs[i].swap_in);
-			free(sched->msgs[i].swap_out);
+			wd_buf_free(sched->msgs[i].swap_in);
+			wd_buf_free(sched->msgs[i].swap_out);
 		}
 	}
-	if (is_nosva && sched->ss_region) {
+	if (priv->inited && is_nosva && sched->ss_region) {
+		smm_fini(sched->ss_region);
 		wd_drv_unmap_qfr(sched->qs[0],
 				 UACCE_QFRT_SS,
 				 sched->ss_region);
 	}
 	wd_sched_fini(sched);
 	hsched = sched->priv;
-	free(hsched->msgs);
+	wd_buf_free(hsched->msgs);
 	free(hsched);
 	free(sched->qs);
 }
 
+/*
+ * Send the input of a block in messages until it's all loaded, or inflate
+ * meets the end of the stream. Then arg->src and arg->dst are moved past
+ * the consumed input and the output, and arg->src_len and arg->dst_len are
+ * the sizes of them.
+ */
+static int hisi_block_run(struct wd_scheduler *sched, struct wd_comp_arg *arg)
+{
+	struct hisi_sched	*hsched = sched->priv;
+	void	*src = arg->src;
+	int	ret;
+
+	hsched->consumed = 0;
+	hsched->total_out = 0;
+	hsched->end = 0;
+	while ((arg->src_len && !hsched->end) || !wd_sched_empty(sched)) {
+		ret = wd_sched_work(sched, hsched->end ? 0 : arg->src_len);
+		if (ret == -EAGAIN)
+			continue;
+		if (ret < 0)
+			return ret;
+	}
+	arg->src = src + hsched->consumed;
+	arg->src_len = hsched->consumed;
+	arg->dst_len = hsched->total_out;
+	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
+	return 0;
+}
+
 static int hisi_comp_block_deflate(struct wd_comp_sess *sess,
 				    struct wd_comp_arg *arg)
 {
 	struct hisi_comp_sess	*priv;
 	struct wd_scheduler	*sched;
 	int	ret;
-	size_t	src_len;
 
 	priv = (struct hisi_comp_sess *)sess->priv;
 	sched = &priv->sched;
@@ -630,22 +849,10 @@ static int hisi_comp_block_deflate(struct wd_comp_sess *sess,
 	if (!(arg->flag & FLAG_INPUT_FINISH) && (arg->src_len < BLOCK_MAX))
 		return -EINVAL;
 
-	src_len = arg->src_len;
-	while (src_len || !wd_sched_empty(sched)) {
-		ret = wd_sched_work(sched, src_len);
-		if (ret == -EAGAIN)
-			continue;
-		if (ret < 0) {
-			WD_ERR("fail to deflate by wd_sched (%d)\n", ret);
-			return ret;
-		}
-		if (src_len == 0)
-			break;
-		src_len -= arg->src_len;
-		arg->src_len = src_len;
-	}
-	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
-	return 0;
+	ret = hisi_block_run(sched, arg);
+	if (ret < 0)
+		WD_ERR("fail to deflate by wd_sched (%d)\n", ret);
+	return ret;
 }
 
 static int hisi_comp_block_inflate(struct wd_comp_sess *sess,
@@ -655,7 +862,6 @@ static int hisi_comp_block_inflate(struct wd_comp_sess *sess,
 	struct wd_scheduler	*sched;
 	struct hisi_sched	*hsched;
 	int	ret;
-	size_t	src_len;
 
 	priv = (struct hisi_comp_sess *)sess->priv;
 	sched = &priv->sched;
@@ -669,22 +875,10 @@ static int hisi_comp_block_inflate(struct wd_comp_sess *sess,
 		}
 	}
 
-	src_len = arg->src_len;
-	while (src_len || !wd_sched_empty(sched)) {
-		ret = wd_sched_work(sched, src_len);
-		if (ret == -EAGAIN)
-			continue;
-		if (ret < 0) {
-			WD_ERR("fail to inflate by wd_sched (%d)\n", ret);
-			return ret;
-		}
-		if (src_len == 0)
-			break;
-		src_len -= arg->src_len;
-		arg->src_len = src_len;
-	}
-	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
-	return 0;
+	ret = hisi_block_run(sched, arg);
+	if (ret < 0)
+		WD_ERR("fail to inflate by wd_sched (%d)\n", ret);
+	return ret;
 }
 
 
@@ -702,11 +896,16 @@ static int hisi_comp_strm_init(struct wd_comp_sess *sess)
 		capa->alg = strdup("gzip");
 		strm->alg_type = GZIP;
 		strm->dw9 = 3;
+	} else if (!strncmp(sess->alg_name, "deflate", strlen("deflate"))) {
+		capa->alg = strdup("deflate");
+		strm->alg_type = RAW;
+		strm->dw9 = 1;
 	} else
 		return -EINVAL;
-	strm->msg = calloc(1, sizeof(struct hisi_strm_info));
+	strm->msg = wd_buf_alloc(sizeof(struct hisi_zip_sqe), -1);
 	if (!strm->msg)
 		return -ENOMEM;
+	memset(strm->msg, 0, sizeof(struct hisi_zip_sqe));
 	return 0;
 }
 
@@ -717,7 +916,7 @@ static int hisi_comp_strm_prep(struct wd_comp_sess *sess,
 	struct hisi_strm_info	*strm = &priv->strm;
 	struct hisi_qm_priv	*qm_priv;
 	handle_t h_ctx;
-	int	ret;
+	int	node, ret;
 
 	qm_priv = (struct hisi_qm_priv *)&priv->capa.priv;
 	qm_priv->sqe_size = sizeof(struct hisi_zip_sqe);
@@ -761,13 +960,14 @@ static int hisi_comp_strm_prep(struct wd_comp_sess *sess,
 		strm->next_in = strm->swap_in;
 		strm->next_out = strm->swap_out;
 	} else {
-		strm->swap_in = malloc(STREAM_MIN);
+		node = wd_get_numa_node(h_ctx);
+		strm->swap_in = wd_buf_alloc(STREAM_MIN, node);
 		if (!strm->swap_in)
 			goto out_in;
-		strm->swap_out = malloc(STREAM_MIN);
+		strm->swap_out = wd_buf_alloc(STREAM_MIN, node);
 		if (!strm->swap_out)
 			goto out_out;
-		strm->ctx_buf = malloc(HW_CTX_SIZE);
+		strm->ctx_buf = wd_buf_alloc(HW_CTX_SIZE, node);
 		if (!strm->ctx_buf)
 			goto out_buf;
 		strm->next_in = NULL;
@@ -779,15 +979,16 @@ out_smm_ctx:
 out_smm_out:
 	smm_free(strm->ss_region, strm->swap_in);
 out_smm:
+	smm_fini(strm->ss_region);
 	free(strm->ss_region);
 out_ss:
 	hisi_qm_free_ctx(h_ctx);
 out:
 	return ret;
 out_buf:
-	free(strm->next_out);
+	wd_buf_free(strm->swap_out);
 out_out:
-	free(strm->next_in);
+	wd_buf_free(strm->swap_in);
 out_in:
 	hisi_qm_free_ctx(h_ctx);
 	return -ENOMEM;
@@ -807,13 +1008,14 @@ static void hisi_comp_strm_exit(struct wd_comp_sess *sess)
 		smm_free(strm->ss_region, strm->swap_in);
 		smm_free(strm->ss_region, strm->swap_out);
 		smm_free(strm->ss_region, strm->ctx_buf);
+		smm_fini(strm->ss_region);
 	} else {
-		free(strm->swap_in);
-		free(strm->swap_out);
-		free(strm->ctx_buf);
+		wd_buf_free(strm->swap_in);
+		wd_buf_free(strm->swap_out);
+		wd_buf_free(strm->ctx_buf);
 	}
 	hisi_qm_free_ctx(qp->h_ctx);
-	free(strm->msg);
+	wd_buf_free(strm->msg);
 }
 
 static int hisi_strm_comm(struct wd_comp_sess *sess, int flush)
@@ -826,11 +1028,12 @@ static int hisi_strm_comm(struct wd_comp_sess *sess, int flush)
 	uint64_t	flush_type;
 	uint64_t	addr;
 	size_t	templen;
-	int	ret = 0;
+	int	frame, ret = 0;
 
 	priv = (struct hisi_comp_sess *)sess->priv;
 	strm = &priv->strm;
 	qp = priv->qp;
+	frame = hisi_frame(strm->alg_type, strm->arg);
 
 	flush_type = (flush == WD_FINISH) ? HZ_FINISH : HZ_SYNC_FLUSH;
 
@@ -861,6 +1064,9 @@ static int hisi_strm_comm(struct wd_comp_sess *sess, int flush)
 	}
 	msg->input_data_length = strm->loaded_in;
 	msg->dest_avail_out = strm->avail_out;
+	/* room for the trailer */
+	if (strm->op_type == DEFLATE && flush == WD_FINISH)
+		msg->dest_avail_out -= hisi_tail_len(frame);
 
 	if (strm->op_type == INFLATE) {
 		if (wd_is_nosva(qp->h_ctx)) {
@@ -935,6 +1141,23 @@ recv_again:
 			ret = Z_STREAM_END;
 		else if (ret == 0 &&  (recv_msg->dw3 & 0x1ff) == 0x113)
 			ret = Z_STREAM_END;    /* decomp_is_end  region */
+
+		if (ret == Z_STREAM_END && strm->op_type == DEFLATE) {
+			hisi_put_tail(frame, strm->next_out,
+				      recv_msg->checksum, recv_msg->isize);
+			templen = hisi_tail_len(frame);
+			strm->next_out += templen;
+			strm->avail_out -= templen;
+			strm->undrained += templen;
+		} else if (ret == Z_STREAM_END &&
+			   hisi_check_tail(frame, strm->next_in,
+					   msg->input_data_length -
+					   recv_msg->consumed,
+					   recv_msg->checksum,
+					   recv_msg->isize)) {
+			WD_ERR("fail to check the trailer\n");
+			ret = -EIO;
+		}
 	} else
 		WD_ERR("bad status (s=%d, t=%d)\n", status, type);
 out:
@@ -948,14 +1171,12 @@ static void hisi_strm_pre_buf(struct wd_comp_sess *sess,
 	struct hisi_comp_sess	*priv;
 	struct hisi_strm_info	*strm;
 	struct hisi_qp		*qp;
-	const char zip_head[2] = {0x78, 0x9c};
-	const char gzip_head[10] = {0x1f, 0x8b, 0x08, 0x0, 0x0,
-				    0x0, 0x0, 0x0, 0x0, 0x03};
-	int templen, skipped;
+	int templen, skipped, frame;
 
 	priv = (struct hisi_comp_sess *)sess->priv;
 	strm = &priv->strm;
 	qp = priv->qp;
+	frame = hisi_frame(strm->alg_type, arg);
 
 	/* reset strm->avail_in */
 	if (strm->avail_in < STREAM_MIN) {
@@ -995,13 +1216,7 @@ static void hisi_strm_pre_buf(struct wd_comp_sess *sess,
 	}
 
 	if (!strm->load_head && strm->op_type == DEFLATE) {
-		if (strm->alg_type == ZLIB) {
-			memcpy(strm->next_out, &zip_head, 2);
-			templen = 2;
-		} else {
-			memcpy(strm->next_out, &gzip_head, 10);
-			templen = 10;
-		}
+		templen = hisi_put_head(frame, strm->next_out);
 		strm->next_out += templen;
 		strm->avail_out -= templen;
 		strm->undrained += templen;
@@ -1026,11 +1241,9 @@ static void hisi_strm_pre_buf(struct wd_comp_sess *sess,
 	}
 
 	if (!strm->load_head && strm->op_type == INFLATE) {
-		if (strm->alg_type == ZLIB)
-			skipped = 2;
-		else
-			skipped = 10;
-		if (strm->loaded_in >= skipped) {
+		skipped = hisi_head_len(frame, strm->next_in,
+					strm->loaded_in);
+		if (skipped >= 0) {
 			strm->skipped = skipped;
 			strm->stream_pos = STREAM_NEW;
 			strm->load_head = 1;
@@ -1138,6 +1351,634 @@ static int hisi_comp_strm_inflate(struct wd_comp_sess *sess,
 	return 0;
 }
 
+static void hisi_async_fill(struct hisi_async_q *aq,
+			    struct hisi_async_slot *slot,
+			    struct wd_comp_arg *arg, int alg_type, int dw9)
+{
+	struct hisi_zip_sqe	*m = &slot->sqe;
+	void	*src, *dst;
+	size_t	src_len, dst_len;
+	int	head_sz, tail_sz;
+
+	alg_type = hisi_frame(alg_type, arg);
+	tail_sz = hisi_tail_len(alg_type);
+	src = arg->src;
+	src_len = arg->src_len;
+	dst = aq->nosva ? slot->swap_out : arg->dst;
+	dst_len = aq->nosva && arg->dst_len > BLOCK_MAX ?
+		  BLOCK_MAX : arg->dst_len;
+
+	if (arg->flag & FLAG_DEFLATE) {
+		head_sz = hisi_put_head(alg_type, dst);
+		dst += head_sz;
+		dst_len -= head_sz + tail_sz;
+	} else {
+		head_sz = hisi_head_len(alg_type, src, src_len);
+		src += head_sz;
+		src_len -= head_sz;
+	}
+	if (aq->nosva) {
+		memcpy(slot->swap_in, src, src_len);
+		src = wd_get_dma_from_va(aq->h_ctx, slot->swap_in);
+		dst = wd_get_dma_from_va(aq->h_ctx, dst);
+	}
+
+	memset(m, 0, sizeof(*m));
+	m->source_addr_l = (__u64)src & 0xffffffff;
+	m->source_addr_h = (__u64)src >> 32;
+	m->dest_addr_l = (__u64)dst & 0xffffffff;
+	m->dest_addr_h = (__u64)dst >> 32;
+	m->input_data_length = src_len;
+	m->dest_avail_out = dst_len;
+	m->dw9 = dw9;
+	slot->arg = arg;
+	slot->alg_type = alg_type;
+	slot->head_sz = head_sz;
+	slot->tail_sz = tail_sz;
+}
+
+/*
+ * Move waiting requests to free slots, and ring the doorbell once for all of
+ * them. It's called with lock held. Requests that can't be sent for other
+ * reason than a full ring are failed, and requests that wait past their
+ * deadlines are taken out unless the session runs them anyway. Both are put
+ * in fails, to be called back out of lock.
+ */
+static void hisi_async_kick(struct hisi_async *as, struct hisi_async_q *aq,
+			    struct hisi_async_fails *fails)
+{
+	struct hisi_comp_sess	*priv = as->sess->priv;
+	struct hisi_sched	*hsched = priv->sched.priv;
+	struct hisi_async_slot	*slot;
+	struct wd_sched_req	popped[ASYNC_DEPTH], req;
+	void	*reqs[ASYNC_DEPTH];
+	uint64_t	now;
+	int	i, n = 0, sent;
+
+	fails->num = 0;
+	fails->nlate = 0;
+	if (as->sess->dl_policy != DEADLINE_RUN && aq->pend.num) {
+		now = wd_sched_now();
+		while (fails->nlate < ASYNC_DEPTH &&
+		       !wd_edf_expire(&aq->pend, now, &req))
+			fails->late[fails->nlate++] = req.data;
+	}
+
+	while (aq->free && !wd_edf_pop(&aq->pend, &popped[n])) {
+		slot = aq->free;
+		aq->free = slot->next;
+		hisi_async_fill(aq, slot, popped[n].data, hsched->alg_type,
+				hsched->dw9);
+		reqs[n++] = &slot->sqe;
+	}
+	if (!n)
+		return;
+
+	sent = hisi_qm_send_batch(aq->h_ctx, reqs, n);
+	if (sent < 0 && sent != -EBUSY) {
+		WD_ERR("fail to send async requests (%d)\n", sent);
+		for (i = 0; i < n; i++) {
+			slot = container_of(reqs[i], struct hisi_async_slot,
+					    sqe);
+			slot->arg->dst_len = 0;
+			slot->arg->status = STATUS_FAILED;
+			fails->args[fails->num++] = slot->arg;
+			slot->arg = NULL;
+			slot->next = aq->free;
+			aq->free = slot;
+		}
+		return;
+	}
+	if (sent < 0)
+		sent = 0;
+	aq->busy += sent;
+	/*
+	 * Ring is full, try the rest again on the next completion. They keep
+	 * their order, so they still go ahead of the later requests.
+	 */
+	for (i = sent; i < n; i++) {
+		slot = container_of(reqs[i], struct hisi_async_slot, sqe);
+		wd_edf_requeue(&aq->pend, &popped[i]);
+		slot->arg = NULL;
+		slot->next = aq->free;
+		aq->free = slot;
+	}
+}
+
+/* call back the requests out of lock, they may send again */
+static void hisi_async_call(struct wd_comp_arg **args, int num)
+{
+	int	i;
+
+	for (i = 0; i < num; i++)
+		args[i]->cb(args[i]->cb_param);
+}
+
+static void hisi_async_fail(struct hisi_async *as,
+			    struct hisi_async_fails *fails)
+{
+	int	i;
+
+	for (i = 0; i < fails->nlate; i++)
+		wd_comp_expire(as->sess, fails->late[i]);
+	hisi_async_call(fails->args, fails->num);
+}
+
+/* fill in the result of a completed request, with lock held */
+static struct wd_comp_arg *hisi_async_done(struct hisi_async *as,
+					   struct hisi_async_q *aq,
+					   struct hisi_zip_sqe *m)
+{
+	struct hisi_async_slot	*slot;
+	struct wd_comp_arg	*arg;
+	uint32_t	status;
+	size_t	out, left;
+
+	slot = container_of(m, struct hisi_async_slot, sqe);
+	arg = slot->arg;
+	status = m->dw3 & 0xff;
+	if (!status || (status == 0x0d) || (status == 0x13)) {
+		if (arg->flag & FLAG_DEFLATE) {
+			out = slot->head_sz + m->produced;
+			if (aq->nosva)
+				memcpy(arg->dst, slot->swap_out, out);
+			hisi_put_tail(slot->alg_type, arg->dst + out,
+				      m->checksum, m->consumed);
+			out += slot->tail_sz;
+			arg->src_len = m->consumed;
+		} else {
+			out = m->produced;
+			if (aq->nosva)
+				memcpy(arg->dst, slot->swap_out, out);
+			left = arg->src_len - slot->head_sz - m->consumed;
+			if (hisi_check_tail(slot->alg_type,
+					    arg->src + slot->head_sz + m->consumed,
+					    left, m->checksum, m->produced)) {
+				WD_ERR("fail to check the trailer\n");
+				arg->dst_len = 0;
+				arg->status = STATUS_FAILED;
+				goto out;
+			}
+			arg->src_len = m->consumed + slot->head_sz;
+			/* the trailer is consumed if it's there */
+			if (left >= slot->tail_sz)
+				arg->src_len += slot->tail_sz;
+		}
+		arg->dst_len = out;
+		arg->status = STATUS_OUT_READY | STATUS_OUT_DRAINED;
+		if (m->consumed < m->input_data_length)
+			arg->status |= STATUS_IN_PART_USE;
+		else
+			arg->status |= STATUS_IN_EMPTY;
+	} else {
+		WD_ERR("bad status (s=%d, t=%d)\n", status, m->dw9 & 0xff);
+		arg->dst_len = 0;
+		arg->status = STATUS_FAILED;
+	}
+out:
+	slot->arg = NULL;
+	slot->next = aq->free;
+	aq->free = slot;
+	aq->busy--;
+	return arg;
+}
+
+/* completion from the poller thread */
+static void hisi_async_complete(void *resp, void *data)
+{
+	struct hisi_async	*as = data;
+	struct hisi_async_slot	*slot;
+	struct hisi_async_fails	fails;
+	struct wd_comp_arg	*arg;
+	int	op;
+
+	slot = container_of(resp, struct hisi_async_slot, sqe);
+	pthread_mutex_lock(&as->lock);
+	op = (slot->arg->flag & FLAG_DEFLATE) ? DEFLATE : INFLATE;
+	arg = hisi_async_done(as, &as->q[op], resp);
+	hisi_async_kick(as, &as->q[op], &fails);
+	pthread_mutex_unlock(&as->lock);
+	arg->cb(arg->cb_param);
+	hisi_async_fail(as, &fails);
+}
+
+static void hisi_async_q_exit(struct hisi_async *as, struct hisi_async_q *aq)
+{
+	int	i;
+
+	if (!aq->h_ctx)
+		return;
+	if (as->sub)
+		wd_poller_del(as->sess->poller, aq->h_ctx);
+	for (i = 0; i < aq->depth && aq->nosva; i++) {
+		if (aq->slots[i].swap_in)
+			smm_free(aq->ss_region, aq->slots[i].swap_in);
+		if (aq->slots[i].swap_out)
+			smm_free(aq->ss_region, aq->slots[i].swap_out);
+	}
+	if (aq->ss_region) {
+		smm_fini(aq->ss_region);
+		wd_drv_unmap_qfr(aq->h_ctx, UACCE_QFRT_SS, aq->ss_region);
+	}
+	hisi_qm_free_ctx(aq->h_ctx);
+	wd_edf_fini(&aq->pend);
+	aq->h_ctx = 0;
+}
+
+/* get the queue of op ready on the first request */
+static int hisi_async_q_init(struct hisi_async *as, int op)
+{
+	struct hisi_async_q	*aq = &as->q[op];
+	struct hisi_qm_priv	qm_priv;
+	size_t	size;
+	int	i, ret;
+
+	qm_priv.sqe_size = sizeof(struct hisi_zip_sqe);
+	qm_priv.op_type = op;
+	aq->h_ctx = hisi_qm_alloc_ctx(as->sess->node_path, &qm_priv,
+				      (void **)&aq->qp);
+	if (!aq->h_ctx)
+		return -EBUSY;
+	ret = wd_edf_init(&aq->pend, ASYNC_PEND);
+	if (ret) {
+		hisi_qm_free_ctx(aq->h_ctx);
+		aq->h_ctx = 0;
+		return ret;
+	}
+
+	aq->nosva = wd_is_nosva(aq->h_ctx);
+	aq->depth = aq->nosva ? ASYNC_NOSVA_DEPTH : ASYNC_DEPTH;
+	if (aq->nosva) {
+		size = 4096 + aq->depth * BLOCK_MAX * 2;
+		aq->ss_region = wd_reserve_mem(aq->h_ctx, size);
+		if (!aq->ss_region) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = smm_init(aq->ss_region, size, 0xF);
+		if (ret)
+			goto out;
+		ret = -ENOMEM;
+		for (i = 0; i < aq->depth; i++) {
+			aq->slots[i].swap_in = smm_alloc(aq->ss_region,
+							 BLOCK_MAX);
+			aq->slots[i].swap_out = smm_alloc(aq->ss_region,
+							  BLOCK_MAX);
+			if (!aq->slots[i].swap_in || !aq->slots[i].swap_out)
+				goto out;
+		}
+	}
+	aq->free = NULL;
+	for (i = aq->depth - 1; i >= 0; i--) {
+		aq->slots[i].next = aq->free;
+		aq->free = &aq->slots[i];
+	}
+
+	if (as->sub) {
+		ret = wd_poller_add(as->sess->poller, aq->h_ctx, hisi_qm_recv,
+				    as->sub);
+		if (ret)
+			goto out;
+	}
+	return 0;
+out:
+	hisi_async_q_exit(as, aq);
+	return ret;
+}
+
+static struct hisi_async *hisi_async_get(struct wd_comp_sess *sess)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_async	*as;
+
+	as = __atomic_load_n(&priv->async, __ATOMIC_ACQUIRE);
+	if (as)
+		return as;
+
+	pthread_mutex_lock(&priv->async_lock);
+	as = priv->async;
+	if (as)
+		goto out;
+	as = calloc(1, sizeof(*as));
+	if (!as)
+		goto out;
+	as->sess = sess;
+	if (sess->poller) {
+		as->sub = wd_poller_sub_alloc(0, hisi_async_complete, as);
+		if (!as->sub) {
+			free(as);
+			as = NULL;
+			goto out;
+		}
+	}
+	pthread_mutex_init(&as->lock, NULL);
+	pthread_mutex_init(&as->init_lock, NULL);
+	__atomic_store_n(&priv->async, as, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&priv->async_lock);
+	return as;
+}
+
+static void hisi_async_exit(struct wd_comp_sess *sess)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_async	*as = priv->async;
+
+	if (!as)
+		return;
+	hisi_async_q_exit(as, &as->q[DEFLATE]);
+	hisi_async_q_exit(as, &as->q[INFLATE]);
+	wd_poller_sub_free(as->sub);
+	pthread_mutex_destroy(&as->init_lock);
+	pthread_mutex_destroy(&as->lock);
+	free(as);
+	priv->async = NULL;
+}
+
+static int hisi_async_check(struct wd_comp_sess *sess,
+			    struct wd_comp_arg *arg, int op)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_sched	*hsched = priv->sched.priv;
+	int	frame = hisi_frame(hsched->alg_type, arg);
+	int	head_sz;
+
+	if (frame == RAW)
+		head_sz = 0;
+	else
+		head_sz = (frame == ZLIB) ? ZLIB_HEADER_SZ : GZIP_HEADER_SZ;
+	if (op == DEFLATE)
+		head_sz += hisi_tail_len(frame);
+	if (!arg->src_len || arg->src_len > BLOCK_MAX ||
+	    arg->dst_len <= head_sz)
+		return -EINVAL;
+	if (op == INFLATE) {
+		head_sz = hisi_head_len(frame, arg->src, arg->src_len);
+		if (head_sz < 0 || arg->src_len <= head_sz)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/* get the async queue of op ready */
+static struct hisi_async *hisi_async_ready(struct wd_comp_sess *sess, int op,
+					   int *ret)
+{
+	struct hisi_async	*as;
+
+	as = hisi_async_get(sess);
+	if (!as) {
+		*ret = -ENOMEM;
+		return NULL;
+	}
+	*ret = 0;
+	if (!__atomic_load_n(&as->ready[op], __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&as->init_lock);
+		*ret = as->q[op].h_ctx ? 0 : hisi_async_q_init(as, op);
+		if (!*ret)
+			__atomic_store_n(&as->ready[op], 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&as->init_lock);
+	}
+	return *ret ? NULL : as;
+}
+
+static int hisi_comp_async(struct wd_comp_sess *sess, struct wd_comp_arg *arg,
+			   int op)
+{
+	struct hisi_async	*as;
+	struct hisi_async_q	*aq;
+	struct hisi_async_fails	fails = { .num = 0, .nlate = 0 };
+	int	ret;
+
+	ret = hisi_async_check(sess, arg, op);
+	if (ret)
+		return ret;
+	as = hisi_async_ready(sess, op, &ret);
+	if (!as)
+		return ret;
+	aq = &as->q[op];
+
+	pthread_mutex_lock(&as->lock);
+	ret = wd_edf_push(&aq->pend, arg, arg->deadline);
+	if (!ret)
+		hisi_async_kick(as, aq, &fails);
+	pthread_mutex_unlock(&as->lock);
+	hisi_async_fail(as, &fails);
+	return ret;
+}
+
+/*
+ * Queue all requests of the batch before kicking the hardware, so that they
+ * share doorbells. Then wait for all of them. A request that is refused has
+ * STATUS_FAILED set.
+ */
+int hisi_comp_batch(struct wd_comp_sess *sess, struct wd_comp_arg *args,
+		    int num)
+{
+	struct hisi_async	*as;
+	struct hisi_async_q	*aq;
+	struct hisi_async_fails	fails;
+	int	op, i, queued = 0, done = 0, ret;
+
+	op = (args[0].flag & FLAG_DEFLATE) ? DEFLATE : INFLATE;
+	as = hisi_async_ready(sess, op, &ret);
+	if (!as)
+		return ret;
+	aq = &as->q[op];
+
+	for (i = 0; i < num; i++) {
+		args[i].cb = wd_comp_count_done;
+		args[i].cb_param = &done;
+		if (hisi_async_check(sess, &args[i], op)) {
+			args[i].dst_len = 0;
+			args[i].status = STATUS_FAILED;
+		}
+	}
+
+	i = 0;
+	while (i < num || __atomic_load_n(&done, __ATOMIC_ACQUIRE) < queued) {
+		if (i < num) {
+			pthread_mutex_lock(&as->lock);
+			for (; i < num; i++) {
+				if (args[i].status & STATUS_FAILED)
+					continue;
+				/* no room, queue the rest after some are done */
+				if (wd_edf_push(&aq->pend, &args[i],
+						args[i].deadline))
+					break;
+				queued++;
+			}
+			hisi_async_kick(as, aq, &fails);
+			pthread_mutex_unlock(&as->lock);
+			hisi_async_fail(as, &fails);
+		}
+		/* the poller thread reaps them */
+		if (as->sub) {
+			sched_yield();
+			continue;
+		}
+		ret = hisi_comp_poll(sess, num);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			wd_wait(aq->h_ctx, 1000);
+	}
+
+	for (i = 0; i < num; i++) {
+		args[i].cb = NULL;
+		args[i].cb_param = NULL;
+	}
+	return 0;
+}
+
+/*
+ * Only an independent gzip block could be split, since gzip members could
+ * be concatenated while zlib streams couldn't.
+ */
+static int hisi_need_split(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_sched	*hsched = priv->sched.priv;
+
+	return hsched->alg_type == GZIP && !(arg->flag & FLAG_RAW) &&
+	       (arg->flag & FLAG_INPUT_FINISH) && arg->src_len > BLOCK_MAX;
+}
+
+/* queue chunks of a split block, and kick them with one doorbell */
+static int hisi_split_send(void *priv, struct wd_comp_arg **args, int num)
+{
+	struct wd_comp_sess	*sess = priv;
+	struct hisi_comp_sess	*hpriv = sess->priv;
+	struct hisi_async	*as = __atomic_load_n(&hpriv->async,
+						  __ATOMIC_ACQUIRE);
+	struct hisi_async_q	*aq = &as->q[DEFLATE];
+	struct hisi_async_fails	fails;
+	int	i;
+
+	pthread_mutex_lock(&as->lock);
+	for (i = 0; i < num; i++) {
+		/* queue the rest after some are done */
+		if (wd_edf_push(&aq->pend, args[i], 0))
+			break;
+	}
+	hisi_async_kick(as, aq, &fails);
+	pthread_mutex_unlock(&as->lock);
+	hisi_async_fail(as, &fails);
+	return i;
+}
+
+static int hisi_split_poll(void *priv)
+{
+	struct wd_comp_sess	*sess = priv;
+	struct hisi_comp_sess	*hpriv = sess->priv;
+	struct hisi_async	*as = __atomic_load_n(&hpriv->async,
+						  __ATOMIC_ACQUIRE);
+	int	ret;
+
+	/* the poller thread reaps them */
+	if (as->sub) {
+		sched_yield();
+		return 0;
+	}
+	ret = hisi_comp_poll(sess, SPLIT_INFLIGHT);
+	if (!ret)
+		wd_wait(as->q[DEFLATE].h_ctx, 1000);
+	return ret;
+}
+
+static const struct wd_comp_split_ops hisi_split_ops = {
+	.send	= hisi_split_send,
+	.poll	= hisi_split_poll,
+};
+
+/*
+ * Cut a large block into chunks of BLOCK_SIZE, and keep up to
+ * SPLIT_INFLIGHT of them on the async queue, see wd_comp_split().
+ */
+static int hisi_block_split(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	struct hisi_async	*as;
+	int	ret;
+
+	as = hisi_async_ready(sess, DEFLATE, &ret);
+	if (!as)
+		return ret;
+	return wd_comp_split(&hisi_split_ops, sess, SPLIT_INFLIGHT,
+			     wd_get_numa_node(as->q[DEFLATE].h_ctx),
+			     BLOCK_SIZE, arg);
+}
+
+int hisi_comp_async_deflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return hisi_comp_async(sess, arg, DEFLATE);
+}
+
+int hisi_comp_async_inflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return hisi_comp_async(sess, arg, INFLATE);
+}
+
+int hisi_comp_poll(struct wd_comp_sess *sess, int budget)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_async	*as = __atomic_load_n(&priv->async,
+						  __ATOMIC_ACQUIRE);
+	struct hisi_async_q	*aq;
+	struct hisi_async_fails	fails;
+	struct wd_comp_arg	*args[ASYNC_DEPTH];
+	void	*resp;
+	int	op, num, n = 0, ret = 0;
+
+	/* nothing was sent, or the poller thread does the work */
+	if (!as || as->sub)
+		return 0;
+
+	for (op = DEFLATE; op <= INFLATE; op++) {
+		if (!__atomic_load_n(&as->ready[op], __ATOMIC_ACQUIRE))
+			continue;
+		aq = &as->q[op];
+		/* refill the freed slots at once, with one doorbell */
+		pthread_mutex_lock(&as->lock);
+		for (num = 0; num < ASYNC_DEPTH && n + num < budget; num++) {
+			ret = hisi_qm_recv(aq->h_ctx, &resp);
+			if (ret)
+				break;
+			args[num] = hisi_async_done(as, aq, resp);
+		}
+		fails.num = 0;
+		fails.nlate = 0;
+		if (num)
+			hisi_async_kick(as, aq, &fails);
+		pthread_mutex_unlock(&as->lock);
+		/* out of the lock, the call backs may send again */
+		hisi_async_call(args, num);
+		hisi_async_fail(as, &fails);
+		n += num;
+		if (ret && ret != -EAGAIN)
+			return ret;
+	}
+	return n;
+}
+
+/* waiting requests are counted too, so it may exceed 100 */
+int hisi_comp_load(struct wd_comp_sess *sess, int deflate)
+{
+	struct hisi_comp_sess	*priv = sess->priv;
+	struct hisi_async	*as = __atomic_load_n(&priv->async,
+						  __ATOMIC_ACQUIRE);
+	struct hisi_async_q	*aq;
+	int	load;
+
+	if (!as)
+		return 0;
+	aq = &as->q[deflate ? DEFLATE : INFLATE];
+	pthread_mutex_lock(&as->lock);
+	load = aq->depth ?
+	       (aq->busy + aq->pend.num) * 100 / aq->depth : 0;
+	pthread_mutex_unlock(&as->lock);
+	return load;
+}
+
 int hisi_comp_init(struct wd_comp_sess *sess)
 {
 	struct hisi_comp_sess	*priv;
@@ -1146,6 +1987,7 @@ int hisi_comp_init(struct wd_comp_sess *sess)
 	if (!priv)
 		return -ENOMEM;
 	priv->inited = 0;
+	pthread_mutex_init(&priv->async_lock, NULL);
 	sess->priv = priv;
 	if (sess->mode & MODE_STREAM)
 		hisi_comp_strm_init(sess);
@@ -1156,11 +1998,15 @@ int hisi_comp_init(struct wd_comp_sess *sess)
 
 void hisi_comp_exit(struct wd_comp_sess *sess)
 {
+	struct hisi_comp_sess	*priv = sess->priv;
+
+	hisi_async_exit(sess);
 	if (sess->mode & MODE_STREAM) {
 		hisi_comp_strm_exit(sess);
 	} else {
 		hisi_comp_block_exit(sess);
 	}
+	pthread_mutex_destroy(&priv->async_lock);
 	free(sess->priv);
 	sess->priv = NULL;
 }
@@ -1187,6 +2033,8 @@ int hisi_comp_deflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
 
 	if (sess->mode & MODE_STREAM)
 		ret = hisi_comp_strm_deflate(sess, arg);
+	else if (hisi_need_split(sess, arg))
+		ret = hisi_block_split(sess, arg);
 	else
 		ret = hisi_comp_block_deflate(sess, arg);
 	return ret;
@@ -1203,11 +2051,6 @@ int hisi_comp_inflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
 	return ret;
 }
 
-int hisi_comp_poll(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
-{
-	return 0;
-}
-
 int hisi_strm_deflate(struct wd_comp_sess *sess, struct wd_comp_strm *strm)
 {
 	struct wd_comp_arg	*arg = &strm->arg;
@@ -76,8 +76,8 @@ static int hisi_qm_fill_sqe(void *sqe, struct hisi_qm_queue_info *info, __u16 i)
 {
 	memcpy(info->sq_base + i * info->sqe_size, sqe, info->sqe_size);
 
-	assert(!info->req_cache[i]);
-	info->req_cache[i] = sqe;
+	/* publish the request before the doorbell, recv may be on another cpu */
+	__atomic_store_n(&info->req_cache[i], sqe, __ATOMIC_RELEASE);
 
 	return 0;
 }
@@ -154,7 +154,6 @@ handle_t hisi_qm_alloc_ctx(char *node_path, void *priv, void **data)
 	q_info->sq_head_index = 0;
 	q_info->cq_head_index = 0;
 	q_info->cqc_phase = 1;
-	q_info->is_sq_full = 0;
 	memset(&qp_ctx, 0, sizeof(struct hisi_qp_ctx));
 	qp_ctx.qc_type = qm_priv->op_type;
 	fd = wd_ctx_get_fd(qp->h_ctx);
@@ -213,13 +212,18 @@ int hisi_qm_send(handle_t h_ctx, void *req)
 	if (!qp)
 		return -EINVAL;
 	q_info = &qp->q_info;
-	if (q_info->is_sq_full) {
+	i = q_info->sq_tail_index;
+
+	/*
+	 * The slot is busy until recv takes the request out of it. Only send
+	 * touches sq_tail_index and only recv clears req_cache, so send and
+	 * recv can run in two threads of their own.
+	 */
+	if (__atomic_load_n(&q_info->req_cache[i], __ATOMIC_ACQUIRE)) {
 		WD_ERR("queue is full!\n");
 		return -EBUSY;
 	}
 
-	i = q_info->sq_tail_index;
-
 	hisi_qm_fill_sqe(req, q_info, i);
 
 	if (i == (QM_Q_DEPTH - 1))
@@ -231,12 +235,47 @@ int hisi_qm_send(handle_t h_ctx, void *req)
 
 	q_info->sq_tail_index = i;
 
-	if (i == q_info->sq_head_index)
-		q_info->is_sq_full = 1;
-
 	return 0;
 }
 
+/*
+ * Put requests on the ring and ring the doorbell once for all of them.
+ * Return the number of requests sent, it's less than num if the ring is
+ * full.
+ */
+int hisi_qm_send_batch(handle_t h_ctx, void **reqs, int num)
+{
+	struct hisi_qp			*qp;
+	struct hisi_qm_queue_info	*q_info;
+	__u16 i;
+	int n;
+
+	qp = (struct hisi_qp *)wd_ctx_get_sess_priv(h_ctx);
+	if (!qp || !reqs || num <= 0)
+		return -EINVAL;
+	q_info = &qp->q_info;
+	i = q_info->sq_tail_index;
+
+	for (n = 0; n < num; n++) {
+		/* the slot is busy until recv takes the request out of it */
+		if (__atomic_load_n(&q_info->req_cache[i], __ATOMIC_ACQUIRE))
+			break;
+		hisi_qm_fill_sqe(reqs[n], q_info, i);
+		if (i == (QM_Q_DEPTH - 1))
+			i = 0;
+		else
+			i++;
+	}
+	if (!n)
+		return -EBUSY;
+
+	q_info->db(q_info, DOORBELL_CMD_SQ, i, 0);
+
+	q_info->sq_tail_index = i;
+
+	return n;
+}
+
 int hisi_qm_recv(handle_t h_ctx, void **resp)
 {
 	struct hisi_qp			*qp;
@@ -265,9 +304,6 @@ int hisi_qm_recv(handle_t h_ctx, void **resp)
 			errno = -EIO;
 			return -EIO;
 		}
-
-		if (q_info->is_sq_full)
-			q_info->is_sq_full = 0;
 	} else {
 		/* enable interrupt for poll notifying */
 		q_info->db(q_info, DOORBELL_CMD_CQ, i, 1);
@@ -275,7 +311,7 @@ int hisi_qm_recv(handle_t h_ctx, void **resp)
 	}
 
 	*resp = q_info->req_cache[i];
-	q_info->req_cache[i] = NULL;
+	__atomic_store_n(&q_info->req_cache[i], NULL, __ATOMIC_RELEASE);
 
 	if (i == (QM_Q_DEPTH - 1)) {
 		q_info->cqc_phase = !(q_info->cqc_phase);
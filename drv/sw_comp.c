@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "sw_comp.h"
+#include "wd_bytes.h"
+#include "wd_crc.h"
+
+#define ZLIB_HEADER_SZ	2
+#define GZIP_HEADER_SZ	10
+#define ZLIB_TAIL_SZ	4
+#define GZIP_TAIL_SZ	8
+
+/* how deflate data is framed */
+#define SW_ZLIB		0
+#define SW_GZIP		1
+#define SW_RAW		2
+
+static const unsigned char zlib_head[ZLIB_HEADER_SZ] = {0x78, 0x9c};
+static const unsigned char gzip_head[GZIP_HEADER_SZ] = {
+	0x1f, 0x8b, 0x08, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x03
+};
+
+static inline int is_gzip(char *alg_name)
+{
+	return !strncmp(alg_name, "gzip", strlen("gzip"));
+}
+
+static inline int is_raw(char *alg_name)
+{
+	return !strncmp(alg_name, "deflate", strlen("deflate"));
+}
+
+static int sw_frame(char *alg_name, uint32_t flag)
+{
+	if (is_raw(alg_name) || (flag & FLAG_RAW))
+		return SW_RAW;
+	return is_gzip(alg_name) ? SW_GZIP : SW_ZLIB;
+}
+
+/* header of hisi_zip, raw deflate data, and the trailer */
+static int sw_block_deflate(int frame, int level, struct wd_comp_arg *arg)
+{
+	unsigned char	*dst = arg->dst;
+	size_t	head_sz = 0, tail_sz = 0;
+	z_stream	zs;
+	uint32_t	check;
+	int	ret;
+
+	if (frame == SW_GZIP) {
+		head_sz = GZIP_HEADER_SZ;
+		tail_sz = GZIP_TAIL_SZ;
+	} else if (frame == SW_ZLIB) {
+		head_sz = ZLIB_HEADER_SZ;
+		tail_sz = ZLIB_TAIL_SZ;
+	}
+	if (arg->dst_len < head_sz + tail_sz)
+		return -ENOSPC;
+	memcpy(dst, frame == SW_GZIP ? gzip_head : zlib_head, head_sz);
+
+	memset(&zs, 0, sizeof(zs));
+	ret = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+			   Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK)
+		return -ENOMEM;
+	zs.next_in = arg->src;
+	zs.avail_in = arg->src_len;
+	zs.next_out = dst + head_sz;
+	zs.avail_out = arg->dst_len - head_sz - tail_sz;
+	ret = deflate(&zs, Z_FINISH);
+	deflateEnd(&zs);
+	if (ret != Z_STREAM_END)
+		return -ENOSPC;
+
+	dst = zs.next_out;
+	if (frame == SW_GZIP) {
+		check = wd_crc32(0, arg->src, arg->src_len);
+		put_le32(dst, check);
+		put_le32(dst + 4, arg->src_len);
+	} else if (frame == SW_ZLIB) {
+		check = wd_adler32(1, arg->src, arg->src_len);
+		put_be32(dst, check);
+	}
+	arg->dst_len = head_sz + zs.total_out + tail_sz;
+	arg->src_len = zs.total_in;
+	return 0;
+}
+
+/* skip the header as hisi_zip does, and stop at the end of the member */
+static int sw_block_inflate(int frame, struct wd_comp_arg *arg)
+{
+	const unsigned char	*tail;
+	size_t	head_sz = 0, tail_sz, left;
+	z_stream	zs;
+	int	ret;
+
+	if (frame == SW_GZIP) {
+		ret = wd_gzip_head_len(arg->src, arg->src_len, NULL);
+		if (ret < 0)
+			return -EINVAL;
+		head_sz = ret;
+	} else if (frame == SW_ZLIB) {
+		head_sz = ZLIB_HEADER_SZ;
+	}
+	if (arg->src_len <= head_sz)
+		return -EINVAL;
+
+	memset(&zs, 0, sizeof(zs));
+	ret = inflateInit2(&zs, -MAX_WBITS);
+	if (ret != Z_OK)
+		return -ENOMEM;
+	zs.next_in = arg->src + head_sz;
+	zs.avail_in = arg->src_len - head_sz;
+	zs.next_out = arg->dst;
+	zs.avail_out = arg->dst_len;
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	if (ret == Z_DATA_ERROR || ret == Z_NEED_DICT) {
+		WD_ERR("fail to inflate by zlib (%d)\n", ret);
+		return -EIO;
+	}
+	if (ret != Z_STREAM_END)
+		return -ENOSPC;
+
+	/* check the trailer if it's there, and consume it */
+	tail = arg->src + head_sz + zs.total_in;
+	left = arg->src_len - head_sz - zs.total_in;
+	tail_sz = 0;
+	if (frame == SW_GZIP && left >= GZIP_TAIL_SZ) {
+		if (get_le32(tail) != wd_crc32(0, arg->dst, zs.total_out) ||
+		    get_le32(tail + 4) != (uint32_t)zs.total_out)
+			ret = -EIO;
+		tail_sz = GZIP_TAIL_SZ;
+	} else if (frame == SW_ZLIB && left >= ZLIB_TAIL_SZ) {
+		if (get_be32(tail) != wd_adler32(1, arg->dst, zs.total_out))
+			ret = -EIO;
+		tail_sz = ZLIB_TAIL_SZ;
+	}
+	if (ret == -EIO) {
+		WD_ERR("fail to check the trailer\n");
+		return ret;
+	}
+
+	arg->dst_len = zs.total_out;
+	arg->src_len = head_sz + zs.total_in + tail_sz;
+	return 0;
+}
+
+/*
+ * Compress or decompress the whole input of arg in one shot. On success,
+ * arg->src_len is the consumed size and arg->dst_len is the produced size,
+ * as struct wd_comp_arg tells.
+ * Return -ENOSPC if the output doesn't fit in arg->dst, and arg is kept.
+ */
+int sw_comp_block(char *alg_name, int level, struct wd_comp_arg *arg)
+{
+	struct wd_comp_arg	tmp = *arg;
+	int	ret;
+
+	if (tmp.flag & FLAG_DEFLATE)
+		ret = sw_block_deflate(sw_frame(alg_name, tmp.flag), level,
+				       &tmp);
+	else
+		ret = sw_block_inflate(sw_frame(alg_name, tmp.flag), &tmp);
+	if (ret)
+		return ret;
+	arg->src_len = tmp.src_len;
+	arg->dst_len = tmp.dst_len;
+	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
+	return 0;
+}
+
+/* zlib frames the data itself, with the same header as hisi_zip */
+static int sw_wbits(int frame)
+{
+	if (frame == SW_GZIP)
+		return MAX_WBITS + 16;
+	return frame == SW_ZLIB ? MAX_WBITS : -MAX_WBITS;
+}
+
+/*
+ * Stream the segments of iov through zlib in block mode, so they aren't
+ * gathered. The header and the trailer are made and checked by zlib, and
+ * an inflate stops at the end of the first stream.
+ */
+static int sw_comp_iov(struct wd_comp_sess *sess, struct wd_comp_iov *iov,
+		       int is_deflate)
+{
+	int	frame = sw_frame(sess->alg_name, iov->flag);
+	int	in_i = 0, out_i = 0, flush, ret;
+	unsigned int	avail_in, avail_out;
+	z_stream	zs;
+
+	memset(&zs, 0, sizeof(zs));
+	if (is_deflate)
+		ret = deflateInit2(&zs, SW_LEVEL_DEFAULT, Z_DEFLATED,
+				   sw_wbits(frame), 8, Z_DEFAULT_STRATEGY);
+	else
+		ret = inflateInit2(&zs, sw_wbits(frame));
+	if (ret != Z_OK)
+		return -ENOMEM;
+	while (1) {
+		/* skip the segments that are used up, empty ones too */
+		while (!zs.avail_in && in_i < iov->src_num) {
+			zs.next_in = iov->src[in_i].iov_base;
+			zs.avail_in = iov->src[in_i].iov_len;
+			in_i++;
+		}
+		while (!zs.avail_out && out_i < iov->dst_num) {
+			zs.next_out = iov->dst[out_i].iov_base;
+			zs.avail_out = iov->dst[out_i].iov_len;
+			out_i++;
+		}
+		flush = (in_i == iov->src_num && !zs.avail_in) ?
+			Z_FINISH : Z_NO_FLUSH;
+		/* the trailer may still be consumed while dst is full */
+		avail_in = zs.avail_in;
+		avail_out = zs.avail_out;
+		if (is_deflate) {
+			ret = deflate(&zs, flush);
+		} else {
+			ret = inflate(&zs, Z_NO_FLUSH);
+			if (ret == Z_DATA_ERROR || ret == Z_NEED_DICT) {
+				WD_ERR("fail to inflate by zlib (%d)\n", ret);
+				ret = -EIO;
+				break;
+			}
+		}
+		if (ret == Z_STREAM_END) {
+			ret = 0;
+			break;
+		}
+		if (zs.avail_in == avail_in && zs.avail_out == avail_out) {
+			/* dst is full, or the input is truncated */
+			ret = zs.avail_out ? -EINVAL : -ENOSPC;
+			break;
+		}
+	}
+	if (is_deflate)
+		deflateEnd(&zs);
+	else
+		inflateEnd(&zs);
+	if (ret)
+		return ret;
+	iov->src_len = zs.total_in;
+	iov->dst_len = zs.total_out;
+	iov->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
+	return 0;
+}
+
+int sw_comp_deflate_iov(struct wd_comp_sess *sess, struct wd_comp_iov *iov)
+{
+	return sw_comp_iov(sess, iov, 1);
+}
+
+int sw_comp_inflate_iov(struct wd_comp_sess *sess, struct wd_comp_iov *iov)
+{
+	return sw_comp_iov(sess, iov, 0);
+}
+
+int sw_comp_init(struct wd_comp_sess *sess)
+{
+	if (strncmp(sess->alg_name, "zlib", strlen("zlib")) &&
+	    !is_gzip(sess->alg_name) && !is_raw(sess->alg_name))
+		return -EINVAL;
+	if (sess->mode & MODE_STREAM)
+		return -EINVAL;
+	return 0;
+}
+
+void sw_comp_exit(struct wd_comp_sess *sess)
+{
+}
+
+/* move the buffers in arg as hisi_zip does in block mode */
+static int sw_comp_sync(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	int	ret;
+
+	ret = sw_comp_block(sess->alg_name, SW_LEVEL_DEFAULT, arg);
+	if (ret)
+		return ret;
+	arg->src += arg->src_len;
+	arg->dst += arg->dst_len;
+	return 0;
+}
+
+int sw_comp_deflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return sw_comp_sync(sess, arg);
+}
+
+int sw_comp_inflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return sw_comp_sync(sess, arg);
+}
+
+/* it's done before return, so the call back is called at once */
+static int sw_comp_async(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	if (sw_comp_block(sess->alg_name, SW_LEVEL_DEFAULT, arg)) {
+		arg->dst_len = 0;
+		arg->status = STATUS_FAILED;
+	}
+	arg->cb(arg->cb_param);
+	return 0;
+}
+
+int sw_comp_async_deflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return sw_comp_async(sess, arg);
+}
+
+int sw_comp_async_inflate(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	return sw_comp_async(sess, arg);
+}
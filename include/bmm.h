@@ -2,9 +2,34 @@
 #ifndef _BMM_H
 #define _BMM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* the pool may be used by multiple threads at the same time */
+#define BMM_CONCURRENT		(1 << 0)
+
+struct bmm_stats {
+	size_t		block_size;
+	size_t		size;		/* bytes of all blocks */
+	size_t		used;
+	size_t		free;
+	size_t		peak_used;
+	size_t		largest_free;	/* the longest run of free blocks */
+	uint64_t	fail_num;	/* allocations that found no room */
+	/* percent of free memory that isn't in the longest free run */
+	unsigned int	frag;
+};
+
 int bmm_init(void *addr_base, unsigned int mem_size, unsigned int block_size,
 	     unsigned int align_size);
+int bmm_init_ex(void *addr_base, unsigned int mem_size,
+		unsigned int block_size, unsigned int align_size,
+		unsigned int flags);
 void *bmm_alloc(void *pool);
 void bmm_free(void *pool, void *buf);
+void *bmm_alloc_n(void *pool, unsigned int n);
+void *bmm_alloc_at(void *pool, unsigned int index);
+void bmm_free_n(void *pool, void *buf, unsigned int n);
+int bmm_get_stats(void *pool, struct bmm_stats *st);
 
 #endif
@@ -11,6 +11,7 @@
 
 #define	ZLIB		0
 #define	GZIP		1
+#define	RAW		2
 
 #define DEFLATE		0
 #define INFLATE		1
@@ -26,8 +27,14 @@ extern int hisi_comp_deflate(struct wd_comp_sess *sess,
 			     struct wd_comp_arg *arg);
 extern int hisi_comp_inflate(struct wd_comp_sess *sess,
 			     struct wd_comp_arg *arg);
-extern int hisi_comp_poll(struct wd_comp_sess *sess,
-			  struct wd_comp_arg *arg);
+extern int hisi_comp_async_deflate(struct wd_comp_sess *sess,
+				   struct wd_comp_arg *arg);
+extern int hisi_comp_async_inflate(struct wd_comp_sess *sess,
+				   struct wd_comp_arg *arg);
+extern int hisi_comp_poll(struct wd_comp_sess *sess, int budget);
+extern int hisi_comp_batch(struct wd_comp_sess *sess, struct wd_comp_arg *args,
+			   int num);
+extern int hisi_comp_load(struct wd_comp_sess *sess, int deflate);
 extern int hisi_strm_deflate(struct wd_comp_sess *sess,
 			     struct wd_comp_strm *strm);
 extern int hisi_strm_inflate(struct wd_comp_sess *sess,
@@ -36,8 +36,7 @@ struct hisi_qm_queue_info {
 	__u16 cq_head_index;
 	__u16 sqn;
 	bool cqc_phase;
-	void *req_cache[QM_Q_DEPTH];
-	int is_sq_full;
+	void *req_cache[QM_Q_DEPTH];	/* requests in flight */
 };
 
 struct hisi_qp {
@@ -48,6 +47,7 @@ struct hisi_qp {
 extern handle_t hisi_qm_alloc_ctx(char *node_path, void *priv, void **data);
 extern void hisi_qm_free_ctx(handle_t h_ctx);
 extern int hisi_qm_send(handle_t h_ctx, void *req);
+extern int hisi_qm_send_batch(handle_t h_ctx, void **reqs, int num);
 extern int hisi_qm_recv(handle_t h_ctx, void **resp);
 
 #endif
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __MCACHE_H
+#define __MCACHE_H
+
+#include <stddef.h>
+
+/*
+ * Per-thread caches of fixed size objects in front of a shared pool, such
+ * as a smm region or a bmm pool. Each thread keeps a magazine of objects,
+ * allocating and freeing in it takes no lock. The magazine is refilled from
+ * or flushed to the pool batch objects at a time, with the pool locked, and
+ * it's drained back to the pool when the thread exits.
+ */
+struct mcache;
+
+#define MCACHE_BATCH_DEFAULT	16
+#define MCACHE_BATCH_MAX	256
+
+extern struct mcache *mcache_create(void *pool, size_t obj_size, int batch,
+				    void *(*alloc_fn)(void *pool, size_t size),
+				    void (*free_fn)(void *pool, void *obj));
+extern struct mcache *mcache_create_smm(void *pt_addr, size_t obj_size,
+					int batch);
+extern struct mcache *mcache_create_bmm(void *pool, int batch);
+extern void mcache_destroy(struct mcache *mc);
+extern void *mcache_alloc(struct mcache *mc);
+extern void mcache_free(struct mcache *mc, void *obj);
+extern void mcache_drain(struct mcache *mc);
+
+#endif /* __MCACHE_H */
@@ -7,9 +7,27 @@
 #include <stdint.h>
 #include "config.h"
 
+#define SMM_THREAD_SAFE		(1 << 0)
+
+struct smm_stats {
+	size_t		size;		/* bytes managed */
+	size_t		used;		/* bytes of allocated blocks */
+	size_t		free;
+	size_t		peak_used;
+	size_t		largest_free;	/* the largest block to allocate */
+	uint64_t	fail_num;	/* allocations that found no room */
+	/* percent of free memory that isn't in the largest free block */
+	unsigned int	frag;
+};
+
 extern int smm_init(void *pt_addr, size_t size, int align_mask);
+extern int smm_init_ex(void *pt_addr, size_t size, int align_mask, int flags);
+extern void smm_fini(void *pt_addr);
+extern size_t smm_block_size(size_t size, int align_mask);
 extern void *smm_alloc(void *pt_addr, size_t size);
 extern void smm_free(void *pt_addr, void *ptr);
+extern void *smm_realloc(void *pt_addr, void *ptr, size_t size);
+extern int smm_get_stats(void *pt_addr, struct smm_stats *st);
 
 #ifndef NDEBUG
 extern void smm_dump(void *pt_addr);
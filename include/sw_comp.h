@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef	__SW_COMP_H
+#define	__SW_COMP_H
+
+#include "wd_comp.h"
+
+/*
+ * Compression on CPU by zlib. The output is framed as the one of hisi_zip,
+ * so that a block could be compressed by either and decompressed by the
+ * other.
+ */
+
+#define SW_LEVEL_DEFAULT	6
+
+extern int sw_comp_init(struct wd_comp_sess *sess);
+extern void sw_comp_exit(struct wd_comp_sess *sess);
+extern int sw_comp_deflate(struct wd_comp_sess *sess,
+			   struct wd_comp_arg *arg);
+extern int sw_comp_inflate(struct wd_comp_sess *sess,
+			   struct wd_comp_arg *arg);
+extern int sw_comp_async_deflate(struct wd_comp_sess *sess,
+				 struct wd_comp_arg *arg);
+extern int sw_comp_async_inflate(struct wd_comp_sess *sess,
+				 struct wd_comp_arg *arg);
+extern int sw_comp_deflate_iov(struct wd_comp_sess *sess,
+			       struct wd_comp_iov *iov);
+extern int sw_comp_inflate_iov(struct wd_comp_sess *sess,
+			       struct wd_comp_iov *iov);
+extern int sw_comp_block(char *alg_name, int level, struct wd_comp_arg *arg);
+
+#endif	/* __SW_COMP_H */
@@ -28,6 +28,7 @@
 #define ARRAY_SIZE(x)			(sizeof(x) / sizeof((x)[0]))
 #define MAX_ACCELS			16
 #define MAX_BYTES_FOR_ACCELS		(MAX_ACCELS >> 3)
+#define WD_MAX_NUMA_NODES		1024
 #define WD_DEV_MASK_MAGIC		0xa395deaf
 
 #ifndef WD_ERR
@@ -66,6 +67,7 @@ struct uacce_dev_info {
 
 	int		node_id;
 	int		iommu_type;
+	int		numa_id;	/* -1 if it's unknown */
 };
 
 struct uacce_dev_list {
@@ -133,6 +135,8 @@ extern int wd_wait(handle_t h_ctx, __u16 ms);
 extern int wd_is_nosva(handle_t h_ctx);
 extern void *wd_reserve_mem(handle_t h_ctx, size_t size);
 extern void *wd_get_dma_from_va(handle_t h_ctx, void *va);
+extern int wd_get_numa_node(handle_t h_ctx);
+extern int wd_numa_bind(void *addr, size_t len, int node);
 
 extern int wd_get_accel_mask(char *alg_name, wd_dev_mask_t *dev_mask);
 
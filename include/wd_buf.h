@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_BUF_H
+#define __WD_BUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wd_buf_stats {
+	size_t		size;		/* bytes in the pool of the node */
+	size_t		used;
+	size_t		peak_used;
+	uint64_t	fail_num;	/* requests the pool can't hold */
+	uint64_t	fallback_num;	/* requests served by malloc() */
+	uint64_t	trimmed;	/* bytes given back to the system */
+};
+
+/*
+ * Free buffers keep their pages, so they're reused without page faults.
+ * Once in idle_ms, free buffers of a pool are trimmed down to high bytes,
+ * or trimmed all if the pool isn't allocated from in the interval.
+ */
+struct wd_buf_config {
+	size_t		high;
+	unsigned int	idle_ms;	/* 0 for no trimming */
+};
+
+/*
+ * Buffers that a device reads or writes, from process-wide pools per NUMA
+ * node. node is the node of the device, see wd_get_numa_node(), or -1 for
+ * buffers that aren't bound to any node. It falls back to malloc() if the
+ * pool can't hold the buffer.
+ */
+extern void *wd_buf_alloc(size_t size, int node);
+extern void wd_buf_free(void *buf);
+extern int wd_buf_prefault(int node, size_t size, int num);
+extern size_t wd_buf_trim(int node, size_t keep);
+extern int wd_buf_set_config(const struct wd_buf_config *cfg);
+extern int wd_buf_get_stats(int node, struct wd_buf_stats *st);
+
+#endif /* __WD_BUF_H */
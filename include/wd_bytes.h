@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_BYTES_H
+#define __WD_BYTES_H
+
+#include <stdint.h>
+
+/*
+ * Fields of gzip and zlib headers and trailers, and of seekable files, in
+ * little or big endian at any alignment, whatever the CPU is.
+ */
+
+static inline void put_le16(unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put_le32(unsigned char *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static inline void put_le64(unsigned char *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline uint16_t get_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static inline uint64_t get_le64(const unsigned char *p)
+{
+	return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+#endif /* __WD_BYTES_H */
@@ -2,23 +2,67 @@
 #ifndef __WD_COMP_H
 #define __WD_COMP_H
 
+#include <sys/uio.h>
+
 #include "config.h"
 #include "wd.h"
+#include "wd_poller.h"
 
 typedef void *wd_alg_comp_cb_t(void *cb_param);
 
+struct wd_comp_arg;
+typedef int wd_alg_comp_fallback_t(struct wd_comp_arg *arg, void *param);
+
 struct wd_alg_comp;
 
 #define MODE_STREAM		(1 << 0)
 #define MODE_INITED		(1 << 1)
+/* a block session runs on zlib of CPU if no accelerator is found */
+#define MODE_SW_FALLBACK	(1 << 2)
 
 #define FLAG_DEFLATE		(1 << 0)
 #define FLAG_INPUT_FINISH	(1 << 1)
+/* raw deflate data without the header and trailer of zlib or gzip */
+#define FLAG_RAW		(1 << 2)
 
 #define STATUS_OUT_READY	(1 << 0)	// data is ready in OUT buffer
 #define STATUS_OUT_DRAINED	(1 << 1)	// all data is drained out
 #define STATUS_IN_PART_USE	(1 << 2)
 #define STATUS_IN_EMPTY		(1 << 3)
+#define STATUS_FAILED		(1 << 4)	// the request fails
+
+/*
+ * A gzip member that has the size of its deflate data in FEXTRA, so members
+ * could be found without being inflated. The subfield ID is "Hi".
+ */
+#define WD_GZIP_MEMBER_HEAD	20
+
+/* what to do with a request that is going to miss its deadline */
+#define DEADLINE_RUN		0	/* run it on accelerator anyway */
+#define DEADLINE_REJECT		1	/* fail it with -ETIME */
+#define DEADLINE_FALLBACK	2	/* run it by the fallback, e.g. CPU */
+
+/* how requests are split between accelerator and CPU */
+struct wd_comp_stats {
+	uint64_t		hw_reqs;
+	uint64_t		hw_bytes;	/* input bytes */
+	uint64_t		cpu_reqs;
+	uint64_t		cpu_bytes;
+};
+
+/*
+ * Spill a block request to CPU if the accelerator is saturated, see
+ * wd_alg_comp_set_hybrid(). A threshold of 0 is ignored.
+ */
+struct wd_hybrid_cfg {
+	int			cpu_threads;	/* threads for async requests */
+	int			max_load;	/* percent of busy async slots */
+	uint64_t		max_ns_per_kb;	/* latency of accelerator */
+	size_t			max_block;	/* larger ones stay on hardware */
+	int			level;		/* zlib level, 0 for default */
+};
+
+struct wd_hybrid;
 
 struct wd_comp_sess {
 	char			*alg_name;	/* zlib or gzip */
@@ -27,8 +71,31 @@ struct wd_comp_sess {
 	struct wd_alg_comp	*drv;
 	uint32_t		mode;
 	void			*priv;
+	/* deadline handling, see wd_alg_comp_set_deadline() */
+	int			dl_policy;
+	wd_alg_comp_fallback_t	*fallback;
+	void			*fallback_param;
+	/* estimated cost of 1KB input, [0] to inflate and [1] to deflate */
+	uint64_t		ns_per_kb[2];
+	/* reap async completions in this thread, see wd_alg_comp_set_poller() */
+	struct wd_poller	*poller;
+	struct wd_hybrid	*hybrid;
+	struct wd_comp_stats	stats;
 };
 
+/*
+ * When a request in block mode is done, src and dst are moved past the
+ * consumed input and the output, src_len is the size of the consumed input
+ * with the header and the trailer, and dst_len is the size of the output.
+ * An inflate stops at the end of the first stream, and src_len tells where
+ * the data after it starts. The sizes are set on the completion of an async
+ * request too, but src and dst are kept.
+ *
+ * A gzip block of more than 1MB may be compressed by hisi_zip into several
+ * gzip members, which gunzip reads as one file. A block decompress inflates
+ * one member only, so such output is decompressed by
+ * wd_alg_decompress_members().
+ */
 struct wd_comp_arg {
 	void			*src;
 	size_t			src_len;
@@ -38,6 +105,7 @@ struct wd_comp_arg {
 	void			*cb_param;
 	uint32_t		flag;
 	uint32_t		status;
+	uint64_t		deadline;	/* ns of CLOCK_MONOTONIC, 0 for none */
 };
 
 struct wd_comp_strm {
@@ -53,6 +121,21 @@ struct wd_comp_strm {
 	size_t			total_out;
 };
 
+/*
+ * A request on scatter-gather lists, see wd_alg_compress_iov(). On return,
+ * src_len and dst_len are the bytes consumed from src and produced in dst.
+ */
+struct wd_comp_iov {
+	const struct iovec	*src;
+	int			src_num;
+	const struct iovec	*dst;
+	int			dst_num;
+	size_t			src_len;
+	size_t			dst_len;
+	uint32_t		flag;
+	uint32_t		status;
+};
+
 struct wd_alg_comp {
 	char	*drv_name;
 	char	*alg_name;
@@ -62,20 +145,71 @@ struct wd_alg_comp {
 	void	(*fini)(struct wd_comp_sess *sess);
 	int	(*deflate)(struct wd_comp_sess *sess, struct wd_comp_arg *arg);
 	int	(*inflate)(struct wd_comp_sess *sess, struct wd_comp_arg *arg);
-	int	(*async_poll)(struct wd_comp_sess *sess,
-			      struct wd_comp_arg *arg);
+	int	(*async_deflate)(struct wd_comp_sess *sess,
+				 struct wd_comp_arg *arg);
+	int	(*async_inflate)(struct wd_comp_sess *sess,
+				 struct wd_comp_arg *arg);
+	int	(*async_poll)(struct wd_comp_sess *sess, int budget);
+	/* percent of busy async slots */
+	int	(*load)(struct wd_comp_sess *sess, int deflate);
+	int	(*batch)(struct wd_comp_sess *sess, struct wd_comp_arg *args,
+			 int num);
 	int	(*strm_deflate)(struct wd_comp_sess *sess,
 				struct wd_comp_strm *strm);
 	int	(*strm_inflate)(struct wd_comp_sess *sess,
 				struct wd_comp_strm *strm);
+	/* block mode on segments, without them being gathered */
+	int	(*deflate_iov)(struct wd_comp_sess *sess,
+			       struct wd_comp_iov *iov);
+	int	(*inflate_iov)(struct wd_comp_sess *sess,
+			       struct wd_comp_iov *iov);
+};
+
+/*
+ * How wd_comp_split() sends chunks. send() queues up to num requests and
+ * returns the number queued, or a negative errno if none is queued. poll()
+ * reaps completions and returns the number of them, or a negative errno.
+ */
+struct wd_comp_split_ops {
+	int	(*send)(void *priv, struct wd_comp_arg **args, int num);
+	int	(*poll)(void *priv);
 };
 
+extern void *wd_comp_count_done(void *cb_param);
+extern void wd_comp_expire(struct wd_comp_sess *sess, struct wd_comp_arg *arg);
+extern int wd_comp_split(const struct wd_comp_split_ops *ops, void *priv,
+			 int inflight, int node, size_t chunk_size,
+			 struct wd_comp_arg *arg);
+
 extern handle_t wd_alg_comp_alloc_sess(char *alg_name, uint32_t mode,
 					wd_dev_mask_t *dev_mask);
 extern void wd_alg_comp_free_sess(handle_t handle);
+extern const char *wd_alg_comp_get_drv(handle_t handle);
+extern int wd_alg_comp_set_deadline(handle_t handle, int policy,
+				    wd_alg_comp_fallback_t *fallback,
+				    void *param);
 extern int wd_alg_compress(handle_t handle, struct wd_comp_arg *arg);
 extern int wd_alg_decompress(handle_t handle, struct wd_comp_arg *arg);
+extern int wd_alg_compress_async(handle_t handle, struct wd_comp_arg *arg);
+extern int wd_alg_decompress_async(handle_t handle, struct wd_comp_arg *arg);
+extern int wd_alg_compress_batch(handle_t handle, struct wd_comp_arg *args,
+				 int num);
+extern int wd_alg_decompress_batch(handle_t handle, struct wd_comp_arg *args,
+				   int num);
+extern int wd_alg_comp_poll(handle_t handle, int budget);
+extern int wd_alg_comp_set_poller(handle_t handle, struct wd_poller *poller);
+extern int wd_alg_comp_set_hybrid(handle_t handle, struct wd_hybrid_cfg *cfg);
+extern int wd_alg_comp_get_stats(handle_t handle, struct wd_comp_stats *stats);
 extern int wd_alg_strm_compress(handle_t handle, struct wd_comp_strm *strm);
 extern int wd_alg_strm_decompress(handle_t handle, struct wd_comp_strm *strm);
+extern int wd_alg_compress_iov(handle_t handle, struct wd_comp_iov *iov);
+extern int wd_alg_compress_members(handle_t *handles, int num,
+				   struct wd_comp_arg *arg, size_t chunk_size);
+extern int wd_alg_decompress_members(handle_t *handles, int num,
+				     struct wd_comp_arg *arg);
+extern void wd_gzip_put_member_head(void *buf, uint32_t deflate_len);
+extern int wd_gzip_head_len(const void *buf, size_t len,
+			    uint32_t *deflate_len);
+extern int wd_alg_decompress_iov(handle_t handle, struct wd_comp_iov *iov);
 
 #endif /* __WD_COMP_H */
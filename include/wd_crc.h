@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_CRC_H
+#define __WD_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32 of gzip and Adler-32 of zlib, computed by CPU. They take the same
+ * initial values and return the same results as crc32() and adler32() of
+ * zlib, 0 and 1 for empty data. Vector instructions are used if the CPU
+ * has them: CRC32 on x86 and ARMv8, Adler-32 on x86 only. Adler-32 has no
+ * NEON path on arm64 and runs the scalar loop there. A combine function
+ * returns the checksum of A followed by B from the checksums of A and B and
+ * the size of B.
+ */
+extern uint32_t wd_crc32(uint32_t crc, const void *buf, size_t len);
+extern uint32_t wd_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+extern uint32_t wd_adler32(uint32_t adler, const void *buf, size_t len);
+extern uint32_t wd_adler32_combine(uint32_t adler1, uint32_t adler2,
+				   uint64_t len2);
+
+#endif /* __WD_CRC_H */
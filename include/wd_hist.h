@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_HIST_H
+#define __WD_HIST_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Log-linear histogram in HDR style. Values below WD_HIST_SUB_NUM are
+ * counted exactly. Every power of two above is split into WD_HIST_SUB_NUM
+ * linear buckets, so the relative error of a bucket is below
+ * 1 / WD_HIST_SUB_NUM.
+ */
+#define WD_HIST_SUB_BITS	4
+#define WD_HIST_SUB_NUM		(1 << WD_HIST_SUB_BITS)
+#define WD_HIST_BUCKETS		((64 - WD_HIST_SUB_BITS + 1) * WD_HIST_SUB_NUM)
+
+struct wd_hist {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	bucket[WD_HIST_BUCKETS];
+};
+
+/* Read the free running counter. It's cheap enough for every request. */
+static inline uint64_t wd_get_cycles(void)
+{
+	uint64_t	cycles;
+
+#if defined(__aarch64__)
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r" (cycles) : : "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+	uint32_t	lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	cycles = ((uint64_t)hi << 32) | lo;
+#else
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	cycles = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+	return cycles;
+}
+
+static inline int wd_hist_index(uint64_t v)
+{
+	int	shift;
+
+	if (v < WD_HIST_SUB_NUM)
+		return (int)v;
+	shift = 63 - __builtin_clzll(v) - WD_HIST_SUB_BITS;
+	return ((shift + 1) << WD_HIST_SUB_BITS) +
+	       (int)(v >> shift) - WD_HIST_SUB_NUM;
+}
+
+static inline void wd_hist_add(struct wd_hist *h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->bucket[wd_hist_index(v)]++;
+}
+
+extern void wd_hist_reset(struct wd_hist *h);
+extern void wd_hist_merge(struct wd_hist *dst, const struct wd_hist *src);
+extern uint64_t wd_hist_percentile(const struct wd_hist *h, double pct);
+extern uint64_t wd_cycles_to_ns(uint64_t cycles);
+
+#endif
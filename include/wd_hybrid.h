@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_HYBRID_H
+#define __WD_HYBRID_H
+
+#include "wd_comp.h"
+
+/*
+ * Hybrid execution of block requests. When the accelerator of a session is
+ * saturated, independent blocks are compressed by zlib on CPU instead, in
+ * the caller's thread for sync requests, or in a pool of CPU threads for
+ * async requests. The output of both is in the same format.
+ */
+
+#define WD_HYBRID_QUEUE		256	/* async requests waiting for CPU */
+#define WD_HYBRID_PROBE		16	/* send 1 of them to hardware */
+
+static inline void wd_hybrid_count(struct wd_comp_sess *sess, int cpu,
+				   size_t len)
+{
+	struct wd_comp_stats	*stats = &sess->stats;
+
+	if (cpu) {
+		__atomic_add_fetch(&stats->cpu_reqs, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->cpu_bytes, len, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&stats->hw_reqs, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->hw_bytes, len, __ATOMIC_RELAXED);
+	}
+}
+
+extern struct wd_hybrid *wd_hybrid_create(struct wd_comp_sess *sess,
+					  struct wd_hybrid_cfg *cfg);
+extern void wd_hybrid_destroy(struct wd_hybrid *hy);
+extern int wd_hybrid_pick(struct wd_hybrid *hy, struct wd_comp_arg *arg,
+			  int async);
+extern int wd_hybrid_sync(struct wd_hybrid *hy, struct wd_comp_arg *arg);
+extern int wd_hybrid_submit(struct wd_hybrid *hy, struct wd_comp_arg *arg);
+
+#endif /* __WD_HYBRID_H */
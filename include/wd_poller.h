@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_POLLER_H
+#define __WD_POLLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wd.h"
+
+#define WD_CACHELINE_SIZE	64
+
+/*
+ * Single producer single consumer ring. The size is a power of two. Each
+ * side keeps its own index and a cached copy of the other side's index on
+ * its own cache line, so the lines only bounce when the cached copy is
+ * stale.
+ */
+struct wd_ring {
+	void		**slots;
+	uint32_t	mask;
+
+	/* consumer side */
+	uint32_t	head __attribute__((aligned(WD_CACHELINE_SIZE)));
+	uint32_t	tail_cache;
+
+	/* producer side */
+	uint32_t	tail __attribute__((aligned(WD_CACHELINE_SIZE)));
+	uint32_t	head_cache;
+} __attribute__((aligned(WD_CACHELINE_SIZE)));
+
+extern int wd_ring_init(struct wd_ring *ring, uint32_t size);
+extern void wd_ring_fini(struct wd_ring *ring);
+
+/* called by the producer */
+static inline bool wd_ring_full(struct wd_ring *ring)
+{
+	if (ring->tail - ring->head_cache <= ring->mask)
+		return false;
+	ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return ring->tail - ring->head_cache > ring->mask;
+}
+
+static inline int wd_ring_push(struct wd_ring *ring, void *p)
+{
+	uint32_t tail = ring->tail;
+
+	if (tail - ring->head_cache > ring->mask) {
+		ring->head_cache = __atomic_load_n(&ring->head,
+						   __ATOMIC_ACQUIRE);
+		if (tail - ring->head_cache > ring->mask)
+			return -EBUSY;
+	}
+	ring->slots[tail & ring->mask] = p;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static inline int wd_ring_pop(struct wd_ring *ring, void **p)
+{
+	uint32_t head = ring->head;
+
+	if (head == ring->tail_cache) {
+		ring->tail_cache = __atomic_load_n(&ring->tail,
+						   __ATOMIC_ACQUIRE);
+		if (head == ring->tail_cache)
+			return -EAGAIN;
+	}
+	*p = ring->slots[head & ring->mask];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * A submitter of a poller. Completions of the queues that are attached to
+ * the submitter are either pushed to its ring, to be taken by
+ * wd_poller_get() in the submitter's thread, or passed to complete() in the
+ * poller thread if it's set.
+ */
+struct wd_poller_sub {
+	struct wd_ring	ring;
+	void		(*complete)(void *resp, void *priv);
+	void		*priv;
+};
+
+struct wd_poller;
+
+extern struct wd_poller *wd_poller_create(int cpu, int idle_us);
+extern void wd_poller_destroy(struct wd_poller *poller);
+extern struct wd_poller_sub *wd_poller_sub_alloc(uint32_t ring_size,
+					void (*complete)(void *resp, void *priv),
+					void *priv);
+extern void wd_poller_sub_free(struct wd_poller_sub *sub);
+extern int wd_poller_add(struct wd_poller *poller, handle_t h_ctx,
+			 int (*recv)(handle_t h_ctx, void **resp),
+			 struct wd_poller_sub *sub);
+extern int wd_poller_del(struct wd_poller *poller, handle_t h_ctx);
+
+static inline int wd_poller_get(struct wd_poller_sub *sub, void **resp)
+{
+	return wd_ring_pop(&sub->ring, resp);
+}
+
+#endif /* __WD_POLLER_H */
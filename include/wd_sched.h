@@ -4,7 +4,10 @@
 #define __WD_SCHED_H__
 
 #include <stdbool.h>
+#include <time.h>
 #include "wd.h"
+#include "wd_hist.h"
+#include "wd_poller.h"
 
 struct wd_msg {
 	void *swap_in;
@@ -14,6 +17,35 @@ struct wd_msg {
 	void *msg;	/* the hw message frame */
 };
 
+/* a request waiting in an EDF queue */
+struct wd_sched_req {
+	uint64_t	deadline;	/* ns of CLOCK_MONOTONIC, 0 for none */
+	uint64_t	seq;		/* keep FIFO order on equal deadline */
+	void		*data;
+};
+
+/* min-heap of requests ordered by earliest deadline */
+struct wd_edf_queue {
+	struct wd_sched_req	*heap;
+	int	size;
+	int	num;
+	uint64_t	seq;
+};
+
+/* order of sched->output() calls */
+#define WD_SCHED_ORDERED	0	/* in submission order */
+#define WD_SCHED_UNORDERED	1	/* as soon as hardware completes */
+
+/* latency histograms, in cycles of wd_get_cycles() */
+#define WD_SCHED_LAT_QUEUE	0	/* from input() done to accepted by hw */
+#define WD_SCHED_LAT_HW		1	/* from accepted by hw to completion */
+#define WD_SCHED_LAT_REORDER	2	/* from completion to output() */
+#define WD_SCHED_LAT_OUTPUT	3	/* time spent in output() */
+#define WD_SCHED_LAT_NUM	4
+
+struct wd_sched_slot;
+struct wd_sched_tune;
+
 struct wd_scheduler {
 	handle_t *qs;
 	int q_num;
@@ -29,6 +61,8 @@ struct wd_scheduler {
 	int q_h, q_t;	/* queue head and tail index */
 	int cl;		/* cache left */
 
+	int order;	/* WD_SCHED_ORDERED or WD_SCHED_UNORDERED */
+
 	void (*init_cache)(struct wd_scheduler *sched, int i, void *priv);
 	int (*input)(struct wd_msg *msg, void *priv);
 	int (*output)(struct wd_msg *msg, void *priv);
@@ -49,15 +83,72 @@ struct wd_scheduler {
 	} *stat;
 
 	bool poll;
+
+	/*
+	 * Completion poller. If it's set, the queues are reaped by the poller
+	 * thread and wd_sched_work() takes the completions from psub. Queues
+	 * are attached to the poller on the first send, and detached in
+	 * wd_sched_fini(), which must be called before the queues are freed.
+	 */
+	struct wd_poller *poller;
+	struct wd_poller_sub *psub;
+	bool polled;
+
+	/* set before wd_sched_init() to record latency histograms */
+	bool lat_stat;
+	struct wd_hist *hist;	/* [q_num][WD_SCHED_LAT_NUM] */
+
+	/*
+	 * In-flight window. If auto_win is set before wd_sched_init(), at most
+	 * win messages are in flight, and win is tuned at runtime between 1
+	 * and msg_cache_num by hill climbing on bytes per second. msg_len()
+	 * gives the bytes of a completed message before output(), a message
+	 * counts as msg_data_size without it. If win_lat is set, win backs
+	 * off while the mean latency is above it. Read win for the current
+	 * choice.
+	 */
+	bool auto_win;
+	int win;
+	uint64_t win_lat;	/* latency target in ns, 0 for none */
+	size_t (*msg_len)(struct wd_msg *msg, void *priv);
+	struct wd_sched_tune *tune;
+
+	/* reorder buffer, maintained by wd_sched only */
+	struct wd_sched_slot *slots;
+	int *q_pend;	/* messages in flight on each queue */
+	int q_p;	/* next queue to poll */
+	int *free_slots;	/* free cache slots in WD_SCHED_UNORDERED */
+	int f_h, f_t;
 };
 
 extern int wd_sched_init(struct wd_scheduler *sched, char *node_path);
 extern void wd_sched_fini(struct wd_scheduler *sched);
 extern int wd_sched_work(struct wd_scheduler *sched, unsigned long have_input);
+extern int wd_sched_get_hist(struct wd_scheduler *sched, int q, int type,
+			     struct wd_hist *snap);
+extern void wd_sched_reset_hist(struct wd_scheduler *sched);
+
+extern int wd_edf_init(struct wd_edf_queue *q, int size);
+extern void wd_edf_fini(struct wd_edf_queue *q);
+extern int wd_edf_push(struct wd_edf_queue *q, void *data, uint64_t deadline);
+extern int wd_edf_pop(struct wd_edf_queue *q, struct wd_sched_req *req);
+extern int wd_edf_expire(struct wd_edf_queue *q, uint64_t due,
+			 struct wd_sched_req *req);
+extern int wd_edf_requeue(struct wd_edf_queue *q,
+			  const struct wd_sched_req *req);
 
 static inline bool wd_sched_empty(struct wd_scheduler *sched)
 {
 	return sched->cl == sched->msg_cache_num;
 }
 
+/* the clock of deadlines */
+static inline uint64_t wd_sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #endif
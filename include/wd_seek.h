@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_SEEK_H
+#define __WD_SEEK_H
+
+#include <sys/types.h>
+
+#include "wd_comp.h"
+
+/*
+ * A seekable gzip file. The input is cut into chunks of the same size, and
+ * each chunk is compressed into a gzip member. An index of the member sizes
+ * and a footer of fixed size are kept in empty members at the end, so a
+ * reader finds the members that cover a range and decompresses only them.
+ * The file is still read by gunzip.
+ */
+
+#define WD_SEEK_CHUNK		(64 << 10)	/* the default chunk size */
+#define WD_SEEK_FOOTER		50		/* the last member */
+
+extern handle_t wd_seek_writer_create(handle_t h_sess, int fd,
+				      size_t chunk_size);
+extern int wd_seek_write(handle_t writer, const void *buf, size_t len);
+extern int wd_seek_writer_close(handle_t writer);
+
+extern handle_t wd_seek_reader_open(handle_t h_sess, int fd);
+extern void wd_seek_reader_close(handle_t reader);
+extern uint64_t wd_seek_size(handle_t reader);
+extern ssize_t wd_seek_read(handle_t reader, void *buf, size_t len,
+			    uint64_t off);
+
+#endif /* __WD_SEEK_H */
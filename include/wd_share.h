@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_SHARE_H
+#define __WD_SHARE_H
+
+#include "wd_comp.h"
+
+/*
+ * A share pool multiplexes the block mode requests of many tenants onto a
+ * bounded set of accelerator sessions. Requests wait in per tenant queues
+ * and are granted an idle session by deficit round robin on input bytes, so
+ * each busy tenant gets a share of the accelerator in proportion to its
+ * weight.
+ */
+
+#define WD_SHARE_QUANTUM	(64 << 10)	/* bytes per round of weight 1 */
+
+extern handle_t wd_share_pool_create(char *alg_name, int max_instn,
+				     wd_dev_mask_t *dev_mask);
+extern void wd_share_pool_destroy(handle_t pool);
+extern handle_t wd_share_attach(handle_t pool, int weight, int max_inflight);
+extern void wd_share_detach(handle_t tenant);
+extern int wd_share_set_weight(handle_t tenant, int weight, int max_inflight);
+extern int wd_share_compress(handle_t tenant, struct wd_comp_arg *arg);
+extern int wd_share_decompress(handle_t tenant, struct wd_comp_arg *arg);
+
+#endif /* __WD_SHARE_H */
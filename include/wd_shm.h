@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_SHM_H
+#define __WD_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bmm.h"
+
+/*
+ * A buffer pool in a memfd that is shared by processes. A process creates
+ * it and passes its fd to others, e.g. by SCM_RIGHTS on a unix socket.
+ * Buffers are named by their offsets in the pool, since each process maps
+ * the pool at its own address. A buffer has a reference count, and it's
+ * freed when the last reference is put. 0 is never a valid offset.
+ */
+struct wd_shm;
+
+extern struct wd_shm *wd_shm_create(const char *name, size_t size,
+				    unsigned int block_size);
+extern struct wd_shm *wd_shm_attach(int fd);
+extern void wd_shm_close(struct wd_shm *shm);
+extern int wd_shm_fd(struct wd_shm *shm);
+extern uint64_t wd_shm_alloc(struct wd_shm *shm, size_t size);
+extern int wd_shm_get(struct wd_shm *shm, uint64_t off);
+extern int wd_shm_put(struct wd_shm *shm, uint64_t off);
+extern void *wd_shm_ptr(struct wd_shm *shm, uint64_t off);
+extern uint64_t wd_shm_off(struct wd_shm *shm, void *ptr);
+extern int wd_shm_get_stats(struct wd_shm *shm, struct bmm_stats *st);
+
+#endif /* __WD_SHM_H */
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#ifndef __WD_SLAB_H
+#define __WD_SLAB_H
+
+#include <stddef.h>
+#include "bmm.h"
+
+#define WD_SLAB_MAX_CLASS	8
+
+/* a size class of a slab, the classes are given in ascending size */
+struct wd_slab_class {
+	size_t		size;	/* object size */
+	size_t		align;	/* 0 for cache line */
+	unsigned int	num;	/* objects in the class */
+};
+
+/*
+ * A slab carves fixed size objects of several classes out of one region,
+ * each class is a bmm pool in its own part of the region. It's safe to
+ * allocate and free from multiple threads.
+ */
+struct wd_slab;
+
+extern size_t wd_slab_region_size(const struct wd_slab_class *cls, int num);
+extern struct wd_slab *wd_slab_create(void *region, size_t size,
+				      const struct wd_slab_class *cls,
+				      int num);
+extern struct wd_slab *wd_slab_create_node(const struct wd_slab_class *cls,
+					   int num, int node);
+extern void wd_slab_destroy(struct wd_slab *slab);
+extern void *wd_slab_alloc(struct wd_slab *slab, size_t size);
+extern void wd_slab_free(struct wd_slab *slab, void *obj);
+extern int wd_slab_owns(struct wd_slab *slab, void *obj);
+extern int wd_slab_prefault(struct wd_slab *slab, size_t size, int num);
+extern size_t wd_slab_trim(struct wd_slab *slab, size_t keep);
+/* block_size, largest_free and frag aren't summed up for a slab */
+extern int wd_slab_get_stats(struct wd_slab *slab, struct bmm_stats *st);
+
+#endif /* __WD_SLAB_H */
@@ -57,7 +57,8 @@ enum wd_comp_flush {
 #define STREAM_FLUSH_SHIFT	25
 
 enum alg_type {
-	HW_ZLIB  = 0x02,
+	HW_RAW_DEFLATE = 0x01,
+	HW_ZLIB,
 	HW_GZIP,
 };
 enum hw_comp_op {
@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "bmm.h"
+#include "mcache.h"
+#include "smm.h"
+#include "wd.h"
+
+/*
+ * The magazine of a thread holds up to twice of batch objects, so a thread
+ * that allocates and frees in turn at the edge of a batch doesn't go to the
+ * pool every time.
+ */
+struct mcache_mag {
+	struct mcache		*mc;
+	int			num;
+	struct mcache_mag	*prev;
+	struct mcache_mag	*next;
+	void			*objs[];
+};
+
+struct mcache {
+	void			*pool;
+	size_t			obj_size;
+	int			batch;
+	void			*(*alloc)(void *pool, size_t size);
+	void			(*free)(void *pool, void *obj);
+	pthread_key_t		key;
+	/* protect the pool and the magazine list */
+	pthread_mutex_t		lock;
+	struct mcache_mag	*mags;
+};
+
+/* give the objects from objs[start] to objs[start + n - 1] back to the pool */
+static void __flush(struct mcache_mag *mag, int start, int n)
+{
+	struct mcache *mc = mag->mc;
+	int i;
+
+	pthread_mutex_lock(&mc->lock);
+	for (i = start; i < start + n; i++)
+		mc->free(mc->pool, mag->objs[i]);
+	pthread_mutex_unlock(&mc->lock);
+	mag->num -= n;
+	if (start < mag->num)
+		memmove(&mag->objs[start], &mag->objs[start + n],
+			(mag->num - start) * sizeof(void *));
+}
+
+static void __refill(struct mcache_mag *mag)
+{
+	struct mcache *mc = mag->mc;
+	void *obj;
+	int i;
+
+	pthread_mutex_lock(&mc->lock);
+	for (i = 0; i < mc->batch; i++) {
+		obj = mc->alloc(mc->pool, mc->obj_size);
+		if (!obj)
+			break;
+		mag->objs[mag->num++] = obj;
+	}
+	pthread_mutex_unlock(&mc->lock);
+}
+
+/* called on thread exit with the magazine of the thread */
+static void __mag_release(void *data)
+{
+	struct mcache_mag *mag = data;
+	struct mcache *mc = mag->mc;
+
+	__flush(mag, 0, mag->num);
+	pthread_mutex_lock(&mc->lock);
+	if (mag->prev)
+		mag->prev->next = mag->next;
+	else
+		mc->mags = mag->next;
+	if (mag->next)
+		mag->next->prev = mag->prev;
+	pthread_mutex_unlock(&mc->lock);
+	free(mag);
+}
+
+static struct mcache_mag *__get_mag(struct mcache *mc)
+{
+	struct mcache_mag *mag;
+
+	mag = pthread_getspecific(mc->key);
+	if (mag)
+		return mag;
+
+	mag = calloc(1, sizeof(*mag) + 2 * mc->batch * sizeof(void *));
+	if (!mag)
+		return NULL;
+	mag->mc = mc;
+	if (pthread_setspecific(mc->key, mag)) {
+		free(mag);
+		return NULL;
+	}
+	pthread_mutex_lock(&mc->lock);
+	mag->next = mc->mags;
+	if (mc->mags)
+		mc->mags->prev = mag;
+	mc->mags = mag;
+	pthread_mutex_unlock(&mc->lock);
+	return mag;
+}
+
+/*
+ * Create a cache of obj_size objects over pool. alloc_fn() and free_fn() are
+ * only called with the cache locked, so the pool needn't be thread safe as long
+ * as it's only used through the cache. batch is the number of objects moved
+ * between a thread and the pool at a time, MCACHE_BATCH_DEFAULT if it's 0.
+ */
+struct mcache *mcache_create(void *pool, size_t obj_size, int batch,
+			     void *(*alloc_fn)(void *pool, size_t size),
+			     void (*free_fn)(void *pool, void *obj))
+{
+	struct mcache *mc;
+
+	if (!pool || !alloc_fn || !free_fn || batch < 0 ||
+	    batch > MCACHE_BATCH_MAX)
+		return NULL;
+
+	mc = calloc(1, sizeof(*mc));
+	if (!mc)
+		return NULL;
+	mc->pool = pool;
+	mc->obj_size = obj_size;
+	mc->batch = batch ? batch : MCACHE_BATCH_DEFAULT;
+	mc->alloc = alloc_fn;
+	mc->free = free_fn;
+	if (pthread_key_create(&mc->key, __mag_release)) {
+		WD_ERR("fail to create the key of mcache\n");
+		free(mc);
+		return NULL;
+	}
+	pthread_mutex_init(&mc->lock, NULL);
+	return mc;
+}
+
+struct mcache *mcache_create_smm(void *pt_addr, size_t obj_size, int batch)
+{
+	return mcache_create(pt_addr, obj_size, batch, smm_alloc, smm_free);
+}
+
+static void *__bmm_alloc(void *pool, size_t size)
+{
+	return bmm_alloc(pool);
+}
+
+/* the objects are the blocks of the pool */
+struct mcache *mcache_create_bmm(void *pool, int batch)
+{
+	return mcache_create(pool, 0, batch, __bmm_alloc, bmm_free);
+}
+
+/*
+ * Give all cached objects back to the pool. The cache mustn't be in use,
+ * and no thread that used it may be exiting at the same time.
+ */
+void mcache_destroy(struct mcache *mc)
+{
+	struct mcache_mag *mag, *next;
+	int i;
+
+	if (!mc)
+		return;
+
+	pthread_key_delete(mc->key);
+	pthread_mutex_lock(&mc->lock);
+	for (mag = mc->mags; mag; mag = next) {
+		next = mag->next;
+		for (i = 0; i < mag->num; i++)
+			mc->free(mc->pool, mag->objs[i]);
+		free(mag);
+	}
+	mc->mags = NULL;
+	pthread_mutex_unlock(&mc->lock);
+	pthread_mutex_destroy(&mc->lock);
+	free(mc);
+}
+
+void *mcache_alloc(struct mcache *mc)
+{
+	struct mcache_mag *mag;
+	void *obj;
+
+	mag = __get_mag(mc);
+	if (!mag) {
+		pthread_mutex_lock(&mc->lock);
+		obj = mc->alloc(mc->pool, mc->obj_size);
+		pthread_mutex_unlock(&mc->lock);
+		return obj;
+	}
+	if (!mag->num)
+		__refill(mag);
+	if (!mag->num)
+		return NULL;
+	return mag->objs[--mag->num];
+}
+
+void mcache_free(struct mcache *mc, void *obj)
+{
+	struct mcache_mag *mag;
+
+	if (!obj)
+		return;
+
+	mag = __get_mag(mc);
+	if (!mag) {
+		pthread_mutex_lock(&mc->lock);
+		mc->free(mc->pool, obj);
+		pthread_mutex_unlock(&mc->lock);
+		return;
+	}
+	/* the oldest objects are the coldest, give them back first */
+	if (mag->num == 2 * mc->batch)
+		__flush(mag, 0, mc->batch);
+	mag->objs[mag->num++] = obj;
+}
+
+/* give the objects cached by the calling thread back to the pool */
+void mcache_drain(struct mcache *mc)
+{
+	struct mcache_mag *mag;
+
+	mag = pthread_getspecific(mc->key);
+	if (mag && mag->num)
+		__flush(mag, 0, mag->num);
+}
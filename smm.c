@@ -1,34 +1,413 @@
 /* SPDX-License-Identifier: Apache-2.0 */
-/* Simple Memory Memory (lib): A simple first fit memory algorithm */
+/*
+ * Simple Memory Management (lib): segregated size classes over a buddy
+ * allocator.
+ *
+ * The managed region is cut into units. Free units are kept in power of two
+ * blocks of the buddy allocator. A large block takes just the units it needs
+ * from a run of free blocks, so blocks that aren't power of two units are
+ * packed as tightly as the callers size the region. Small ones come from
+ * slabs of one unit with a bitmap of free objects. All metadata is kept out of the region, only a
+ * head that points to it is at the start of the region, so the region stays
+ * dense for the device.
+ */
 
-#include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "smm.h"
+#include "wd.h"
+
+#define SMM_HEAD_TAG		0xE5E5
+
+#define SMM_UNIT		4096
+#define SMM_MAX_ORDER		31	/* units are indexed by int32_t */
+#define SMM_MIN_OBJ		16
+#define SMM_CLASSES		8	/* 16 to 2048 bytes */
+#define SMM_SLAB_WORDS		(SMM_UNIT / SMM_MIN_OBJ / 64)
+
+#define SMM_NONE		(-1)
+
+/* state of a unit */
+#define SMM_U_TAIL		0	/* inside a block */
+#define SMM_U_FREE		1	/* head of a free block */
+#define SMM_U_USED		2	/* head of an allocated block */
+#define SMM_U_SLAB		3
+
+struct smm_unit {
+	/* free list of the buddy order, or partial list of the slab class */
+	int32_t		prev;
+	int32_t		next;
+	uint8_t		state;
+	uint8_t		order;
+	uint8_t		cls;
+	uint16_t	nfree;
+	/*
+	 * units of an allocated large block, or the head of a free block in
+	 * the last unit of it
+	 */
+	int32_t		len;
+	uint64_t	bitmap[SMM_SLAB_WORDS];	/* set for free objects */
+};
 
-#define SMM_HEAD_TAG 0xE5E5
-#define SMMB_HEAD_FREE_TAG 0x5E5E
-#define SMMB_HEAD_ALLOCED_TAG 0xAAAA
-
-/* todo: free block need not to be the same as allocated block */
-struct smmb_head {
-	int tag;
-	size_t size;
-	struct smmb_head *next;
+struct smm_pool {
+	void		*base;
+	size_t		unit;
+	int32_t		nunits;
+	int		flags;
+	pthread_mutex_t	lock;
+	int		min_cls;
+	uint64_t	free_mask;	/* set for orders with free blocks */
+	int32_t		free_head[SMM_MAX_ORDER];
+	/*
+	 * Where __run_alloc() starts to search for blocks of the order. No
+	 * run of free blocks that is longer than half of the order starts
+	 * before it.
+	 */
+	int32_t		run_from[SMM_MAX_ORDER];
+	int32_t		partial[SMM_CLASSES];
+	struct smm_unit	*units;
+	/*
+	 * Statistics are written with the pool locked, and read by
+	 * smm_get_stats() without the lock.
+	 */
+	size_t		used;		/* bytes of blocks and objects */
+	size_t		peak;
+	int32_t		free_units;	/* units in the free lists */
+	uint64_t	fails;
 };
 
-/* todo: make alignment */
 struct smm_head {
-	int tag;
-	int align_mask;
-	struct smmb_head *freelist;
+	int		tag;
+	struct smm_pool	*pool;
 };
 
-static size_t __aligned_size(size_t sz, int align_mask)
+/* only the writer holds the pool, readers may load it at any time */
+#define STAT_SET(var, val)	__atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define STAT_GET(var)		__atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+static inline struct smm_pool *__get_pool(void *pt_addr)
+{
+	struct smm_head *h = pt_addr;
+
+	if (!h || h->tag != SMM_HEAD_TAG)
+		return NULL;
+	return h->pool;
+}
+
+static inline void __lock(struct smm_pool *p)
+{
+	if (p->flags & SMM_THREAD_SAFE)
+		pthread_mutex_lock(&p->lock);
+}
+
+static inline void __unlock(struct smm_pool *p)
+{
+	if (p->flags & SMM_THREAD_SAFE)
+		pthread_mutex_unlock(&p->lock);
+}
+
+/* smallest order with (1 << order) >= n */
+static inline int __order(size_t n)
+{
+	return n <= 1 ? 0 : 64 - __builtin_clzl(n - 1);
+}
+
+static void __list_add(struct smm_pool *p, int32_t *head, int32_t i)
+{
+	struct smm_unit *u = &p->units[i];
+
+	u->prev = SMM_NONE;
+	u->next = *head;
+	if (*head != SMM_NONE)
+		p->units[*head].prev = i;
+	*head = i;
+}
+
+static void __list_del(struct smm_pool *p, int32_t *head, int32_t i)
+{
+	struct smm_unit *u = &p->units[i];
+
+	if (u->prev != SMM_NONE)
+		p->units[u->prev].next = u->next;
+	else
+		*head = u->next;
+	if (u->next != SMM_NONE)
+		p->units[u->next].prev = u->prev;
+}
+
+static void __free_add(struct smm_pool *p, int32_t i, int order)
+{
+	p->units[i].state = SMM_U_FREE;
+	p->units[i].order = order;
+	p->units[i + (1 << order) - 1].len = i;
+	__list_add(p, &p->free_head[order], i);
+	STAT_SET(p->free_mask, p->free_mask | (1ULL << order));
+	STAT_SET(p->free_units, p->free_units + (1 << order));
+}
+
+static void __free_del(struct smm_pool *p, int32_t i)
+{
+	int order = p->units[i].order;
+
+	__list_del(p, &p->free_head[order], i);
+	if (p->free_head[order] == SMM_NONE)
+		STAT_SET(p->free_mask, p->free_mask & ~(1ULL << order));
+	STAT_SET(p->free_units, p->free_units - (1 << order));
+}
+
+/* units from i to i + n - 1 are taken, move the search starts past them */
+static void __run_skip(struct smm_pool *p, int32_t i, int32_t n)
+{
+	int o;
+
+	for (o = 0; o < SMM_MAX_ORDER; o++) {
+		if (p->run_from[o] > i && p->run_from[o] < i + n)
+			p->run_from[o] = i + n;
+	}
+}
+
+/* the head of the free block that ends at unit i - 1, or SMM_NONE */
+static int32_t __free_before(struct smm_pool *p, int32_t i)
+{
+	struct smm_unit *u;
+	int32_t h;
+
+	if (!i)
+		return SMM_NONE;
+	u = &p->units[i - 1];
+	/* len of the last unit is only valid in a free block, check it */
+	h = u->state == SMM_U_TAIL ? u->len : i - 1;
+	if (h < 0 || h >= i || p->units[h].state != SMM_U_FREE ||
+	    h + (1 << p->units[h].order) != i)
+		return SMM_NONE;
+	return h;
+}
+
+/*
+ * Unit i is given back and merged into a free block, searches start from the
+ * run of the block at most.
+ */
+static void __run_freed(struct smm_pool *p, int32_t i)
+{
+	int32_t h;
+	int o;
+
+	for (o = 0; o < SMM_MAX_ORDER; o++) {
+		h = i & ~((1 << o) - 1);
+		if (p->units[h].state == SMM_U_FREE && p->units[h].order == o)
+			break;
+	}
+	i = h;
+	while ((h = __free_before(p, i)) != SMM_NONE)
+		i = h;
+	for (o = 0; o < SMM_MAX_ORDER; o++) {
+		if (p->run_from[o] > i)
+			p->run_from[o] = i;
+	}
+}
+
+static int32_t __buddy_alloc(struct smm_pool *p, int order)
+{
+	uint64_t m;
+	int32_t i;
+	int o;
+
+	if (order >= SMM_MAX_ORDER)
+		return SMM_NONE;
+	m = p->free_mask >> order;
+	if (!m)
+		return SMM_NONE;
+	o = order + __builtin_ctzl(m);
+	i = p->free_head[o];
+	__free_del(p, i);
+	/* give back the upper halves */
+	while (o > order) {
+		o--;
+		__free_add(p, i + (1 << o), o);
+	}
+	p->units[i].state = SMM_U_USED;
+	p->units[i].order = order;
+	__run_skip(p, i, 1 << order);
+	return i;
+}
+
+static void __buddy_free(struct smm_pool *p, int32_t i)
+{
+	int o = p->units[i].order;
+	int32_t b;
+
+	while (o < SMM_MAX_ORDER - 1) {
+		b = i ^ (1 << o);
+		if (b + (1 << o) > p->nunits ||
+		    p->units[b].state != SMM_U_FREE || p->units[b].order != o)
+			break;
+		__free_del(p, b);
+		p->units[b].state = SMM_U_TAIL;
+		p->units[i].state = SMM_U_TAIL;
+		if (b < i)
+			i = b;
+		o++;
+	}
+	__free_add(p, i, o);
+}
+
+/* give back n units from i, cut into the largest aligned blocks */
+static void __free_range(struct smm_pool *p, int32_t i, int32_t n)
+{
+	int o;
+
+	while (n > 0) {
+		o = i ? __builtin_ctz(i) : SMM_MAX_ORDER - 1;
+		while ((1L << o) > n)
+			o--;
+		p->units[i].order = o;
+		__buddy_free(p, i);
+		i += 1 << o;
+		n -= 1 << o;
+	}
+}
+
+/* units from the head unit i to the next head */
+static inline int32_t __span(struct smm_pool *p, int32_t i)
+{
+	struct smm_unit *u = &p->units[i];
+
+	if (u->state == SMM_U_FREE)
+		return 1 << u->order;
+	if (u->state == SMM_U_USED)
+		return u->len;
+	return 1;
+}
+
+/*
+ * Take the first run of adjacent free blocks that has n units, and give back
+ * the rest of the run. Blocks are packed from the start of the region as the
+ * first-fit allocator did, so a region sized for its blocks holds all of
+ * them. The search starts from run_from of the order of n, and leaves it at
+ * the first run that a later block of the order may fit in.
+ */
+static int32_t __run_alloc(struct smm_pool *p, int32_t n)
+{
+	int32_t i, j, len, first = SMM_NONE;
+	int order = __order(n);
+	/* the smallest block of the order */
+	int32_t min = order ? (1 << (order - 1)) + 1 : 1;
+
+	for (i = p->run_from[order]; i < p->nunits; i = j) {
+		if (p->units[i].state != SMM_U_FREE) {
+			j = i + __span(p, i);
+			continue;
+		}
+		for (j = i, len = 0; len < n && j < p->nunits &&
+		     p->units[j].state == SMM_U_FREE; j += 1 << p->units[j].order)
+			len += 1 << p->units[j].order;
+		if (len < n) {
+			if (len >= min && first == SMM_NONE)
+				first = i;
+			continue;
+		}
+		for (j = i; j < i + len; j += 1 << p->units[j].order) {
+			__free_del(p, j);
+			p->units[j].state = SMM_U_TAIL;
+		}
+		/* the rest may merge with free blocks past the run */
+		if (len > n) {
+			__free_range(p, i + n, len - n);
+			__run_freed(p, i + n);
+		}
+		__run_skip(p, i, n);
+		p->run_from[order] = first != SMM_NONE ? first : i + n;
+		return i;
+	}
+	p->run_from[order] = first != SMM_NONE ? first : p->nunits;
+	return SMM_NONE;
+}
+
+/*
+ * Allocate n units in one block. A power of two block comes from the buddy
+ * lists at once, others are cut from a run of free blocks.
+ */
+static int32_t __large_alloc(struct smm_pool *p, int32_t n)
+{
+	int32_t i = SMM_NONE;
+
+	if (!(n & (n - 1)))
+		i = __buddy_alloc(p, __order(n));
+	if (i == SMM_NONE)
+		i = __run_alloc(p, n);
+	if (i == SMM_NONE)
+		return SMM_NONE;
+	p->units[i].state = SMM_U_USED;
+	p->units[i].len = n;
+	return i;
+}
+
+static inline size_t __obj_size(int cls)
 {
-	//printf("__aligned_size: %lx, %x, %x\n", sz, align_mask, ~align_mask);
-	return (sz + align_mask) & ~align_mask;
+	return SMM_MIN_OBJ << cls;
+}
+
+static void *__slab_alloc(struct smm_pool *p, int cls)
+{
+	struct smm_unit *u;
+	int32_t i = p->partial[cls];
+	int w, bit, n;
+
+	if (i == SMM_NONE) {
+		i = __buddy_alloc(p, 0);
+		if (i == SMM_NONE)
+			return NULL;
+		u = &p->units[i];
+		u->state = SMM_U_SLAB;
+		u->cls = cls;
+		n = p->unit / __obj_size(cls);
+		u->nfree = n;
+		memset(u->bitmap, 0, sizeof(u->bitmap));
+		for (w = 0; w < n / 64; w++)
+			u->bitmap[w] = ~0ULL;
+		if (n % 64)
+			u->bitmap[w] = (1ULL << (n % 64)) - 1;
+		__list_add(p, &p->partial[cls], i);
+	}
+
+	u = &p->units[i];
+	for (w = 0; !u->bitmap[w]; w++)
+		;
+	bit = __builtin_ctzl(u->bitmap[w]);
+	u->bitmap[w] &= ~(1ULL << bit);
+	if (!--u->nfree)
+		__list_del(p, &p->partial[cls], i);
+	return p->base + i * p->unit + (w * 64 + bit) * __obj_size(cls);
+}
+
+static int __slab_free(struct smm_pool *p, int32_t i, size_t off)
+{
+	struct smm_unit *u = &p->units[i];
+	size_t obj = __obj_size(u->cls);
+	int n = p->unit / obj;
+	int bit;
+
+	if (off % obj)
+		return -EINVAL;
+	bit = off / obj;
+	if (u->bitmap[bit / 64] & (1ULL << (bit % 64)))
+		return -EINVAL;
+
+	u->bitmap[bit / 64] |= 1ULL << (bit % 64);
+	if (++u->nfree == 1)
+		__list_add(p, &p->partial[u->cls], i);
+	if (u->nfree == n) {
+		/* the slab is empty, give the unit back */
+		__list_del(p, &p->partial[u->cls], i);
+		u->state = SMM_U_USED;
+		u->order = 0;
+		__buddy_free(p, i);
+		__run_freed(p, i);
+	}
+	return 0;
 }
 
 /**
@@ -36,161 +415,309 @@ static size_t __aligned_size(size_t sz, int align_mask)
  *
  * @pt_addr the first address of the managed memory region
  * @size size of the region
- * @align_mask mask for address mask, 
+ * @align_mask mask for address mask,
  *             e.g. 0xFFF for aligning the memory block to 4K boundary
+ * @flags SMM_THREAD_SAFE to lock it for calls from many threads
+ *
+ * The first unit of the region is taken by the head. The metadata is
+ * allocated out of the region, it's freed by smm_fini().
  */
-int smm_init(void *pt_addr, size_t size, int align_mask)
+int smm_init_ex(void *pt_addr, size_t size, int align_mask, int flags)
 {
 	struct smm_head *h = pt_addr;
-	struct smmb_head *bh;
-	size_t hs = __aligned_size(sizeof(*h), align_mask);
-	size_t bs = __aligned_size(sizeof(*bh), align_mask);
+	struct smm_pool *p;
+	uintptr_t start, end;
+	size_t unit = SMM_UNIT;
+	int32_t i;
+	int o;
+
+	if (!pt_addr || align_mask < 0 || (align_mask & (align_mask + 1)))
+		return -EINVAL;
+	if ((size_t)align_mask + 1 > unit)
+		unit = align_mask + 1;
+
+	start = ((uintptr_t)pt_addr + sizeof(*h) + unit - 1) & ~(unit - 1);
+	end = (uintptr_t)pt_addr + size;
+	if (end < start + unit)
+		return -ENOMEM;
 
-	if (size < hs + bs)
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	p->base = (void *)start;
+	p->unit = unit;
+	p->nunits = (end - start) / unit;
+	p->flags = flags;
+	p->units = calloc(p->nunits, sizeof(*p->units));
+	if (!p->units) {
+		free(p);
 		return -ENOMEM;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	for (o = 0; o < SMM_MAX_ORDER; o++)
+		p->free_head[o] = SMM_NONE;
+	for (o = 0; o < SMM_CLASSES; o++)
+		p->partial[o] = SMM_NONE;
+	for (p->min_cls = 0; p->min_cls < SMM_CLASSES; p->min_cls++) {
+		if (__obj_size(p->min_cls) > (size_t)align_mask)
+			break;
+	}
+
+	/* cut the units into the largest aligned blocks */
+	for (i = 0; i < p->nunits; i += 1 << o) {
+		o = i ? __builtin_ctz(i) : SMM_MAX_ORDER - 1;
+		while (i + (1L << o) > p->nunits)
+			o--;
+		__free_add(p, i, o);
+	}
 
 	h->tag = SMM_HEAD_TAG;
-	h->align_mask = align_mask;
-	bh = h->freelist = pt_addr + hs;
-	bh->tag = SMMB_HEAD_FREE_TAG;
-	bh->next = NULL;
-	bh->size = size - hs;
-	
+	h->pool = p;
 	return 0;
 }
 
-void *smm_alloc(void *pt_addr, size_t size)
+int smm_init(void *pt_addr, size_t size, int align_mask)
 {
-	struct smm_head *h = pt_addr;
-	struct smmb_head **bhp = &h->freelist;
-	struct smmb_head *bh_new, *bh = h->freelist;
-	size_t sz = __aligned_size(size + sizeof(*bh), h->align_mask);
-	//printf("alloc 0x%lx for 0x%lx\n", sz, size);
-
-	assert(h->tag == SMM_HEAD_TAG);
-
-	while (bh) {
-		assert(bh->tag == SMMB_HEAD_FREE_TAG);
-
-		//printf("alloc try block(%p, %ld) for %ld\n", bh, bh->size, sz);
-		if (bh->size >= sz) {
-			/* gotcha */
-
-			if (bh->size < sz + sizeof(*bh)) {
-				//printf("use the whole block\n");
-				*bhp = bh->next;
-			} else {
-				bh_new = (void *)bh + sz;
-				bh_new->tag = SMMB_HEAD_FREE_TAG;
-				bh_new->size = bh->size - sz;
-				bh_new->next = bh->next;
-				*bhp = bh_new;
-				bh->size = sz;
-				//printf("split block, new block %p(%ld)\n",
-				//       bh_new, bh_new->size);
-			}
-
-			bh->tag = SMMB_HEAD_ALLOCED_TAG;
-			return bh + 1;
-		}
+	return smm_init_ex(pt_addr, size, align_mask, 0);
+}
 
-		bhp = &(bh->next);
-		bh = bh->next;
-	}
+void smm_fini(void *pt_addr)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
 
-	return NULL;
+	if (!p)
+		return;
+	((struct smm_head *)pt_addr)->tag = 0;
+	pthread_mutex_destroy(&p->lock);
+	free(p->units);
+	free(p);
 }
 
-static inline _Bool __merge_free_block(struct smmb_head *h1,
-				      struct smmb_head *h2)
+static void __account(struct smm_pool *p, void *ptr, size_t size)
 {
-	if ((void *)h1 + h1->size == h2) {
-		//printf("merge %p, %p\n", h1, h2);
-		h1->size += h2->size;
-		h1->next = h2->next;
-		return true;
+	if (!ptr) {
+		STAT_SET(p->fails, p->fails + 1);
+		return;
 	}
-
-	//printf("nomerge %p, %p\n", h1, h2);
-	return false;
+	STAT_SET(p->used, p->used + size);
+	if (p->used > p->peak)
+		STAT_SET(p->peak, p->used);
 }
 
-void smm_free(void *pt_addr, void *ptr)
+static void *__alloc(struct smm_pool *p, size_t size)
 {
-	struct smm_head *h = pt_addr;
-	struct smmb_head **bhp = &h->freelist;
-	struct smmb_head *bh = h->freelist;
-	struct smmb_head *bh_cur = ptr - sizeof(struct smmb_head);
-
-	assert(h->tag == SMM_HEAD_TAG);
-	//printf("bh_cur->tag= %x\n", bh_cur->tag);
-	assert(bh_cur->tag == SMMB_HEAD_ALLOCED_TAG);
+	void *ptr = NULL;
+	int32_t i, n;
+	int cls;
+
+	if (!size)
+		size = 1;
+	cls = __order(size) - __order(SMM_MIN_OBJ);
+	if (cls < p->min_cls)
+		cls = p->min_cls;
+	if (cls < SMM_CLASSES && __obj_size(cls) <= p->unit / 2) {
+		ptr = __slab_alloc(p, cls);
+		__account(p, ptr, __obj_size(cls));
+		return ptr;
+	}
 
-	if (!bh) {
-		*bhp = bh_cur;
-		bh_cur->tag = SMMB_HEAD_FREE_TAG;
-		return;
+	if (size > (size_t)p->nunits * p->unit) {
+		__account(p, NULL, 0);
+		return NULL;
 	}
+	n = (size + p->unit - 1) / p->unit;
+	i = __large_alloc(p, n);
+	if (i != SMM_NONE)
+		ptr = p->base + i * p->unit;
+	__account(p, ptr, p->unit * n);
+	return ptr;
+}
+
+/*
+ * Return the bytes of region that a block of size takes, so that callers
+ * could size the region for their blocks. A large block takes whole units,
+ * and the head of the region takes the first unit.
+ */
+size_t smm_block_size(size_t size, int align_mask)
+{
+	size_t unit = SMM_UNIT;
 
-	while (bh) {
-		assert(bh->tag == SMMB_HEAD_FREE_TAG);
+	if (align_mask >= 0 && (size_t)align_mask + 1 > unit)
+		unit = align_mask + 1;
+	return (size + unit - 1) / unit * unit;
+}
+
+void *smm_alloc(void *pt_addr, size_t size)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
+	void *ptr;
+
+	if (!p)
+		return NULL;
+	__lock(p);
+	ptr = __alloc(p, size);
+	__unlock(p);
+	return ptr;
+}
 
-		//printf("free: bh=%p, bh->size=%ld, bh_cur=%p\n", bh, bh->size, bh_cur);
-		if (bh_cur < bh) {
-			*bhp = bh_cur;
-			bh_cur->tag = SMMB_HEAD_FREE_TAG;
+/* Return the usable size of ptr, or 0 if it isn't allocated. */
+static size_t __alloc_size(struct smm_pool *p, void *ptr)
+{
+	struct smm_unit *u;
+	int32_t i;
+
+	if (ptr < p->base || ptr >= p->base + p->nunits * p->unit)
+		return 0;
+	i = (ptr - p->base) / p->unit;
+	u = &p->units[i];
+	if (u->state == SMM_U_SLAB)
+		return __obj_size(u->cls);
+	if (u->state == SMM_U_USED && ptr == p->base + i * p->unit)
+		return p->unit * u->len;
+	return 0;
+}
 
-			if (!__merge_free_block(bh_cur, bh))
-				bh_cur->next = bh;
+static void __free(struct smm_pool *p, void *ptr)
+{
+	size_t off, size;
+	int32_t i;
 
-			return;
-		} else if ((void *)bh + bh->size == bh_cur) {
-			bh->size += bh_cur->size;
-			(void)__merge_free_block(bh, bh->next);
+	size = __alloc_size(p, ptr);
+	if (!size) {
+		WD_ERR("smm: free invalid pointer %p\n", ptr);
+		return;
+	}
+	off = ptr - p->base;
+	i = off / p->unit;
+	if (p->units[i].state == SMM_U_SLAB) {
+		if (__slab_free(p, i, off % p->unit)) {
+			WD_ERR("smm: free invalid pointer %p\n", ptr);
 			return;
 		}
-
-		bhp = &(bh->next);
-		bh = bh->next;
+	} else {
+		p->units[i].state = SMM_U_TAIL;
+		__free_range(p, i, p->units[i].len);
+		__run_freed(p, i);
 	}
-
-	assert(false);
+	STAT_SET(p->used, p->used - size);
 }
 
-void *smm_realloc(void *pt_addr, void *ptr, size_t size)
+void smm_free(void *pt_addr, void *ptr)
 {
-	/* there is no benefit to do reallocation in this algorithm */
-	assert(false);
-}
+	struct smm_pool *p = __get_pool(pt_addr);
 
-#ifndef NDEBUG
-void smm_dump(void *pt_addr) {
-	struct smm_head *h = pt_addr;
-	struct smmb_head *bh = h->freelist;
+	if (!p || !ptr)
+		return;
+	__lock(p);
+	__free(p, ptr);
+	__unlock(p);
+}
 
-	assert(h->tag == SMM_HEAD_TAG);
+/*
+ * Resize ptr to size. The block is kept if it's large enough, or the data
+ * is moved to a new block. Return NULL and keep ptr if no memory.
+ */
+void *smm_realloc(void *pt_addr, void *ptr, size_t size)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
+	void *new;
+	size_t old;
+
+	if (!p)
+		return NULL;
+	if (!ptr)
+		return smm_alloc(pt_addr, size);
+	if (!size) {
+		smm_free(pt_addr, ptr);
+		return NULL;
+	}
 
-	printf("dump pt %p: align_mask = 0x%x\n", h, h->align_mask);
-	while (bh) {
-		assert(bh->tag == SMMB_HEAD_FREE_TAG);
-		printf("freeblock(%p): sz=%ld\n", bh, bh->size);
-		bh = bh->next;
+	__lock(p);
+	old = __alloc_size(p, ptr);
+	if (!old) {
+		new = NULL;
+	} else if (size <= old) {
+		new = ptr;
+	} else {
+		new = __alloc(p, size);
+		if (new) {
+			memcpy(new, ptr, old);
+			__free(p, ptr);
+		}
 	}
+	__unlock(p);
+	return new;
 }
 
-int smm_get_freeblock_num(void *pt_addr) {
-	struct smm_head *h = pt_addr;
-	struct smmb_head *bh = h->freelist;
-	int ret = 0;
+/*
+ * Take a snapshot of the statistics of the region. It doesn't lock the
+ * pool, so the fields may come from slightly different moments when other
+ * threads are allocating.
+ */
+int smm_get_stats(void *pt_addr, struct smm_stats *st)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
+	uint64_t mask;
+	size_t buddy_free;
+
+	if (!p || !st)
+		return -EINVAL;
+
+	st->size = p->nunits * p->unit;
+	st->used = STAT_GET(p->used);
+	st->free = st->size - st->used;
+	st->peak_used = STAT_GET(p->peak);
+	st->fail_num = STAT_GET(p->fails);
+	mask = STAT_GET(p->free_mask);
+	st->largest_free = mask ? p->unit << (63 - __builtin_clzl(mask)) : 0;
+	/* objects free in slabs don't help large blocks, leave them out */
+	buddy_free = (size_t)STAT_GET(p->free_units) * p->unit;
+	st->frag = buddy_free && st->largest_free < buddy_free ?
+		   100 - st->largest_free * 100 / buddy_free : 0;
+	return 0;
+}
 
-	assert(h->tag == SMM_HEAD_TAG);
+#ifndef NDEBUG
+void smm_dump(void *pt_addr)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
+	int32_t i;
+	int o;
 
-	while (bh) {
-		assert(bh->tag == SMMB_HEAD_FREE_TAG);
-		bh = bh->next;
-		ret++;
+	if (!p)
+		return;
+	__lock(p);
+	printf("dump pt %p: base = %p, unit = 0x%lx, units = %d\n",
+	       pt_addr, p->base, p->unit, p->nunits);
+	for (o = 0; o < SMM_MAX_ORDER; o++) {
+		for (i = p->free_head[o]; i != SMM_NONE; i = p->units[i].next)
+			printf("freeblock(%p): sz=%ld\n",
+			       p->base + i * p->unit, p->unit << o);
 	}
+	for (o = 0; o < SMM_CLASSES; o++) {
+		for (i = p->partial[o]; i != SMM_NONE; i = p->units[i].next)
+			printf("slab(%p): obj=%ld, free=%d\n",
+			       p->base + i * p->unit, __obj_size(o),
+			       p->units[i].nfree);
+	}
+	__unlock(p);
+}
 
+/* number of free blocks in the buddy allocator */
+int smm_get_freeblock_num(void *pt_addr)
+{
+	struct smm_pool *p = __get_pool(pt_addr);
+	int32_t i;
+	int o, ret = 0;
+
+	if (!p)
+		return 0;
+	__lock(p);
+	for (o = 0; o < SMM_MAX_ORDER; o++) {
+		for (i = p->free_head[o]; i != SMM_NONE; i = p->units[i].next)
+			ret++;
+	}
+	__unlock(p);
 	return ret;
 }
 #endif
@@ -1049,6 +1049,234 @@ out_src:
 	return ret;
 }
 
+#define ASYNC_REQS	8
+
+static void *async_done(void *cb_param)
+{
+	int	*done = cb_param;
+
+	__atomic_add_fetch(done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* wait until all requests are called back, poll by the caller if no poller */
+static int async_wait(handle_t handle, int *done, int num, int polled)
+{
+	int	ret;
+
+	while (__atomic_load_n(done, __ATOMIC_ACQUIRE) < num) {
+		if (polled)
+			continue;
+		ret = wd_alg_comp_poll(handle, num);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Submit a batch of requests with async API, and reap them either by polling
+ * or by a poller thread.
+ */
+int test_async(int flag, int polled)
+{
+	handle_t	handle;
+	struct wd_poller	*poller = NULL;
+	struct wd_comp_arg	args[ASYNC_REQS];
+	char	src[ASYNC_REQS][TEST_WORD_LEN];
+	char	dst[ASYNC_REQS][TEST_WORD_LEN];
+	char	algs[60];
+	int	i, done, ret;
+
+	if (flag & FLAG_ZLIB)
+		sprintf(algs, "zlib");
+	else if (flag & FLAG_GZIP)
+		sprintf(algs, "gzip");
+	handle = wd_alg_comp_alloc_sess(algs, 0, NULL);
+	if (!handle)
+		return -EINVAL;
+	if (polled) {
+		poller = wd_poller_create(-1, 10);
+		if (!poller) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		wd_alg_comp_set_poller(handle, poller);
+	}
+
+	done = 0;
+	memset(args, 0, sizeof(args));
+	for (i = 0; i < ASYNC_REQS; i++) {
+		snprintf(src[i], TEST_WORD_LEN, "%s %d", word, i);
+		args[i].src = src[i];
+		args[i].src_len = strlen(src[i]);
+		args[i].dst = dst[i];
+		args[i].dst_len = TEST_WORD_LEN;
+		args[i].cb = async_done;
+		args[i].cb_param = &done;
+		ret = wd_alg_compress_async(handle, &args[i]);
+		if (ret < 0)
+			goto out_poller;
+	}
+	ret = async_wait(handle, &done, ASYNC_REQS, polled);
+	if (ret < 0)
+		goto out_poller;
+
+	done = 0;
+	for (i = 0; i < ASYNC_REQS; i++) {
+		if (args[i].status & STATUS_FAILED) {
+			ret = -EIO;
+			goto out_poller;
+		}
+		/* compressed data becomes the input of decompression */
+		memcpy(src[i], dst[i], args[i].dst_len);
+		args[i].src_len = args[i].dst_len;
+		args[i].dst_len = TEST_WORD_LEN;
+		ret = wd_alg_decompress_async(handle, &args[i]);
+		if (ret < 0)
+			goto out_poller;
+	}
+	ret = async_wait(handle, &done, ASYNC_REQS, polled);
+	if (ret < 0)
+		goto out_poller;
+
+	for (i = 0; i < ASYNC_REQS; i++) {
+		snprintf(src[i], TEST_WORD_LEN, "%s %d", word, i);
+		if ((args[i].status & STATUS_FAILED) ||
+		    (args[i].dst_len != strlen(src[i])) ||
+		    memcmp(src[i], dst[i], args[i].dst_len)) {
+			printf("match failure on async request %d\n", i);
+			ret = -EFAULT;
+			goto out_poller;
+		}
+	}
+	printf("Pass async compress test %s.\n",
+	       polled ? "with poller" : "with polling");
+	ret = 0;
+out_poller:
+	/* the session is freed before the poller it's attached to */
+	wd_alg_comp_free_sess(handle);
+	wd_poller_destroy(poller);
+	return ret;
+out:
+	wd_alg_comp_free_sess(handle);
+	return ret;
+}
+
+/*
+ * Let CPU threads take async requests when accelerator is busy, and show
+ * how requests are split.
+ */
+int test_hybrid(int flag)
+{
+	handle_t	handle;
+	struct wd_hybrid_cfg	cfg;
+	struct wd_comp_stats	stats;
+	struct wd_comp_arg	args[ASYNC_REQS];
+	char	dst[ASYNC_REQS][TEST_WORD_LEN];
+	char	algs[60];
+	int	i, done = 0, ret;
+
+	if (flag & FLAG_ZLIB)
+		sprintf(algs, "zlib");
+	else if (flag & FLAG_GZIP)
+		sprintf(algs, "gzip");
+	handle = wd_alg_comp_alloc_sess(algs, 0, NULL);
+	if (!handle)
+		return -EINVAL;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cpu_threads = 2;
+	cfg.max_load = 50;
+	ret = wd_alg_comp_set_hybrid(handle, &cfg);
+	if (ret < 0)
+		goto out;
+
+	memset(args, 0, sizeof(args));
+	for (i = 0; i < ASYNC_REQS; i++) {
+		args[i].src = word;
+		args[i].src_len = strlen(word);
+		args[i].dst = dst[i];
+		args[i].dst_len = TEST_WORD_LEN;
+		args[i].cb = async_done;
+		args[i].cb_param = &done;
+		ret = wd_alg_compress_async(handle, &args[i]);
+		if (ret < 0)
+			goto out;
+	}
+	ret = async_wait(handle, &done, ASYNC_REQS, 0);
+	if (ret < 0)
+		goto out;
+	wd_alg_comp_get_stats(handle, &stats);
+	printf("Pass hybrid test: %llu requests on accelerator, "
+	       "%llu requests on CPU.\n",
+	       (unsigned long long)stats.hw_reqs,
+	       (unsigned long long)stats.cpu_reqs);
+out:
+	wd_alg_comp_free_sess(handle);
+	return ret;
+}
+
+#define BATCH_REQS	32
+
+/* compress and decompress many small buffers as batches */
+int test_batch(int flag)
+{
+	handle_t	handle;
+	struct wd_comp_arg	args[BATCH_REQS];
+	char	src[BATCH_REQS][TEST_WORD_LEN];
+	char	dst[BATCH_REQS][TEST_WORD_LEN];
+	char	algs[60];
+	int	i, ret;
+
+	if (flag & FLAG_ZLIB)
+		sprintf(algs, "zlib");
+	else if (flag & FLAG_GZIP)
+		sprintf(algs, "gzip");
+	handle = wd_alg_comp_alloc_sess(algs, 0, NULL);
+	if (!handle)
+		return -EINVAL;
+
+	memset(args, 0, sizeof(args));
+	for (i = 0; i < BATCH_REQS; i++) {
+		snprintf(src[i], TEST_WORD_LEN, "%s %d", word, i);
+		args[i].src = src[i];
+		args[i].src_len = strlen(src[i]);
+		args[i].dst = dst[i];
+		args[i].dst_len = TEST_WORD_LEN;
+	}
+	ret = wd_alg_compress_batch(handle, args, BATCH_REQS);
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < BATCH_REQS; i++) {
+		if (args[i].status & STATUS_FAILED) {
+			ret = -EIO;
+			goto out;
+		}
+		memcpy(src[i], dst[i], args[i].dst_len);
+		args[i].src_len = args[i].dst_len;
+		args[i].dst_len = TEST_WORD_LEN;
+	}
+	ret = wd_alg_decompress_batch(handle, args, BATCH_REQS);
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < BATCH_REQS; i++) {
+		snprintf(src[i], TEST_WORD_LEN, "%s %d", word, i);
+		if ((args[i].status & STATUS_FAILED) ||
+		    (args[i].dst_len != strlen(src[i])) ||
+		    memcmp(src[i], dst[i], args[i].dst_len)) {
+			printf("match failure on batch request %d\n", i);
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+	printf("Pass batch compress test.\n");
+out:
+	wd_alg_comp_free_sess(handle);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	test_comp_once(FLAG_ZLIB, MODE_STREAM);
@@ -1087,5 +1315,13 @@ int main(int argc, char **argv)
 	else
 		printf("Pass concurrent case for GZIP.\n");
 	usleep(100);
+	test_async(FLAG_ZLIB, 0);
+	test_async(FLAG_GZIP, 0);
+	test_async(FLAG_ZLIB, 1);
+	test_async(FLAG_GZIP, 1);
+	test_hybrid(FLAG_ZLIB);
+	test_hybrid(FLAG_GZIP);
+	test_batch(FLAG_ZLIB);
+	test_batch(FLAG_GZIP);
 	return 0;
 }
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Stress and benchmark the block memory allocator shared by threads.
+ * - each thread allocates a batch of blocks or runs, stamps them, and
+ *   checks the stamps before it frees them, so a block handed out twice
+ *   is caught;
+ * - the throughput of the concurrent pool is measured with 1, 2, 4, ...
+ *   threads, against a pool that is locked by a mutex.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bmm.h"
+
+#define MAX_THREADS	64
+#define MAX_BATCH	64
+
+struct test_options {
+	size_t		mem_size;
+	unsigned int	block_size;
+	unsigned int	max_run;	/* 1 for single blocks only */
+	unsigned int	batch;
+	unsigned long	loops;
+	int		threads;
+	int		bench;
+};
+
+struct thread_ctx {
+	pthread_t		thread;
+	int			id;
+	void			*pool;
+	pthread_mutex_t		*lock;	/* for the baseline pool */
+	struct test_options	*opts;
+	unsigned long		fails;	/* allocations that found no room */
+	int			errors;
+};
+
+static void *pool_alloc(struct thread_ctx *ctx, unsigned int n)
+{
+	void *p;
+
+	if (ctx->lock)
+		pthread_mutex_lock(ctx->lock);
+	p = n > 1 ? bmm_alloc_n(ctx->pool, n) : bmm_alloc(ctx->pool);
+	if (ctx->lock)
+		pthread_mutex_unlock(ctx->lock);
+	return p;
+}
+
+static void pool_free(struct thread_ctx *ctx, void *p, unsigned int n)
+{
+	if (ctx->lock)
+		pthread_mutex_lock(ctx->lock);
+	if (n > 1)
+		bmm_free_n(ctx->pool, p, n);
+	else
+		bmm_free(ctx->pool, p);
+	if (ctx->lock)
+		pthread_mutex_unlock(ctx->lock);
+}
+
+static void stamp_buf(void *buf, size_t len, unsigned long stamp)
+{
+	size_t i;
+
+	for (i = 0; i + sizeof(stamp) <= len; i += sizeof(stamp))
+		memcpy((char *)buf + i, &stamp, sizeof(stamp));
+}
+
+static int check_buf(void *buf, size_t len, unsigned long stamp)
+{
+	size_t i;
+
+	for (i = 0; i + sizeof(stamp) <= len; i += sizeof(stamp)) {
+		if (memcmp((char *)buf + i, &stamp, sizeof(stamp)))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static void *thread_func(void *arg)
+{
+	struct thread_ctx *ctx = arg;
+	struct test_options *opts = ctx->opts;
+	void *bufs[MAX_BATCH];
+	unsigned int runs[MAX_BATCH];
+	unsigned int seed = ctx->id + 1;
+	unsigned long loop, stamp;
+	unsigned int i, num;
+	size_t len;
+
+	for (loop = 0; loop < opts->loops; loop++) {
+		stamp = ((unsigned long)ctx->id << 32) | loop;
+		num = rand_r(&seed) % opts->batch + 1;
+		for (i = 0; i < num; i++) {
+			runs[i] = 1;
+			if (opts->max_run > 1 && !(rand_r(&seed) % 4))
+				runs[i] = rand_r(&seed) % opts->max_run + 1;
+			bufs[i] = pool_alloc(ctx, runs[i]);
+			if (!bufs[i])
+				ctx->fails++;
+			else if (!opts->bench)
+				stamp_buf(bufs[i], runs[i] * opts->block_size,
+					  stamp);
+		}
+		for (i = 0; i < num; i++) {
+			if (!bufs[i])
+				continue;
+			len = runs[i] * opts->block_size;
+			if (!opts->bench && check_buf(bufs[i], len, stamp)) {
+				fprintf(stderr, "thread %d: block %p is "
+					"overwritten\n", ctx->id, bufs[i]);
+				ctx->errors++;
+			}
+			pool_free(ctx, bufs[i], runs[i]);
+		}
+	}
+	return NULL;
+}
+
+/* take all blocks of the pool and give them back */
+static int count_blocks(void *pool)
+{
+	void **bufs = NULL, **tmp;
+	int i, num = 0, size = 0;
+
+	while (1) {
+		if (num == size) {
+			size = size ? size * 2 : 1024;
+			tmp = realloc(bufs, size * sizeof(void *));
+			if (!tmp) {
+				num = -ENOMEM;
+				break;
+			}
+			bufs = tmp;
+		}
+		bufs[num] = bmm_alloc(pool);
+		if (!bufs[num])
+			break;
+		num++;
+	}
+	for (i = 0; i < num; i++)
+		bmm_free(pool, bufs[i]);
+	free(bufs);
+	return num;
+}
+
+static double run_threads(struct test_options *opts, int threads,
+			  int concurrent, unsigned long *fails, int *errors)
+{
+	struct thread_ctx ctx[MAX_THREADS];
+	pthread_mutex_t lock;
+	struct timespec t0, t1;
+	void *pool;
+	int i, ret, blocks;
+
+	if (posix_memalign(&pool, 4096, opts->mem_size))
+		return -ENOMEM;
+	ret = bmm_init_ex(pool, opts->mem_size, opts->block_size, 64,
+			  concurrent ? BMM_CONCURRENT : 0);
+	if (ret) {
+		fprintf(stderr, "fail to init bmm (%d)\n", ret);
+		free(pool);
+		return ret;
+	}
+	blocks = count_blocks(pool);
+	if (blocks < 0) {
+		free(pool);
+		return blocks;
+	}
+	pthread_mutex_init(&lock, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < threads; i++) {
+		ctx[i].id = i;
+		ctx[i].pool = pool;
+		ctx[i].lock = concurrent ? NULL : &lock;
+		ctx[i].opts = opts;
+		ctx[i].fails = 0;
+		ctx[i].errors = 0;
+		pthread_create(&ctx[i].thread, NULL, thread_func, &ctx[i]);
+	}
+	*fails = 0;
+	*errors = 0;
+	for (i = 0; i < threads; i++) {
+		pthread_join(ctx[i].thread, NULL);
+		*fails += ctx[i].fails;
+		*errors += ctx[i].errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	/* everything is back, so each block can be taken once more */
+	for (i = 0; bmm_alloc(pool); i++)
+		;
+	if (i != blocks) {
+		fprintf(stderr, "%d of %d blocks are lost\n",
+			blocks - i, blocks);
+		(*errors)++;
+	}
+
+	pthread_mutex_destroy(&lock);
+	free(pool);
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-b] [-t threads] [-l loops] [-m mem_size]\n"
+	       "	[-s block_size] [-r max_run] [-n batch]\n"
+	       "  -b  run the benchmark instead of the stress test\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.mem_size	= 16 << 20,
+		.block_size	= 4096,
+		.max_run	= 8,
+		.batch		= 16,
+		.loops		= 100000,
+		.threads	= 8,
+	};
+	unsigned long fails;
+	double secs, ops;
+	int opt, errors, t, c;
+
+	while ((opt = getopt(argc, argv, "bt:l:m:s:r:n:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			opts.bench = 1;
+			break;
+		case 't':
+			opts.threads = atoi(optarg);
+			break;
+		case 'l':
+			opts.loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts.mem_size = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.max_run = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (opts.threads < 1 || opts.threads > MAX_THREADS ||
+	    !opts.batch || opts.batch > MAX_BATCH || !opts.block_size ||
+	    !opts.max_run || opts.mem_size > UINT32_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!opts.bench) {
+		secs = run_threads(&opts, opts.threads, 1, &fails, &errors);
+		if (secs < 0)
+			return 1;
+		printf("%d threads: %lu allocations found no room\n",
+		       opts.threads, fails);
+		if (errors) {
+			printf("fail to share bmm between threads\n");
+			return 1;
+		}
+		printf("Pass bmm stress test.\n");
+		return 0;
+	}
+
+	for (c = 0; c < 2; c++) {
+		for (t = 1; t <= opts.threads; t *= 2) {
+			secs = run_threads(&opts, t, !c, &fails, &errors);
+			if (secs < 0)
+				return 1;
+			/* an alloc and a free for (batch + 1) / 2 buffers */
+			ops = (double)t * opts.loops * (opts.batch + 1);
+			printf("%s %2d threads: %.2f Mops/s\n",
+			       c ? "locked    " : "concurrent", t,
+			       ops / secs / 1e6);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Check CRC32 and Adler-32 against zlib.
+ * - buffers of every length up to a few vectors, and of random lengths at
+ *   random alignments, so both the vector loops and the tails are run;
+ * - checksums are chained from random initial values as streams do;
+ * - the combine functions join the checksums of two random parts.
+ */
+#include <stdint.h>
+#include <zlib.h>
+
+#include "test_lib.h"
+#include "wd_crc.h"
+
+#define SHORT_LEN	512	/* every length below it is checked */
+#define MAX_ALIGN	64
+
+static int check_one(const unsigned char *buf, size_t len, uint32_t init)
+{
+	uint32_t crc, adler;
+
+	crc = wd_crc32(init, buf, len);
+	if (crc != crc32(init, buf, len)) {
+		fprintf(stderr, "crc32 of %zu bytes at %p: %08x\n", len, buf,
+			crc);
+		return -1;
+	}
+	/* adler32 takes 1 as the initial value, keep both halves in range */
+	init = (init % 65521) | ((init >> 16) % 65521) << 16;
+	adler = wd_adler32(init, buf, len);
+	if (adler != adler32(init, buf, len)) {
+		fprintf(stderr, "adler32 of %zu bytes at %p: %08x\n", len,
+			buf, adler);
+		return -1;
+	}
+	return 0;
+}
+
+static int check_combine(const unsigned char *buf, size_t len, size_t cut)
+{
+	uint32_t a, b;
+
+	a = wd_crc32(0, buf, cut);
+	b = wd_crc32(0, buf + cut, len - cut);
+	if (wd_crc32_combine(a, b, len - cut) != crc32(0, buf, len)) {
+		fprintf(stderr, "crc32 combine of %zu and %zu bytes\n", cut,
+			len - cut);
+		return -1;
+	}
+	a = wd_adler32(1, buf, cut);
+	b = wd_adler32(1, buf + cut, len - cut);
+	if (wd_adler32_combine(a, b, len - cut) != adler32(1, buf, len)) {
+		fprintf(stderr, "adler32 combine of %zu and %zu bytes\n", cut,
+			len - cut);
+		return -1;
+	}
+	return 0;
+}
+
+static int test_short(unsigned char *buf)
+{
+	size_t len, align;
+	int errors = 0;
+
+	for (align = 0; align < MAX_ALIGN; align += 7) {
+		for (len = 0; len < SHORT_LEN; len++) {
+			errors -= check_one(buf + align, len, 0);
+			errors -= check_one(buf + align, len, 0xFFFFFFFF);
+		}
+	}
+	return errors;
+}
+
+static int test_random(unsigned char *buf, struct test_options *opts)
+{
+	unsigned int seed = 2;
+	size_t len, align;
+	int i, errors = 0;
+
+	for (i = 0; i < opts->run_num; i++) {
+		align = rand_r(&seed) % MAX_ALIGN;
+		len = rand_r(&seed) % (opts->total_len + 1);
+		errors -= check_one(buf + align, len, rand_r(&seed));
+		errors -= check_combine(buf + align, len,
+					rand_r(&seed) % (len + 1));
+	}
+	/* the whole buffer, and the parts at both ends */
+	errors -= check_combine(buf, opts->total_len, 0);
+	errors -= check_combine(buf, opts->total_len, opts->total_len);
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.total_len	= 1 << 20,
+		.run_num	= 1000,
+	};
+	unsigned int seed = 1;
+	unsigned char *buf;
+	size_t i;
+	int opt, ret;
+	int show_help = 0;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING)) != -1)
+		show_help = parse_common_option(opt, optarg, &opts);
+
+	SYS_ERR_COND(show_help || optind > argc, COMMON_HELP, argv[0]);
+
+	/* no less than the short lengths at the last alignment */
+	if (opts.total_len < SHORT_LEN)
+		opts.total_len = SHORT_LEN;
+	buf = malloc(opts.total_len + MAX_ALIGN);
+	if (!buf) {
+		printf("fail to allocate a buffer\n");
+		return 1;
+	}
+	for (i = 0; i < opts.total_len + MAX_ALIGN; i++)
+		buf[i] = rand_r(&seed);
+
+	ret = test_short(buf);
+	if (ret) {
+		printf("fail to check short buffers (%d)\n", ret);
+		return 1;
+	}
+	ret = test_random(buf, &opts);
+	if (ret) {
+		printf("fail to check random buffers (%d)\n", ret);
+		return 1;
+	}
+	free(buf);
+	printf("Pass crc test.\n");
+	return 0;
+}
@@ -171,8 +171,10 @@ void hw_end(struct zip_stream *zstrm)
 		free(zstrm->next_in);
 		free(zstrm->next_out);
 		free(zstrm->ctx_buf);
-	} else
+	} else {
+		smm_fini(zstrm->workspace);
 		hisi_qm_free_ctx(zstrm->h_ctx);
+	}
 }
 
 unsigned int bit_reverse(register unsigned int x)
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Compress and decompress scatter-gather lists.
+ * - the input is cut into segments of random sizes, and compressed into
+ *   segments of dst by wd_alg_compress_iov();
+ * - the output is checked by zlib, and decompressed back by
+ *   wd_alg_decompress_iov() into segments again;
+ * - it runs on zlib of CPU if there's no accelerator, and stream mode is
+ *   skipped then.
+ */
+#include <string.h>
+#include <sys/uio.h>
+
+#include "test_lib.h"
+#include "wd_comp.h"
+
+#define MAX_SEGS	16
+
+/* cut buf into num segments of random sizes, some of them may be empty */
+static void cut_buf(void *buf, size_t len, struct iovec *iov, int num,
+		    unsigned int *seed)
+{
+	size_t off = 0, seg;
+	int i;
+
+	for (i = 0; i < num - 1; i++) {
+		seg = rand_r(seed) % (2 * len / num + 1);
+		if (seg > len - off)
+			seg = len - off;
+		iov[i].iov_base = buf + off;
+		iov[i].iov_len = seg;
+		off += seg;
+	}
+	iov[i].iov_base = buf + off;
+	iov[i].iov_len = len - off;
+}
+
+static int test_iov(char *alg, uint32_t mode, struct test_options *opts,
+		    int segs, unsigned int seed)
+{
+	struct iovec src_iov[MAX_SEGS], dst_iov[MAX_SEGS];
+	size_t size = opts->total_len, bound, len;
+	struct wd_comp_iov iov;
+	unsigned char *in, *out, *back;
+	handle_t h;
+	int ret = -ENOMEM;
+
+	h = wd_alg_comp_alloc_sess(alg, mode, NULL);
+	if (!h)
+		return -ENODEV;
+	bound = size + (size >> 3) + 1024;
+	in = malloc(size);
+	out = malloc(bound);
+	back = malloc(size);
+	if (!in || !out || !back)
+		goto out;
+	hizip_fill_text(in, size, seed);
+
+	cut_buf(in, size, src_iov, segs, &seed);
+	cut_buf(out, bound, dst_iov, segs, &seed);
+	memset(&iov, 0, sizeof(iov));
+	iov.src = src_iov;
+	iov.src_num = segs;
+	iov.dst = dst_iov;
+	iov.dst_num = segs;
+	iov.flag = FLAG_INPUT_FINISH;
+	ret = wd_alg_compress_iov(h, &iov);
+	if (ret) {
+		fprintf(stderr, "fail to compress %s iov (%d)\n", alg, ret);
+		goto out;
+	}
+	if (iov.src_len != size || iov.dst_len > bound) {
+		fprintf(stderr, "%s: bad sizes, in %zu out %zu\n", alg,
+			iov.src_len, iov.dst_len);
+		ret = -EIO;
+		goto out;
+	}
+
+	/* the segments of dst are contiguous, so zlib reads them at once */
+	len = size;
+	ret = zlib_inflate(back, &len, out, iov.dst_len,
+			   strcmp(alg, "gzip") ? 15 : 31);
+	if (ret || len != size || memcmp(in, back, len)) {
+		fprintf(stderr, "%s: zlib doesn't read the output\n", alg);
+		ret = -EIO;
+		goto out;
+	}
+
+	len = iov.dst_len;
+	cut_buf(out, len, src_iov, segs, &seed);
+	memset(back, 0, size);
+	cut_buf(back, size, dst_iov, segs, &seed);
+	memset(&iov, 0, sizeof(iov));
+	iov.src = src_iov;
+	iov.src_num = segs;
+	iov.dst = dst_iov;
+	iov.dst_num = segs;
+	iov.flag = FLAG_INPUT_FINISH;
+	ret = wd_alg_decompress_iov(h, &iov);
+	if (ret) {
+		fprintf(stderr, "fail to decompress %s iov (%d)\n", alg, ret);
+		goto out;
+	}
+	/* the trailer is consumed too */
+	if (iov.src_len != len || iov.dst_len != size ||
+	    memcmp(in, back, size)) {
+		fprintf(stderr, "%s: bad output of %zu bytes from %zu\n", alg,
+			iov.dst_len, iov.src_len);
+		ret = -EIO;
+	}
+out:
+	free(back);
+	free(out);
+	free(in);
+	wd_alg_comp_free_sess(h);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.total_len	= 300000,
+		.run_num	= 20,
+	};
+	char *algs[] = { "zlib", "gzip" };
+	int opt, i, j, ret, segs = 5;
+	int show_help = 0;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING "g:")) != -1) {
+		switch (opt) {
+		case 'g':
+			segs = strtol(optarg, NULL, 0);
+			if (segs < 1 || segs > MAX_SEGS)
+				show_help = 1;
+			break;
+		default:
+			show_help = parse_common_option(opt, optarg, &opts);
+			break;
+		}
+	}
+
+	SYS_ERR_COND(show_help || optind > argc,
+		     COMMON_HELP
+		     "  -g <num>      number of segments, up to 16\n",
+		     argv[0]
+		    );
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < opts.run_num; j++) {
+			ret = test_iov(algs[i], MODE_SW_FALLBACK, &opts, segs,
+				       j + 1);
+			if (ret) {
+				printf("fail to test %s iov in block mode\n",
+				       algs[i]);
+				return 1;
+			}
+			ret = test_iov(algs[i], MODE_STREAM, &opts, segs,
+				       j + 1);
+			if (ret == -ENODEV) {
+				if (!j)
+					printf("no %s accelerator, skip "
+					       "stream mode\n", algs[i]);
+			} else if (ret) {
+				printf("fail to test %s iov in stream mode\n",
+				       algs[i]);
+				return 1;
+			}
+		}
+	}
+	printf("Pass iov test.\n");
+	return 0;
+}
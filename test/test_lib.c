@@ -156,6 +156,14 @@ int hizip_test_default_output(struct wd_msg *msg, void *priv)
 	return 0;
 }
 
+/* the input of a message, for tuning the window */
+static size_t hizip_test_msg_len(struct wd_msg *msg, void *priv)
+{
+	struct hisi_zip_sqe *m = msg->msg;
+
+	return m->consumed;
+}
+
 struct test_ops default_test_ops = {
 	.init_cache = hizip_test_default_init_cache,
 	.input = hizip_test_default_input,
@@ -206,6 +214,16 @@ void hizip_prepare_random_input_data(struct hizip_test_context *ctx)
 	}
 }
 
+void hizip_fill_text(void *buf, size_t len, unsigned int seed)
+{
+	unsigned char *p = buf;
+	size_t i;
+
+	/* eight letters in turns of 4KB */
+	for (i = 0; i < len; i++)
+		p[i] = "abcdefgh"[rand_r(&seed) % 8] + (i >> 12) % 4;
+}
+
 static int hizip_check_rand(unsigned char *buf, unsigned int size, void *opaque)
 {
 	int i;
@@ -289,6 +307,8 @@ int hizip_test_init(struct wd_scheduler *sched, struct test_options *opts,
 	sched->q_num = opts->q_num;
 	sched->ss_region_size = 0; /* let system make decision */
 	sched->msg_cache_num = opts->req_cache_num;
+	sched->auto_win = opts->auto_win;
+	sched->msg_len = hizip_test_msg_len;
 	/* use twice the size of the input data, hope it is enough for output */
 	sched->msg_data_size = opts->block_size * EXPANSION_RATIO;
 
@@ -320,6 +340,14 @@ int hizip_test_init(struct wd_scheduler *sched, struct test_options *opts,
 	if (!ctx->msgs)
 		goto out_msgs;
 
+	if (opts->poller) {
+		sched->poller = wd_poller_create(opts->poller_cpu, 0);
+		if (!sched->poller) {
+			ret = -ENOMEM;
+			goto out_poller;
+		}
+	}
+
 	ret = wd_sched_init(sched, HISI_DEV_NODE);
 	if (ret)
 		goto out_sched;
@@ -334,7 +362,8 @@ int hizip_test_init(struct wd_scheduler *sched, struct test_options *opts,
 
 	if (!sched->ss_region_size)
 		sched->ss_region_size = 4096 + /* add 1 page extra */
-			sched->msg_cache_num * sched->msg_data_size * 2;
+			sched->msg_cache_num *
+			smm_block_size(sched->msg_data_size, 0xF) * 2;
 	if (wd_is_nosva(sched->qs[0])) {
 		sched->ss_region = wd_reserve_mem(sched->qs[0],
 						  sched->ss_region_size);
@@ -370,6 +399,7 @@ out_swap:
 	}
 out_smm:
 	if (wd_is_nosva(sched->qs[0]) && sched->ss_region) {
+		smm_fini(sched->ss_region);
 		wd_drv_unmap_qfr(sched->qs[0], UACCE_QFRT_SS, sched->ss_region);
 	}
 out_region:
@@ -382,6 +412,8 @@ out_hw:
 		sched->hw_free(sched->qs[j]);
 	}
 out_sched:
+	wd_poller_destroy(sched->poller);
+out_poller:
 	free(ctx->msgs);
 out_msgs:
 	free(sched->qs);
@@ -410,11 +442,23 @@ int hizip_test_sched(struct wd_scheduler *sched, struct test_options *opts,
  */
 void hizip_test_fini(struct wd_scheduler *sched, struct test_options *opts)
 {
+	struct smm_stats st;
 	int i;
 
+	/* detach the queues from the poller before they're freed */
+	wd_sched_fini(sched);
+	wd_poller_destroy(sched->poller);
+	if (wd_is_nosva(sched->qs[0]) && sched->ss_region) {
+		/* help to size ss_region_size */
+		if (opts->verbose && !smm_get_stats(sched->ss_region, &st))
+			fprintf(stderr, "ss region: %zu bytes, peak %zu, "
+				"largest free %zu, frag %u%%, %lu fails\n",
+				st.size, st.peak_used, st.largest_free,
+				st.frag, (unsigned long)st.fail_num);
+		smm_fini(sched->ss_region);
+	}
 	for (i = 0; i < sched->q_num; i++)
 		sched->hw_free(sched->qs[i]);
-	wd_sched_fini(sched);
 	free(sched->qs);
 }
 
@@ -422,6 +466,9 @@ int parse_common_option(const char opt, const char *optarg,
 			struct test_options *opts)
 {
 	switch (opt) {
+	case 'a':
+		opts->auto_win = true;
+		break;
 	case 'b':
 		opts->block_size = strtol(optarg, NULL, 0);
 		if (opts->block_size <= 0)
@@ -449,6 +496,10 @@ int parse_common_option(const char opt, const char *optarg,
 		if (opts->q_num <= 0)
 			return 1;
 		break;
+	case 'P':
+		opts->poller = true;
+		opts->poller_cpu = strtol(optarg, NULL, 0);
+		break;
 	case 's':
 		opts->total_len = strtol(optarg, NULL, 0);
 		SYS_ERR_COND(opts->total_len <= 0, "invalid size '%s'\n",
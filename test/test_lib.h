@@ -50,6 +50,13 @@ struct test_options {
 
 	bool verify;
 	bool verbose;
+
+	/* tune the in-flight window, req_cache_num is the upper bound */
+	bool auto_win;
+
+	/* reap completions in a poller thread pinned on poller_cpu */
+	bool poller;
+	int poller_cpu;
 };
 
 struct hizip_test_context {
@@ -92,12 +99,17 @@ int hizip_verify_random_output(char *out_buf, struct test_options *opts,
 
 void *mmap_alloc(size_t len);
 
+/* compressible, but not too much, the same data for the same seed */
+void hizip_fill_text(void *buf, size_t len, unsigned int seed);
+
 typedef int (*check_output_fn)(unsigned char *buf, unsigned int size, void *opaque);
 #ifdef USE_ZLIB
 int hizip_check_output(void *buf, size_t size, size_t *checked,
 		       check_output_fn check_output, void *opaque);
 int zlib_deflate(void *output, unsigned int out_size,
 		 void *input, unsigned int in_size, unsigned long *produced);
+int zlib_inflate(void *output, size_t *out_size, void *input, size_t in_size,
+		 int window_bits);
 #else
 static inline int hizip_check_output(void *buf, size_t size, size_t *checked,
 				     check_output_fn check_output,
@@ -117,6 +129,12 @@ static inline int zlib_deflate(void *output, unsigned int out_size, void *input,
 	WD_ERR("no zlib available\n");
 	return -ENOSYS;
 }
+static inline int zlib_inflate(void *output, size_t *out_size, void *input,
+			       size_t in_size, int window_bits)
+{
+	WD_ERR("no zlib available\n");
+	return -ENOSYS;
+}
 #endif
 
 static inline void hizip_test_adjust_len(struct test_options *opts)
@@ -128,15 +146,19 @@ static inline void hizip_test_adjust_len(struct test_options *opts)
 		opts->block_size * opts->block_size;
 }
 
-#define COMMON_OPTSTRING "hb:n:q:c:l:s:Vvz"
+#define COMMON_OPTSTRING "ab:hn:q:c:l:s:P:Vvz"
 
 #define COMMON_HELP "%s [opts]\n"					\
+	"  -a            tune the number of requests in flight,\n"	\
+	"                up to the number of caches\n"			\
 	"  -b <size>     block size\n"					\
 	"  -n <num>      number of runs\n"				\
 	"  -q <num>      number of queues\n"				\
 	"  -c <num>      number of caches\n"				\
 	"  -l <num>      number of compact runs\n"			\
 	"  -s <size>     total size\n"					\
+	"  -P <cpu>      reap completions in a poller thread on cpu,\n"	\
+	"                -1 for any cpu\n"				\
 	"  -V            verify output\n"				\
 	"  -v            display detailed performance information\n"	\
 	"  -z            test zlib algorithm, default gzip\n"		\
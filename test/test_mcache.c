@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Stress the per-thread caches over a smm region and a bmm pool.
+ * - each thread allocates more objects than its magazine holds, stamps them,
+ *   and checks the stamps before it frees them, so the magazines are
+ *   refilled and flushed, and an object handed out twice is caught;
+ * - threads exit with objects in their magazines, which must be back in the
+ *   pool once the threads are joined;
+ * - mcache_drain() gives back the objects cached by the calling thread.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmm.h"
+#include "mcache.h"
+#include "smm.h"
+
+#define MAX_THREADS	64
+#define MAX_OBJS	(4 * MCACHE_BATCH_MAX)
+
+struct test_options {
+	size_t		obj_size;
+	unsigned int	batch;
+	unsigned long	loops;
+	int		threads;
+};
+
+struct thread_ctx {
+	pthread_t		thread;
+	int			id;
+	struct mcache		*mc;
+	size_t			obj_size;
+	struct test_options	*opts;
+	int			errors;
+};
+
+static void stamp_buf(void *buf, size_t len, unsigned long stamp)
+{
+	size_t i;
+
+	for (i = 0; i + sizeof(stamp) <= len; i += sizeof(stamp))
+		memcpy((char *)buf + i, &stamp, sizeof(stamp));
+}
+
+static int check_buf(void *buf, size_t len, unsigned long stamp)
+{
+	size_t i;
+
+	for (i = 0; i + sizeof(stamp) <= len; i += sizeof(stamp)) {
+		if (memcmp((char *)buf + i, &stamp, sizeof(stamp)))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static void *thread_func(void *arg)
+{
+	struct thread_ctx *ctx = arg;
+	struct test_options *opts = ctx->opts;
+	void *objs[MAX_OBJS];
+	unsigned int seed = ctx->id + 1;
+	unsigned long loop, stamp;
+	unsigned int i, num;
+
+	for (loop = 0; loop < opts->loops; loop++) {
+		stamp = ((unsigned long)ctx->id << 32) | loop;
+		/* up to twice of the magazine, to refill and flush it */
+		num = rand_r(&seed) % (4 * opts->batch) + 1;
+		for (i = 0; i < num; i++) {
+			objs[i] = mcache_alloc(ctx->mc);
+			if (objs[i])
+				stamp_buf(objs[i], ctx->obj_size, stamp);
+		}
+		for (i = 0; i < num; i++) {
+			if (!objs[i])
+				continue;
+			if (check_buf(objs[i], ctx->obj_size, stamp)) {
+				fprintf(stderr, "thread %d: object %p is "
+					"overwritten\n", ctx->id, objs[i]);
+				ctx->errors++;
+			}
+			mcache_free(ctx->mc, objs[i]);
+		}
+	}
+	/* exit with the magazine full, it's released by the key */
+	return NULL;
+}
+
+static int run_threads(struct test_options *opts, struct mcache *mc,
+		       size_t obj_size)
+{
+	struct thread_ctx ctx[MAX_THREADS];
+	int i, errors = 0;
+
+	for (i = 0; i < opts->threads; i++) {
+		ctx[i].id = i;
+		ctx[i].mc = mc;
+		ctx[i].obj_size = obj_size;
+		ctx[i].opts = opts;
+		ctx[i].errors = 0;
+		pthread_create(&ctx[i].thread, NULL, thread_func, &ctx[i]);
+	}
+	for (i = 0; i < opts->threads; i++) {
+		pthread_join(ctx[i].thread, NULL);
+		errors += ctx[i].errors;
+	}
+	return errors;
+}
+
+/* take objects in the calling thread, and give them back by draining */
+static void fill_and_drain(struct mcache *mc, struct test_options *opts)
+{
+	void *objs[MAX_OBJS];
+	unsigned int i, num = opts->batch + 1;
+
+	for (i = 0; i < num; i++)
+		objs[i] = mcache_alloc(mc);
+	for (i = 0; i < num; i++)
+		mcache_free(mc, objs[i]);
+	mcache_drain(mc);
+}
+
+static int test_smm(struct test_options *opts)
+{
+	size_t size = 4096 + opts->threads * opts->batch * 4 *
+		      smm_block_size(opts->obj_size, 0xF);
+	struct smm_stats st;
+	struct mcache *mc;
+	void *region;
+	int errors;
+
+	if (posix_memalign(&region, 4096, size))
+		return -ENOMEM;
+	if (smm_init(region, size, 0xF)) {
+		free(region);
+		return -ENOMEM;
+	}
+	mc = mcache_create_smm(region, opts->obj_size, opts->batch);
+	if (!mc) {
+		smm_fini(region);
+		free(region);
+		return -ENOMEM;
+	}
+
+	errors = run_threads(opts, mc, opts->obj_size);
+	smm_get_stats(region, &st);
+	if (st.used) {
+		fprintf(stderr, "smm: %zu bytes aren't released on exit\n",
+			st.used);
+		errors++;
+	}
+	fill_and_drain(mc, opts);
+	smm_get_stats(region, &st);
+	if (st.used) {
+		fprintf(stderr, "smm: %zu bytes aren't drained\n", st.used);
+		errors++;
+	}
+
+	mcache_destroy(mc);
+	smm_fini(region);
+	free(region);
+	return errors;
+}
+
+static int test_bmm(struct test_options *opts)
+{
+	unsigned int block_size = 4096;
+	unsigned int size = opts->threads * opts->batch * 4 * block_size;
+	struct bmm_stats st;
+	struct mcache *mc;
+	void *pool;
+	int errors;
+
+	if (posix_memalign(&pool, 4096, size))
+		return -ENOMEM;
+	if (bmm_init(pool, size, block_size, 64)) {
+		free(pool);
+		return -ENOMEM;
+	}
+	mc = mcache_create_bmm(pool, opts->batch);
+	if (!mc) {
+		free(pool);
+		return -ENOMEM;
+	}
+
+	errors = run_threads(opts, mc, block_size);
+	bmm_get_stats(pool, &st);
+	if (st.used) {
+		fprintf(stderr, "bmm: %zu bytes aren't released on exit\n",
+			st.used);
+		errors++;
+	}
+	fill_and_drain(mc, opts);
+	bmm_get_stats(pool, &st);
+	if (st.used) {
+		fprintf(stderr, "bmm: %zu bytes aren't drained\n", st.used);
+		errors++;
+	}
+
+	mcache_destroy(mc);
+	free(pool);
+	return errors;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-l loops] [-s obj_size] [-n batch]\n",
+	       name);
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.obj_size	= 256,
+		.batch		= 16,
+		.loops		= 10000,
+		.threads	= 8,
+	};
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t:l:s:n:h")) != -1) {
+		switch (opt) {
+		case 't':
+			opts.threads = atoi(optarg);
+			break;
+		case 'l':
+			opts.loops = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.obj_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (opts.threads < 1 || opts.threads > MAX_THREADS ||
+	    !opts.batch || opts.batch > MCACHE_BATCH_MAX || !opts.obj_size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = test_smm(&opts);
+	if (ret) {
+		printf("fail to cache smm objects (%d)\n", ret);
+		return 1;
+	}
+	ret = test_bmm(&opts);
+	if (ret) {
+		printf("fail to cache bmm blocks (%d)\n", ret);
+		return 1;
+	}
+	printf("Pass mcache test.\n");
+	return 0;
+}
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Compress a large buffer as gzip members on several sessions.
+ * - the output of wd_alg_compress_members() is read by zlib as one gzip
+ *   file, member by member as gunzip does;
+ * - each member has the size of its deflate data in the "Hi" subfield,
+ *   so members are found by their headers alone;
+ * - the members are decompressed back by wd_alg_decompress_members(), and
+ *   so are members of zlib without "Hi", which are inflated one by one;
+ * - headers with optional fields are parsed by wd_gzip_head_len();
+ * - requests that members can't serve are refused.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "test_lib.h"
+#include "wd_comp.h"
+
+#define MAX_SESS	8
+#define ZLIB_MEMBERS	3
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* walk members by the sizes in their headers, return the number of them */
+static int walk_members(unsigned char *buf, size_t len, size_t chunk_size)
+{
+	size_t off = 0;
+	uint32_t deflate_len;
+	int num = 0;
+
+	while (off < len) {
+		if (len - off < WD_GZIP_MEMBER_HEAD || buf[off] != 0x1f ||
+		    buf[off + 1] != 0x8b || buf[off + 12] != 'H' ||
+		    buf[off + 13] != 'i')
+			return -EINVAL;
+		deflate_len = get_le32(buf + off + 16);
+		off += WD_GZIP_MEMBER_HEAD + deflate_len;
+		/* ISIZE of each member but the last is the chunk */
+		if (off + 8 > len || (off + 8 < len &&
+		    get_le32(buf + off + 4) != chunk_size))
+			return -EINVAL;
+		off += 8;
+		num++;
+	}
+	return num;
+}
+
+static int alloc_sessions(handle_t *h, int num, char *alg)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		h[i] = wd_alg_comp_alloc_sess(alg, MODE_SW_FALLBACK, NULL);
+		if (!h[i]) {
+			while (i--)
+				wd_alg_comp_free_sess(h[i]);
+			return -ENODEV;
+		}
+	}
+	return 0;
+}
+
+static void free_sessions(handle_t *h, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		wd_alg_comp_free_sess(h[i]);
+}
+
+/* block_size is the size of a chunk, 0 for the default */
+static int test_compress(struct test_options *opts, unsigned char *in,
+			 unsigned char *out, size_t *out_len,
+			 unsigned char *back)
+{
+	struct wd_comp_arg arg;
+	handle_t h[MAX_SESS];
+	size_t len, chunk;
+	int ret, num;
+
+	ret = alloc_sessions(h, opts->q_num, "gzip");
+	if (ret)
+		return ret;
+	memset(&arg, 0, sizeof(arg));
+	arg.src = in;
+	arg.src_len = opts->total_len;
+	arg.dst = out;
+	arg.dst_len = *out_len;
+	ret = wd_alg_compress_members(h, opts->q_num, &arg, opts->block_size);
+	if (ret) {
+		fprintf(stderr, "fail to compress members (%d)\n", ret);
+		goto out;
+	}
+	if (arg.dst != out + arg.dst_len ||
+	    !(arg.status & STATUS_OUT_DRAINED)) {
+		fprintf(stderr, "bad output of %zu bytes\n", arg.dst_len);
+		ret = -EIO;
+		goto out;
+	}
+
+	chunk = opts->block_size ? opts->block_size : 512 << 10;
+	num = walk_members(out, arg.dst_len, chunk);
+	if (num != (opts->total_len + chunk - 1) / chunk) {
+		fprintf(stderr, "bad members (%d)\n", num);
+		ret = -EIO;
+		goto out;
+	}
+	len = opts->total_len;
+	ret = zlib_inflate(back, &len, out, arg.dst_len, 31);
+	if (ret || len != opts->total_len || memcmp(in, back, len)) {
+		fprintf(stderr, "zlib doesn't read the members\n");
+		ret = -EIO;
+	}
+	*out_len = arg.dst_len;
+out:
+	free_sessions(h, opts->q_num);
+	return ret;
+}
+
+/* decompress the members of test_compress() back */
+static int test_decompress(struct test_options *opts, unsigned char *in,
+			   unsigned char *out, size_t out_len,
+			   unsigned char *back)
+{
+	struct wd_comp_arg arg;
+	handle_t h[MAX_SESS];
+	int ret;
+
+	ret = alloc_sessions(h, opts->q_num, "gzip");
+	if (ret)
+		return ret;
+	memset(back, 0, opts->total_len);
+	memset(&arg, 0, sizeof(arg));
+	arg.src = out;
+	arg.src_len = out_len;
+	arg.dst = back;
+	arg.dst_len = opts->total_len;
+	ret = wd_alg_decompress_members(h, opts->q_num, &arg);
+	if (ret) {
+		fprintf(stderr, "fail to decompress members (%d)\n", ret);
+		goto out;
+	}
+	if (arg.dst_len != opts->total_len ||
+	    memcmp(in, back, opts->total_len)) {
+		fprintf(stderr, "bad output of %zu bytes\n", arg.dst_len);
+		ret = -EIO;
+	}
+out:
+	free_sessions(h, opts->q_num);
+	return ret;
+}
+
+/* gzip members of zlib have a name, a comment and a header CRC, no "Hi" */
+static int zlib_members(unsigned char *in, size_t size, unsigned char *out,
+			size_t *out_len)
+{
+	gz_header head;
+	z_stream zs;
+	size_t off = 0, len;
+	int i, ret;
+
+	memset(&head, 0, sizeof(head));
+	head.name = (Bytef *)"test_members";
+	head.comment = (Bytef *)"made by zlib";
+	head.hcrc = 1;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -ENOMEM;
+	zs.next_out = out;
+	zs.avail_out = *out_len;
+	for (i = 0; i < ZLIB_MEMBERS; i++) {
+		len = (size - off) / (ZLIB_MEMBERS - i);
+		if (deflateReset(&zs) != Z_OK || deflateSetHeader(&zs, &head)) {
+			ret = -EIO;
+			goto out;
+		}
+		zs.next_in = in + off;
+		zs.avail_in = len;
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		off += len;
+	}
+	*out_len = zs.next_out - out;
+	ret = 0;
+out:
+	deflateEnd(&zs);
+	return ret;
+}
+
+static int test_zlib_members(struct test_options *opts, unsigned char *in,
+			     unsigned char *out, size_t bound,
+			     unsigned char *back)
+{
+	size_t len = bound;
+	int ret;
+
+	ret = zlib_members(in, opts->total_len, out, &len);
+	if (ret) {
+		fprintf(stderr, "zlib fails to make members (%d)\n", ret);
+		return ret;
+	}
+	return test_decompress(opts, in, out, len, back);
+}
+
+/* a header with every optional field, and a subfield before "Hi" */
+static size_t make_head(unsigned char *buf, uint32_t deflate_len)
+{
+	unsigned char extra[] = { 'A', 'B', 4, 0, 1, 2, 3, 4,
+				  'H', 'i', 4, 0, 0, 0, 0, 0 };
+	size_t off = 10;
+
+	memset(buf, 0, off);
+	buf[0] = 0x1f;
+	buf[1] = 0x8b;
+	buf[2] = 0x08;
+	/* FHCRC, FEXTRA, FNAME and FCOMMENT */
+	buf[3] = 0x02 | 0x04 | 0x08 | 0x10;
+	buf[9] = 3;
+	buf[off++] = sizeof(extra);
+	buf[off++] = 0;
+	extra[12] = deflate_len;
+	extra[13] = deflate_len >> 8;
+	extra[14] = deflate_len >> 16;
+	extra[15] = deflate_len >> 24;
+	memcpy(buf + off, extra, sizeof(extra));
+	off += sizeof(extra);
+	memcpy(buf + off, "name", 5);
+	off += 5;
+	memcpy(buf + off, "comment", 8);
+	off += 8;
+	/* the CRC isn't checked by the parser */
+	buf[off++] = 0x12;
+	buf[off++] = 0x34;
+	return off;
+}
+
+static int test_head_len(void)
+{
+	unsigned char buf[64];
+	uint32_t deflate_len;
+	size_t len, i;
+	int ret;
+
+	wd_gzip_put_member_head(buf, 12345);
+	ret = wd_gzip_head_len(buf, WD_GZIP_MEMBER_HEAD, &deflate_len);
+	if (ret != WD_GZIP_MEMBER_HEAD || deflate_len != 12345) {
+		fprintf(stderr, "member head: %d, %u\n", ret, deflate_len);
+		return -EIO;
+	}
+
+	len = make_head(buf, 0x1234567);
+	ret = wd_gzip_head_len(buf, len, &deflate_len);
+	if (ret != len || deflate_len != 0x1234567) {
+		fprintf(stderr, "full head: %d, %u\n", ret, deflate_len);
+		return -EIO;
+	}
+	/* more bytes after the header don't count */
+	ret = wd_gzip_head_len(buf, sizeof(buf), NULL);
+	if (ret != len) {
+		fprintf(stderr, "longer buffer: %d\n", ret);
+		return -EIO;
+	}
+	for (i = 0; i < len; i++) {
+		ret = wd_gzip_head_len(buf, i, &deflate_len);
+		if (ret != -EAGAIN) {
+			fprintf(stderr, "truncated to %zu: %d\n", i, ret);
+			return -EIO;
+		}
+	}
+
+	buf[1] = 0x8c;
+	if (wd_gzip_head_len(buf, len, NULL) != -EINVAL)
+		return -EIO;
+	buf[1] = 0x8b;
+	/* a reserved flag */
+	buf[3] |= 0x20;
+	if (wd_gzip_head_len(buf, len, NULL) != -EINVAL)
+		return -EIO;
+	return 0;
+}
+
+/* the output doesn't fit, or the sessions can't make members */
+static int test_refuse(struct test_options *opts, unsigned char *in,
+		       unsigned char *out)
+{
+	struct wd_comp_arg arg;
+	handle_t h[MAX_SESS];
+	int ret;
+
+	ret = alloc_sessions(h, 1, "gzip");
+	if (ret)
+		return ret;
+	memset(&arg, 0, sizeof(arg));
+	arg.src = in;
+	arg.src_len = opts->total_len;
+	arg.dst = out;
+	arg.dst_len = opts->total_len / 100;
+	ret = wd_alg_compress_members(h, 1, &arg, 0);
+	if (ret != -ENOSPC) {
+		fprintf(stderr, "small dst: %d\n", ret);
+		goto out;
+	}
+	free_sessions(h, 1);
+
+	ret = alloc_sessions(h, 1, "zlib");
+	if (ret)
+		return ret;
+	arg.dst_len = opts->total_len;
+	ret = wd_alg_compress_members(h, 1, &arg, 0);
+	if (ret != -EINVAL) {
+		fprintf(stderr, "zlib session: %d\n", ret);
+		goto out;
+	}
+	ret = 0;
+out:
+	free_sessions(h, 1);
+	return ret ? -EIO : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.total_len	= 5 << 20,
+		.block_size	= 0,
+		.q_num		= 2,
+	};
+	unsigned char *in, *out, *back;
+	size_t bound, len;
+	int opt, ret;
+	int show_help = 0;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING)) != -1)
+		show_help = parse_common_option(opt, optarg, &opts);
+
+	SYS_ERR_COND(show_help || optind > argc || opts.q_num > MAX_SESS,
+		     COMMON_HELP
+		     "  the block size is the size of a member, and the number\n"
+		     "  of queues is the number of sessions, up to 8\n",
+		     argv[0]
+		    );
+
+	bound = opts.total_len + (opts.total_len >> 3) + (64 << 10);
+	in = malloc(opts.total_len);
+	out = malloc(bound);
+	back = malloc(opts.total_len);
+	if (!in || !out || !back) {
+		printf("fail to allocate buffers\n");
+		return 1;
+	}
+	hizip_fill_text(in, opts.total_len, 1);
+
+	ret = test_head_len();
+	if (ret) {
+		printf("fail to parse gzip headers (%d)\n", ret);
+		return 1;
+	}
+	len = bound;
+	ret = test_compress(&opts, in, out, &len, back);
+	if (ret) {
+		printf("fail to compress members (%d)\n", ret);
+		return 1;
+	}
+	ret = test_decompress(&opts, in, out, len, back);
+	if (ret) {
+		printf("fail to decompress members (%d)\n", ret);
+		return 1;
+	}
+	ret = test_zlib_members(&opts, in, out, bound, back);
+	if (ret) {
+		printf("fail to decompress members of zlib (%d)\n", ret);
+		return 1;
+	}
+	ret = test_refuse(&opts, in, out);
+	if (ret) {
+		printf("fail to refuse requests (%d)\n", ret);
+		return 1;
+	}
+	free(back);
+	free(out);
+	free(in);
+	printf("Pass members test.\n");
+	return 0;
+}
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Compress and decompress raw deflate data.
+ * - "deflate" sessions, and "zlib" and "gzip" sessions with FLAG_RAW, make
+ *   deflate data without header and trailer, which is checked by zlib;
+ * - the data is decompressed back on the same sessions;
+ * - raw data can't be made into gzip members, so members refuse it;
+ * - sessions only run on zlib of CPU with MODE_SW_FALLBACK.
+ */
+#include <string.h>
+
+#include "test_lib.h"
+#include "wd_comp.h"
+
+static int test_raw(char *alg, uint32_t flag, struct test_options *opts,
+		    unsigned int seed)
+{
+	size_t size = opts->total_len, bound, len;
+	unsigned char *in, *out, *back;
+	struct wd_comp_arg arg;
+	handle_t h;
+	int ret = -ENOMEM;
+
+	h = wd_alg_comp_alloc_sess(alg, MODE_SW_FALLBACK, NULL);
+	if (!h)
+		return -ENODEV;
+	bound = size + (size >> 3) + 1024;
+	in = malloc(size);
+	out = malloc(bound);
+	back = malloc(size);
+	if (!in || !out || !back)
+		goto out;
+	hizip_fill_text(in, size, seed);
+
+	memset(&arg, 0, sizeof(arg));
+	arg.src = in;
+	arg.src_len = size;
+	arg.dst = out;
+	arg.dst_len = bound;
+	arg.flag = flag | FLAG_INPUT_FINISH;
+	ret = wd_alg_compress(h, &arg);
+	if (ret) {
+		fprintf(stderr, "fail to compress on %s (%d)\n", alg, ret);
+		goto out;
+	}
+	/* raw deflate data for zlib */
+	len = size;
+	ret = zlib_inflate(back, &len, out, arg.dst_len, -15);
+	if (ret || len != size || memcmp(in, back, len)) {
+		fprintf(stderr, "%s: zlib doesn't read raw data\n", alg);
+		ret = -EIO;
+		goto out;
+	}
+
+	memset(back, 0, size);
+	arg.src = out;
+	arg.src_len = arg.dst_len;
+	arg.dst = back;
+	arg.dst_len = size;
+	arg.flag = flag | FLAG_INPUT_FINISH;
+	arg.status = 0;
+	ret = wd_alg_decompress(h, &arg);
+	if (ret) {
+		fprintf(stderr, "fail to decompress on %s (%d)\n", alg, ret);
+		goto out;
+	}
+	if (arg.dst_len != size || memcmp(in, back, size)) {
+		fprintf(stderr, "%s: bad output of %zu bytes\n", alg,
+			arg.dst_len);
+		ret = -EIO;
+	}
+out:
+	free(back);
+	free(out);
+	free(in);
+	wd_alg_comp_free_sess(h);
+	return ret;
+}
+
+/* members have gzip headers, so raw requests and sessions are refused */
+static int test_members(void)
+{
+	unsigned char src[64], dst[256];
+	struct wd_comp_arg arg;
+	handle_t h;
+	int ret = -EIO;
+
+	memset(src, 'a', sizeof(src));
+	h = wd_alg_comp_alloc_sess("gzip", MODE_SW_FALLBACK, NULL);
+	if (!h)
+		return -ENODEV;
+	memset(&arg, 0, sizeof(arg));
+	arg.src = src;
+	arg.src_len = sizeof(src);
+	arg.dst = dst;
+	arg.dst_len = sizeof(dst);
+	arg.flag = FLAG_RAW;
+	if (wd_alg_compress_members(&h, 1, &arg, 0) != -EINVAL ||
+	    wd_alg_decompress_members(&h, 1, &arg) != -EINVAL)
+		goto out;
+	wd_alg_comp_free_sess(h);
+
+	h = wd_alg_comp_alloc_sess("deflate", MODE_SW_FALLBACK, NULL);
+	if (!h)
+		return -ENODEV;
+	arg.flag = 0;
+	if (wd_alg_compress_members(&h, 1, &arg, 0) != -EINVAL ||
+	    wd_alg_decompress_members(&h, 1, &arg) != -EINVAL)
+		goto out;
+	ret = 0;
+out:
+	wd_alg_comp_free_sess(h);
+	return ret;
+}
+
+/* the driver is reported, and zlib of CPU isn't taken without the flag */
+static int test_drv(void)
+{
+	const char *drv;
+	handle_t h;
+	int ret = 0;
+
+	h = wd_alg_comp_alloc_sess("zlib", MODE_SW_FALLBACK, NULL);
+	if (!h)
+		return -ENODEV;
+	drv = wd_alg_comp_get_drv(h);
+	if (!drv || !*drv)
+		ret = -EIO;
+	wd_alg_comp_free_sess(h);
+	if (ret)
+		return ret;
+
+	h = wd_alg_comp_alloc_sess("zlib", 0, NULL);
+	if (h && !strcmp(wd_alg_comp_get_drv(h), "sw_zlib"))
+		ret = -EIO;
+	wd_alg_comp_free_sess(h);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.total_len	= 300000,
+		.run_num	= 10,
+	};
+	char *algs[] = { "deflate", "zlib", "gzip" };
+	int opt, i, j, ret;
+	int show_help = 0;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING)) != -1)
+		show_help = parse_common_option(opt, optarg, &opts);
+
+	SYS_ERR_COND(show_help || optind > argc, COMMON_HELP, argv[0]);
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < opts.run_num; j++) {
+			/* "deflate" is raw without the flag */
+			ret = test_raw(algs[i], i ? FLAG_RAW : 0, &opts,
+				       j + 1);
+			if (ret) {
+				printf("fail to test raw data on %s (%d)\n",
+				       algs[i], ret);
+				return 1;
+			}
+		}
+	}
+	ret = test_members();
+	if (ret) {
+		printf("fail to refuse raw members (%d)\n", ret);
+		return 1;
+	}
+	ret = test_drv();
+	if (ret) {
+		printf("fail to choose the driver (%d)\n", ret);
+		return 1;
+	}
+	printf("Pass raw test.\n");
+	return 0;
+}
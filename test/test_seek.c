@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Write and read a seekable gzip file.
+ * - the input is written by pieces of random sizes, and read back at
+ *   random offsets, across chunks and past the end;
+ * - the whole file is still read by zlib as gunzip does;
+ * - footers with chunk numbers out of the index are refused.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "test_lib.h"
+#include "wd_seek.h"
+
+/* the footer data is after the header, XLEN and the subfield header */
+#define FOOTER_DATA	16
+
+static int write_file(handle_t h, int fd, unsigned char *in,
+		      struct test_options *opts)
+{
+	unsigned int seed = 2;
+	handle_t w;
+	size_t off, len;
+	int ret;
+
+	w = wd_seek_writer_create(h, fd, opts->block_size);
+	if (!w)
+		return -ENOMEM;
+	for (off = 0; off < opts->total_len; off += len) {
+		len = rand_r(&seed) % (3 * WD_SEEK_CHUNK);
+		if (len > opts->total_len - off)
+			len = opts->total_len - off;
+		ret = wd_seek_write(w, in + off, len);
+		if (ret) {
+			wd_seek_writer_close(w);
+			return ret;
+		}
+	}
+	return wd_seek_writer_close(w);
+}
+
+static int read_file(handle_t h, int fd, unsigned char *in,
+		     unsigned char *buf, struct test_options *opts)
+{
+	size_t size = opts->total_len, len, exp;
+	unsigned int seed = 3;
+	uint64_t off;
+	ssize_t got;
+	handle_t r;
+	int i, ret = -EIO;
+
+	r = wd_seek_reader_open(h, fd);
+	if (!r)
+		return -EINVAL;
+	if (wd_seek_size(r) != size)
+		goto out;
+	for (i = 0; i < opts->run_num; i++) {
+		off = rand_r(&seed) % (size + 1);
+		len = rand_r(&seed) % (4 * WD_SEEK_CHUNK);
+		got = wd_seek_read(r, buf, len, off);
+		exp = len < size - off ? len : size - off;
+		if (got != exp || memcmp(buf, in + off, exp)) {
+			fprintf(stderr, "read %zu at %lu: %zd\n", len,
+				(unsigned long)off, got);
+			goto out;
+		}
+	}
+	if (wd_seek_read(r, buf, 1, size + 1) != 0)
+		goto out;
+	ret = 0;
+out:
+	wd_seek_reader_close(r);
+	return ret;
+}
+
+/* read the file as gunzip does, all members in a row */
+static int gunzip_file(int fd, unsigned char *in, unsigned char *buf,
+		       struct test_options *opts)
+{
+	size_t len = opts->total_len;
+	unsigned char *file;
+	struct stat st;
+	int ret = -EIO;
+
+	if (fstat(fd, &st))
+		return -EIO;
+	file = malloc(st.st_size);
+	if (!file)
+		return -ENOMEM;
+	if (pread(fd, file, st.st_size, 0) == st.st_size)
+		ret = zlib_inflate(buf, &len, file, st.st_size, 31);
+	if (!ret && (len != opts->total_len || memcmp(in, buf, len)))
+		ret = -EIO;
+	free(file);
+	return ret;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		p[i] = v >> (8 * i);
+}
+
+/* footers with more chunks than the index has, or sizes that wrap */
+static int test_bad_footer(handle_t h, int fd)
+{
+	unsigned char footer[WD_SEEK_FOOTER], bad[WD_SEEK_FOOTER];
+	off_t end = lseek(fd, 0, SEEK_END) - WD_SEEK_FOOTER;
+	handle_t r;
+	int ret = 0;
+
+	if (pread(fd, footer, sizeof(footer), end) != sizeof(footer))
+		return -EIO;
+	memcpy(bad, footer, sizeof(bad));
+	put_le(bad + FOOTER_DATA + 8, 0xFFFFFFFFULL, 8);
+	put_le(bad + FOOTER_DATA + 16, 1, 4);
+	put_le(bad + FOOTER_DATA + 20, 0xFFFFFFFFU, 4);
+	if (pwrite(fd, bad, sizeof(bad), end) != sizeof(bad))
+		return -EIO;
+	r = wd_seek_reader_open(h, fd);
+	if (r) {
+		wd_seek_reader_close(r);
+		ret = -EIO;
+	}
+	/* the input size that wraps with chunk_size added */
+	put_le(bad + FOOTER_DATA + 8, UINT64_MAX - 1, 8);
+	put_le(bad + FOOTER_DATA + 16, 4, 4);
+	put_le(bad + FOOTER_DATA + 20, 0, 4);
+	if (pwrite(fd, bad, sizeof(bad), end) != sizeof(bad))
+		return -EIO;
+	r = wd_seek_reader_open(h, fd);
+	if (r) {
+		wd_seek_reader_close(r);
+		ret = -EIO;
+	}
+	if (pwrite(fd, footer, sizeof(footer), end) != sizeof(footer))
+		return -EIO;
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test_options opts = {
+		.total_len	= 3 << 20,
+		.block_size	= 0,
+		.run_num	= 500,
+	};
+	char path[] = "/tmp/test_seek.XXXXXX";
+	unsigned char *in, *buf;
+	int opt, fd, ret;
+	int show_help = 0;
+	handle_t h;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING)) != -1)
+		show_help = parse_common_option(opt, optarg, &opts);
+
+	SYS_ERR_COND(show_help || optind > argc,
+		     COMMON_HELP
+		     "  the block size is the size of a chunk, and the number\n"
+		     "  of runs is the number of random reads\n",
+		     argv[0]
+		    );
+
+	in = malloc(opts.total_len + 1);
+	buf = malloc(opts.total_len + 4 * WD_SEEK_CHUNK);
+	fd = mkstemp(path);
+	if (!in || !buf || fd < 0) {
+		printf("fail to prepare the test\n");
+		return 1;
+	}
+	unlink(path);
+	hizip_fill_text(in, opts.total_len, 1);
+	h = wd_alg_comp_alloc_sess("gzip", MODE_SW_FALLBACK, NULL);
+	if (!h) {
+		printf("fail to allocate a gzip session\n");
+		return 1;
+	}
+
+	ret = write_file(h, fd, in, &opts);
+	if (ret) {
+		printf("fail to write the file (%d)\n", ret);
+		return 1;
+	}
+	ret = read_file(h, fd, in, buf, &opts);
+	if (ret) {
+		printf("fail to read the file (%d)\n", ret);
+		return 1;
+	}
+	ret = gunzip_file(fd, in, buf, &opts);
+	if (ret) {
+		printf("fail to read the file by zlib (%d)\n", ret);
+		return 1;
+	}
+	ret = test_bad_footer(h, fd);
+	if (ret) {
+		printf("fail to refuse a bad footer (%d)\n", ret);
+		return 1;
+	}
+	ret = read_file(h, fd, in, buf, &opts);
+	if (ret) {
+		printf("fail to read the file again (%d)\n", ret);
+		return 1;
+	}
+
+	wd_alg_comp_free_sess(h);
+	close(fd);
+	free(buf);
+	free(in);
+	printf("Pass seek test.\n");
+	return 0;
+}
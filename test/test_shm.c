@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Share buffers of a memfd pool between processes.
+ * - the parent fills buffers and hands them to a child process over a
+ *   pipe, the child attaches the pool by the inherited fd, compresses each
+ *   buffer into another one of the pool, and hands that one back;
+ * - both sides drop their references, and the parent checks that every
+ *   buffer is freed with the last reference;
+ * - references of freed buffers and offsets out of the pool are refused.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "test_lib.h"
+#include "wd_comp.h"
+#include "wd_shm.h"
+
+#define SHM_WINDOW	8	/* buffers handed to the child at most */
+#define SHM_EXTRA	1024	/* output is a bit larger than input */
+
+/*
+ * total_len is the size of the pool, block_size is the size of a buffer,
+ * and run_num is the number of buffers.
+ */
+struct shm_options {
+	struct test_options	common;
+	unsigned int		pool_block;
+};
+
+static int write_u64(int fd, uint64_t v)
+{
+	return write(fd, &v, sizeof(v)) == sizeof(v) ? 0 : -EIO;
+}
+
+static int read_u64(int fd, uint64_t *v)
+{
+	return read(fd, v, sizeof(*v)) == sizeof(*v) ? 0 : -EIO;
+}
+
+/* compress the buffers from in, and hand the output back to out */
+static int run_child(int shm_fd, int in, int out, struct test_options *opts)
+{
+	struct wd_comp_arg arg;
+	struct wd_shm *shm;
+	uint64_t off, dst;
+	handle_t h;
+	int i, ret = -EIO;
+
+	shm = wd_shm_attach(shm_fd);
+	if (!shm) {
+		fprintf(stderr, "child: fail to attach the pool\n");
+		return -EINVAL;
+	}
+	h = wd_alg_comp_alloc_sess("gzip", MODE_SW_FALLBACK, NULL);
+	if (!h)
+		goto out;
+	for (i = 0; i < opts->run_num; i++) {
+		if (read_u64(in, &off))
+			goto out_sess;
+		dst = wd_shm_alloc(shm, opts->block_size + SHM_EXTRA);
+		if (!dst) {
+			fprintf(stderr, "child: no room for output\n");
+			goto out_sess;
+		}
+		memset(&arg, 0, sizeof(arg));
+		arg.src = wd_shm_ptr(shm, off);
+		arg.src_len = opts->block_size;
+		arg.dst = wd_shm_ptr(shm, dst);
+		arg.dst_len = opts->block_size + SHM_EXTRA;
+		arg.flag = FLAG_INPUT_FINISH;
+		ret = wd_alg_compress(h, &arg);
+		/* done with the input */
+		if (wd_shm_put(shm, off))
+			ret = -EINVAL;
+		if (!ret)
+			ret = write_u64(out, dst) ?: write_u64(out, arg.dst_len);
+		if (ret) {
+			wd_shm_put(shm, dst);
+			goto out_sess;
+		}
+		/* the reference is handed over with the offset */
+	}
+	ret = 0;
+out_sess:
+	wd_alg_comp_free_sess(h);
+out:
+	wd_shm_close(shm);
+	return ret;
+}
+
+static int check_output(struct wd_shm *shm, uint64_t off, size_t len,
+			size_t size, int id)
+{
+	unsigned char *exp, *back;
+	int ret = -ENOMEM;
+
+	exp = malloc(size);
+	back = malloc(size);
+	if (!exp || !back)
+		goto out;
+	hizip_fill_text(exp, size, id + 1);
+	ret = zlib_inflate(back, &size, wd_shm_ptr(shm, off), len, 31);
+	if (!ret && memcmp(exp, back, size))
+		ret = -EIO;
+out:
+	free(back);
+	free(exp);
+	return ret;
+}
+
+/* hand buffers to the child, and check what it hands back */
+static int test_share(struct shm_options *sopts)
+{
+	struct test_options *opts = &sopts->common;
+	int to_child[2], to_parent[2], status, i, done, ret = -EIO;
+	struct bmm_stats st;
+	struct wd_shm *shm;
+	uint64_t off, len;
+	pid_t pid;
+
+	shm = wd_shm_create("test_shm", opts->total_len, sopts->pool_block);
+	if (!shm)
+		return -ENOMEM;
+	if (pipe(to_child) || pipe(to_parent))
+		goto out;
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (!pid) {
+		close(to_child[1]);
+		close(to_parent[0]);
+		ret = run_child(dup(wd_shm_fd(shm)), to_child[0],
+				to_parent[1], opts);
+		_exit(ret ? 1 : 0);
+	}
+	close(to_child[0]);
+	close(to_parent[1]);
+
+	/* keep a few buffers in the child, so the pool isn't run out */
+	for (i = 0, done = 0; done < opts->run_num; ) {
+		if (i < opts->run_num && i - done < SHM_WINDOW) {
+			off = wd_shm_alloc(shm, opts->block_size);
+			if (!off) {
+				fprintf(stderr, "no room for buffer %d\n", i);
+				goto out_wait;
+			}
+			hizip_fill_text(wd_shm_ptr(shm, off), opts->block_size,
+					i + 1);
+			/* one for the child, and drop ours after it's sent */
+			if (wd_shm_get(shm, off) ||
+			    write_u64(to_child[1], off) ||
+			    wd_shm_put(shm, off))
+				goto out_wait;
+			i++;
+			continue;
+		}
+		if (read_u64(to_parent[0], &off) ||
+		    read_u64(to_parent[0], &len))
+			goto out_wait;
+		if (check_output(shm, off, len, opts->block_size, done)) {
+			fprintf(stderr, "bad output of buffer %d\n", done);
+			goto out_wait;
+		}
+		if (wd_shm_put(shm, off))
+			goto out_wait;
+		/* the last reference is gone */
+		if (wd_shm_put(shm, off) != -EINVAL ||
+		    wd_shm_get(shm, off) != -EINVAL) {
+			fprintf(stderr, "buffer %d is referred after free\n",
+				done);
+			goto out_wait;
+		}
+		done++;
+	}
+	ret = 0;
+out_wait:
+	close(to_child[1]);
+	close(to_parent[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		fprintf(stderr, "the child fails\n");
+		ret = -EIO;
+	}
+	if (!ret && (wd_shm_get_stats(shm, &st) || st.used)) {
+		fprintf(stderr, "%zu bytes aren't freed\n", st.used);
+		ret = -EIO;
+	}
+out:
+	wd_shm_close(shm);
+	return ret;
+}
+
+/* offsets out of buffers and fds of other files are refused */
+static int test_invalid(struct shm_options *sopts)
+{
+	struct test_options *opts = &sopts->common;
+	struct wd_shm *shm;
+	uint64_t off;
+	int fd, ret = -EIO;
+
+	shm = wd_shm_create("test_shm", opts->total_len, sopts->pool_block);
+	if (!shm)
+		return -ENOMEM;
+	off = wd_shm_alloc(shm, 1);
+	if (!off || wd_shm_get(shm, 0) != -EINVAL ||
+	    wd_shm_put(shm, 1) != -EINVAL ||
+	    wd_shm_put(shm, UINT64_MAX) != -EINVAL ||
+	    wd_shm_ptr(shm, UINT64_MAX) ||
+	    wd_shm_off(shm, &off) ||
+	    wd_shm_off(shm, wd_shm_ptr(shm, off)) != off)
+		goto out;
+	if (wd_shm_alloc(shm, opts->total_len + 1))
+		goto out;
+	if (wd_shm_put(shm, off))
+		goto out;
+
+	/* not a pool */
+	fd = dup(STDIN_FILENO);
+	if (fd >= 0 && wd_shm_attach(fd))
+		goto out;
+	if (fd >= 0)
+		close(fd);
+	ret = 0;
+out:
+	wd_shm_close(shm);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct shm_options opts = {
+		.common = {
+			.total_len	= 8 << 20,
+			.block_size	= 100000,
+			.run_num	= 200,
+		},
+		.pool_block	= 4096,
+	};
+	int opt, ret;
+	int show_help = 0;
+
+	while ((opt = getopt(argc, argv, COMMON_OPTSTRING "k:")) != -1) {
+		switch (opt) {
+		case 'k':
+			opts.pool_block = strtoul(optarg, NULL, 0);
+			if (!opts.pool_block)
+				show_help = 1;
+			break;
+		default:
+			show_help = parse_common_option(opt, optarg,
+							&opts.common);
+			break;
+		}
+	}
+
+	SYS_ERR_COND(show_help || optind > argc,
+		     COMMON_HELP
+		     "  -k <size>     block size of the pool\n",
+		     argv[0]
+		    );
+
+	ret = test_invalid(&opts);
+	if (ret) {
+		printf("fail to refuse invalid references (%d)\n", ret);
+		return 1;
+	}
+	ret = test_share(&opts);
+	if (ret) {
+		printf("fail to share buffers between processes (%d)\n", ret);
+		return 1;
+	}
+	printf("Pass shm test.\n");
+	return 0;
+}
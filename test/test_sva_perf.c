@@ -53,6 +53,14 @@ enum hizip_stats_variable {
 
 	ST_COMPRESSION_RATIO,
 
+	/* Latency from submit to complete, in ns */
+	ST_LAT_P50,
+	ST_LAT_P99,
+	ST_LAT_P999,
+
+	/* In-flight window at the end of the run */
+	ST_WINDOW,
+
 	NUM_STATS
 };
 
@@ -262,6 +270,7 @@ static int run_one_test(struct priv_options *opts, struct hizip_stats *stats)
 	struct timespec setup_cputime, start_cputime, end_cputime;
 	struct rusage setup_rusage, start_rusage, end_rusage;
 	int stat_size = sizeof(*sched.stat) * copts->q_num;
+	struct wd_hist lat, lat_run;
 
 	stats->v[ST_SEND] = stats->v[ST_RECV] = stats->v[ST_SEND_RETRY] =
 			    stats->v[ST_RECV_RETRY] = 0;
@@ -316,6 +325,8 @@ static int run_one_test(struct priv_options *opts, struct hizip_stats *stats)
 
 	if (opts->option & USE_POLL)
 		sched.poll = true;
+	sched.lat_stat = true;
+	wd_hist_reset(&lat);
 
 	if (!(opts->option & TEST_ZLIB)) {
 		ret = hizip_test_init(&sched, copts, &default_test_ops, &ctx);
@@ -354,6 +365,9 @@ static int run_one_test(struct priv_options *opts, struct hizip_stats *stats)
 			stats->v[ST_RECV_RETRY] += sched.stat[i].recv_retries;
 			memset(sched.stat, 0, stat_size);
 		}
+		if (!wd_sched_get_hist(&sched, -1, WD_SCHED_LAT_HW, &lat_run))
+			wd_hist_merge(&lat, &lat_run);
+		wd_sched_reset_hist(&sched);
 	}
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &end_time);
@@ -396,6 +410,11 @@ static int run_one_test(struct priv_options *opts, struct hizip_stats *stats)
 
 	stats->v[ST_IOPF] = perf_event_put(perf_fds, nr_fds);
 
+	stats->v[ST_LAT_P50] = wd_cycles_to_ns(wd_hist_percentile(&lat, 50));
+	stats->v[ST_LAT_P99] = wd_cycles_to_ns(wd_hist_percentile(&lat, 99));
+	stats->v[ST_LAT_P999] = wd_cycles_to_ns(wd_hist_percentile(&lat, 99.9));
+	stats->v[ST_WINDOW] = sched.win;
+
 	v = stats->v[ST_RUN_TIME] + stats->v[ST_SETUP_TIME];
 	stats->v[ST_CPU_IDLE] = (v - stats->v[ST_CPU_TIME]) / v * 100;
 	stats->v[ST_FAULTS] = stats->v[ST_MAJFLT] + stats->v[ST_MINFLT];
@@ -470,7 +489,7 @@ static int comp_std(struct hizip_stats *std, struct hizip_stats *variation,
 	return 0;
 }
 
-static const int csv_format_version = 4;
+static const int csv_format_version = 6;
 
 static void output_csv_header(void)
 {
@@ -505,7 +524,11 @@ static void output_csv_header(void)
 	/* Percent of CPU idle time */
 	printf("cpu_idle;");
 	/* Compression ratio (output / input) in percent */
-	printf("compression_ratio");
+	printf("compression_ratio;");
+	/* Latency percentiles in ns */
+	printf("lat_p50;lat_p99;lat_p999;");
+	/* In-flight window */
+	printf("window");
 	printf("\n");
 }
 
@@ -528,7 +551,10 @@ static void output_csv_stats(struct hizip_stats *s, struct priv_options *opts)
 	printf("%.0f;", s->v[ST_SIGNALS]);
 	printf("%.3f;%.3f;", s->v[ST_SPEED], s->v[ST_TOTAL_SPEED]);
 	printf("%.3f;", s->v[ST_CPU_IDLE]);
-	printf("%.1f", s->v[ST_COMPRESSION_RATIO]);
+	printf("%.1f;", s->v[ST_COMPRESSION_RATIO]);
+	printf("%.0f;%.0f;%.0f;", s->v[ST_LAT_P50], s->v[ST_LAT_P99],
+	       s->v[ST_LAT_P999]);
+	printf("%.0f", s->v[ST_WINDOW]);
 	printf("\n");
 }
 
@@ -597,7 +623,11 @@ static int run_test(struct priv_options *opts)
 		" iopf          %12.0f     ±%0.1f%%\n"
 		" voluntary cs  %12.0f     ±%0.1f%%\n"
 		" invol cs      %12.0f     ±%0.1f%%\n"
-		" compression   %12.0f %%   ±%0.1f%%\n",
+		" compression   %12.0f %%   ±%0.1f%%\n"
+		" latency p50   %12.2f us  ±%0.1f%%\n"
+		" latency p99   %12.2f us  ±%0.1f%%\n"
+		" latency p99.9 %12.2f us  ±%0.1f%%\n"
+		" window        %12.0f     ±%0.1f%%\n",
 		avg.v[ST_SEND],			variation.v[ST_SEND],
 		avg.v[ST_RECV],			variation.v[ST_RECV],
 		avg.v[ST_SEND_RETRY],		variation.v[ST_SEND_RETRY],
@@ -612,7 +642,11 @@ static int run_test(struct priv_options *opts)
 		avg.v[ST_IOPF],			variation.v[ST_IOPF],
 		avg.v[ST_VCTX],			variation.v[ST_VCTX],
 		avg.v[ST_INVCTX],		variation.v[ST_INVCTX],
-		avg.v[ST_COMPRESSION_RATIO],	variation.v[ST_COMPRESSION_RATIO]);
+		avg.v[ST_COMPRESSION_RATIO],	variation.v[ST_COMPRESSION_RATIO],
+		avg.v[ST_LAT_P50] / 1000,	variation.v[ST_LAT_P50],
+		avg.v[ST_LAT_P99] / 1000,	variation.v[ST_LAT_P99],
+		avg.v[ST_LAT_P999] / 1000,	variation.v[ST_LAT_P999],
+		avg.v[ST_WINDOW],		variation.v[ST_WINDOW]);
 
 	return 0;
 }
@@ -110,3 +110,40 @@ int zlib_deflate(void *output, unsigned int out_size,
 
 	return ret;
 }
+
+/*
+ * Inflate all of input into output by zLib, member after member as gunzip
+ * does. window_bits is 15 for zlib, 31 for gzip and -15 for raw deflate.
+ * out_size is the size of output, and it's set to the size of the data.
+ *
+ * Return 0 if input ends with the end of a stream, or an error.
+ */
+int zlib_inflate(void *output, size_t *out_size, void *input, size_t in_size,
+		 int window_bits)
+{
+	int ret;
+	z_stream stream = {
+		.next_in	= input,
+		.avail_in	= in_size,
+		.next_out	= output,
+		.avail_out	= *out_size,
+	};
+
+	ret = inflateInit2(&stream, window_bits);
+	if (ret != Z_OK) {
+		WD_ERR("zlib inflateInit: %d\n", ret);
+		return -EINVAL;
+	}
+
+	do {
+		ret = inflate(&stream, Z_FINISH);
+		/* total_out is reset with each member */
+		if (ret == Z_STREAM_END && stream.avail_in)
+			ret = inflateReset(&stream);
+	} while (ret == Z_OK);
+
+	*out_size = (unsigned char *)stream.next_out -
+		    (unsigned char *)output;
+	inflateEnd(&stream);
+	return (ret == Z_STREAM_END && !stream.avail_in) ? 0 : -EIO;
+}
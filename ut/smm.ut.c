@@ -0,0 +1,159 @@
+#include "ut.c"
+
+#include "../smm.c"
+
+#define REGION_ALIGN	4096
+
+/* size the region the way the drivers do, and fill it with 2 * n blocks */
+static void fill_region(size_t size, int n)
+{
+	size_t region_size = 4096 + n * smm_block_size(size, 0xF) * 2;
+	struct smm_stats st;
+	void *region, **blk;
+	int i, ret;
+
+	region = aligned_alloc(REGION_ALIGN, region_size);
+	blk = calloc(2 * n, sizeof(*blk));
+	ut_assert(region && blk);
+
+	ret = smm_init(region, region_size, 0xF);
+	ut_assert(!ret);
+	for (i = 0; i < 2 * n; i++) {
+		blk[i] = smm_alloc(region, size);
+		ut_assert_str(blk[i], "size %ld: block %d of %d\n",
+			      size, i, 2 * n);
+		ut_assert(((uintptr_t)blk[i] & 0xF) == 0);
+		ut_assert((char *)blk[i] + size <= (char *)region +
+			  region_size);
+		memset(blk[i], i, size);
+	}
+	for (i = 0; i < 2 * n; i++)
+		ut_assert(((char *)blk[i])[size - 1] == (char)i);
+
+	/* every other one back, then all of them again */
+	for (i = 0; i < 2 * n; i += 2)
+		smm_free(region, blk[i]);
+	for (i = 0; i < 2 * n; i += 2) {
+		blk[i] = smm_alloc(region, size);
+		ut_assert(blk[i]);
+	}
+	for (i = 0; i < 2 * n; i++)
+		smm_free(region, blk[i]);
+	ret = smm_get_stats(region, &st);
+	ut_assert(!ret && !st.used);
+	smm_fini(region);
+	free(blk);
+	free(region);
+}
+
+void case_caller_size(void) {
+	static const size_t sizes[] = {
+		1024000,	/* test_sva_perf -b 512000 */
+		1 << 20,	/* BLOCK_MAX */
+		200000,		/* not a multiple of the unit */
+		65536 + 16,
+		3000,
+	};
+	int i, n;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (n = 1; n <= 16; n++)
+			fill_region(sizes[i], n);
+	}
+}
+
+/* freed blocks merge back, so the whole region could be taken again */
+void case_merge(void) {
+	size_t region_size = 4096 + 500 * 4096;
+	void *region, *a, *b, *c;
+	int ret;
+
+	region = aligned_alloc(REGION_ALIGN, region_size);
+	ut_assert(region);
+	ret = smm_init(region, region_size, 0xF);
+	ut_assert(!ret);
+
+	a = smm_alloc(region, 250 * 4096);
+	b = smm_alloc(region, 100);
+	c = smm_alloc(region, 249 * 4096);
+	ut_assert(a && b && c);
+	ut_assert(!smm_alloc(region, 4096));
+	smm_free(region, b);
+	b = smm_alloc(region, 4096);
+	ut_assert(b);
+	smm_free(region, a);
+	smm_free(region, b);
+	smm_free(region, c);
+
+	a = smm_alloc(region, 500 * 4096);
+	ut_assert(a);
+	ut_assert(!smm_alloc(region, 16));
+	smm_free(region, a);
+	ut_assert(!smm_alloc(region, 501 * 4096));
+	smm_fini(region);
+	free(region);
+}
+
+/* no run that a block of the order fits in starts before run_from */
+static void check_run_from(struct smm_pool *p)
+{
+	int32_t i, j, len, min;
+	int o;
+
+	for (i = 0; i < p->nunits; i = j) {
+		if (p->units[i].state != SMM_U_FREE) {
+			j = i + __span(p, i);
+			continue;
+		}
+		for (j = i, len = 0; j < p->nunits &&
+		     p->units[j].state == SMM_U_FREE; j += 1 << p->units[j].order)
+			len += 1 << p->units[j].order;
+		for (o = 0; o < SMM_MAX_ORDER; o++) {
+			min = o ? (1 << (o - 1)) + 1 : 1;
+			ut_assert(len < min || p->run_from[o] <= i);
+		}
+	}
+}
+
+/* large blocks of random sizes are taken and given back at random */
+void case_run_from(void) {
+	size_t region_size = 4096 + 1000 * 4096;
+	unsigned int seed = 1;
+	struct smm_stats st;
+	void *region, *blk[64] = { NULL };
+	int i, k, ret;
+
+	region = aligned_alloc(REGION_ALIGN, region_size);
+	ut_assert(region);
+	ret = smm_init(region, region_size, 0xF);
+	ut_assert(!ret);
+
+	for (i = 0; i < 20000; i++) {
+		k = rand_r(&seed) % 64;
+		if (blk[k]) {
+			smm_free(region, blk[k]);
+			blk[k] = NULL;
+		} else {
+			blk[k] = smm_alloc(region,
+					   (rand_r(&seed) % 40 + 1) * 4096 - 100);
+		}
+		check_run_from(__get_pool(region));
+	}
+	for (k = 0; k < 64; k++)
+		smm_free(region, blk[k]);
+	ret = smm_get_stats(region, &st);
+	ut_assert(!ret && !st.used);
+	/* every run is merged back */
+	blk[0] = smm_alloc(region, 900 * 4096);
+	ut_assert(blk[0]);
+	smm_free(region, blk[0]);
+	smm_fini(region);
+	free(region);
+}
+
+int main(void) {
+	test(100, case_caller_size);
+	test(200, case_merge);
+	test(300, case_run_from);
+	return 0;
+}
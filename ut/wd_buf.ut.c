@@ -0,0 +1,77 @@
+#include "ut.c"
+
+#include "../wd_buf.c"
+
+static void check_stats(int node, size_t used, uint64_t fallbacks)
+{
+	struct wd_buf_stats st;
+
+	ut_assert(!wd_buf_get_stats(node, &st));
+	ut_assert_str(st.used == used && st.fallback_num == fallbacks,
+		      "node %d: used %zu, fallbacks %lu\n", node, st.used,
+		      st.fallback_num);
+	ut_assert(st.peak_used >= st.used && st.size >= st.used);
+}
+
+/* every node has its own pool, and its statistics count only its buffers */
+void case_nodes(void)
+{
+	struct wd_buf_config cfg = { .high = 0, .idle_ms = 0 };
+	struct wd_buf_stats st;
+	void *a, *b, *c, *d;
+
+	/* only trim by hand */
+	ut_assert(!wd_buf_set_config(&cfg));
+	ut_assert(wd_buf_get_stats(0, &st) == -ENOENT);
+	ut_assert(wd_buf_get_stats(WD_MAX_NUMA_NODES, &st) == -EINVAL);
+	ut_assert(wd_buf_get_stats(0, NULL) == -EINVAL);
+
+	a = wd_buf_alloc(100, 0);
+	ut_assert(a);
+	check_stats(0, 128, 0);
+	ut_assert(wd_buf_get_stats(-1, &st) == -ENOENT);
+
+	/* an invalid node takes the pool without node */
+	b = wd_buf_alloc(4096, WD_MAX_NUMA_NODES);
+	ut_assert(b && !((uintptr_t)b & 4095));
+	check_stats(-1, 4096, 0);
+	check_stats(0, 128, 0);
+
+	/* larger than any class, it comes from malloc() */
+	c = wd_buf_alloc(2 << 20, 0);
+	ut_assert(c);
+	check_stats(0, 128, 1);
+	d = wd_buf_alloc(64 << 10, 0);
+	ut_assert(d);
+	check_stats(0, 128 + (64 << 10), 1);
+
+	wd_buf_free(b);
+	check_stats(-1, 0, 0);
+	check_stats(0, 128 + (64 << 10), 1);
+	wd_buf_free(c);
+	wd_buf_free(d);
+	wd_buf_free(a);
+	check_stats(0, 0, 1);
+	ut_assert(!wd_buf_get_stats(0, &st));
+	ut_assert(st.peak_used == 128 + (64 << 10));
+}
+
+/* trimmed bytes are counted on the node that is trimmed */
+void case_trim(void)
+{
+	struct wd_buf_stats st;
+
+	ut_assert(wd_buf_prefault(0, 4096, 4) == 4);
+	ut_assert(wd_buf_prefault(WD_MAX_NUMA_NODES, 4096, 4) == -EINVAL);
+	ut_assert(wd_buf_trim(0, 4096) == 3 * 4096);
+	ut_assert(!wd_buf_get_stats(0, &st) && st.trimmed == 3 * 4096);
+	ut_assert(!wd_buf_get_stats(-1, &st) && !st.trimmed);
+	ut_assert(wd_buf_trim(0, 0) == 4096);
+	ut_assert(!wd_buf_trim(1, 0));
+}
+
+int main(void) {
+	test(1, case_nodes);
+	test(2, case_trim);
+	return 0;
+}
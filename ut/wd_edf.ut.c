@@ -0,0 +1,129 @@
+#include "ut.c"
+
+#include "../wd_sched.c"
+
+#define EDF_SIZE	64
+#define MAX_DL		100
+
+static struct wd_edf_queue q;
+
+/* pop all and check that deadlines don't go back, 0 (none) is the last */
+static void check_order(int num)
+{
+	struct wd_sched_req req;
+	uint64_t last = 0;
+	int i, ret;
+
+	for (i = 0; i < num; i++) {
+		ret = wd_edf_pop(&q, &req);
+		ut_assert(!ret);
+		ut_assert_str(last != UINT64_MAX || !req.deadline,
+			      "deadline %lu after none\n", req.deadline);
+		ut_assert_str(!req.deadline || req.deadline >= last,
+			      "deadline %lu after %lu\n", req.deadline, last);
+		last = req.deadline ? req.deadline : UINT64_MAX;
+	}
+	ut_assert(wd_edf_pop(&q, &req) == -ENOENT);
+}
+
+void case_order(void)
+{
+	int i, d, ret, cnt[MAX_DL];
+	struct wd_sched_req req;
+	unsigned int seed = 1;
+
+	ret = wd_edf_init(&q, EDF_SIZE);
+	ut_assert(!ret);
+	for (i = 0; i < EDF_SIZE; i++) {
+		ret = wd_edf_push(&q, NULL, rand_r(&seed) % 16);
+		ut_assert(!ret);
+	}
+	ut_assert(wd_edf_push(&q, NULL, 1) == -EBUSY);
+	check_order(EDF_SIZE);
+
+	/* pops and pushes mixed up, the head is the least one in cnt[] */
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < EDF_SIZE * 16; i++) {
+		if (q.num < EDF_SIZE && rand_r(&seed) % 3) {
+			d = rand_r(&seed) % MAX_DL;
+			ut_assert(!wd_edf_push(&q, NULL, d));
+			cnt[d]++;
+		} else if (q.num) {
+			ut_assert(!wd_edf_pop(&q, &req));
+			for (d = 1; d < MAX_DL && !cnt[d]; d++)
+				;
+			if (d == MAX_DL)
+				d = 0;
+			ut_assert_str(req.deadline == d, "got %lu, expect %d\n",
+				      req.deadline, d);
+			cnt[d]--;
+		}
+	}
+	check_order(q.num);
+	wd_edf_fini(&q);
+}
+
+/* the same deadline is served in submission order, even after requeue */
+void case_fifo(void)
+{
+	struct wd_sched_req req, first;
+	long i, exp;
+	int ret;
+
+	ret = wd_edf_init(&q, EDF_SIZE);
+	ut_assert(!ret);
+	for (i = 0; i < EDF_SIZE / 2; i++) {
+		ut_assert(!wd_edf_push(&q, (void *)i, 100));
+		ut_assert(!wd_edf_push(&q, (void *)(i + EDF_SIZE), 0));
+	}
+	/* the head can't be sent, put it back */
+	ut_assert(!wd_edf_pop(&q, &first));
+	ut_assert(first.data == (void *)0);
+	ut_assert(!wd_edf_requeue(&q, &first));
+
+	/* those without deadline are after them */
+	for (i = 0; i < EDF_SIZE; i++) {
+		exp = i < EDF_SIZE / 2 ? i : i + EDF_SIZE / 2;
+		ut_assert(!wd_edf_pop(&q, &req));
+		ut_assert_str(req.data == (void *)exp, "got %ld, expect %ld\n",
+			      (long)req.data, exp);
+	}
+	wd_edf_fini(&q);
+}
+
+/* only requests with deadlines before due are taken out */
+void case_expire(void)
+{
+	struct wd_sched_req req;
+	int i, ret;
+
+	ret = wd_edf_init(&q, EDF_SIZE);
+	ut_assert(!ret);
+	ut_assert(wd_edf_expire(&q, 100, &req) == -ENOENT);
+	for (i = 0; i < 10; i++)
+		ut_assert(!wd_edf_push(&q, NULL, (10 - i) * 10));
+	ut_assert(!wd_edf_push(&q, NULL, 0));
+
+	for (i = 1; i <= 4; i++) {
+		ret = wd_edf_expire(&q, 50, &req);
+		ut_assert(!ret);
+		ut_assert(req.deadline == i * 10);
+	}
+	/* 50 is due at 50, it isn't late yet */
+	ut_assert(wd_edf_expire(&q, 50, &req) == -ENOENT);
+	ut_assert(q.num == 7);
+
+	/* the one without deadline never expires */
+	for (i = 5; i <= 10; i++)
+		ut_assert(!wd_edf_expire(&q, UINT64_MAX, &req));
+	ut_assert(wd_edf_expire(&q, UINT64_MAX, &req) == -ENOENT);
+	ut_assert(!wd_edf_pop(&q, &req) && !req.deadline);
+	wd_edf_fini(&q);
+}
+
+int main(void) {
+	test(100, case_order);
+	test(200, case_fifo);
+	test(300, case_expire);
+	return 0;
+}
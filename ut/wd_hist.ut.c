@@ -0,0 +1,87 @@
+#include "ut.c"
+
+#include "../wd_hist.c"
+
+/* v falls into a bucket that holds it, and the buckets keep the order */
+static void check_index(uint64_t v)
+{
+	int idx = wd_hist_index(v);
+
+	ut_assert_str(idx >= 0 && idx < WD_HIST_BUCKETS, "%lu at %d\n", v,
+		      idx);
+	ut_assert_str(bucket_top(idx) >= v, "%lu above bucket %d\n", v, idx);
+	ut_assert_str(!idx || bucket_top(idx - 1) < v,
+		      "%lu below bucket %d\n", v, idx);
+	/* the relative error of a bucket */
+	ut_assert_str(bucket_top(idx) - v <= v / WD_HIST_SUB_NUM,
+		      "%lu in bucket %d up to %lu\n", v, idx, bucket_top(idx));
+}
+
+void case_index(void)
+{
+	unsigned int seed = 1;
+	uint64_t v;
+	int i, b;
+
+	/* values below WD_HIST_SUB_NUM are exact */
+	for (v = 0; v < WD_HIST_SUB_NUM; v++)
+		ut_assert(wd_hist_index(v) == v && bucket_top(v) == v);
+	for (v = 0; v < 100000; v++)
+		check_index(v);
+	for (b = 0; b < 64; b++) {
+		v = 1ULL << b;
+		check_index(v);
+		check_index(v - 1);
+		check_index(v + 1);
+	}
+	check_index(UINT64_MAX);
+	ut_assert(wd_hist_index(UINT64_MAX) == WD_HIST_BUCKETS - 1);
+	for (i = 0; i < 100000; i++) {
+		v = (uint64_t)rand_r(&seed) << 33 ^ (uint64_t)rand_r(&seed);
+		check_index(v >> rand_r(&seed) % 64);
+	}
+}
+
+void case_percentile(void)
+{
+	struct wd_hist h, a, b;
+	uint64_t v, p;
+	int pct;
+
+	wd_hist_reset(&h);
+	ut_assert(!wd_hist_percentile(&h, 50));
+
+	wd_hist_reset(&a);
+	wd_hist_reset(&b);
+	for (v = 1; v <= 10000; v++) {
+		wd_hist_add(&h, v);
+		wd_hist_add(v % 2 ? &a : &b, v);
+	}
+	ut_assert(h.count == 10000 && h.min == 1 && h.max == 10000);
+	ut_assert(h.sum == 10000ULL * 10001 / 2);
+	for (pct = 1; pct < 100; pct++) {
+		p = wd_hist_percentile(&h, pct);
+		/* the value of the percentile, within the error of a bucket */
+		v = pct * 100;
+		ut_assert_str(p >= v && p - v <= v / WD_HIST_SUB_NUM,
+			      "p%d is %lu\n", pct, p);
+	}
+	ut_assert(wd_hist_percentile(&h, 0) == 1);
+	ut_assert(wd_hist_percentile(&h, 100) == 10000);
+
+	/* merged halves give the same histogram */
+	wd_hist_merge(&a, &b);
+	ut_assert(!memcmp(&a, &h, sizeof(h)));
+
+	/* a single value is exact at every percentile */
+	wd_hist_reset(&h);
+	wd_hist_add(&h, 12345);
+	ut_assert(wd_hist_percentile(&h, 1) == 12345);
+	ut_assert(wd_hist_percentile(&h, 99.9) == 12345);
+}
+
+int main(void) {
+	test(1, case_index);
+	test(2, case_percentile);
+	return 0;
+}
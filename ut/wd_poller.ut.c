@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include "ut.c"
+
+#include <stdint.h>
+
+#include "../wd_poller.c"
+
+#define RING_MSGS	100000
+#define POLL_MSGS	10000
+
+/* a fake queue gives completions 1, 2, ... up to num */
+struct fake_queue {
+	uint32_t	next;
+	uint32_t	num;
+};
+
+static int fake_recv(handle_t h_ctx, void **resp)
+{
+	struct fake_queue *q = (struct fake_queue *)h_ctx;
+
+	if (q->next == q->num)
+		return -EAGAIN;
+	*resp = (void *)(uintptr_t)++q->next;
+	return 0;
+}
+
+/* wait until cond holds, or for ms, return the last result */
+#define wait_for(cond, ms) ({						\
+	int __n = (ms);							\
+	while (!(cond) && __n--)					\
+		usleep(1000);						\
+	!!(cond);							\
+})
+
+void case_ring(void)
+{
+	struct wd_ring ring;
+	void *p;
+	int i;
+
+	ut_assert(wd_ring_init(&ring, 0) == -EINVAL);
+	ut_assert(!wd_ring_init(&ring, 5));
+	ut_assert(ring.mask == 7);
+
+	/* indexes wrap around at 2^32 */
+	ring.head = ring.tail = ring.head_cache = ring.tail_cache = -3U;
+	ut_assert(wd_ring_pop(&ring, &p) == -EAGAIN);
+	for (i = 0; i < 8; i++)
+		ut_assert(!wd_ring_push(&ring, (void *)(uintptr_t)i));
+	ut_assert(wd_ring_full(&ring));
+	ut_assert(wd_ring_push(&ring, NULL) == -EBUSY);
+	for (i = 0; i < 8; i++) {
+		ut_assert(!wd_ring_pop(&ring, &p));
+		ut_assert(p == (void *)(uintptr_t)i);
+	}
+	ut_assert(wd_ring_pop(&ring, &p) == -EAGAIN);
+	ut_assert(!wd_ring_full(&ring));
+	wd_ring_fini(&ring);
+}
+
+static void *run_producer(void *data)
+{
+	struct wd_ring *ring = data;
+	uintptr_t i;
+
+	for (i = 1; i <= RING_MSGS; i++) {
+		while (wd_ring_push(ring, (void *)i))
+			sched_yield();
+	}
+	return NULL;
+}
+
+/* a producer and a consumer thread, nothing is lost or reordered */
+void case_ring_threads(void)
+{
+	struct wd_ring ring;
+	pthread_t thread;
+	uintptr_t i;
+	void *p;
+
+	ut_assert(!wd_ring_init(&ring, 64));
+	ut_assert(!pthread_create(&thread, NULL, run_producer, &ring));
+	for (i = 1; i <= RING_MSGS; i++) {
+		while (wd_ring_pop(&ring, &p))
+			sched_yield();
+		ut_assert_str(p == (void *)i, "got %p, expect %lu\n", p, i);
+	}
+	pthread_join(thread, NULL);
+	ut_assert(wd_ring_pop(&ring, &p) == -EAGAIN);
+	wd_ring_fini(&ring);
+}
+
+/* completions go to the ring of the sub, with a ring smaller than them */
+void case_poller(void)
+{
+	struct fake_queue q = { .num = POLL_MSGS };
+	struct wd_poller_sub *sub;
+	struct wd_poller *poller;
+	uintptr_t i;
+	void *p;
+	int n;
+
+	poller = wd_poller_create(-1, 0);
+	sub = wd_poller_sub_alloc(16, NULL, NULL);
+	ut_assert(poller && sub);
+	ut_assert(wd_poller_add(poller, (handle_t)&q, NULL, sub) == -EINVAL);
+	ut_assert(!wd_poller_add(poller, (handle_t)&q, fake_recv, sub));
+	for (i = 1; i <= POLL_MSGS; i++) {
+		for (n = 0; wd_poller_get(sub, &p); n++) {
+			ut_assert_str(n < 1000000, "no completion %lu\n", i);
+			sched_yield();
+		}
+		ut_assert_str(p == (void *)i, "got %p, expect %lu\n", p, i);
+	}
+	ut_assert(!wd_poller_del(poller, (handle_t)&q));
+	ut_assert(wd_poller_del(poller, (handle_t)&q) == -ENOENT);
+	ut_assert(wd_poller_get(sub, &p) == -EAGAIN);
+	wd_poller_sub_free(sub);
+	wd_poller_destroy(poller);
+}
+
+static struct wd_poller *cb_poller;
+static struct wd_poller_sub *cb_sub;
+static struct fake_queue cb_q[2];
+static uint32_t cb_done[2];
+
+/* the first completion of queue 0 adds queue 1 from the poller thread */
+static void complete(void *resp, void *priv)
+{
+	uintptr_t v = (uintptr_t)resp;
+
+	if (v > POLL_MSGS) {
+		__atomic_add_fetch(&cb_done[1], 1, __ATOMIC_RELEASE);
+		return;
+	}
+	if (v == 1)
+		ut_assert(!wd_poller_add(cb_poller, (handle_t)&cb_q[1],
+					 fake_recv, cb_sub));
+	__atomic_add_fetch(&cb_done[0], 1, __ATOMIC_RELEASE);
+}
+
+void case_complete(void)
+{
+	memset(cb_q, 0, sizeof(cb_q));
+	memset(cb_done, 0, sizeof(cb_done));
+	cb_q[0].num = POLL_MSGS;
+	/* completions of queue 1 are told apart by value */
+	cb_q[1].next = POLL_MSGS;
+	cb_q[1].num = POLL_MSGS * 2;
+
+	cb_poller = wd_poller_create(-1, 10);
+	cb_sub = wd_poller_sub_alloc(0, complete, NULL);
+	ut_assert(cb_poller && cb_sub);
+	ut_assert(!wd_poller_add(cb_poller, (handle_t)&cb_q[0], fake_recv,
+				 cb_sub));
+	ut_assert_str(wait_for(__atomic_load_n(&cb_done[0], __ATOMIC_ACQUIRE) ==
+			       POLL_MSGS &&
+			       __atomic_load_n(&cb_done[1], __ATOMIC_ACQUIRE) ==
+			       POLL_MSGS, 10000),
+		      "completed %u and %u\n", cb_done[0], cb_done[1]);
+	ut_assert(!wd_poller_del(cb_poller, (handle_t)&cb_q[0]));
+	ut_assert(!wd_poller_del(cb_poller, (handle_t)&cb_q[1]));
+	wd_poller_sub_free(cb_sub);
+	wd_poller_destroy(cb_poller);
+}
+
+int main(void) {
+	test(1, case_ring);
+	test(2, case_ring_threads);
+	test(3, case_poller);
+	test(4, case_complete);
+	return 0;
+}
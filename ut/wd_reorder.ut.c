@@ -0,0 +1,134 @@
+#include "ut.c"
+
+#include "../wd_sched.c"
+
+#define RO_QUEUES	3
+#define RO_CACHE	16
+#define RO_MSGS		2000
+
+/* a fake hardware queue completes its messages in FIFO order */
+struct fake_queue {
+	int	*fifo[RO_CACHE];
+	int	h, t, num;
+	int	slow;	/* completes one of slow polls */
+};
+
+static struct fake_queue fq[RO_QUEUES];
+static handle_t qs[RO_QUEUES];
+static int seqs[RO_CACHE];	/* the message of a cache slot */
+static int done[RO_MSGS];
+static int next_in, next_out, last_recv, last_out, reordered, passed;
+static unsigned int seed;
+
+static void init_cache(struct wd_scheduler *sched, int i, void *priv)
+{
+	sched->msgs[i].msg = &seqs[i];
+}
+
+static int input(struct wd_msg *msg, void *priv)
+{
+	*(int *)msg->msg = next_in++;
+	return 0;
+}
+
+static int output(struct wd_msg *msg, void *priv)
+{
+	int seq = *(int *)msg->msg;
+	struct wd_scheduler *sched = priv;
+
+	ut_assert(seq >= 0 && seq < RO_MSGS && !done[seq]);
+	if (sched->order == WD_SCHED_ORDERED)
+		ut_assert_str(seq == next_out, "output %d, expect %d\n", seq,
+			      next_out);
+	done[seq] = 1;
+	/* delivered before an earlier message */
+	if (seq < last_out)
+		passed++;
+	last_out = seq;
+	next_out++;
+	return 0;
+}
+
+static int hw_send(handle_t h_ctx, void *req)
+{
+	struct fake_queue *q = (struct fake_queue *)h_ctx;
+
+	ut_assert(q->num < RO_CACHE);
+	q->fifo[q->t] = req;
+	q->t = (q->t + 1) % RO_CACHE;
+	q->num++;
+	return 0;
+}
+
+static int hw_recv(handle_t h_ctx, void **req)
+{
+	struct fake_queue *q = (struct fake_queue *)h_ctx;
+
+	if (!q->num || rand_r(&seed) % q->slow)
+		return -EAGAIN;
+	*req = q->fifo[q->h];
+	q->h = (q->h + 1) % RO_CACHE;
+	q->num--;
+	/* a later message completes before an earlier one */
+	if (*(int *)*req < last_recv)
+		reordered++;
+	last_recv = *(int *)*req;
+	return 0;
+}
+
+/* queue 0 is much slower than the others */
+static void run_sched(int order)
+{
+	struct wd_scheduler sched;
+	int i, ret;
+
+	memset(fq, 0, sizeof(fq));
+	memset(done, 0, sizeof(done));
+	next_in = next_out = last_recv = last_out = reordered = passed = 0;
+	seed = 1;
+	for (i = 0; i < RO_QUEUES; i++) {
+		fq[i].slow = i ? 1 : 20;
+		qs[i] = (handle_t)&fq[i];
+	}
+
+	memset(&sched, 0, sizeof(sched));
+	sched.qs = qs;
+	sched.q_num = RO_QUEUES;
+	sched.msg_cache_num = RO_CACHE;
+	sched.order = order;
+	sched.init_cache = init_cache;
+	sched.input = input;
+	sched.output = output;
+	sched.hw_send = hw_send;
+	sched.hw_recv = hw_recv;
+	sched.priv = &sched;
+	ret = wd_sched_init(&sched, NULL);
+	ut_assert(!ret);
+
+	while (next_in < RO_MSGS || !wd_sched_empty(&sched)) {
+		ret = wd_sched_work(&sched, RO_MSGS - next_in);
+		ut_assert_str(ret >= 0, "wd_sched_work: %d\n", ret);
+	}
+	ut_assert(next_out == RO_MSGS);
+	ut_assert_str(reordered, "no completion out of order\n");
+	__fini_cache(&sched);
+}
+
+/* completions out of order are held until all messages before them */
+void case_ordered(void)
+{
+	run_sched(WD_SCHED_ORDERED);
+}
+
+/* every message is delivered once, the slow queue doesn't hold the others */
+void case_unordered(void)
+{
+	run_sched(WD_SCHED_UNORDERED);
+	ut_assert_str(passed, "output in submission order\n");
+}
+
+int main(void) {
+	test(1, case_ordered);
+	test(2, case_unordered);
+	return 0;
+}
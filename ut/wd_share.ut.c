@@ -0,0 +1,262 @@
+#include "ut.c"
+
+#include <unistd.h>
+
+#include "../wd_share.c"
+
+/*
+ * Sessions are faked, so the pool runs without an accelerator. queues are
+ * the ones left on the devices, and a request that has cb_param is held in
+ * the session until it's released.
+ */
+static struct wd_alg_comp fake_drv;
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fake_cond = PTHREAD_COND_INITIALIZER;
+static int queues, allocs;
+
+struct hold {
+	int	in;
+	int	release;
+};
+
+struct job {
+	handle_t		tenant;
+	struct wd_comp_arg	arg;
+	struct hold		hold;
+	pthread_t		thread;
+	int			done;
+	int			ret;
+};
+
+handle_t wd_alg_comp_alloc_sess(char *alg_name, uint32_t mode,
+				wd_dev_mask_t *dev_mask)
+{
+	struct wd_comp_sess *sess = NULL;
+
+	pthread_mutex_lock(&fake_lock);
+	if (queues) {
+		sess = calloc(1, sizeof(*sess));
+		sess->drv = &fake_drv;
+		queues--;
+		allocs++;
+	}
+	pthread_mutex_unlock(&fake_lock);
+	return (handle_t)sess;
+}
+
+void wd_alg_comp_free_sess(handle_t handle)
+{
+	pthread_mutex_lock(&fake_lock);
+	queues++;
+	pthread_mutex_unlock(&fake_lock);
+	free((void *)handle);
+}
+
+int wd_alg_compress(handle_t handle, struct wd_comp_arg *arg)
+{
+	struct hold *hold = arg->cb_param;
+
+	if (!hold)
+		return 0;
+	pthread_mutex_lock(&fake_lock);
+	hold->in = 1;
+	pthread_cond_broadcast(&fake_cond);
+	while (!hold->release)
+		pthread_cond_wait(&fake_cond, &fake_lock);
+	pthread_mutex_unlock(&fake_lock);
+	return 0;
+}
+
+int wd_alg_decompress(handle_t handle, struct wd_comp_arg *arg)
+{
+	return wd_alg_compress(handle, arg);
+}
+
+static void *run_job(void *data)
+{
+	struct job *job = data;
+
+	job->ret = wd_share_compress(job->tenant, &job->arg);
+	pthread_mutex_lock(&fake_lock);
+	job->done = 1;
+	pthread_cond_broadcast(&fake_cond);
+	pthread_mutex_unlock(&fake_lock);
+	return NULL;
+}
+
+static void start_job(struct job *job, handle_t tenant, int hold)
+{
+	memset(job, 0, sizeof(*job));
+	job->tenant = tenant;
+	job->arg.src_len = 4096;
+	if (hold)
+		job->arg.cb_param = &job->hold;
+	ut_assert(!pthread_create(&job->thread, NULL, run_job, job));
+}
+
+/* wait until cond holds, or for ms, return the last result */
+#define wait_for(cond, ms) ({						\
+	int __n = (ms);							\
+	pthread_mutex_lock(&fake_lock);					\
+	while (!(cond) && __n--) {					\
+		pthread_mutex_unlock(&fake_lock);			\
+		usleep(1000);						\
+		pthread_mutex_lock(&fake_lock);				\
+	}								\
+	__n = !!(cond);							\
+	pthread_mutex_unlock(&fake_lock);				\
+	__n;								\
+})
+
+static void release_job(struct job *job)
+{
+	pthread_mutex_lock(&fake_lock);
+	job->hold.release = 1;
+	pthread_cond_broadcast(&fake_cond);
+	pthread_mutex_unlock(&fake_lock);
+}
+
+static int exhausted(struct share_pool *pool)
+{
+	int ret;
+
+	pthread_mutex_lock(&pool->lock);
+	ret = pool->exhausted[SHARE_DEFLATE] != 0;
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+/*
+ * A request that can't get a queue waits for the busy instance, and a queue
+ * freed later is taken once the exhausted mark expires.
+ */
+void case_exhausted(void)
+{
+	struct share_pool *pool;
+	struct job a, b;
+	handle_t h, t;
+
+	queues = 1;
+	allocs = 0;
+	h = wd_share_pool_create("zlib", 4, NULL);
+	t = wd_share_attach(h, 1, 0);
+	ut_assert(h && t);
+	pool = (struct share_pool *)h;
+
+	start_job(&a, t, 1);
+	ut_assert(wait_for(a.hold.in, 1000));
+	start_job(&b, t, 0);
+	ut_assert(wait_for(exhausted(pool), 1000));
+	ut_assert(!b.done);
+	release_job(&a);
+	ut_assert(wait_for(a.done && b.done, 1000));
+	pthread_join(a.thread, NULL);
+	pthread_join(b.thread, NULL);
+	ut_assert(!a.ret && !b.ret && allocs == 1);
+
+	/* a queue is freed by someone else */
+	pthread_mutex_lock(&fake_lock);
+	queues++;
+	pthread_mutex_unlock(&fake_lock);
+	usleep(SHARE_RETRY_NS / 1000 + 10000);
+	start_job(&a, t, 1);
+	ut_assert(wait_for(a.hold.in, 1000));
+	start_job(&b, t, 0);
+	ut_assert_str(wait_for(b.done, 1000), "no new instance\n");
+	release_job(&a);
+	pthread_join(a.thread, NULL);
+	pthread_join(b.thread, NULL);
+	ut_assert(!a.ret && !b.ret && allocs == 2 && !exhausted(pool));
+
+	wd_share_detach(t);
+	wd_share_pool_destroy(h);
+	ut_assert(queues == 2);
+}
+
+#define DRR_TENANTS	3
+#define DRR_REQS	2000
+#define DRR_MAX_COST	(256 << 10)
+
+static void enqueue(struct share_tenant *t, struct share_req *req, size_t cost)
+{
+	memset(req, 0, sizeof(*req));
+	req->tenant = t;
+	req->cost = cost;
+	if (t->tail)
+		t->tail->next = req;
+	else
+		t->head = req;
+	t->tail = req;
+}
+
+/*
+ * Tenants that are always backlogged get bytes in proportion to weight.
+ * Requests are picked by __pick() directly, with an idle instance that
+ * every request may take.
+ */
+void case_drr(void)
+{
+	static const int weights[DRR_TENANTS] = { 1, 2, 4 };
+	struct share_req *reqs[DRR_TENANTS], *req;
+	struct share_tenant *t[DRR_TENANTS];
+	size_t served[DRR_TENANTS] = { 0 };
+	struct share_inst inst = { 0 };
+	struct share_pool *pool;
+	unsigned int seed = 1;
+	double share, dev;
+	int i, j, ret;
+	handle_t h;
+
+	h = wd_share_pool_create("zlib", 4, NULL);
+	ut_assert(h);
+	pool = (struct share_pool *)h;
+	pool->idle[SHARE_DEFLATE] = &inst;
+	for (i = 0; i < DRR_TENANTS; i++) {
+		t[i] = (struct share_tenant *)wd_share_attach(h, weights[i], 0);
+		reqs[i] = calloc(DRR_REQS, sizeof(*reqs[i]));
+		ut_assert(t[i] && reqs[i]);
+		for (j = 0; j < DRR_REQS; j++)
+			enqueue(t[i], &reqs[i][j],
+				rand_r(&seed) % DRR_MAX_COST + 1);
+	}
+
+	/* stop before a tenant runs out of requests */
+	for (ret = 1; ret; ) {
+		req = __pick(pool);
+		ut_assert(req);
+		for (i = 0; i < DRR_TENANTS; i++) {
+			if (req->tenant == t[i])
+				served[i] += req->cost;
+			if (!t[i]->head)
+				ret = 0;
+		}
+	}
+
+	/* a tenant is ahead of its share by a round and a request at most */
+	for (i = 0; i < DRR_TENANTS; i++) {
+		share = (double)(served[0] + served[1] + served[2]) *
+			weights[i] / (weights[0] + weights[1] + weights[2]);
+		dev = served[i] > share ? served[i] - share : share - served[i];
+		ut_assert_str(dev <= 7 * WD_SHARE_QUANTUM + 2 * DRR_MAX_COST,
+			      "tenant %d: %zu bytes, share %.0f\n", i,
+			      served[i], share);
+	}
+
+	/* a tenant that goes idle doesn't keep its credit */
+	while (t[0]->head)
+		__dequeue(t[0]);
+	ut_assert(!t[0]->deficit);
+
+	pool->idle[SHARE_DEFLATE] = NULL;
+	for (i = 0; i < DRR_TENANTS; i++) {
+		wd_share_detach((handle_t)t[i]);
+		free(reqs[i]);
+	}
+	wd_share_pool_destroy(h);
+}
+
+int main(void) {
+	test(1, case_exhausted);
+	test(2, case_drr);
+	return 0;
+}
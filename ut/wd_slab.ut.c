@@ -0,0 +1,146 @@
+#include "ut.c"
+
+#include "../wd_slab.c"
+
+#define TRIM_OBJS	8
+#define TRIM_SIZE	8192
+
+static const struct wd_slab_class classes[] = {
+	{ .size = 64, .num = 4 },
+	{ .size = 200, .num = 4 },
+	{ .size = 4096, .align = 4096, .num = 2 },
+};
+
+#define CLASS_NUM	(sizeof(classes) / sizeof(classes[0]))
+
+/* the index of the class that obj is in */
+static int class_of(struct wd_slab *slab, void *obj)
+{
+	int i;
+
+	for (i = 0; i < slab->num; i++) {
+		if ((char *)obj >= slab->caches[i].start &&
+		    (char *)obj < slab->caches[i].end)
+			return i;
+	}
+	return -1;
+}
+
+/* an object of the smallest class that holds the size, or none */
+void case_class(void)
+{
+	static const struct wd_slab_class bad[] = {
+		{ .size = 256, .num = 4 },
+		{ .size = 64, .num = 4 },
+	};
+	static const struct wd_slab_class bad_align[] = {
+		{ .size = 64, .align = 48, .num = 4 },
+	};
+	static const struct { size_t size; int cls; } cases[] = {
+		/* objects of 200 bytes are cache line aligned to 256 */
+		{ 1, 0 }, { 64, 0 }, { 65, 1 }, { 201, 1 }, { 256, 1 },
+		{ 257, 2 }, { 4096, 2 },
+	};
+	struct wd_slab *slab;
+	struct bmm_stats st;
+	void *obj[16];
+	int i, n;
+
+	ut_assert(!wd_slab_region_size(bad, 2));
+	ut_assert(!wd_slab_region_size(bad_align, 1));
+	ut_assert(!wd_slab_region_size(classes, 0));
+
+	slab = wd_slab_create(NULL, 0, classes, CLASS_NUM);
+	ut_assert(slab);
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		obj[0] = wd_slab_alloc(slab, cases[i].size);
+		ut_assert_str(obj[0] && class_of(slab, obj[0]) == cases[i].cls,
+			      "%zu bytes in class %d\n", cases[i].size,
+			      class_of(slab, obj[0]));
+		ut_assert(!((uintptr_t)obj[0] &
+			    (class_align(&classes[cases[i].cls]) - 1)));
+		ut_assert(wd_slab_owns(slab, obj[0]));
+		wd_slab_free(slab, obj[0]);
+	}
+	ut_assert(!wd_slab_alloc(slab, 4097));
+
+	/* a full class doesn't take objects of a larger one */
+	for (n = 0; n < 16 && (obj[n] = wd_slab_alloc(slab, 64)); n++)
+		ut_assert(class_of(slab, obj[n]) == 0);
+	ut_assert(n >= classes[0].num && n < 16);
+	ut_assert(!wd_slab_get_stats(slab, &st) && st.used && st.fail_num);
+	while (n--)
+		wd_slab_free(slab, obj[n]);
+	ut_assert(!wd_slab_get_stats(slab, &st) && !st.used);
+	wd_slab_destroy(slab);
+}
+
+static int resident(void *obj)
+{
+	unsigned char vec;
+
+	ut_assert(!mincore(obj, SLAB_PAGE, &vec));
+	return vec & 1;
+}
+
+/* populated free objects are trimmed beyond keep, used ones are left */
+void case_trim(void)
+{
+	static const struct wd_slab_class cls[] = {
+		{ .size = TRIM_SIZE, .align = SLAB_PAGE, .num = TRIM_OBJS },
+	};
+	struct wd_slab *slab;
+	void *obj[TRIM_OBJS], *used;
+	int i, n;
+
+	slab = wd_slab_create(NULL, 0, cls, 1);
+	ut_assert(slab);
+	ut_assert(wd_slab_prefault(slab, TRIM_SIZE, TRIM_OBJS) == TRIM_OBJS);
+	ut_assert(!wd_slab_trim(slab, TRIM_OBJS * TRIM_SIZE));
+
+	used = wd_slab_alloc(slab, TRIM_SIZE);
+	ut_assert(used);
+	memset(used, 0x5a, TRIM_SIZE);
+	ut_assert(wd_slab_trim(slab, TRIM_SIZE * 2) ==
+		  (TRIM_OBJS - 3) * TRIM_SIZE);
+	ut_assert(((char *)used)[TRIM_SIZE - 1] == 0x5a);
+
+	for (i = 0, n = 0; i < TRIM_OBJS - 1; i++) {
+		obj[i] = wd_slab_alloc(slab, TRIM_SIZE);
+		ut_assert(obj[i]);
+		n += resident(obj[i]);
+	}
+	ut_assert_str(n == 2, "%d objects are resident\n", n);
+	ut_assert(!wd_slab_alloc(slab, TRIM_SIZE));
+	for (i = 0; i < TRIM_OBJS - 1; i++)
+		wd_slab_free(slab, obj[i]);
+	wd_slab_free(slab, used);
+	ut_assert(wd_slab_trim(slab, 0) == 3 * TRIM_SIZE);
+	wd_slab_destroy(slab);
+}
+
+/* a slab in the caller's region isn't trimmed */
+void case_region(void)
+{
+	size_t size = wd_slab_region_size(classes, CLASS_NUM);
+	struct wd_slab *slab;
+	void *region;
+
+	region = aligned_alloc(SLAB_PAGE, size);
+	ut_assert(region);
+	ut_assert(!wd_slab_create(region, size - 1, classes, CLASS_NUM));
+	ut_assert(!wd_slab_create(region + 1, size, classes, CLASS_NUM));
+	slab = wd_slab_create(region, size, classes, CLASS_NUM);
+	ut_assert(slab);
+	ut_assert(wd_slab_prefault(slab, 4096, 2) == 2);
+	ut_assert(!wd_slab_trim(slab, 0));
+	wd_slab_destroy(slab);
+	free(region);
+}
+
+int main(void) {
+	test(1, case_class);
+	test(2, case_trim);
+	test(3, case_region);
+	return 0;
+}
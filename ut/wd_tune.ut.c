@@ -0,0 +1,97 @@
+#include "ut.c"
+
+#include "../wd_sched.c"
+
+#define TUNE_CACHE	64
+#define TUNE_KNEE	16
+#define TUNE_PERIODS	400
+
+static struct wd_scheduler sched;
+static uint64_t now;
+
+static void init_sched(void)
+{
+	memset(&sched, 0, sizeof(sched));
+	sched.msg_cache_num = TUNE_CACHE;
+	sched.win = 1;
+	sched.tune = calloc(1, sizeof(*sched.tune));
+	ut_assert(sched.tune);
+	sched.tune->dir = 1;
+	now = 1;
+	sched.tune->start = now;
+}
+
+/*
+ * Complete messages at the rate and of the size that the current window
+ * gives, until the window is tuned once.
+ */
+static void run_period(uint64_t (*rate)(int win), size_t (*size)(int win))
+{
+	int win = sched.win, done = 0;
+
+	while (done < TUNE_MIN_DONE || done < win * 2) {
+		now += 1000000000ULL / rate(win);
+		__tune(&sched, now, 1000, size(win));
+		done++;
+	}
+}
+
+/* a deeper window completes more messages, but smaller ones past the knee */
+static uint64_t rate_linear(int win)
+{
+	return 1000 * win;
+}
+
+static size_t size_shrink(int win)
+{
+	if (win <= TUNE_KNEE)
+		return 4096;
+	return 4096 * TUNE_KNEE * TUNE_KNEE / (win * win);
+}
+
+static size_t size_fixed(int win)
+{
+	return 4096;
+}
+
+/* bytes per second peak at the knee, so the window stays around it */
+void case_converge(void)
+{
+	int i, min = TUNE_CACHE, max = 0;
+
+	init_sched();
+	for (i = 0; i < TUNE_PERIODS; i++) {
+		run_period(rate_linear, size_shrink);
+		if (i < TUNE_PERIODS / 2)
+			continue;
+		if (sched.win < min)
+			min = sched.win;
+		if (sched.win > max)
+			max = sched.win;
+	}
+	ut_assert_str(min >= TUNE_KNEE / 2 && max <= TUNE_KNEE * 2,
+		      "window in %d..%d\n", min, max);
+	free(sched.tune);
+}
+
+/* throughput keeps growing with the window, it goes to the top */
+void case_grow(void)
+{
+	int i, top = 0;
+
+	init_sched();
+	for (i = 0; i < TUNE_PERIODS; i++) {
+		run_period(rate_linear, size_fixed);
+		if (sched.win == TUNE_CACHE)
+			top++;
+	}
+	ut_assert_str(top > TUNE_PERIODS / 4, "window %d, at top %d times\n",
+		      sched.win, top);
+	free(sched.tune);
+}
+
+int main(void) {
+	test(1, case_converge);
+	test(2, case_grow);
+	return 0;
+}
@@ -20,6 +20,10 @@
 
 #define SYS_CLASS_DIR	"/sys/class/uacce"
 
+/* the memory policies of mbind(2) */
+#define WD_MPOL_PREFERRED	1
+#define WD_MPOL_MF_MOVE		(1 << 1)
+
 struct wd_ctx {
 	int		fd;
 	char		node_path[MAX_DEV_NAME_LEN];
@@ -105,7 +109,8 @@ static int get_str_attr(struct uacce_dev_info *info, char *attr, char *buf,
 
 static int get_dev_info(struct uacce_dev_info *info)
 {
-	int	value;
+	char	path[PATH_STR_SIZE + sizeof("/device/numa_node")];
+	int	value = 0;
 
 	get_int_attr(info, "available_instances", &info->avail_instn);
 	get_int_attr(info, "flags", &info->flags);
@@ -117,6 +122,12 @@ static int get_dev_info(struct uacce_dev_info *info)
 	info->qfrs_offs[UACCE_QFRT_DUS] = value;
 	info->qfrs_offs[UACCE_QFRT_SS] = 0;
 
+	/* the parent device may not be bound to any NUMA node */
+	info->numa_id = -1;
+	snprintf(path, sizeof(path), "%s/device/numa_node", info->dev_root);
+	if (!access(path, R_OK))
+		get_int_attr(info, "device/numa_node", &info->numa_id);
+
 	return 0;
 }
 
@@ -637,3 +648,34 @@ void *wd_get_dma_from_va(handle_t h_ctx, void *va)
 		return NULL;
 	return va - ctx->ss_va + ctx->ss_pa;
 }
+
+/* Return the NUMA node of the device, or -1 if it's unknown. */
+int wd_get_numa_node(handle_t h_ctx)
+{
+	struct wd_ctx	*ctx = (struct wd_ctx *)h_ctx;
+
+	if (!ctx || !ctx->dev_info)
+		return -1;
+	return ctx->dev_info->numa_id;
+}
+
+/*
+ * Prefer the pages of [addr, addr + len) on node. Pages that are already
+ * populated are moved. addr is page aligned.
+ */
+int wd_numa_bind(void *addr, size_t len, int node)
+{
+	unsigned long mask[WD_MAX_NUMA_NODES / (8 * sizeof(long))] = {0};
+	const int bits = 8 * sizeof(long);
+
+	if (!addr || !len || node < 0 || node >= WD_MAX_NUMA_NODES)
+		return -EINVAL;
+	mask[node / bits] = 1UL << (node % bits);
+	/* the kernel takes one bit less than maxnode */
+	if (syscall(SYS_mbind, addr, len, WD_MPOL_PREFERRED, mask,
+		    WD_MAX_NUMA_NODES + 1, WD_MPOL_MF_MOVE)) {
+		WD_ERR("fail to bind memory on node %d (%d)\n", node, errno);
+		return -errno;
+	}
+	return 0;
+}
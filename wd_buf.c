@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "wd.h"
+#include "wd_buf.h"
+#include "wd_slab.h"
+
+/* the pool of node n is pools[n + 1], pools[0] isn't bound to a node */
+#define BUF_POOL_NUM		(WD_MAX_NUMA_NODES + 1)
+
+#define BUF_HIGH_DEFAULT	(16 << 20)
+#define BUF_IDLE_MS_DEFAULT	1000
+
+static const struct wd_slab_class buf_cls[] = {
+	{ 128,		0,	1024 },		/* SQE */
+	{ 4096,		4096,	256 },
+	{ 64 << 10,	4096,	64 },		/* hardware context */
+	{ 1 << 20,	4096,	64 },		/* block */
+};
+
+struct wd_buf_pool {
+	struct wd_slab	*slab;
+	uint64_t	allocs;
+	uint64_t	fallbacks;
+	uint64_t	trimmed;	/* bytes given back to the system */
+	uint64_t	last_allocs;	/* allocs at the last check */
+	int		checked;
+};
+
+static struct wd_buf_pool *pools[BUF_POOL_NUM];
+static int pools_end;	/* pools[pools_end] and later aren't created */
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct wd_buf_config buf_config = {
+	.high		= BUF_HIGH_DEFAULT,
+	.idle_ms	= BUF_IDLE_MS_DEFAULT,
+};
+
+/*
+ * Pools are trimmed by a thread, so neither the data path nor the first
+ * allocation after an idle period pays for it. The thread parks once every
+ * pool is idle and trimmed, and an allocation wakes it up. It's stopped
+ * before the library is unloaded.
+ */
+static pthread_mutex_t trim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trim_cond;
+static pthread_t trim_thread;
+static pid_t trim_pid;		/* the thread isn't in forked children */
+static int trim_started;
+static int trim_parked;
+static int trim_stop;
+
+static inline int node_valid(int node)
+{
+	return node >= -1 && node < WD_MAX_NUMA_NODES;
+}
+
+/*
+ * Trim a pool once in an interval. A pool that isn't allocated from in the
+ * whole interval is idle, and all free buffers are trimmed. Otherwise free
+ * buffers are trimmed down to the high water. Return 1 if the pool is idle.
+ */
+static int check_pool(struct wd_buf_pool *pool)
+{
+	uint64_t allocs;
+	size_t keep;
+	int idle;
+
+	allocs = __atomic_load_n(&pool->allocs, __ATOMIC_SEQ_CST);
+	idle = allocs == pool->last_allocs;
+	/* the first check only starts the interval */
+	if (pool->checked) {
+		keep = idle ? 0 :
+		       __atomic_load_n(&buf_config.high, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&pool->trimmed,
+				   wd_slab_trim(pool->slab, keep),
+				   __ATOMIC_RELAXED);
+	}
+	pool->last_allocs = allocs;
+	idle = idle && pool->checked;
+	pool->checked = 1;
+	return idle;
+}
+
+/* return 1 if all pools are idle */
+static int check_pools(void)
+{
+	struct wd_buf_pool *pool;
+	int i, end, idle = 1;
+
+	end = __atomic_load_n(&pools_end, __ATOMIC_ACQUIRE);
+	for (i = 0; i < end; i++) {
+		pool = __atomic_load_n(&pools[i], __ATOMIC_ACQUIRE);
+		if (pool && !check_pool(pool))
+			idle = 0;
+	}
+	return idle;
+}
+
+/* whether any pool is allocated from since its last check */
+static int pools_busy(void)
+{
+	struct wd_buf_pool *pool;
+	int i, end;
+
+	end = __atomic_load_n(&pools_end, __ATOMIC_ACQUIRE);
+	for (i = 0; i < end; i++) {
+		pool = __atomic_load_n(&pools[i], __ATOMIC_ACQUIRE);
+		if (pool && __atomic_load_n(&pool->allocs, __ATOMIC_SEQ_CST) !=
+			    pool->last_allocs)
+			return 1;
+	}
+	return 0;
+}
+
+static void *__trim_thread(void *data)
+{
+	unsigned int idle_ms;
+	struct timespec ts;
+	uint64_t ns;
+	int idle = 0;
+
+	pthread_mutex_lock(&trim_lock);
+	while (!trim_stop) {
+		idle_ms = __atomic_load_n(&buf_config.idle_ms,
+					  __ATOMIC_RELAXED);
+		if (idle) {
+			/* an allocation between the check and here unparks */
+			__atomic_store_n(&trim_parked, 1, __ATOMIC_SEQ_CST);
+			if (pools_busy())
+				__atomic_store_n(&trim_parked, 0,
+						 __ATOMIC_SEQ_CST);
+		}
+		if (!idle_ms || __atomic_load_n(&trim_parked,
+						__ATOMIC_RELAXED)) {
+			pthread_cond_wait(&trim_cond, &trim_lock);
+			idle = 0;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ns = ts.tv_nsec + idle_ms * 1000000ULL;
+		ts.tv_sec += ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		if (pthread_cond_timedwait(&trim_cond, &trim_lock, &ts) !=
+		    ETIMEDOUT) {
+			/* woken up, or the interval is changed */
+			idle = 0;
+			continue;
+		}
+		pthread_mutex_unlock(&trim_lock);
+		idle = check_pools();
+		pthread_mutex_lock(&trim_lock);
+	}
+	pthread_mutex_unlock(&trim_lock);
+	return NULL;
+}
+
+/* with pools_lock held */
+static void start_trim(void)
+{
+	pthread_condattr_t attr;
+
+	if (trim_started)
+		return;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&trim_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* without the thread, pools are only trimmed by wd_buf_trim() */
+	if (pthread_create(&trim_thread, NULL, __trim_thread, NULL)) {
+		WD_ERR("fail to create the thread to trim buffers\n");
+		return;
+	}
+	trim_pid = getpid();
+	trim_started = 1;
+}
+
+/* the thread mustn't run the code of the library after it's unloaded */
+static void __attribute__((destructor)) stop_trim(void)
+{
+	if (!trim_started || trim_pid != getpid())
+		return;
+	pthread_mutex_lock(&trim_lock);
+	trim_stop = 1;
+	pthread_cond_signal(&trim_cond);
+	pthread_mutex_unlock(&trim_lock);
+	pthread_join(trim_thread, NULL);
+	trim_started = 0;
+}
+
+static void wake_trim(void)
+{
+	pthread_mutex_lock(&trim_lock);
+	if (__atomic_load_n(&trim_parked, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&trim_parked, 0, __ATOMIC_RELAXED);
+		pthread_cond_signal(&trim_cond);
+	}
+	pthread_mutex_unlock(&trim_lock);
+}
+
+static struct wd_buf_pool *get_pool(int node)
+{
+	struct wd_buf_pool *pool;
+
+	pool = __atomic_load_n(&pools[node + 1], __ATOMIC_ACQUIRE);
+	if (pool)
+		return pool;
+
+	pthread_mutex_lock(&pools_lock);
+	pool = pools[node + 1];
+	if (pool)
+		goto out;
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		goto out;
+	pool->slab = wd_slab_create_node(buf_cls, ARRAY_SIZE(buf_cls), node);
+	if (!pool->slab) {
+		free(pool);
+		pool = NULL;
+		goto out;
+	}
+	__atomic_store_n(&pools[node + 1], pool, __ATOMIC_RELEASE);
+	if (node + 2 > pools_end)
+		__atomic_store_n(&pools_end, node + 2, __ATOMIC_RELEASE);
+	start_trim();
+out:
+	pthread_mutex_unlock(&pools_lock);
+	return pool;
+}
+
+void *wd_buf_alloc(size_t size, int node)
+{
+	struct wd_buf_pool *pool;
+	void *buf = NULL;
+
+	if (!node_valid(node))
+		node = -1;
+	pool = get_pool(node);
+	if (pool) {
+		__atomic_add_fetch(&pool->allocs, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&trim_parked, __ATOMIC_SEQ_CST))
+			wake_trim();
+		buf = wd_slab_alloc(pool->slab, size);
+		if (!buf)
+			__atomic_add_fetch(&pool->fallbacks, 1,
+					   __ATOMIC_RELAXED);
+	}
+	return buf ? buf : malloc(size);
+}
+
+void wd_buf_free(void *buf)
+{
+	struct wd_buf_pool *pool;
+	int i, end;
+
+	if (!buf)
+		return;
+	end = __atomic_load_n(&pools_end, __ATOMIC_ACQUIRE);
+	for (i = 0; i < end; i++) {
+		pool = __atomic_load_n(&pools[i], __ATOMIC_ACQUIRE);
+		if (pool && wd_slab_owns(pool->slab, buf)) {
+			wd_slab_free(pool->slab, buf);
+			return;
+		}
+	}
+	free(buf);
+}
+
+/*
+ * Populate num free buffers that hold size in the pool of node ahead, so
+ * sessions don't fault on them. Return the number of buffers populated.
+ */
+int wd_buf_prefault(int node, size_t size, int num)
+{
+	struct wd_buf_pool *pool;
+
+	if (!node_valid(node) || num <= 0)
+		return -EINVAL;
+	pool = get_pool(node);
+	if (!pool)
+		return -ENOMEM;
+	return wd_slab_prefault(pool->slab, size, num);
+}
+
+/* Trim free buffers of node down to keep bytes now, return bytes trimmed. */
+size_t wd_buf_trim(int node, size_t keep)
+{
+	struct wd_buf_pool *pool;
+	size_t trimmed;
+
+	if (!node_valid(node))
+		return 0;
+	pool = __atomic_load_n(&pools[node + 1], __ATOMIC_ACQUIRE);
+	if (!pool)
+		return 0;
+	trimmed = wd_slab_trim(pool->slab, keep);
+	__atomic_add_fetch(&pool->trimmed, trimmed, __ATOMIC_RELAXED);
+	return trimmed;
+}
+
+/* it applies to pools of all nodes */
+int wd_buf_set_config(const struct wd_buf_config *cfg)
+{
+	if (!cfg)
+		return -EINVAL;
+	__atomic_store_n(&buf_config.high, cfg->high, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf_config.idle_ms, cfg->idle_ms, __ATOMIC_RELAXED);
+	/* restart the interval */
+	pthread_mutex_lock(&pools_lock);
+	if (trim_started) {
+		pthread_mutex_lock(&trim_lock);
+		__atomic_store_n(&trim_parked, 0, __ATOMIC_RELAXED);
+		pthread_cond_signal(&trim_cond);
+		pthread_mutex_unlock(&trim_lock);
+	}
+	pthread_mutex_unlock(&pools_lock);
+	return 0;
+}
+
+/* the usage of the pool on node, -ENOENT if nothing is allocated there */
+int wd_buf_get_stats(int node, struct wd_buf_stats *st)
+{
+	struct wd_buf_pool *pool;
+	struct bmm_stats bst;
+	int ret;
+
+	if (!node_valid(node) || !st)
+		return -EINVAL;
+	pool = __atomic_load_n(&pools[node + 1], __ATOMIC_ACQUIRE);
+	if (!pool)
+		return -ENOENT;
+	ret = wd_slab_get_stats(pool->slab, &bst);
+	if (ret)
+		return ret;
+	st->size = bst.size;
+	st->used = bst.used;
+	st->peak_used = bst.peak_used;
+	st->fail_num = bst.fail_num;
+	st->fallback_num = __atomic_load_n(&pool->fallbacks, __ATOMIC_RELAXED);
+	st->trimmed = __atomic_load_n(&pool->trimmed, __ATOMIC_RELAXED);
+	return 0;
+}
@@ -1,15 +1,28 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 #include <dirent.h>
 #include <errno.h>
+#include <sched.h>
 #include <string.h>
 #include <time.h>
 
 #include "config.h"
 #include "hisi_comp.h"
+#include "wd_buf.h"
+#include "wd_bytes.h"
 #include "wd_comp.h"
+#include "wd_hybrid.h"
+#if HAVE_ZLIB
+#include "sw_comp.h"
+#endif
 
 #define SYS_CLASS_DIR	"/sys/class/uacce"
 
+#define GZIP_HEADER_SZ		10
+#define GZIP_TAIL_SZ		8
+#define MEMBER_CHUNK_DEFAULT	(512 << 10)
+#define MEMBER_CHUNK_MAX	(1 << 20)	/* an async request at most */
+#define MEMBER_INFLIGHT		64		/* chunks on a session */
+
 /* remove node p */
 #define RM_NODE(head, prev, p)	do {					\
 					if (!prev) {			\
@@ -38,18 +51,48 @@
 static struct wd_alg_comp wd_alg_comp_list[] = {
 	{
 		.drv_name	= "hisi_zip",
-		.alg_name	= "zlib\ngzip",
+		.alg_name	= "zlib\ngzip\ndeflate",
 		.init		= hisi_comp_init,
 		.exit		= hisi_comp_exit,
 		.prep		= hisi_comp_prep,
 		.deflate	= hisi_comp_deflate,
 		.inflate	= hisi_comp_inflate,
+		.async_deflate	= hisi_comp_async_deflate,
+		.async_inflate	= hisi_comp_async_inflate,
 		.async_poll	= hisi_comp_poll,
+		.batch		= hisi_comp_batch,
+		.load		= hisi_comp_load,
 		.strm_deflate	= hisi_strm_deflate,
 		.strm_inflate	= hisi_strm_inflate,
 	},
 };
 
+#if HAVE_ZLIB
+/* block mode with MODE_SW_FALLBACK runs on it if no accelerator is found */
+static struct wd_alg_comp wd_alg_comp_sw = {
+	.drv_name	= "sw_zlib",
+	.alg_name	= "zlib\ngzip\ndeflate",
+	.init		= sw_comp_init,
+	.exit		= sw_comp_exit,
+	.deflate	= sw_comp_deflate,
+	.inflate	= sw_comp_inflate,
+	.async_deflate	= sw_comp_async_deflate,
+	.async_inflate	= sw_comp_async_inflate,
+	.deflate_iov	= sw_comp_deflate_iov,
+	.inflate_iov	= sw_comp_inflate_iov,
+};
+
+static inline int is_sw_drv(struct wd_alg_comp *drv)
+{
+	return drv == &wd_alg_comp_sw;
+}
+#else
+static inline int is_sw_drv(struct wd_alg_comp *drv)
+{
+	return 0;
+}
+#endif
+
 static inline int is_accel_avail(wd_dev_mask_t *dev_mask, int idx)
 {
 	int	offs, ret;
@@ -59,15 +102,22 @@ static inline int is_accel_avail(wd_dev_mask_t *dev_mask, int idx)
 	return ret;
 }
 
+/*
+ * Raw deflate data is made by the same engine as zlib and gzip, so a device
+ * that has either of them does "deflate", though its "algorithms" in sysfs
+ * doesn't list it.
+ */
 static inline int match_alg_name(char *dev_alg_name, char *alg_name)
 {
 	char	*sub;
-	int	found;
+	int	found, raw;
 
+	raw = !strcmp(alg_name, "deflate");
 	sub = strtok(dev_alg_name, "\n");
 	found = 0;
 	while (sub) {
-		if (!strncmp(sub, alg_name, strlen(alg_name))) {
+		if (!strncmp(sub, alg_name, strlen(alg_name)) ||
+		    (raw && (!strcmp(sub, "zlib") || !strcmp(sub, "gzip")))) {
 			found = 1;
 			break;
 		}
@@ -82,7 +132,8 @@ handle_t wd_alg_comp_alloc_sess(char *alg_name, uint32_t mode,
 	struct uacce_dev_list	*head = NULL, *p, *prev;
 	wd_dev_mask_t		*mask = NULL;
 	struct wd_comp_sess	*sess = NULL;
-	int	i, found, max = 0, ret;
+	struct wd_alg_comp	*drv;
+	int	i, found = 0, max = 0, ret;
 	char	*dev_name;
 #if HAVE_PERF
 	struct timespec	ts_time1 = {0, 0}, ts_time2 = {0, 0}, ts_time3 = {0, 0};
@@ -99,7 +150,9 @@ handle_t wd_alg_comp_alloc_sess(char *alg_name, uint32_t mode,
 	head = wd_list_accels(mask);
 	if (!head) {
 		WD_ERR("Failed to get any accelerators in system!\n");
-		return (handle_t)sess;
+		/* it may be freed by wd_list_accels() */
+		mask = NULL;
+		goto out_drv;
 	}
 	/* merge two masks */
 	if (dev_mask && (dev_mask->magic == WD_DEV_MASK_MAGIC) &&
@@ -150,18 +203,31 @@ handle_t wd_alg_comp_alloc_sess(char *alg_name, uint32_t mode,
 		if (found)
 			break;
 	}
-	if (!found)
+out_drv:
+	if (found) {
+		drv = &wd_alg_comp_list[i];
+	} else {
+#if HAVE_ZLIB
+		if ((mode & MODE_STREAM) || !(mode & MODE_SW_FALLBACK))
+			goto out;
+		drv = &wd_alg_comp_sw;
+#else
 		goto out;
+#endif
+	}
 	sess = calloc(1, (sizeof(struct wd_comp_sess)));
 	if (!sess)
 		goto out;
 	sess->mode = mode;
 	sess->alg_name = strdup(alg_name);
-	dev_name = wd_get_accel_name(p->info->dev_root, 0);
-	snprintf(sess->node_path, MAX_DEV_NAME_LEN, "/dev/%s", dev_name);
-	free(dev_name);
+	if (found) {
+		dev_name = wd_get_accel_name(p->info->dev_root, 0);
+		snprintf(sess->node_path, MAX_DEV_NAME_LEN, "/dev/%s",
+			 dev_name);
+		free(dev_name);
+	}
 	sess->dev_mask = mask;
-	sess->drv = &wd_alg_comp_list[i];
+	sess->drv = drv;
 #if HAVE_PERF
 	clock_gettime(CLOCK_REALTIME, &ts_time2);
 #endif
@@ -195,55 +261,383 @@ void wd_alg_comp_free_sess(handle_t handle)
 	if (!sess)
 		return;
 
+#if HAVE_ZLIB
+	/* CPU threads may hand requests back to accelerator */
+	wd_hybrid_destroy(sess->hybrid);
+#endif
 	if (sess->drv->exit)
 		sess->drv->exit(sess);
 
-	if (sess->dev_mask->mask)
+	if (sess->dev_mask) {
 		free(sess->dev_mask->mask);
-
-	if (sess->dev_mask)
 		free(sess->dev_mask);
+	}
 
 	free(sess->alg_name);
 	free(sess);
 }
 
-int wd_alg_compress(handle_t handle, struct wd_comp_arg *arg)
+/* the driver that the session runs on, "sw_zlib" for zlib of CPU */
+const char *wd_alg_comp_get_drv(handle_t handle)
+{
+	struct wd_comp_sess *sess = (struct wd_comp_sess *)handle;
+
+	return sess ? sess->drv->drv_name : NULL;
+}
+
+/*
+ * Set what to do with the requests that can't finish before arg->deadline.
+ * The cost of a request is estimated from the requests done in the session.
+ * fallback is required by DEADLINE_FALLBACK. It's called with FLAG_DEFLATE
+ * set in arg->flag for compression.
+ */
+int wd_alg_comp_set_deadline(handle_t handle, int policy,
+			     wd_alg_comp_fallback_t *fallback, void *param)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess)
+		return -EINVAL;
+	if (policy != DEADLINE_RUN && policy != DEADLINE_REJECT &&
+	    policy != DEADLINE_FALLBACK)
+		return -EINVAL;
+	if (policy == DEADLINE_FALLBACK && !fallback)
+		return -EINVAL;
+
+	sess->dl_policy = policy;
+	sess->fallback = fallback;
+	sess->fallback_param = param;
+	return 0;
+}
+
+/*
+ * Return 1 if the request is handled here because of its deadline, 0 if it
+ * should go to accelerator, or negative errno.
+ */
+static int check_deadline(struct wd_comp_sess *sess, struct wd_comp_arg *arg,
+			  uint64_t now)
+{
+	uint64_t cost;
+	int	ret;
+
+	if (!arg->deadline || sess->dl_policy == DEADLINE_RUN)
+		return 0;
+
+	cost = sess->ns_per_kb[!!(arg->flag & FLAG_DEFLATE)] *
+	       ((arg->src_len >> 10) + 1);
+	if (now + cost <= arg->deadline)
+		return 0;
+
+	if (sess->dl_policy == DEADLINE_REJECT)
+		return -ETIME;
+	ret = sess->fallback(arg, sess->fallback_param);
+	return ret ? ret : 1;
+}
+
+static void update_cost(struct wd_comp_sess *sess, int deflate, size_t len,
+			uint64_t start)
+{
+	uint64_t *avg = &sess->ns_per_kb[deflate];
+	uint64_t cost;
+
+	cost = (wd_sched_now() - start) / ((len >> 10) + 1);
+	/* moving average, weight of the latest sample is 1/8 */
+	if (*avg)
+		*avg = (*avg * 7 + cost) >> 3;
+	else
+		*avg = cost;
+}
+
+static int comp_sync(handle_t handle, struct wd_comp_arg *arg, int deflate)
 {
 	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+	uint64_t	start = 0;
+	size_t	len;
 	int	ret = -EINVAL;
 
-	if (!arg)
+	if (!sess || !arg)
 		return ret;
-	arg->flag |= FLAG_DEFLATE;
+	len = arg->src_len;
+	if (deflate)
+		arg->flag |= FLAG_DEFLATE;
+	else
+		arg->flag &= ~FLAG_DEFLATE;
+	if (arg->deadline || sess->hybrid)
+		start = wd_sched_now();
+	if (arg->deadline) {
+		ret = check_deadline(sess, arg, start);
+		if (ret)
+			return ret < 0 ? ret : 0;
+	}
+#if HAVE_ZLIB
+	if (sess->hybrid && wd_hybrid_pick(sess->hybrid, arg, 0) &&
+	    !wd_hybrid_sync(sess->hybrid, arg))
+		return 0;
+#endif
 	if (sess->drv->prep) {
 		ret = sess->drv->prep(sess, arg);
 		if (ret)
 			return ret;
 	}
-	if (sess->drv->deflate)
+	if (deflate && sess->drv->deflate)
 		ret = sess->drv->deflate(sess, arg);
-	return ret;
+	else if (!deflate && sess->drv->inflate)
+		ret = sess->drv->inflate(sess, arg);
+	if (ret)
+		return ret;
+	wd_hybrid_count(sess, is_sw_drv(sess->drv), len);
+	if (start)
+		update_cost(sess, deflate, len, start);
+	return 0;
+}
+
+int wd_alg_compress(handle_t handle, struct wd_comp_arg *arg)
+{
+	return comp_sync(handle, arg, 1);
 }
 
 int wd_alg_decompress(handle_t handle, struct wd_comp_arg *arg)
+{
+	return comp_sync(handle, arg, 0);
+}
+
+/*
+ * An async request waited in the driver until its deadline passed. Fail it,
+ * or run it by the fallback, as the deadline policy of the session tells,
+ * and call it back. It's called out of the locks of the driver.
+ */
+void wd_comp_expire(struct wd_comp_sess *sess, struct wd_comp_arg *arg)
+{
+	if (sess->dl_policy != DEADLINE_FALLBACK ||
+	    sess->fallback(arg, sess->fallback_param)) {
+		arg->dst_len = 0;
+		arg->status = STATUS_FAILED;
+	}
+	arg->cb(arg->cb_param);
+}
+
+/*
+ * Queue a request and return at once. arg, its buffers and arg->cb are
+ * required until arg->cb(arg->cb_param) is called. The request is done in
+ * one shot, so the whole input and output must fit in arg. On completion,
+ * arg->src_len and arg->dst_len are the sizes of the consumed input and
+ * the output as in block mode, and arg->status tells the result.
+ * Requests wait in earliest deadline first order when the hardware is busy.
+ */
+static int comp_async(handle_t handle, struct wd_comp_arg *arg, int deflate)
 {
 	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
-	int	ret = -EINVAL;
+	size_t	len;
+	int	ret;
 
-	if (!arg)
-		return ret;
-	arg->flag &= ~FLAG_DEFLATE;
-	if (sess->drv->prep) {
-		ret = sess->drv->prep(sess, arg);
-		if (ret)
+	if (!sess || !arg || !arg->cb || (sess->mode & MODE_STREAM))
+		return -EINVAL;
+	if (deflate)
+		arg->flag |= FLAG_DEFLATE;
+	else
+		arg->flag &= ~FLAG_DEFLATE;
+	arg->status = 0;
+	if (arg->deadline) {
+		ret = check_deadline(sess, arg, wd_sched_now());
+		if (ret < 0)
 			return ret;
+		if (ret) {
+			/* done by the fallback already */
+			arg->cb(arg->cb_param);
+			return 0;
+		}
 	}
-	if (sess->drv->inflate)
-		ret = sess->drv->inflate(sess, arg);
+#if HAVE_ZLIB
+	/* go to accelerator if CPU threads are saturated too */
+	if (sess->hybrid && wd_hybrid_pick(sess->hybrid, arg, 1) &&
+	    !wd_hybrid_submit(sess->hybrid, arg))
+		return 0;
+#endif
+	len = arg->src_len;
+	if (deflate && sess->drv->async_deflate)
+		ret = sess->drv->async_deflate(sess, arg);
+	else if (!deflate && sess->drv->async_inflate)
+		ret = sess->drv->async_inflate(sess, arg);
+	else
+		return -EINVAL;
+	/* a software request is done already */
+	if (!ret && !(arg->status & STATUS_FAILED))
+		wd_hybrid_count(sess, is_sw_drv(sess->drv), len);
 	return ret;
 }
 
+int wd_alg_compress_async(handle_t handle, struct wd_comp_arg *arg)
+{
+	return comp_async(handle, arg, 1);
+}
+
+int wd_alg_decompress_async(handle_t handle, struct wd_comp_arg *arg)
+{
+	return comp_async(handle, arg, 0);
+}
+
+/* the call back of requests that are waited for, it counts them in cb_param */
+void *wd_comp_count_done(void *cb_param)
+{
+	int	*done = cb_param;
+
+	__atomic_add_fetch(done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Compress or decompress num independent buffers in args, and return when
+ * all of them are done. Each request is done in one shot as an async
+ * request, and has its own result in arg->status and arg->dst_len. Return
+ * 0 if the batch is run, even though some requests may have STATUS_FAILED
+ * set. arg->cb of the requests is used by the batch.
+ */
+static int comp_batch(handle_t handle, struct wd_comp_arg *args, int num,
+		      int deflate)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+	size_t	*lens;
+	int	i, done = 0, ret;
+
+	if (!sess || !args || num <= 0 || (sess->mode & MODE_STREAM))
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		if (deflate)
+			args[i].flag |= FLAG_DEFLATE;
+		else
+			args[i].flag &= ~FLAG_DEFLATE;
+		args[i].status = 0;
+	}
+
+	if (sess->drv->batch) {
+		/* src_len is the consumed size when it's done */
+		lens = malloc(num * sizeof(*lens));
+		if (!lens)
+			return -ENOMEM;
+		for (i = 0; i < num; i++)
+			lens[i] = args[i].src_len;
+		ret = sess->drv->batch(sess, args, num);
+		for (i = 0; !ret && i < num; i++) {
+			if (!(args[i].status & STATUS_FAILED))
+				wd_hybrid_count(sess, is_sw_drv(sess->drv),
+						lens[i]);
+		}
+		free(lens);
+		return ret;
+	}
+
+	/* one by one on the async interface */
+	for (i = 0; i < num; i++) {
+		args[i].cb = wd_comp_count_done;
+		args[i].cb_param = &done;
+		ret = comp_async(handle, &args[i], deflate);
+		if (ret) {
+			args[i].dst_len = 0;
+			args[i].status = STATUS_FAILED;
+			__atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+		}
+	}
+	while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) < num) {
+		/* the poller thread reaps them */
+		if (sess->poller) {
+			sched_yield();
+			continue;
+		}
+		ret = wd_alg_comp_poll(handle, num);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+int wd_alg_compress_batch(handle_t handle, struct wd_comp_arg *args, int num)
+{
+	return comp_batch(handle, args, num, 1);
+}
+
+int wd_alg_decompress_batch(handle_t handle, struct wd_comp_arg *args,
+			    int num)
+{
+	return comp_batch(handle, args, num, 0);
+}
+
+/*
+ * Reap at most budget completed async requests of the session and call
+ * their call backs. Return the number of requests reaped or negative errno.
+ * It does nothing if a poller is attached to the session.
+ */
+int wd_alg_comp_poll(handle_t handle, int budget)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess || budget <= 0)
+		return -EINVAL;
+	if (!sess->drv->async_poll)
+		return 0;
+	return sess->drv->async_poll(sess, budget);
+}
+
+/*
+ * Let a poller thread reap the async requests of the session. Call backs
+ * then run in the poller thread. It must be set before the first async
+ * request.
+ */
+int wd_alg_comp_set_poller(handle_t handle, struct wd_poller *poller)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess)
+		return -EINVAL;
+	sess->poller = poller;
+	return 0;
+}
+
+/*
+ * Let CPU share the block requests of the session when the accelerator is
+ * saturated. Async requests are spilled to cfg->cpu_threads threads if
+ * cfg->max_load percent of hardware slots are busy. Both sync and async
+ * requests are spilled if accelerator takes more than cfg->max_ns_per_kb on
+ * 1KB input. cfg of NULL turns it off. It mustn't be called with requests
+ * in flight.
+ */
+int wd_alg_comp_set_hybrid(handle_t handle, struct wd_hybrid_cfg *cfg)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess || (sess->mode & MODE_STREAM))
+		return -EINVAL;
+#if HAVE_ZLIB
+	if (cfg && (cfg->cpu_threads < 0 || cfg->max_load < 0 ||
+		    cfg->level < 0 || cfg->level > 9))
+		return -EINVAL;
+	wd_hybrid_destroy(sess->hybrid);
+	sess->hybrid = NULL;
+	if (!cfg)
+		return 0;
+	sess->hybrid = wd_hybrid_create(sess, cfg);
+	return sess->hybrid ? 0 : -ENOMEM;
+#else
+	return cfg ? -EOPNOTSUPP : 0;
+#endif
+}
+
+int wd_alg_comp_get_stats(handle_t handle, struct wd_comp_stats *stats)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess || !stats)
+		return -EINVAL;
+	stats->hw_reqs = __atomic_load_n(&sess->stats.hw_reqs,
+					 __ATOMIC_RELAXED);
+	stats->hw_bytes = __atomic_load_n(&sess->stats.hw_bytes,
+					  __ATOMIC_RELAXED);
+	stats->cpu_reqs = __atomic_load_n(&sess->stats.cpu_reqs,
+					  __ATOMIC_RELAXED);
+	stats->cpu_bytes = __atomic_load_n(&sess->stats.cpu_bytes,
+					   __ATOMIC_RELAXED);
+	return 0;
+}
+
 int wd_alg_strm_compress(handle_t handle, struct wd_comp_strm *strm)
 {
 	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
@@ -298,3 +692,654 @@ int wd_alg_strm_decompress(handle_t handle, struct wd_comp_strm *strm)
 		ret = sess->drv->strm_inflate(sess, strm);
 	return ret;
 }
+
+static size_t iov_len(const struct iovec *iov, int num)
+{
+	size_t	len = 0;
+	int	i;
+
+	for (i = 0; i < num; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
+/*
+ * Feed the segments to the stream one by one. A segment is handed to the
+ * driver as it is, and the driver splits it at its own limits. Output goes
+ * to the current dst segment until it's full.
+ */
+static int strm_iov(handle_t handle, struct wd_comp_iov *iov, int deflate)
+{
+	struct wd_comp_strm	strm;
+	size_t	in_off = 0, out_off = 0;
+	int	in_i = 0, out_i = 0, finish, stall = 0, ret;
+
+	finish = iov->flag & FLAG_INPUT_FINISH;
+	iov->src_len = 0;
+	iov->dst_len = 0;
+	iov->status = 0;
+	memset(&strm, 0, sizeof(strm));
+	while (out_i < iov->dst_num) {
+		/* skip the segments that are used up */
+		if (in_i < iov->src_num && in_off == iov->src[in_i].iov_len) {
+			in_i++;
+			in_off = 0;
+			continue;
+		}
+		if (out_off == iov->dst[out_i].iov_len) {
+			out_i++;
+			out_off = 0;
+			continue;
+		}
+		memset(&strm.arg, 0, sizeof(strm.arg));
+		if (in_i < iov->src_num) {
+			strm.in = iov->src[in_i].iov_base + in_off;
+			strm.in_sz = iov->src[in_i].iov_len - in_off;
+		} else {
+			/* drain the output left in the driver */
+			strm.in = iov->dst[out_i].iov_base;
+			strm.in_sz = 0;
+		}
+		if (finish && in_i >= iov->src_num - 1)
+			strm.arg.flag |= FLAG_INPUT_FINISH;
+		strm.out = iov->dst[out_i].iov_base + out_off;
+		strm.out_sz = iov->dst[out_i].iov_len - out_off;
+		if (deflate)
+			ret = wd_alg_strm_compress(handle, &strm);
+		else
+			ret = wd_alg_strm_decompress(handle, &strm);
+		if (ret < 0)
+			return ret;
+
+		if (in_i < iov->src_num)
+			in_off += strm.in_sz;
+		if (strm.arg.status & STATUS_OUT_READY)
+			out_off += strm.out_sz;
+		iov->src_len += in_i < iov->src_num ? strm.in_sz : 0;
+		iov->dst_len += (strm.arg.status & STATUS_OUT_READY) ?
+				strm.out_sz : 0;
+		if (in_i >= iov->src_num - 1 &&
+		    (strm.arg.status & STATUS_OUT_DRAINED) &&
+		    (strm.arg.status & STATUS_IN_EMPTY)) {
+			/* the last segment may have been consumed */
+			if (in_i < iov->src_num &&
+			    in_off < iov->src[in_i].iov_len)
+				continue;
+			iov->status = strm.arg.status;
+			return 0;
+		}
+		if (strm.in_sz || strm.out_sz)
+			stall = 0;
+		else if (++stall > 1)
+			return -EIO;
+	}
+	/* the caller may go on with more dst segments */
+	iov->status = STATUS_OUT_READY;
+	if (in_i < iov->src_num)
+		iov->status |= STATUS_IN_PART_USE;
+	return 0;
+}
+
+/*
+ * A block request is done in one shot. A driver that takes segments, as
+ * zlib of CPU does, streams them through. Otherwise, as hisi_zip takes one
+ * contiguous buffer for a request, the input is used in place if there's
+ * only one segment, or gathered, and so is the output.
+ */
+static int block_iov(handle_t handle, struct wd_comp_iov *iov, int deflate)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+	struct wd_comp_arg	arg;
+	size_t	src_len, dst_len, off, len;
+	void	*src = NULL, *dst = NULL;
+	int	i, ret;
+
+	if (deflate && sess->drv->deflate_iov)
+		ret = sess->drv->deflate_iov(sess, iov);
+	else if (!deflate && sess->drv->inflate_iov)
+		ret = sess->drv->inflate_iov(sess, iov);
+	else
+		goto gather;
+	if (!ret)
+		wd_hybrid_count(sess, is_sw_drv(sess->drv), iov->src_len);
+	return ret;
+
+gather:
+	src_len = iov_len(iov->src, iov->src_num);
+	dst_len = iov_len(iov->dst, iov->dst_num);
+	memset(&arg, 0, sizeof(arg));
+	arg.flag = iov->flag | FLAG_INPUT_FINISH;
+	if (iov->src_num == 1) {
+		arg.src = iov->src[0].iov_base;
+	} else {
+		src = malloc(src_len);
+		if (!src)
+			return -ENOMEM;
+		for (i = 0, off = 0; i < iov->src_num; i++) {
+			memcpy(src + off, iov->src[i].iov_base,
+			       iov->src[i].iov_len);
+			off += iov->src[i].iov_len;
+		}
+		arg.src = src;
+	}
+	if (iov->dst_num == 1) {
+		arg.dst = iov->dst[0].iov_base;
+	} else {
+		dst = malloc(dst_len);
+		if (!dst) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		arg.dst = dst;
+	}
+	arg.src_len = src_len;
+	arg.dst_len = dst_len;
+	if (deflate)
+		ret = wd_alg_compress(handle, &arg);
+	else
+		ret = wd_alg_decompress(handle, &arg);
+	if (ret)
+		goto out;
+
+	dst_len = arg.dst_len;
+	if (dst) {
+		for (i = 0, off = 0; i < iov->dst_num && off < dst_len; i++) {
+			len = iov->dst[i].iov_len;
+			if (len > dst_len - off)
+				len = dst_len - off;
+			memcpy(iov->dst[i].iov_base, dst + off, len);
+			off += len;
+		}
+	}
+	iov->src_len = arg.src_len;
+	iov->dst_len = dst_len;
+	iov->status = arg.status;
+out:
+	free(dst);
+	free(src);
+	return ret;
+}
+
+static int comp_iov(handle_t handle, struct wd_comp_iov *iov, int deflate)
+{
+	struct wd_comp_sess	*sess = (struct wd_comp_sess *)handle;
+
+	if (!sess || !iov || !iov->src || iov->src_num <= 0 ||
+	    !iov->dst || iov->dst_num <= 0)
+		return -EINVAL;
+	if (sess->mode & MODE_STREAM)
+		return strm_iov(handle, iov, deflate);
+	return block_iov(handle, iov, deflate);
+}
+
+/*
+ * Compress the segments of iov->src into the segments of iov->dst. In
+ * stream mode, the segments are fed to the session in order without being
+ * linearized, and it returns with STATUS_IN_PART_USE if dst is full. Set
+ * FLAG_INPUT_FINISH in iov->flag with the last segments of the stream. In
+ * block mode, the request is done in one shot. zlib of CPU streams the
+ * segments, but hisi_zip takes contiguous buffers, so src and dst of
+ * multiple segments are gathered into bounce buffers for it.
+ */
+int wd_alg_compress_iov(handle_t handle, struct wd_comp_iov *iov)
+{
+	return comp_iov(handle, iov, 1);
+}
+
+int wd_alg_decompress_iov(handle_t handle, struct wd_comp_iov *iov)
+{
+	return comp_iov(handle, iov, 0);
+}
+
+#define GZIP_FHCRC	0x02
+#define GZIP_FEXTRA	0x04
+#define GZIP_FNAME	0x08
+#define GZIP_FCOMMENT	0x10
+#define GZIP_FRESERVED	0xe0
+
+/* XLEN, then the subfield "Hi" of 4 bytes */
+static const unsigned char gzip_member_head[WD_GZIP_MEMBER_HEAD] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+	0x08, 0x00, 0x48, 0x69, 0x04, 0x00,
+};
+
+void wd_gzip_put_member_head(void *buf, uint32_t deflate_len)
+{
+	unsigned char	*p = buf;
+
+	memcpy(p, gzip_member_head, WD_GZIP_MEMBER_HEAD);
+	put_le32(p + 16, deflate_len);
+}
+
+/* a chunk of the input, it's compressed into a gzip member */
+struct member_chunk {
+	struct wd_comp_arg	arg;
+	int			done;
+	size_t			isize;	/* the input of the gzip member */
+};
+
+/* wait for the chunks in flight, so their buffers could be freed */
+static int members_drain(const struct wd_comp_split_ops *ops, void *priv,
+			 struct member_chunk *chunks, int inflight,
+			 int emitted, int sent, int free_dst)
+{
+	struct member_chunk	*c;
+	int	ret;
+
+	while (emitted < sent) {
+		c = &chunks[emitted % inflight];
+		if (__atomic_load_n(&c->done, __ATOMIC_ACQUIRE)) {
+			if (free_dst)
+				wd_buf_free(c->arg.dst);
+			emitted++;
+			continue;
+		}
+		ret = ops->poll(priv);
+		/* the buffers may still be written, leave them */
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Copy a compressed chunk out as a member, the plain header is replaced. A
+ * member without its CRC32 and ISIZE isn't read by gunzip, so the trailer
+ * is checked against the input of the chunk.
+ */
+static int members_emit(struct member_chunk *c, struct wd_comp_arg *arg,
+			size_t *out)
+{
+	size_t	len = c->arg.dst_len - GZIP_HEADER_SZ;
+
+	if (c->arg.status & (STATUS_FAILED | STATUS_IN_PART_USE))
+		return -EIO;
+	if (c->arg.dst_len < GZIP_HEADER_SZ + GZIP_TAIL_SZ ||
+	    get_le32(c->arg.dst + c->arg.dst_len - 4) !=
+	    (uint32_t)c->isize)
+		return -EIO;
+	if (WD_GZIP_MEMBER_HEAD + len > arg->dst_len - *out)
+		return -ENOSPC;
+	/* the deflate data without the trailer */
+	wd_gzip_put_member_head(arg->dst + *out, len - GZIP_TAIL_SZ);
+	*out += WD_GZIP_MEMBER_HEAD;
+	memcpy(arg->dst + *out, c->arg.dst + GZIP_HEADER_SZ, len);
+	*out += len;
+	return 0;
+}
+
+/*
+ * Cut arg->src into chunks of chunk_size, and keep up to inflight of them
+ * sent by ops. Each chunk becomes a gzip member with the size of its
+ * deflate data in FEXTRA, and the members are copied to arg->dst in order
+ * as they're done, so the output is still read by gunzip. Buffers of the
+ * chunks are on node. On success, arg->dst is moved past the output and
+ * arg->dst_len is the size of it.
+ */
+int wd_comp_split(const struct wd_comp_split_ops *ops, void *priv,
+		  int inflight, int node, size_t chunk_size,
+		  struct wd_comp_arg *arg)
+{
+	struct member_chunk	*chunks, *c;
+	struct wd_comp_arg	**args;
+	size_t	out = 0, off, bound;
+	int	i, n, total, sent = 0, emitted = 0, ret = 0;
+
+	if (!ops || inflight <= 0 || !chunk_size || !arg->src_len)
+		return -EINVAL;
+	/* a chunk may grow a bit if it's stored */
+	bound = chunk_size + (chunk_size >> 4) + GZIP_HEADER_SZ + 64;
+	chunks = calloc(inflight, sizeof(*chunks));
+	args = calloc(inflight, sizeof(*args));
+	if (!chunks || !args) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	total = (arg->src_len + chunk_size - 1) / chunk_size;
+	while (emitted < total) {
+		for (n = 0; sent + n < total && sent + n - emitted < inflight;
+		     n++) {
+			c = &chunks[(sent + n) % inflight];
+			memset(c, 0, sizeof(*c));
+			c->arg.dst = wd_buf_alloc(bound, node);
+			if (!c->arg.dst) {
+				ret = -ENOMEM;
+				break;
+			}
+			off = (size_t)(sent + n) * chunk_size;
+			c->arg.src = arg->src + off;
+			c->arg.src_len = arg->src_len - off < chunk_size ?
+					 arg->src_len - off : chunk_size;
+			c->isize = c->arg.src_len;
+			c->arg.dst_len = bound;
+			c->arg.flag = FLAG_DEFLATE | FLAG_INPUT_FINISH;
+			c->arg.cb = wd_comp_count_done;
+			c->arg.cb_param = &c->done;
+			args[n] = &c->arg;
+		}
+		i = n ? ops->send(priv, args, n) : 0;
+		/* the rest are sent again after some are done */
+		while (n > (i > 0 ? i : 0))
+			wd_buf_free(args[--n]->dst);
+		if (i < 0)
+			ret = i;
+		else
+			sent += i;
+		if (ret)
+			goto out;
+
+		/* copy out the members that are done in order */
+		while (emitted < sent) {
+			c = &chunks[emitted % inflight];
+			if (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE))
+				break;
+			ret = members_emit(c, arg, &out);
+			wd_buf_free(c->arg.dst);
+			emitted++;
+			if (ret)
+				goto out;
+		}
+		if (emitted == total)
+			break;
+		ret = ops->poll(priv);
+		if (ret < 0)
+			goto out;
+		ret = 0;
+	}
+	arg->src += arg->src_len;
+	arg->dst += out;
+	arg->dst_len = out;
+	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
+out:
+	if (members_drain(ops, priv, chunks, inflight, emitted, sent, 1)) {
+		free(args);
+		return ret;
+	}
+out_free:
+	free(args);
+	free(chunks);
+	return ret;
+}
+
+struct members_ctx {
+	handle_t	*handles;
+	int		num;
+	int		next;	/* the session of the next chunk */
+};
+
+/* send chunks to the sessions in turn */
+static int members_send(void *priv, struct wd_comp_arg **args, int num)
+{
+	struct members_ctx	*ctx = priv;
+	int	i, ret;
+
+	for (i = 0; i < num; i++) {
+		ret = wd_alg_compress_async(ctx->handles[ctx->next], args[i]);
+		if (ret)
+			return i ? i : ret;
+		ctx->next = (ctx->next + 1) % ctx->num;
+	}
+	return num;
+}
+
+/* reap completions of all sessions, return the number of them */
+static int members_poll(void *priv)
+{
+	struct members_ctx	*ctx = priv;
+	int	i, ret, n = 0;
+
+	for (i = 0; i < ctx->num; i++) {
+		ret = wd_alg_comp_poll(ctx->handles[i], MEMBER_INFLIGHT);
+		if (ret < 0)
+			return ret;
+		n += ret;
+	}
+	/* or poller threads do the work */
+	if (!n)
+		sched_yield();
+	return n;
+}
+
+static const struct wd_comp_split_ops members_ops = {
+	.send	= members_send,
+	.poll	= members_poll,
+};
+
+/*
+ * Cut arg->src into chunks of chunk_size, 512KB if it's 0, and compress
+ * them as gzip members on the sessions in turn, see wd_comp_split(). The
+ * sessions are gzip sessions in block mode, e.g. on different devices, so
+ * the chunks are done in parallel.
+ */
+int wd_alg_compress_members(handle_t *handles, int num,
+			    struct wd_comp_arg *arg, size_t chunk_size)
+{
+	struct members_ctx	ctx = { handles, num, 0 };
+	struct wd_comp_sess	*sess;
+	int	i;
+
+	if (!handles || num <= 0 || !arg || !arg->src_len ||
+	    (arg->flag & FLAG_RAW) || chunk_size > MEMBER_CHUNK_MAX)
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		sess = (struct wd_comp_sess *)handles[i];
+		if (!sess || (sess->mode & MODE_STREAM) ||
+		    strncmp(sess->alg_name, "gzip", strlen("gzip")))
+			return -EINVAL;
+	}
+	if (!chunk_size)
+		chunk_size = MEMBER_CHUNK_DEFAULT;
+	return wd_comp_split(&members_ops, &ctx, num * MEMBER_INFLIGHT, -1,
+			     chunk_size, arg);
+}
+
+/*
+ * Return the size of the gzip header at buf, -EAGAIN if it isn't complete
+ * in len bytes, or -EINVAL if it isn't a gzip header. If deflate_len isn't
+ * NULL, it's the size of deflate data in the "Hi" subfield, or 0 if the
+ * header hasn't the subfield.
+ */
+int wd_gzip_head_len(const void *buf, size_t len, uint32_t *deflate_len)
+{
+	const unsigned char	*p = buf, *end;
+	size_t	off = GZIP_HEADER_SZ, xlen, sub, sub_len;
+
+	if (deflate_len)
+		*deflate_len = 0;
+	if (len < GZIP_HEADER_SZ)
+		return -EAGAIN;
+	if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 0x08 ||
+	    (p[3] & GZIP_FRESERVED))
+		return -EINVAL;
+	if (p[3] & GZIP_FEXTRA) {
+		if (len < off + 2)
+			return -EAGAIN;
+		xlen = p[off] | (p[off + 1] << 8);
+		off += 2;
+		if (len < off + xlen)
+			return -EAGAIN;
+		for (sub = off; sub + 4 <= off + xlen; sub += 4 + sub_len) {
+			sub_len = p[sub + 2] | (p[sub + 3] << 8);
+			if (p[sub] == 'H' && p[sub + 1] == 'i' && sub_len == 4 &&
+			    sub + 8 <= off + xlen && deflate_len)
+				*deflate_len = get_le32(p + sub + 4);
+		}
+		off += xlen;
+	}
+	if (p[3] & GZIP_FNAME) {
+		end = memchr(p + off, 0, len - off);
+		if (!end)
+			return -EAGAIN;
+		off = end - p + 1;
+	}
+	if (p[3] & GZIP_FCOMMENT) {
+		end = memchr(p + off, 0, len - off);
+		if (!end)
+			return -EAGAIN;
+		off = end - p + 1;
+	}
+	if (p[3] & GZIP_FHCRC) {
+		off += 2;
+		if (len < off)
+			return -EAGAIN;
+	}
+	return off;
+}
+
+/* wait for the members before until, and check their output */
+static int members_reap(struct members_ctx *ctx,
+			struct member_chunk *chunks, int inflight,
+			int *emitted, int until)
+{
+	struct member_chunk	*c;
+	int	ret;
+
+	while (*emitted < until) {
+		c = &chunks[*emitted % inflight];
+		if (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE)) {
+			ret = members_poll(ctx);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+		(*emitted)++;
+		if ((c->arg.status & STATUS_FAILED) ||
+		    c->arg.dst_len != c->isize)
+			return -EIO;
+	}
+	return 0;
+}
+
+/* inflate a member that hasn't its size in the header by the first session */
+static int members_inflate_one(handle_t *handles, struct wd_comp_arg *arg,
+			       size_t *in, size_t *out)
+{
+	struct wd_comp_arg	one;
+	int	ret;
+
+	memset(&one, 0, sizeof(one));
+	one.src = arg->src + *in;
+	one.src_len = arg->src_len - *in;
+	one.dst = arg->dst + *out;
+	one.dst_len = arg->dst_len - *out;
+	one.flag = FLAG_INPUT_FINISH;
+	ret = wd_alg_decompress(handles[0], &one);
+	if (ret)
+		return ret;
+	/* a member without its trailer is cut */
+	if (one.src_len < GZIP_TAIL_SZ || one.src_len > arg->src_len - *in)
+		return -EINVAL;
+	*in += one.src_len;
+	*out += one.dst_len;
+	return 0;
+}
+
+/*
+ * Decompress all gzip members in arg->src on the sessions. The sessions are
+ * gzip sessions in block mode, e.g. on different devices. A member that has
+ * the size of its deflate data in the header, as wd_alg_compress_members()
+ * writes, is sent to the sessions in turn, and it's decompressed into its
+ * place in arg->dst from the ISIZE of trailers, so members are done in
+ * parallel and the output is in order. Other members are found by
+ * decompressing them one by one. On success, arg->dst is moved past the
+ * output and arg->dst_len is the size of it.
+ */
+int wd_alg_decompress_members(handle_t *handles, int num,
+			      struct wd_comp_arg *arg)
+{
+	struct members_ctx	ctx = { handles, num, 0 };
+	const unsigned char	*p;
+	struct wd_comp_sess	*sess;
+	struct member_chunk	*chunks, *c;
+	size_t	in = 0, out = 0, size;
+	uint32_t	deflate_len, isize = 0;
+	int	i, head, inflight, sent = 0, emitted = 0, ret = 0;
+
+	if (!handles || num <= 0 || !arg || !arg->src_len ||
+	    (arg->flag & FLAG_RAW))
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		sess = (struct wd_comp_sess *)handles[i];
+		if (!sess || (sess->mode & MODE_STREAM) ||
+		    strncmp(sess->alg_name, "gzip", strlen("gzip")))
+			return -EINVAL;
+	}
+	inflight = num * MEMBER_INFLIGHT;
+	chunks = calloc(inflight, sizeof(*chunks));
+	if (!chunks)
+		return -ENOMEM;
+
+	while (in < arg->src_len) {
+		p = arg->src + in;
+		head = wd_gzip_head_len(p, arg->src_len - in, &deflate_len);
+		if (head < 0) {
+			ret = -EINVAL;
+			goto out;
+		}
+		size = head + deflate_len + GZIP_TAIL_SZ;
+		isize = 0;
+		if (deflate_len && size <= arg->src_len - in)
+			isize = get_le32(p + size - 4);
+		/* an empty member, e.g. the index of a seekable file */
+		if (arg->src_len - in >= head + 2 + GZIP_TAIL_SZ &&
+		    p[head] == 0x03 && p[head + 1] == 0x00 &&
+		    !get_le32(p + head + 2 + 4)) {
+			in += head + 2 + GZIP_TAIL_SZ;
+			continue;
+		}
+		if (!deflate_len || size > arg->src_len - in ||
+		    size > MEMBER_CHUNK_MAX || !isize ||
+		    isize > MEMBER_CHUNK_MAX) {
+			/* wait for the members before it */
+			ret = members_reap(&ctx, chunks, inflight,
+					   &emitted, sent);
+			if (ret)
+				goto out;
+			ret = members_inflate_one(handles, arg, &in, &out);
+			if (ret)
+				goto out;
+			continue;
+		}
+		if (isize > arg->dst_len - out) {
+			ret = -ENOSPC;
+			goto out;
+		}
+
+		/* free a slot */
+		ret = members_reap(&ctx, chunks, inflight, &emitted,
+				   sent - inflight + 1);
+		if (ret)
+			goto out;
+		c = &chunks[sent % inflight];
+		memset(c, 0, sizeof(*c));
+		c->arg.src = (void *)p;
+		c->arg.src_len = size;
+		c->arg.dst = arg->dst + out;
+		c->arg.dst_len = isize;
+		c->arg.flag = FLAG_INPUT_FINISH;
+		c->arg.cb = wd_comp_count_done;
+		c->arg.cb_param = &c->done;
+		c->isize = isize;
+		ret = wd_alg_decompress_async(handles[sent % num], &c->arg);
+		if (ret)
+			goto out;
+		sent++;
+		in += size;
+		out += isize;
+	}
+	ret = members_reap(&ctx, chunks, inflight, &emitted, sent);
+	if (ret)
+		goto out;
+	arg->dst += out;
+	arg->dst_len = out;
+	arg->status = STATUS_IN_EMPTY | STATUS_OUT_READY | STATUS_OUT_DRAINED;
+	free(chunks);
+	return 0;
+out:
+	if (members_drain(&members_ops, &ctx, chunks, inflight, emitted, sent,
+			  0))
+		return ret;
+	free(chunks);
+	return ret;
+}
@@ -0,0 +1,369 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <pthread.h>
+#include <string.h>
+
+#include "config.h"
+#include "wd_crc.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32		(1 << 7)
+#endif
+#endif
+
+#define CRC32_POLY		0xedb88320	/* reflected */
+#define ADLER_BASE		65521
+#define ADLER_NMAX		5552	/* bytes before s2 overflows */
+
+/* the vector code takes blocks of 16 bytes, and 64 bytes at least */
+#define CRC32_VEC_MIN		64
+#define CRC32_VEC_MASK		15
+#define ADLER_VEC_BLOCK		32
+
+/* slicing by 8 for CPUs without vector instructions */
+static uint32_t crc32_table[8][256];
+/* x^(2^n) modulo the polynomial, for combine */
+static uint32_t crc32_x2n[32];
+
+static int have_crc_vec;
+static int have_adler_vec;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* a * b modulo the polynomial, both are reflected */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t	m = (uint32_t)1 << 31, p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if (!(a & (m - 1)))
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+	}
+	return p;
+}
+
+/* x^(n * 2^k) modulo the polynomial */
+static uint32_t x2nmodp(uint64_t n, unsigned int k)
+{
+	uint32_t	p = (uint32_t)1 << 31;	/* x^0 */
+
+	while (n) {
+		if (n & 1)
+			p = multmodp(crc32_x2n[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void crc_init(void)
+{
+	uint32_t	c;
+	int	i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		crc32_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		c = crc32_table[0][i];
+		for (j = 1; j < 8; j++) {
+			c = crc32_table[0][c & 0xff] ^ (c >> 8);
+			crc32_table[j][i] = c;
+		}
+	}
+	crc32_x2n[0] = (uint32_t)1 << 30;	/* x^1 */
+	for (i = 1; i < 32; i++)
+		crc32_x2n[i] = multmodp(crc32_x2n[i - 1], crc32_x2n[i - 1]);
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	have_crc_vec = __builtin_cpu_supports("pclmul") &&
+		       __builtin_cpu_supports("sse4.1");
+	have_adler_vec = __builtin_cpu_supports("ssse3");
+#elif defined(__aarch64__)
+	have_crc_vec = !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+#endif
+}
+
+/* c is the raw register, it's not inverted */
+static uint32_t crc32_sw(uint32_t c, const unsigned char *p, size_t len)
+{
+	while (len && ((uintptr_t)p & 7)) {
+		c = crc32_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		/* read in little endian */
+		uint32_t lo = p[0] | (p[1] << 8) | (p[2] << 16) |
+			      ((uint32_t)p[3] << 24);
+		uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) |
+			      ((uint32_t)p[7] << 24);
+
+		lo ^= c;
+		c = crc32_table[7][lo & 0xff] ^
+		    crc32_table[6][(lo >> 8) & 0xff] ^
+		    crc32_table[5][(lo >> 16) & 0xff] ^
+		    crc32_table[4][lo >> 24] ^
+		    crc32_table[3][hi & 0xff] ^
+		    crc32_table[2][(hi >> 8) & 0xff] ^
+		    crc32_table[1][(hi >> 16) & 0xff] ^
+		    crc32_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		c = crc32_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+	return c;
+}
+
+#if defined(__x86_64__)
+/*
+ * Fold 4 x 128 bits in parallel by PCLMULQDQ, then fold to 128 bits and do
+ * Barrett reduction, as "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction" of Intel. len is a multiple of 16 and 64 at least.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_vec(uint32_t c, const unsigned char *p, size_t len)
+{
+	static const uint64_t __attribute__((aligned(16)))
+		k1k2[] = { 0x0154442bd4, 0x01c6e41596 },
+		k3k4[] = { 0x01751997d0, 0x00ccaa009e },
+		k5k0[] = { 0x0163cd6124, 0x0000000000 },
+		poly[] = { 0x01db710641, 0x01f7011641 };
+	__m128i	x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((__m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((__m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((__m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((__m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(c));
+	x0 = _mm_load_si128((__m128i *)k1k2);
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((__m128i *)(p + 0x00));
+		y6 = _mm_loadu_si128((__m128i *)(p + 0x10));
+		y7 = _mm_loadu_si128((__m128i *)(p + 0x20));
+		y8 = _mm_loadu_si128((__m128i *)(p + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold into 128 bits */
+	x0 = _mm_load_si128((__m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((__m128i *)p);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		len -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((__m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((__m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+
+/*
+ * 32 bytes a step: s1 by the sum of absolute differences to 0, s2 by the
+ * bytes multiplied by their distances to the end of the step.
+ */
+__attribute__((target("ssse3")))
+static uint32_t adler32_vec(uint32_t adler, const unsigned char *p,
+			    size_t len)
+{
+	uint32_t	s1 = adler & 0xffff, s2 = adler >> 16;
+	size_t	blocks = len / ADLER_VEC_BLOCK;
+	unsigned int	n;
+
+	while (blocks) {
+		const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26,
+						   25, 24, 23, 22, 21, 20, 19,
+						   18, 17);
+		const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10,
+						   9, 8, 7, 6, 5, 4, 3, 2, 1);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i ones = _mm_set1_epi16(1);
+		__m128i	v_ps, v_s1, v_s2, b1, b2;
+
+		n = ADLER_NMAX / ADLER_VEC_BLOCK;
+		if (n > blocks)
+			n = blocks;
+		blocks -= n;
+		v_ps = _mm_set_epi32(0, 0, 0, s1 * n);
+		v_s2 = _mm_set_epi32(0, 0, 0, s2);
+		v_s1 = _mm_setzero_si128();
+		do {
+			b1 = _mm_loadu_si128((__m128i *)p);
+			b2 = _mm_loadu_si128((__m128i *)(p + 16));
+			/* s1 of the steps before, each is added 32 times */
+			v_ps = _mm_add_epi32(v_ps, v_s1);
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b1, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+					     _mm_maddubs_epi16(b1, tap1), ones));
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b2, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+					     _mm_maddubs_epi16(b2, tap2), ones));
+			p += ADLER_VEC_BLOCK;
+		} while (--n);
+		v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+		/* horizontal sums */
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0xb1));
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, 0x4e));
+		s1 += _mm_cvtsi128_si32(v_s1);
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0xb1));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, 0x4e));
+		s2 = _mm_cvtsi128_si32(v_s2);
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+	}
+	len %= ADLER_VEC_BLOCK;
+	while (len--) {
+		s1 += *p++;
+		s2 += s1;
+	}
+	return (s1 % ADLER_BASE) | ((s2 % ADLER_BASE) << 16);
+}
+#elif defined(__aarch64__)
+/* the CRC32 instructions of ARMv8 take the gzip polynomial */
+__attribute__((target("+crc")))
+static uint32_t crc32_vec(uint32_t c, const unsigned char *p, size_t len)
+{
+	uint64_t	v;
+
+	while (len >= 8) {
+		memcpy(&v, p, sizeof(v));
+		c = __crc32d(c, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		c = __crc32b(c, *p++);
+	return c;
+}
+#endif
+
+uint32_t wd_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char	*p = buf;
+	uint32_t	c = ~crc;
+
+	pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+	if (have_crc_vec && len >= CRC32_VEC_MIN) {
+		size_t	n = len & ~(size_t)CRC32_VEC_MASK;
+
+		c = crc32_vec(c, p, n);
+		p += n;
+		len -= n;
+	}
+#elif defined(__aarch64__)
+	if (have_crc_vec)
+		return ~crc32_vec(c, p, len);
+#endif
+	return ~crc32_sw(c, p, len);
+}
+
+uint32_t wd_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	pthread_once(&crc_once, crc_init);
+	/* shift crc1 by len2 bytes */
+	return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+uint32_t wd_adler32(uint32_t adler, const void *buf, size_t len)
+{
+	const unsigned char	*p = buf;
+	uint32_t	s1 = adler & 0xffff, s2 = adler >> 16;
+	size_t	n;
+
+	pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+	if (have_adler_vec)
+		return adler32_vec(adler, p, len);
+#endif
+	/* arm64 has no NEON path, it comes here too */
+	while (len) {
+		n = len < ADLER_NMAX ? len : ADLER_NMAX;
+		len -= n;
+		while (n--) {
+			s1 += *p++;
+			s2 += s1;
+		}
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+	}
+	return s1 | (s2 << 16);
+}
+
+uint32_t wd_adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2)
+{
+	uint32_t	rem = len2 % ADLER_BASE;
+	uint64_t	s1, s2;
+
+	s1 = adler1 & 0xffff;
+	s2 = ((uint64_t)rem * s1) % ADLER_BASE;
+	s1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+	s2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+	if (s1 >= ADLER_BASE)
+		s1 -= ADLER_BASE;
+	if (s1 >= ADLER_BASE)
+		s1 -= ADLER_BASE;
+	if (s2 >= (uint64_t)ADLER_BASE << 1)
+		s2 -= (uint64_t)ADLER_BASE << 1;
+	if (s2 >= ADLER_BASE)
+		s2 -= ADLER_BASE;
+	return s1 | (s2 << 16);
+}
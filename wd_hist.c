@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wd_hist.h"
+
+static uint64_t cycles_per_sec;
+
+void wd_hist_reset(struct wd_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void wd_hist_merge(struct wd_hist *dst, const struct wd_hist *src)
+{
+	int	i;
+
+	if (!src->count)
+		return;
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < WD_HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+/* the highest value that falls into the bucket */
+static uint64_t bucket_top(int idx)
+{
+	int	shift;
+
+	if (idx < WD_HIST_SUB_NUM)
+		return idx;
+	shift = (idx >> WD_HIST_SUB_BITS) - 1;
+	return (((uint64_t)(WD_HIST_SUB_NUM + (idx & (WD_HIST_SUB_NUM - 1))) +
+		 1) << shift) - 1;
+}
+
+/* return the value that pct percent of the samples are not above */
+uint64_t wd_hist_percentile(const struct wd_hist *h, double pct)
+{
+	uint64_t	target, seen = 0, v;
+	int	i;
+
+	if (!h->count)
+		return 0;
+	if (pct >= 100.0)
+		return h->max;
+	target = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (!target)
+		target = 1;
+	for (i = 0; i < WD_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target) {
+			v = bucket_top(i);
+			if (v > h->max)
+				v = h->max;
+			if (v < h->min)
+				v = h->min;
+			return v;
+		}
+	}
+	return h->max;
+}
+
+static uint64_t get_cycles_per_sec(void)
+{
+#if defined(__aarch64__)
+	uint64_t	freq;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+	return freq;
+#elif defined(__x86_64__) || defined(__i386__)
+	struct timespec	t0, t1;
+	uint64_t	c0, c1, ns;
+
+	/* TSC rate isn't exposed to user space, measure it once */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c0 = wd_get_cycles();
+	usleep(10000);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c1 = wd_get_cycles();
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	return (c1 - c0) * 1000000000ULL / ns;
+#else
+	return 1000000000ULL;
+#endif
+}
+
+uint64_t wd_cycles_to_ns(uint64_t cycles)
+{
+	if (!cycles_per_sec)
+		cycles_per_sec = get_cycles_per_sec();
+	/* split it to avoid overflow on long intervals */
+	return cycles / cycles_per_sec * 1000000000ULL +
+	       cycles % cycles_per_sec * 1000000000ULL / cycles_per_sec;
+}
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "sw_comp.h"
+#include "wd_hybrid.h"
+
+struct wd_hybrid {
+	struct wd_comp_sess	*sess;
+	struct wd_hybrid_cfg	cfg;
+	pthread_t		*threads;
+	int			nthreads;
+	/* async requests waiting for CPU threads */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct wd_comp_arg	*queue[WD_HYBRID_QUEUE];
+	int			head;
+	int			num;
+	int			stop;
+	unsigned int		spilled;
+};
+
+/* hand an async request that CPU can't finish back to accelerator */
+static void hybrid_to_hw(struct wd_hybrid *hy, struct wd_comp_arg *arg)
+{
+	struct wd_comp_sess	*sess = hy->sess;
+	int	ret;
+
+	wd_hybrid_count(sess, 0, arg->src_len);
+	if (arg->flag & FLAG_DEFLATE)
+		ret = sess->drv->async_deflate(sess, arg);
+	else
+		ret = sess->drv->async_inflate(sess, arg);
+	if (ret) {
+		arg->dst_len = 0;
+		arg->status = STATUS_FAILED;
+		arg->cb(arg->cb_param);
+	}
+}
+
+static void *hybrid_thread(void *data)
+{
+	struct wd_hybrid	*hy = data;
+	struct wd_comp_arg	*arg;
+	size_t	len;
+
+	while (1) {
+		pthread_mutex_lock(&hy->lock);
+		while (!hy->num && !hy->stop)
+			pthread_cond_wait(&hy->cond, &hy->lock);
+		if (!hy->num) {
+			pthread_mutex_unlock(&hy->lock);
+			break;
+		}
+		arg = hy->queue[hy->head];
+		hy->head = (hy->head + 1) % WD_HYBRID_QUEUE;
+		hy->num--;
+		pthread_mutex_unlock(&hy->lock);
+
+		len = arg->src_len;
+		if (sw_comp_block(hy->sess->alg_name, hy->cfg.level, arg)) {
+			hybrid_to_hw(hy, arg);
+			continue;
+		}
+		wd_hybrid_count(hy->sess, 1, len);
+		arg->cb(arg->cb_param);
+	}
+	return NULL;
+}
+
+struct wd_hybrid *wd_hybrid_create(struct wd_comp_sess *sess,
+				   struct wd_hybrid_cfg *cfg)
+{
+	struct wd_hybrid	*hy;
+	int	i, ret;
+
+	hy = calloc(1, sizeof(*hy));
+	if (!hy)
+		return NULL;
+	hy->sess = sess;
+	hy->cfg = *cfg;
+	if (!hy->cfg.level)
+		hy->cfg.level = SW_LEVEL_DEFAULT;
+	pthread_mutex_init(&hy->lock, NULL);
+	pthread_cond_init(&hy->cond, NULL);
+
+	if (cfg->cpu_threads) {
+		hy->threads = calloc(cfg->cpu_threads, sizeof(*hy->threads));
+		if (!hy->threads)
+			goto out;
+	}
+	for (i = 0; i < cfg->cpu_threads; i++) {
+		ret = pthread_create(&hy->threads[i], NULL, hybrid_thread, hy);
+		if (ret) {
+			WD_ERR("fail to create CPU thread (%d)\n", ret);
+			goto out;
+		}
+		hy->nthreads++;
+	}
+	return hy;
+out:
+	wd_hybrid_destroy(hy);
+	return NULL;
+}
+
+/* requests in the queue are done before it returns */
+void wd_hybrid_destroy(struct wd_hybrid *hy)
+{
+	int	i;
+
+	if (!hy)
+		return;
+
+	pthread_mutex_lock(&hy->lock);
+	hy->stop = 1;
+	pthread_cond_broadcast(&hy->cond);
+	pthread_mutex_unlock(&hy->lock);
+	for (i = 0; i < hy->nthreads; i++)
+		pthread_join(hy->threads[i], NULL);
+	pthread_cond_destroy(&hy->cond);
+	pthread_mutex_destroy(&hy->lock);
+	free(hy->threads);
+	free(hy);
+}
+
+/* Return 1 if the request should go to CPU. */
+int wd_hybrid_pick(struct wd_hybrid *hy, struct wd_comp_arg *arg, int async)
+{
+	struct wd_comp_sess	*sess = hy->sess;
+	struct wd_hybrid_cfg	*cfg = &hy->cfg;
+	int	load;
+
+	if (!arg->src_len || (cfg->max_block && arg->src_len > cfg->max_block))
+		return 0;
+	if (async) {
+		if (!hy->nthreads)
+			return 0;
+		if (cfg->max_load && sess->drv->load) {
+			load = sess->drv->load(sess, arg->flag & FLAG_DEFLATE);
+			if (load >= cfg->max_load)
+				return 1;
+		}
+	} else if (!(arg->flag & FLAG_INPUT_FINISH)) {
+		/* only the last piece of data is an independent block */
+		return 0;
+	}
+
+	if (cfg->max_ns_per_kb && sess->ns_per_kb[!!(arg->flag & FLAG_DEFLATE)] >
+	    cfg->max_ns_per_kb) {
+		/* or the latency of accelerator is never updated */
+		if (!(__atomic_add_fetch(&hy->spilled, 1, __ATOMIC_RELAXED) %
+		      WD_HYBRID_PROBE))
+			return 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Run a sync request in the caller's thread, since the caller waits for it
+ * anyway. Buffers in arg are moved as accelerator does in block mode. The
+ * request should go to accelerator if it fails.
+ */
+int wd_hybrid_sync(struct wd_hybrid *hy, struct wd_comp_arg *arg)
+{
+	size_t	len = arg->src_len;
+	int	ret;
+
+	ret = sw_comp_block(hy->sess->alg_name, hy->cfg.level, arg);
+	if (ret)
+		return ret;
+	wd_hybrid_count(hy->sess, 1, len);
+	arg->src += arg->src_len;
+	arg->dst += arg->dst_len;
+	return 0;
+}
+
+/* Return -EBUSY if CPU threads are saturated too. */
+int wd_hybrid_submit(struct wd_hybrid *hy, struct wd_comp_arg *arg)
+{
+	int	ret = 0;
+
+	pthread_mutex_lock(&hy->lock);
+	if (hy->num == WD_HYBRID_QUEUE) {
+		ret = -EBUSY;
+		goto out;
+	}
+	hy->queue[(hy->head + hy->num) % WD_HYBRID_QUEUE] = arg;
+	hy->num++;
+	pthread_cond_signal(&hy->cond);
+out:
+	pthread_mutex_unlock(&hy->lock);
+	return ret;
+}
@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "wd_poller.h"
+
+#define POLL_BUDGET	32	/* completions taken from a queue in a pass */
+#define POLL_SPIN	1024	/* empty passes before the poller sleeps */
+#define POLL_CALLS	256	/* completions called back in a pass */
+
+struct wd_poller_queue {
+	handle_t		h_ctx;
+	int			(*recv)(handle_t h_ctx, void **resp);
+	struct wd_poller_sub	*sub;
+};
+
+/* a completion to be passed to complete() of sub */
+struct wd_poller_call {
+	struct wd_poller_sub	*sub;
+	void			*resp;
+};
+
+struct wd_poller {
+	pthread_t		thread;
+	int			idle_us;
+	int			stop;
+	/* protect the queue table against the poller thread */
+	pthread_mutex_t		lock;
+	struct wd_poller_queue	*queues;
+	int			q_num;
+	int			q_size;
+	/*
+	 * Completions are called back out of lock, so complete() may add
+	 * queues. wd_poller_del() waits until calls of the pass are done.
+	 */
+	struct wd_poller_call	calls[POLL_CALLS];
+	int			calling;
+	pthread_cond_t		called;
+};
+
+int wd_ring_init(struct wd_ring *ring, uint32_t size)
+{
+	uint32_t n = 1;
+
+	if (!size || size > (1U << 31))
+		return -EINVAL;
+	while (n < size)
+		n <<= 1;
+
+	ring->slots = calloc(n, sizeof(*ring->slots));
+	if (!ring->slots)
+		return -ENOMEM;
+	ring->mask = n - 1;
+	ring->head = ring->tail = 0;
+	ring->head_cache = ring->tail_cache = 0;
+	return 0;
+}
+
+void wd_ring_fini(struct wd_ring *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+/*
+ * Return number of completions taken from the queue. Completions of a sub
+ * with complete() are added to calls[] of poller.
+ */
+static int __reap(struct wd_poller *poller, struct wd_poller_queue *q)
+{
+	struct wd_poller_sub *sub = q->sub;
+	struct wd_poller_call *call;
+	void *resp;
+	int n, ret;
+
+	for (n = 0; n < POLL_BUDGET; n++) {
+		/* leave the completion in hardware if there's no room */
+		if (sub->complete ? poller->calling == POLL_CALLS :
+		    wd_ring_full(&sub->ring))
+			break;
+		ret = q->recv(q->h_ctx, &resp);
+		if (ret == -EAGAIN)
+			break;
+		if (ret) {
+			WD_ERR("poller fails to recv (%d)\n", ret);
+			break;
+		}
+		if (sub->complete) {
+			call = &poller->calls[poller->calling++];
+			call->sub = sub;
+			call->resp = resp;
+		} else {
+			wd_ring_push(&sub->ring, resp);
+		}
+	}
+	return n;
+}
+
+static void *__poller_thread(void *data)
+{
+	struct wd_poller *poller = data;
+	struct wd_poller_call *call;
+	int i, found, idle = 0;
+
+	while (!__atomic_load_n(&poller->stop, __ATOMIC_ACQUIRE)) {
+		found = 0;
+		pthread_mutex_lock(&poller->lock);
+		for (i = 0; i < poller->q_num; i++)
+			found += __reap(poller, &poller->queues[i]);
+		pthread_mutex_unlock(&poller->lock);
+
+		/* calls[] is only changed by this thread */
+		for (i = 0; i < poller->calling; i++) {
+			call = &poller->calls[i];
+			call->sub->complete(call->resp, call->sub->priv);
+		}
+		if (poller->calling) {
+			pthread_mutex_lock(&poller->lock);
+			poller->calling = 0;
+			pthread_cond_broadcast(&poller->called);
+			pthread_mutex_unlock(&poller->lock);
+		}
+
+		if (found) {
+			idle = 0;
+		} else if (++idle >= POLL_SPIN) {
+			if (poller->idle_us)
+				usleep(poller->idle_us);
+			else
+				sched_yield();
+			idle = 0;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Start a poller thread on cpu, or on any cpu if cpu is negative. The
+ * poller busy polls, and sleeps idle_us after a while without completions.
+ * With idle_us 0, it only yields.
+ */
+struct wd_poller *wd_poller_create(int cpu, int idle_us)
+{
+	struct wd_poller *poller;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret;
+
+	if (idle_us < 0)
+		return NULL;
+
+	poller = calloc(1, sizeof(*poller));
+	if (!poller)
+		return NULL;
+	poller->idle_us = idle_us;
+	pthread_mutex_init(&poller->lock, NULL);
+	pthread_cond_init(&poller->called, NULL);
+
+	pthread_attr_init(&attr);
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		ret = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		if (ret) {
+			WD_ERR("fail to pin poller on cpu %d (%d)\n", cpu, ret);
+			goto out;
+		}
+	}
+	ret = pthread_create(&poller->thread, &attr, __poller_thread, poller);
+	if (ret) {
+		WD_ERR("fail to create poller thread (%d)\n", ret);
+		goto out;
+	}
+	pthread_attr_destroy(&attr);
+	return poller;
+
+out:
+	pthread_attr_destroy(&attr);
+	pthread_cond_destroy(&poller->called);
+	pthread_mutex_destroy(&poller->lock);
+	free(poller);
+	return NULL;
+}
+
+/* queues should be deleted before */
+void wd_poller_destroy(struct wd_poller *poller)
+{
+	if (!poller)
+		return;
+
+	__atomic_store_n(&poller->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(poller->thread, NULL);
+	pthread_cond_destroy(&poller->called);
+	pthread_mutex_destroy(&poller->lock);
+	free(poller->queues);
+	free(poller);
+}
+
+struct wd_poller_sub *wd_poller_sub_alloc(uint32_t ring_size,
+					  void (*complete)(void *resp,
+							   void *priv),
+					  void *priv)
+{
+	struct wd_poller_sub *sub;
+
+	/* keep the ring indexes on their own cache lines */
+	if (posix_memalign((void **)&sub, WD_CACHELINE_SIZE, sizeof(*sub)))
+		return NULL;
+	memset(sub, 0, sizeof(*sub));
+	if (!complete && wd_ring_init(&sub->ring, ring_size)) {
+		free(sub);
+		return NULL;
+	}
+	sub->complete = complete;
+	sub->priv = priv;
+	return sub;
+}
+
+void wd_poller_sub_free(struct wd_poller_sub *sub)
+{
+	if (!sub)
+		return;
+	wd_ring_fini(&sub->ring);
+	free(sub);
+}
+
+/*
+ * Let the poller reap completions of h_ctx for sub. The submitter keeps
+ * sending on h_ctx, so the driver's send and recv must be safe to run at the
+ * same time from two threads. complete() of sub runs out of the queue table
+ * lock, so it may add queues, or delete the queues of other subs.
+ */
+int wd_poller_add(struct wd_poller *poller, handle_t h_ctx,
+		  int (*recv)(handle_t h_ctx, void **resp),
+		  struct wd_poller_sub *sub)
+{
+	struct wd_poller_queue *queues;
+	int size, ret = 0;
+
+	if (!poller || !h_ctx || !recv || !sub)
+		return -EINVAL;
+
+	pthread_mutex_lock(&poller->lock);
+	if (poller->q_num == poller->q_size) {
+		size = poller->q_size ? poller->q_size * 2 : 8;
+		queues = realloc(poller->queues, size * sizeof(*queues));
+		if (!queues) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		poller->queues = queues;
+		poller->q_size = size;
+	}
+	poller->queues[poller->q_num].h_ctx = h_ctx;
+	poller->queues[poller->q_num].recv = recv;
+	poller->queues[poller->q_num].sub = sub;
+	poller->q_num++;
+out:
+	pthread_mutex_unlock(&poller->lock);
+	return ret;
+}
+
+/*
+ * The poller doesn't touch h_ctx after it returns, and completions taken
+ * from h_ctx are called back.
+ */
+int wd_poller_del(struct wd_poller *poller, handle_t h_ctx)
+{
+	int i, ret = -ENOENT;
+
+	if (!poller)
+		return -EINVAL;
+
+	pthread_mutex_lock(&poller->lock);
+	for (i = 0; i < poller->q_num; i++) {
+		if (poller->queues[i].h_ctx != h_ctx)
+			continue;
+		poller->queues[i] = poller->queues[--poller->q_num];
+		ret = 0;
+		break;
+	}
+	/* complete() of the poller thread can't wait for itself */
+	while (poller->calling &&
+	       !pthread_equal(pthread_self(), poller->thread))
+		pthread_cond_wait(&poller->called, &poller->lock);
+	pthread_mutex_unlock(&poller->lock);
+	return ret;
+}
@@ -3,6 +3,40 @@
 #include "wd_sched.h"
 #include "smm.h"
 
+/* state of a cache slot in the reorder buffer */
+#define SLOT_FREE	0
+#define SLOT_BUSY	1	/* sent to hardware */
+#define SLOT_DONE	2	/* completed, waiting for output */
+
+struct wd_sched_slot {
+	int	state;
+	int	q;	/* index of the queue that the slot is sent to */
+	/* timestamps for latency histograms */
+	uint64_t	t_input;
+	uint64_t	t_send;
+	uint64_t	t_recv;
+	uint64_t	t_admit;	/* wd_sched_now() when sent, for __tune() */
+};
+
+/* in-flight window tuning */
+#define TUNE_MIN_DONE	32	/* completions in a period at least */
+#define TUNE_NOISE	5	/* throughput drop in percent to turn around */
+
+struct wd_sched_tune {
+	uint64_t	start;	/* start of the period */
+	uint64_t	lat_sum;
+	uint64_t	bytes;	/* of the completions in the period */
+	int		done;
+	int		dir;	/* 1 to grow the window, -1 to shrink */
+	uint64_t	last_tput;	/* bytes per second */
+};
+
+static inline struct wd_hist *__hist(struct wd_scheduler *sched, int q,
+				     int type)
+{
+	return &sched->hist[q * WD_SCHED_LAT_NUM + type];
+}
+
 /*
  * In SVA scenario, a whole user buffer could be divided into multiple frames.
  * In NOSVA scenario, data from a whole user buffer should be copied into
@@ -23,9 +57,53 @@ static int __init_cache(struct wd_scheduler *sched)
 	if (!sched->stat)
 		goto err_with_msgs;
 
+	sched->slots = calloc(sched->msg_cache_num, sizeof(*sched->slots));
+	if (!sched->slots)
+		goto err_with_stat;
+
+	sched->q_pend = calloc(sched->q_num, sizeof(*sched->q_pend));
+	if (!sched->q_pend)
+		goto err_with_slots;
+
+	sched->free_slots = calloc(sched->msg_cache_num,
+				   sizeof(*sched->free_slots));
+	if (!sched->free_slots)
+		goto err_with_pend;
+
+	if (sched->lat_stat) {
+		sched->hist = calloc(sched->q_num * WD_SCHED_LAT_NUM,
+				     sizeof(*sched->hist));
+		if (!sched->hist)
+			goto err_with_free;
+	}
+
+	if (sched->auto_win) {
+		sched->tune = calloc(1, sizeof(*sched->tune));
+		if (!sched->tune) {
+			ret = -ENOMEM;
+			goto err_with_hist;
+		}
+		sched->tune->dir = 1;
+		sched->tune->start = wd_sched_now();
+		if (sched->win <= 0 || sched->win > sched->msg_cache_num)
+			sched->win = 1;
+	} else {
+		sched->win = sched->msg_cache_num;
+	}
+
+	if (sched->poller) {
+		sched->psub = wd_poller_sub_alloc(sched->msg_cache_num, NULL,
+						  NULL);
+		if (!sched->psub) {
+			ret = -ENOMEM;
+			goto err_with_tune;
+		}
+	}
+
 	for (i = 0; i < sched->msg_cache_num; i++) {
 		sched->msgs[i].next_in = NULL;
 		sched->msgs[i].next_out = NULL;
+		sched->free_slots[i] = i;
 
 		if (sched->init_cache)
 			sched->init_cache(sched, i, sched->priv);
@@ -33,6 +111,20 @@ static int __init_cache(struct wd_scheduler *sched)
 
 	return 0;
 
+err_with_tune:
+	free(sched->tune);
+	sched->tune = NULL;
+err_with_hist:
+	free(sched->hist);
+	sched->hist = NULL;
+err_with_free:
+	free(sched->free_slots);
+err_with_pend:
+	free(sched->q_pend);
+err_with_slots:
+	free(sched->slots);
+err_with_stat:
+	free(sched->stat);
 err_with_msgs:
 	free(sched->msgs);
 	return ret;
@@ -40,6 +132,21 @@ err_with_msgs:
 
 static void __fini_cache(struct wd_scheduler *sched)
 {
+	int i;
+
+	if (sched->psub) {
+		for (i = 0; sched->polled && i < sched->q_num; i++)
+			wd_poller_del(sched->poller, sched->qs[i]);
+		wd_poller_sub_free(sched->psub);
+		sched->psub = NULL;
+	}
+	free(sched->tune);
+	sched->tune = NULL;
+	free(sched->hist);
+	sched->hist = NULL;
+	free(sched->free_slots);
+	free(sched->q_pend);
+	free(sched->slots);
 	free(sched->stat);
 	free(sched->msgs);
 }
@@ -48,7 +155,16 @@ int wd_sched_init(struct wd_scheduler *sched, char *node_path)
 {
 	int ret;
 
+	if (sched->order != WD_SCHED_ORDERED &&
+	    sched->order != WD_SCHED_UNORDERED)
+		return -EINVAL;
+
 	sched->cl = sched->msg_cache_num;
+	sched->c_h = sched->c_t = 0;
+	sched->q_h = sched->q_t = 0;
+	sched->q_p = 0;
+	sched->f_h = sched->f_t = 0;
+	sched->polled = false;
 
 	ret = __init_cache(sched);
 	if (ret)
@@ -64,25 +180,34 @@ void wd_sched_fini(struct wd_scheduler *sched)
 		free(sched->ss_region);
 }
 
-static int wd_recv_sync(struct wd_scheduler *sched, handle_t h_ctx,
-			void **resp, __u16 ms)
+/* the queues are allocated after wd_sched_init(), attach them here */
+static int __attach_poller(struct wd_scheduler *sched)
 {
-	int ret;
+	int i, ret;
 
-	while (1) {
-		ret = sched->hw_recv(h_ctx, resp);
-		if (ret == -EBUSY) {
-			ret = wd_wait(h_ctx, ms);
-			if (ret)
-				return ret;
-		} else
-			return ret;
+	for (i = 0; i < sched->q_num; i++) {
+		ret = wd_poller_add(sched->poller, sched->qs[i],
+				    sched->hw_recv, sched->psub);
+		if (ret)
+			goto out;
 	}
+	sched->polled = true;
+	return 0;
+out:
+	while (i--)
+		wd_poller_del(sched->poller, sched->qs[i]);
+	return ret;
 }
 
 static int __sync_send(struct wd_scheduler *sched) {
 	int ret;
 
+	if (sched->psub && !sched->polled) {
+		ret = __attach_poller(sched);
+		if (ret)
+			return ret;
+	}
+
 	dbg("send ci(%d) to q(%d): %p\n", sched->c_h, sched->q_h,
 	    sched->msgs[sched->c_h].msg);
 	do {
@@ -98,102 +223,327 @@ static int __sync_send(struct wd_scheduler *sched) {
 			return ret;
 	} while (ret);
 
+	if (sched->hist) {
+		struct wd_sched_slot *slot = &sched->slots[sched->c_h];
+
+		slot->t_send = wd_get_cycles();
+		wd_hist_add(__hist(sched, sched->q_h, WD_SCHED_LAT_QUEUE),
+			    slot->t_send - slot->t_input);
+	}
+	if (sched->tune)
+		sched->slots[sched->c_h].t_admit = wd_sched_now();
+	sched->slots[sched->c_h].state = SLOT_BUSY;
+	sched->slots[sched->c_h].q = sched->q_h;
+	sched->q_pend[sched->q_h]++;
 	sched->q_h = (sched->q_h + 1) % sched->q_num;
 	return 0;
 }
 
-static int __poll_wait(struct wd_scheduler *sched) {
-	void *recv_msg;
-	int ret;
-	int ms = 1000;
+/* find the cache slot that carries the hardware message */
+static int __find_slot(struct wd_scheduler *sched, void *msg)
+{
+	int i, idx;
 
-	dbg("recv, ci(%d) from q(%d): %p\n", sched->c_t, sched->q_t,
-	    sched->msgs[sched->c_h].msg);
-	ret = wd_wait(sched->qs[sched->q_t], ms);
-	if (ret > 0) {
-		do {
-			handle_t h_ctx = sched->qs[sched->q_t];
-			ret = sched->hw_recv(h_ctx, &recv_msg);
-			if (ret == -EIO)
-				return ret;
-			if (ret == -EAGAIN) {
-				sched->stat[sched->q_t].recv_retries++;
-				break;
-			}
+	/* the oldest slot is the most likely one */
+	for (i = 0; i < sched->msg_cache_num; i++) {
+		idx = (sched->c_t + i) % sched->msg_cache_num;
+		if (sched->msgs[idx].msg == msg)
+			return idx;
+	}
+	return -1;
+}
 
-			sched->stat[sched->q_t].recv++;
-			sched->q_t = (sched->q_t + 1) % sched->q_num;
+static void __mark_done(struct wd_scheduler *sched, int idx, int q)
+{
+	sched->slots[idx].state = SLOT_DONE;
+	if (sched->hist) {
+		struct wd_sched_slot *slot = &sched->slots[idx];
 
-			if (recv_msg != sched->msgs[sched->c_t].msg) {
-				fprintf(stderr, "recv msg %p and input %p mismatch\n",
-						recv_msg, sched->msgs[sched->c_t].msg);
-				return -EINVAL;
-			}
+		slot->t_recv = wd_get_cycles();
+		wd_hist_add(__hist(sched, q, WD_SCHED_LAT_HW),
+			    slot->t_recv - slot->t_send);
+	}
+}
 
-			ret = sched->output(&sched->msgs[sched->c_t], sched->priv);
-			if (ret)
-				return ret;
+/* take one completion that the poller thread has reaped */
+static int __recv_polled(struct wd_scheduler *sched)
+{
+	void *recv_msg;
+	int q, idx;
 
-			sched->c_t = (sched->c_t + 1) % sched->msg_cache_num;
-			sched->cl++;
-		} while(!ret);
+	if (wd_poller_get(sched->psub, &recv_msg))
+		return -EAGAIN;
 
+	idx = __find_slot(sched, recv_msg);
+	if (idx < 0 || sched->slots[idx].state != SLOT_BUSY) {
+		fprintf(stderr, "polled msg %p mismatch\n", recv_msg);
+		return -EINVAL;
 	}
-
-	return ret;
+	q = sched->slots[idx].q;
+	sched->stat[q].recv++;
+	sched->q_pend[q]--;
+	__mark_done(sched, idx, q);
+	dbg("polled, ci(%d) from q(%d): %p\n", idx, q, recv_msg);
+	return idx;
 }
 
-static int __sync_wait(struct wd_scheduler *sched) {
+/*
+ * Fetch one completion from whichever queue has one ready. Queues are polled
+ * round robin so that a slow queue can't hide completions of the others.
+ * Return the index of the completed slot, or -EAGAIN if nothing is ready.
+ */
+static int __recv_any(struct wd_scheduler *sched)
+{
 	void *recv_msg;
-	int ret;
+	int i, q, idx, ret;
 
-	dbg("recv, ci(%d) from q(%d): %p\n", sched->c_t, sched->q_t,
-	    sched->msgs[sched->c_h].msg);
-	do {
-		sched->stat[sched->q_t].recv++;
-		ret = wd_recv_sync(sched, sched->qs[sched->q_t],
-				   &recv_msg, 1000);
+	if (sched->psub)
+		return __recv_polled(sched);
+
+	for (i = 0; i < sched->q_num; i++) {
+		q = (sched->q_p + i) % sched->q_num;
+		if (!sched->q_pend[q])
+			continue;
+
+		ret = sched->hw_recv(sched->qs[q], &recv_msg);
 		if (ret == -EAGAIN) {
-			usleep(1);
-			sched->stat[sched->q_t].recv_retries++;
+			sched->stat[q].recv_retries++;
 			continue;
-		} else if (ret == -EIO)
+		} else if (ret)
 			return ret;
 
-		if (recv_msg != sched->msgs[sched->c_t].msg) {
-			fprintf(stderr, "recv msg %p and input %p mismatch\n",
-				recv_msg, sched->msgs[sched->c_t].msg);
+		sched->stat[q].recv++;
+		sched->q_pend[q]--;
+		sched->q_p = (q + 1) % sched->q_num;
+
+		idx = __find_slot(sched, recv_msg);
+		if (idx < 0 || sched->slots[idx].state != SLOT_BUSY) {
+			fprintf(stderr, "recv msg %p from q(%d) mismatch\n",
+				recv_msg, q);
 			return -EINVAL;
 		}
-	} while (ret);
+		__mark_done(sched, idx, q);
+		dbg("recv, ci(%d) from q(%d): %p\n", idx, q, recv_msg);
+		return idx;
+	}
+
+	return -EAGAIN;
+}
 
-	sched->q_t = (sched->q_t + 1) % sched->q_num;
+/*
+ * Hill climbing on throughput in bytes, so a window that completes more but
+ * smaller messages isn't taken as faster. The window moves one step per
+ * period in the current direction, and turns around when throughput drops.
+ * The period is long enough to turn the window over twice.
+ */
+static void __tune(struct wd_scheduler *sched, uint64_t now, uint64_t lat,
+		   size_t bytes)
+{
+	struct wd_sched_tune *t = sched->tune;
+	uint64_t tput, elapsed;
+	int step;
+
+	t->done++;
+	t->bytes += bytes;
+	t->lat_sum += lat;
+	if (t->done < TUNE_MIN_DONE || t->done < sched->win * 2)
+		return;
+
+	elapsed = now - t->start;
+	if (!elapsed)
+		return;
+	tput = t->bytes * 1000000000ULL / elapsed;
+
+	if (sched->win_lat && t->lat_sum / t->done > sched->win_lat) {
+		/* over the latency target, back off multiplicatively */
+		sched->win = sched->win * 3 / 4;
+		t->dir = -1;
+	} else {
+		if (tput * 100 < t->last_tput * (100 - TUNE_NOISE))
+			t->dir = -t->dir;
+		step = sched->win / 8 ? sched->win / 8 : 1;
+		sched->win += t->dir * step;
+	}
+
+	if (sched->win >= sched->msg_cache_num) {
+		sched->win = sched->msg_cache_num;
+		t->dir = -1;
+	} else if (sched->win <= 1) {
+		sched->win = 1;
+		t->dir = 1;
+	}
+
+	dbg("tune: tput=%luB/s, lat=%luns, win=%d\n", tput,
+	    t->lat_sum / t->done, sched->win);
+	t->last_tput = tput;
+	t->bytes = 0;
+	t->done = 0;
+	t->lat_sum = 0;
+	t->start = now;
+}
+
+static int __output(struct wd_scheduler *sched, int idx)
+{
+	struct wd_sched_slot *slot = &sched->slots[idx];
+	uint64_t t_out = 0;
+	size_t bytes = 0;
+	int ret;
+
+	/* let output() see the slot and the queue that it's working on */
+	sched->c_t = idx;
+	sched->q_t = slot->q;
+	if (sched->hist)
+		t_out = wd_get_cycles();
+	/* before output() takes the message */
+	if (sched->tune)
+		bytes = sched->msg_len ?
+			sched->msg_len(&sched->msgs[idx], sched->priv) :
+			sched->msg_data_size;
+	ret = sched->output(&sched->msgs[idx], sched->priv);
+	if (ret)
+		return ret;
+	if (sched->hist) {
+		wd_hist_add(__hist(sched, slot->q, WD_SCHED_LAT_REORDER),
+			    t_out - slot->t_recv);
+		wd_hist_add(__hist(sched, slot->q, WD_SCHED_LAT_OUTPUT),
+			    wd_get_cycles() - t_out);
+	}
+	if (sched->tune) {
+		uint64_t now = wd_sched_now();
+
+		__tune(sched, now, now - slot->t_admit, bytes);
+	}
+
+	sched->slots[idx].state = SLOT_FREE;
+	sched->cl++;
 	return 0;
 }
 
-/* return number of msg in the sent cache or negative errno */
-int wd_sched_work(struct wd_scheduler *sched, unsigned long remained)
+/*
+ * Deliver the completed slot. In WD_SCHED_ORDERED, a slot is held in the
+ * reorder buffer until all slots submitted before it are delivered.
+ */
+static int __deliver(struct wd_scheduler *sched, int idx)
 {
 	int ret;
 
-#define MOV_INDEX(id) do { \
-	sched->id = (sched->id + 1) % sched->msg_cache_num; \
-} while(0)
+	if (sched->order == WD_SCHED_UNORDERED) {
+		ret = __output(sched, idx);
+		if (ret)
+			return ret;
+		sched->free_slots[sched->f_t] = idx;
+		sched->f_t = (sched->f_t + 1) % sched->msg_cache_num;
+		return 0;
+	}
+
+	while (!wd_sched_empty(sched) &&
+	       sched->slots[sched->c_t].state == SLOT_DONE) {
+		idx = sched->c_t;
+		ret = __output(sched, idx);
+		if (ret)
+			return ret;
+		sched->c_t = (idx + 1) % sched->msg_cache_num;
+	}
+	return 0;
+}
+
+static inline bool __head_done(struct wd_scheduler *sched)
+{
+	return sched->slots[sched->c_t].state == SLOT_DONE;
+}
+
+/* the queue to sleep on when nothing is ready */
+static int __wait_queue(struct wd_scheduler *sched)
+{
+	int i, q;
+
+	/* the head blocks the output in order, so wait for it first */
+	if (sched->order == WD_SCHED_ORDERED)
+		return sched->slots[sched->c_t].q;
+
+	for (i = 0; i < sched->q_num; i++) {
+		q = (sched->q_p + i) % sched->q_num;
+		if (sched->q_pend[q])
+			return q;
+	}
+	return sched->q_p;
+}
+
+static int __poll_wait(struct wd_scheduler *sched) {
+	int idx, ret;
+	int ms = 1000;
+
+	idx = __recv_any(sched);
+	/* the poller thread owns the queues, don't sleep on them */
+	if (idx == -EAGAIN && !__head_done(sched) && !sched->psub) {
+		ret = wd_wait(sched->qs[__wait_queue(sched)], ms);
+		if (ret <= 0)
+			return ret;
+		idx = __recv_any(sched);
+	}
+
+	/* reap everything that is ready now */
+	while (idx >= 0 || __head_done(sched)) {
+		ret = __deliver(sched, idx >= 0 ? idx : sched->c_t);
+		if (ret)
+			return ret;
+		idx = __recv_any(sched);
+	}
+
+	return idx;
+}
+
+static int __sync_wait(struct wd_scheduler *sched) {
+	int idx;
+
+	/*
+	 * Completions from other queues are parked in the reorder buffer
+	 * while waiting, so they're delivered together with the head.
+	 */
+	while (1) {
+		if (sched->order == WD_SCHED_ORDERED && __head_done(sched))
+			return __deliver(sched, sched->c_t);
+
+		idx = __recv_any(sched);
+		if (idx == -EAGAIN) {
+			usleep(1);
+			continue;
+		} else if (idx < 0)
+			return idx;
+
+		if (sched->order == WD_SCHED_UNORDERED)
+			return __deliver(sched, idx);
+	}
+}
+
+/* Return number of msg in the sent cache or negative errno. */
+int wd_sched_work(struct wd_scheduler *sched, unsigned long remained)
+{
+	int ret;
 
 	dbg("sched: cl=%d, data_remained=%d\n", sched->cl, remained);
 
-	if (sched->cl && remained) {
+	if (sched->cl && remained &&
+	    sched->msg_cache_num - sched->cl < sched->win) {
+		if (sched->order == WD_SCHED_UNORDERED)
+			sched->c_h = sched->free_slots[sched->f_h];
+
 		ret = sched->input(&sched->msgs[sched->c_h], sched->priv);
 		if (ret)
 			return ret;
+		if (sched->hist)
+			sched->slots[sched->c_h].t_input = wd_get_cycles();
 
 		ret = __sync_send(sched);
 		if (ret)
 			return ret;
 
-		MOV_INDEX(c_h);
+		if (sched->order == WD_SCHED_UNORDERED)
+			sched->f_h = (sched->f_h + 1) % sched->msg_cache_num;
+		else
+			sched->c_h = (sched->c_h + 1) % sched->msg_cache_num;
 		sched->cl--;
-	} else {
+	} else if (!wd_sched_empty(sched)) {
 		if (sched->poll) {
 			ret = __poll_wait(sched);
 			if (ret && ret != -EAGAIN)
@@ -202,16 +552,155 @@ int wd_sched_work(struct wd_scheduler *sched, unsigned long remained)
 			ret = __sync_wait(sched);
 			if (ret)
 				return ret;
-
-			ret = sched->output(&sched->msgs[sched->c_t], sched->priv);
-			if (ret)
-				return ret;
-
-			MOV_INDEX(c_t);
-			sched->cl++;
 		}
 	}
 
 	return sched->cl;
 }
 
+/*
+ * Copy out a latency histogram of queue q, or the merged histogram of all
+ * queues if q is negative. Values are in cycles, see wd_cycles_to_ns().
+ */
+int wd_sched_get_hist(struct wd_scheduler *sched, int q, int type,
+		      struct wd_hist *snap)
+{
+	int i;
+
+	if (!sched->hist || !snap || q >= sched->q_num ||
+	    type < 0 || type >= WD_SCHED_LAT_NUM)
+		return -EINVAL;
+
+	if (q >= 0) {
+		memcpy(snap, __hist(sched, q, type), sizeof(*snap));
+		return 0;
+	}
+	wd_hist_reset(snap);
+	for (i = 0; i < sched->q_num; i++)
+		wd_hist_merge(snap, __hist(sched, i, type));
+	return 0;
+}
+
+void wd_sched_reset_hist(struct wd_scheduler *sched)
+{
+	int i;
+
+	if (!sched->hist)
+		return;
+	for (i = 0; i < sched->q_num * WD_SCHED_LAT_NUM; i++)
+		wd_hist_reset(&sched->hist[i]);
+}
+
+/*
+ * A request without deadline is due after all requests with deadlines.
+ * Requests of the same deadline are served in submission order.
+ */
+static inline bool __edf_before(const struct wd_sched_req *a,
+				const struct wd_sched_req *b)
+{
+	uint64_t da = a->deadline ? a->deadline : UINT64_MAX;
+	uint64_t db = b->deadline ? b->deadline : UINT64_MAX;
+
+	if (da != db)
+		return da < db;
+	return a->seq < b->seq;
+}
+
+int wd_edf_init(struct wd_edf_queue *q, int size)
+{
+	if (size <= 0)
+		return -EINVAL;
+
+	q->heap = calloc(size, sizeof(*q->heap));
+	if (!q->heap)
+		return -ENOMEM;
+	q->size = size;
+	q->num = 0;
+	q->seq = 0;
+	return 0;
+}
+
+void wd_edf_fini(struct wd_edf_queue *q)
+{
+	free(q->heap);
+	q->heap = NULL;
+	q->size = q->num = 0;
+}
+
+static int __edf_insert(struct wd_edf_queue *q, const struct wd_sched_req *req)
+{
+	int i, parent;
+
+	if (q->num == q->size)
+		return -EBUSY;
+
+	/* sift up */
+	for (i = q->num++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!__edf_before(req, &q->heap[parent]))
+			break;
+		q->heap[i] = q->heap[parent];
+	}
+	q->heap[i] = *req;
+	return 0;
+}
+
+int wd_edf_push(struct wd_edf_queue *q, void *data, uint64_t deadline)
+{
+	struct wd_sched_req req;
+	int ret;
+
+	req.deadline = deadline;
+	req.seq = q->seq;
+	req.data = data;
+	ret = __edf_insert(q, &req);
+	if (!ret)
+		q->seq++;
+	return ret;
+}
+
+/*
+ * Put back a request that was popped but couldn't be sent. It keeps its
+ * place among the requests of the same deadline.
+ */
+int wd_edf_requeue(struct wd_edf_queue *q, const struct wd_sched_req *req)
+{
+	return __edf_insert(q, req);
+}
+
+int wd_edf_pop(struct wd_edf_queue *q, struct wd_sched_req *req)
+{
+	struct wd_sched_req last;
+	int i, child;
+
+	if (!q->num)
+		return -ENOENT;
+
+	*req = q->heap[0];
+	last = q->heap[--q->num];
+
+	/* sift down */
+	for (i = 0; (child = 2 * i + 1) < q->num; i = child) {
+		if (child + 1 < q->num &&
+		    __edf_before(&q->heap[child + 1], &q->heap[child]))
+			child++;
+		if (!__edf_before(&q->heap[child], &last))
+			break;
+		q->heap[i] = q->heap[child];
+	}
+	q->heap[i] = last;
+	return 0;
+}
+
+/*
+ * Pop the request with the earliest deadline if the deadline is before due,
+ * so it's going to be late. Requests without deadline don't expire. Return
+ * 0 if a request is popped, or -ENOENT.
+ */
+int wd_edf_expire(struct wd_edf_queue *q, uint64_t due,
+		  struct wd_sched_req *req)
+{
+	if (!q->num || !q->heap[0].deadline || q->heap[0].deadline >= due)
+		return -ENOENT;
+	return wd_edf_pop(q, req);
+}
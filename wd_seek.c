@@ -0,0 +1,490 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "wd_bytes.h"
+#include "wd_seek.h"
+
+#define SEEK_CHUNK_MAX		(1 << 20)
+#define SEEK_BATCH		32		/* chunks compressed at once */
+#define SEEK_MEMBER_TAIL	8
+#define SEEK_INDEX_MAX		16382		/* entries in an index member */
+#define SEEK_FOOTER_DATA	24
+
+/* an empty member: header, XLEN, subfield, empty deflate and trailer */
+#define SEEK_EMPTY_SZ(len)	(10 + 2 + 4 + (len) + 2 + 8)
+
+/*
+ * The file is:
+ *	data member ... index member ... footer member
+ * A data member is a gzip member of WD_GZIP_MEMBER_HEAD. An index member
+ * is an empty member with subfield "Ix", it has the sizes of data members
+ * in 32 bits. The footer is an empty member with subfield "If":
+ *	index offset (64), input size (64), chunk size (32), chunk number (32)
+ * All of them are in little endian.
+ */
+
+struct seek_writer {
+	handle_t	sess;
+	int		fd;
+	size_t		chunk_size;
+	void		*in;		/* input of a batch */
+	size_t		in_len;
+	void		*out;
+	size_t		out_size;
+	uint32_t	*sizes;		/* sizes of data members */
+	uint32_t	num;
+	uint32_t	max;
+	uint64_t	size;		/* input so far */
+	uint64_t	off;		/* output so far */
+	int		err;
+};
+
+struct seek_reader {
+	handle_t	sess;
+	int		fd;
+	size_t		chunk_size;
+	uint64_t	size;
+	uint32_t	num;
+	uint64_t	*offs;		/* offsets of data members, num + 1 */
+	void		*rbuf;		/* a data member */
+	void		*cbuf;		/* a decompressed chunk */
+	int64_t		cached;		/* the chunk in cbuf, or -1 */
+	size_t		cached_len;
+};
+
+static const unsigned char gzip_head[10] = {
+	0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03
+};
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t	n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len, uint64_t off)
+{
+	ssize_t	n;
+
+	while (len) {
+		n = pread(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!n)
+			return -EIO;
+		buf += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/* an empty gzip member that has only the subfield, return its size */
+static size_t put_empty_member(unsigned char *p, const char *id,
+			       const void *data, uint16_t len)
+{
+	memcpy(p, gzip_head, sizeof(gzip_head));
+	p[3] = 0x04;		/* FLG.FEXTRA */
+	put_le16(p + 10, len + 4);
+	p[12] = id[0];
+	p[13] = id[1];
+	put_le16(p + 14, len);
+	/* data may be in place already */
+	memmove(p + 16, data, len);
+	p += 16 + len;
+	/* a final fixed block with only end of block, then CRC32 and ISIZE */
+	p[0] = 0x03;
+	memset(p + 1, 0, 9);
+	return SEEK_EMPTY_SZ(len);
+}
+
+/* check the empty member at p and return its subfield, or NULL */
+static const unsigned char *get_empty_member(const unsigned char *p,
+					     size_t size, const char *id,
+					     uint16_t *len)
+{
+	uint16_t	xlen;
+
+	if (size < SEEK_EMPTY_SZ(0) || memcmp(p, "\x1f\x8b\x08\x04", 4))
+		return NULL;
+	xlen = get_le16(p + 10);
+	*len = get_le16(p + 14);
+	if (xlen != *len + 4 || size < SEEK_EMPTY_SZ(*len) ||
+	    p[12] != id[0] || p[13] != id[1])
+		return NULL;
+	return p + 16;
+}
+
+/*
+ * Write a file into fd, which is empty. h_sess is a gzip session in
+ * block mode, and chunk_size is WD_SEEK_CHUNK if it's 0. A smaller chunk
+ * makes small reads cheaper and the ratio a bit worse.
+ */
+handle_t wd_seek_writer_create(handle_t h_sess, int fd, size_t chunk_size)
+{
+	struct seek_writer	*w;
+
+	if (!h_sess || fd < 0 || chunk_size > SEEK_CHUNK_MAX)
+		return 0;
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return 0;
+	w->sess = h_sess;
+	w->fd = fd;
+	w->chunk_size = chunk_size ? chunk_size : WD_SEEK_CHUNK;
+	/* a chunk may grow a bit if it's stored */
+	w->out_size = SEEK_BATCH * (w->chunk_size + (w->chunk_size >> 4) +
+				    WD_GZIP_MEMBER_HEAD + 64);
+	w->in = malloc(SEEK_BATCH * w->chunk_size);
+	w->out = malloc(w->out_size);
+	if (!w->in || !w->out) {
+		free(w->in);
+		free(w->out);
+		free(w);
+		return 0;
+	}
+	return (handle_t)w;
+}
+
+static int seek_add_member(struct seek_writer *w, uint32_t size)
+{
+	uint32_t	*sizes;
+
+	if (w->num == w->max) {
+		w->max = w->max ? w->max * 2 : 1024;
+		sizes = realloc(w->sizes, w->max * sizeof(*sizes));
+		if (!sizes)
+			return -ENOMEM;
+		w->sizes = sizes;
+	}
+	w->sizes[w->num++] = size;
+	return 0;
+}
+
+/* compress the input of the batch, and record the members */
+static int seek_flush(struct seek_writer *w)
+{
+	struct wd_comp_arg	arg;
+	unsigned char	*p;
+	size_t	len;
+	uint32_t	size;
+	int	ret;
+
+	if (!w->in_len)
+		return 0;
+	memset(&arg, 0, sizeof(arg));
+	arg.src = w->in;
+	arg.src_len = w->in_len;
+	arg.dst = w->out;
+	arg.dst_len = w->out_size;
+	ret = wd_alg_compress_members(&w->sess, 1, &arg, w->chunk_size);
+	if (ret)
+		return ret;
+	for (p = w->out; p < (unsigned char *)w->out + arg.dst_len; p += size) {
+		size = WD_GZIP_MEMBER_HEAD + get_le32(p + 16) +
+		       SEEK_MEMBER_TAIL;
+		ret = seek_add_member(w, size);
+		if (ret)
+			return ret;
+	}
+	len = arg.dst_len;
+	ret = write_all(w->fd, w->out, len);
+	if (ret)
+		return ret;
+	w->off += len;
+	w->size += w->in_len;
+	w->in_len = 0;
+	return 0;
+}
+
+int wd_seek_write(handle_t writer, const void *buf, size_t len)
+{
+	struct seek_writer	*w = (struct seek_writer *)writer;
+	size_t	batch, n;
+
+	if (!w || (!buf && len))
+		return -EINVAL;
+	/* the file is broken after a failure */
+	if (w->err)
+		return w->err;
+	batch = SEEK_BATCH * w->chunk_size;
+	while (len) {
+		n = batch - w->in_len;
+		if (n > len)
+			n = len;
+		memcpy(w->in + w->in_len, buf, n);
+		w->in_len += n;
+		buf += n;
+		len -= n;
+		if (w->in_len == batch) {
+			w->err = seek_flush(w);
+			if (w->err)
+				return w->err;
+		}
+	}
+	return 0;
+}
+
+static int seek_write_index(struct seek_writer *w)
+{
+	unsigned char	*p, *q;
+	unsigned char	footer[SEEK_FOOTER_DATA];
+	uint32_t	i, n;
+	uint64_t	index_off = w->off;
+	size_t	len;
+	int	ret;
+
+	/* the largest index member */
+	p = malloc(SEEK_EMPTY_SZ(SEEK_INDEX_MAX * 4));
+	if (!p)
+		return -ENOMEM;
+	q = p + 16;
+	for (i = 0; i < w->num; i += n) {
+		n = w->num - i < SEEK_INDEX_MAX ? w->num - i : SEEK_INDEX_MAX;
+		/* entries are put in place, then the member around them */
+		for (len = 0; len < n; len++)
+			put_le32(q + len * 4, w->sizes[i + len]);
+		len = put_empty_member(p, "Ix", q, n * 4);
+		ret = write_all(w->fd, p, len);
+		if (ret)
+			goto out;
+		w->off += len;
+	}
+	put_le64(footer, index_off);
+	put_le64(footer + 8, w->size);
+	put_le32(footer + 16, w->chunk_size);
+	put_le32(footer + 20, w->num);
+	len = put_empty_member(p, "If", footer, sizeof(footer));
+	ret = write_all(w->fd, p, len);
+out:
+	free(p);
+	return ret;
+}
+
+/* write the last chunk and the index, and free the writer */
+int wd_seek_writer_close(handle_t writer)
+{
+	struct seek_writer	*w = (struct seek_writer *)writer;
+	int	ret;
+
+	if (!w)
+		return -EINVAL;
+	ret = w->err;
+	if (!ret)
+		ret = seek_flush(w);
+	if (!ret)
+		ret = seek_write_index(w);
+	free(w->sizes);
+	free(w->out);
+	free(w->in);
+	free(w);
+	return ret;
+}
+
+static int seek_load_index(struct seek_reader *r, uint64_t index_off,
+			   uint64_t end)
+{
+	const unsigned char	*e;
+	unsigned char	*buf, *p;
+	uint64_t	len = end - index_off;
+	uint32_t	i = 0, j;
+	uint16_t	n;
+	int	ret;
+
+	r->offs[0] = 0;
+	if (!len)
+		return r->num ? -EINVAL : 0;
+	buf = malloc(len);
+	if (!buf)
+		return -ENOMEM;
+	ret = read_all(r->fd, buf, len, index_off);
+	if (ret)
+		goto out;
+	for (p = buf; p < buf + len; p += SEEK_EMPTY_SZ(n)) {
+		e = get_empty_member(p, buf + len - p, "Ix", &n);
+		if (!e || (n & 3) || i + n / 4 > r->num) {
+			ret = -EINVAL;
+			goto out;
+		}
+		for (j = 0; j < n / 4; j++, i++)
+			r->offs[i + 1] = r->offs[i] + get_le32(e + j * 4);
+	}
+	if (i != r->num || r->offs[i] != index_off)
+		ret = -EINVAL;
+out:
+	free(buf);
+	return ret;
+}
+
+/*
+ * Open a file made by the writer. h_sess is a gzip session in block mode.
+ * A reader keeps the last chunk it decompressed, so it's used by one thread
+ * at a time.
+ */
+handle_t wd_seek_reader_open(handle_t h_sess, int fd)
+{
+	struct seek_reader	*r;
+	unsigned char	footer[WD_SEEK_FOOTER];
+	const unsigned char	*e;
+	struct stat	st;
+	uint64_t	index_off, end, max = 0;
+	uint32_t	i;
+	uint16_t	len;
+
+	if (!h_sess || fd < 0 || fstat(fd, &st) ||
+	    st.st_size < WD_SEEK_FOOTER)
+		return 0;
+	end = st.st_size - WD_SEEK_FOOTER;
+	if (read_all(fd, footer, sizeof(footer), end))
+		return 0;
+	e = get_empty_member(footer, sizeof(footer), "If", &len);
+	if (!e || len != SEEK_FOOTER_DATA)
+		return 0;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return 0;
+	r->sess = h_sess;
+	r->fd = fd;
+	r->cached = -1;
+	index_off = get_le64(e);
+	r->size = get_le64(e + 8);
+	r->chunk_size = get_le32(e + 16);
+	r->num = get_le32(e + 20);
+	if (!r->chunk_size || r->chunk_size > SEEK_CHUNK_MAX ||
+	    index_off > end ||
+	    r->num != r->size / r->chunk_size + !!(r->size % r->chunk_size))
+		goto out;
+	/* each chunk has 4 bytes in the index, so num is bounded by the file */
+	if ((uint64_t)r->num * 4 > end - index_off ||
+	    r->num >= SIZE_MAX / sizeof(*r->offs))
+		goto out;
+	r->offs = malloc(((size_t)r->num + 1) * sizeof(*r->offs));
+	if (!r->offs || seek_load_index(r, index_off, end))
+		goto out;
+	for (i = 0; i < r->num; i++) {
+		if (r->offs[i + 1] - r->offs[i] > max)
+			max = r->offs[i + 1] - r->offs[i];
+	}
+	r->rbuf = malloc(max);
+	r->cbuf = malloc(r->chunk_size);
+	if ((max && !r->rbuf) || !r->cbuf)
+		goto out;
+	return (handle_t)r;
+out:
+	wd_seek_reader_close((handle_t)r);
+	return 0;
+}
+
+void wd_seek_reader_close(handle_t reader)
+{
+	struct seek_reader	*r = (struct seek_reader *)reader;
+
+	if (!r)
+		return;
+	free(r->cbuf);
+	free(r->rbuf);
+	free(r->offs);
+	free(r);
+}
+
+/* the size of the input */
+uint64_t wd_seek_size(handle_t reader)
+{
+	struct seek_reader	*r = (struct seek_reader *)reader;
+
+	return r ? r->size : 0;
+}
+
+static int seek_load_chunk(struct seek_reader *r, uint32_t i)
+{
+	struct wd_comp_arg	arg;
+	unsigned char	*p = r->rbuf;
+	size_t	size, len;
+	int	ret;
+
+	if (r->cached == i)
+		return 0;
+	r->cached = -1;
+	size = r->offs[i + 1] - r->offs[i];
+	if (size < WD_GZIP_MEMBER_HEAD + SEEK_MEMBER_TAIL)
+		return -EIO;
+	ret = read_all(r->fd, p, size, r->offs[i]);
+	if (ret)
+		return ret;
+	if (memcmp(p, "\x1f\x8b\x08\x04", 4))
+		return -EIO;
+	/* a plain header in front of the deflate data, as the session takes */
+	p += WD_GZIP_MEMBER_HEAD - sizeof(gzip_head);
+	memcpy(p, gzip_head, sizeof(gzip_head));
+	len = r->size - (uint64_t)i * r->chunk_size;
+	if (len > r->chunk_size)
+		len = r->chunk_size;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.src = p;
+	arg.src_len = size - (WD_GZIP_MEMBER_HEAD - sizeof(gzip_head));
+	arg.dst = r->cbuf;
+	arg.dst_len = r->chunk_size;
+	arg.flag = FLAG_INPUT_FINISH;
+	ret = wd_alg_decompress(r->sess, &arg);
+	if (ret)
+		return ret;
+	if (arg.dst - r->cbuf != len)
+		return -EIO;
+	r->cached = i;
+	r->cached_len = len;
+	return 0;
+}
+
+/*
+ * Read up to len bytes of the input at off. Only the chunks that cover the
+ * range are read and decompressed. Return the number of bytes, 0 at the
+ * end, or error number.
+ */
+ssize_t wd_seek_read(handle_t reader, void *buf, size_t len, uint64_t off)
+{
+	struct seek_reader	*r = (struct seek_reader *)reader;
+	size_t	done = 0, in_off, n;
+	int	ret;
+
+	if (!r || (!buf && len))
+		return -EINVAL;
+	if (off >= r->size)
+		return 0;
+	if (len > r->size - off)
+		len = r->size - off;
+	while (done < len) {
+		ret = seek_load_chunk(r, off / r->chunk_size);
+		if (ret)
+			return done ? done : ret;
+		in_off = off % r->chunk_size;
+		n = r->cached_len - in_off;
+		if (n > len - done)
+			n = len - done;
+		memcpy(buf + done, r->cbuf + in_off, n);
+		done += n;
+		off += n;
+	}
+	return done;
+}
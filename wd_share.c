@@ -0,0 +1,477 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "wd_sched.h"
+#include "wd_share.h"
+
+#define SHARE_DEFLATE	0
+#define SHARE_INFLATE	1
+#define SHARE_OP_NUM	2
+
+/* queues may be freed by other processes, so try to grow again after it */
+#define SHARE_RETRY_NS	(100 * 1000000ULL)
+
+/* an accelerator session in the pool, bound to one operation */
+struct share_inst {
+	handle_t		sess;
+	struct share_inst	*next;
+};
+
+/* a request waiting for an instance, it lives on the caller's stack */
+struct share_req {
+	struct share_tenant	*tenant;
+	struct wd_comp_arg	*arg;
+	int			op;
+	size_t			cost;
+	size_t			left;	/* deficit dropped when dequeued */
+	struct share_inst	*inst;	/* the granted instance */
+	int			ret;	/* failure before the request runs */
+	int			done;
+	pthread_cond_t		cond;
+	struct share_req	*next;
+};
+
+struct share_tenant {
+	struct share_pool	*pool;
+	int			weight;
+	int			max_inflight;	/* 0 for no limit */
+	int			inflight;
+	size_t			deficit;
+	struct share_req	*head;
+	struct share_req	*tail;
+	/* ring of the tenants in the pool */
+	struct share_tenant	*prev;
+	struct share_tenant	*next;
+};
+
+struct share_pool {
+	char			*alg_name;
+	wd_dev_mask_t		*dev_mask;
+	int			max_instn;	/* for each operation */
+	int			instn[SHARE_OP_NUM];
+	/*
+	 * wd_sched_now() when no more instance could be got from the devices,
+	 * 0 if op may grow
+	 */
+	uint64_t		exhausted[SHARE_OP_NUM];
+	struct share_inst	*idle[SHARE_OP_NUM];
+	/* the tenant that deficit round robin stays on */
+	struct share_tenant	*cur;
+	int			tenant_num;
+	pthread_mutex_t		lock;
+};
+
+/*
+ * Create an instance of op. It's called without pool->lock, since getting a
+ * queue of device takes a while, and the slot of it is counted in
+ * pool->instn[op] already.
+ */
+static struct share_inst *__create_inst(struct share_pool *pool, int op)
+{
+	struct share_inst	*inst;
+	struct wd_comp_sess	*sess;
+	struct wd_comp_arg	arg;
+	int	ret;
+
+	inst = calloc(1, sizeof(*inst));
+	if (!inst)
+		return NULL;
+	inst->sess = wd_alg_comp_alloc_sess(pool->alg_name, 0, pool->dev_mask);
+	if (!inst->sess)
+		goto out;
+
+	/* bind the hardware queue now, so that failure is seen here */
+	sess = (struct wd_comp_sess *)inst->sess;
+	memset(&arg, 0, sizeof(arg));
+	arg.flag = (op == SHARE_DEFLATE) ? FLAG_DEFLATE : 0;
+	if (sess->drv->prep) {
+		ret = sess->drv->prep(sess, &arg);
+		if (ret)
+			goto out_sess;
+	}
+	return inst;
+
+out_sess:
+	wd_alg_comp_free_sess(inst->sess);
+out:
+	free(inst);
+	return NULL;
+}
+
+static void __free_inst(struct share_inst *inst)
+{
+	wd_alg_comp_free_sess(inst->sess);
+	free(inst);
+}
+
+/*
+ * Create an instance for a request that got a slot of op. If the devices run
+ * out of queues while op has no other instance, an idle instance of the other
+ * operation is given back to make room.
+ */
+static struct share_inst *__grow(struct share_pool *pool, int op)
+{
+	struct share_inst	*inst, *victim = NULL;
+	int	other = !op;
+
+	inst = __create_inst(pool, op);
+	if (inst)
+		return inst;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->instn[op] == 1 && pool->idle[other]) {
+		victim = pool->idle[other];
+		pool->idle[other] = victim->next;
+		pool->instn[other]--;
+		pool->exhausted[other] = 0;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (!victim)
+		return NULL;
+	__free_inst(victim);
+	return __create_inst(pool, op);
+}
+
+/* whether op failed to grow lately, the mark expires after a while */
+static bool __exhausted(struct share_pool *pool, int op)
+{
+	if (!pool->exhausted[op])
+		return false;
+	if (wd_sched_now() - pool->exhausted[op] < SHARE_RETRY_NS)
+		return true;
+	pool->exhausted[op] = 0;
+	return false;
+}
+
+static inline bool __can_run(struct share_pool *pool, struct share_tenant *t)
+{
+	int	op;
+
+	if (!t->head)
+		return false;
+	if (t->max_inflight && t->inflight >= t->max_inflight)
+		return false;
+	op = t->head->op;
+	if (pool->idle[op])
+		return true;
+	/* without any instance, let it try and fail rather than wait */
+	return pool->instn[op] < pool->max_instn &&
+	       (!pool->instn[op] || !__exhausted(pool, op));
+}
+
+static void __dequeue(struct share_tenant *t)
+{
+	struct share_req	*req = t->head;
+
+	t->head = req->next;
+	if (!t->head) {
+		t->tail = NULL;
+		/* an idle tenant can't save credit */
+		req->left = t->deficit;
+		t->deficit = 0;
+	}
+}
+
+/* put a request back at the head, with the deficit that __pick() took */
+static void __requeue(struct share_tenant *t, struct share_req *req)
+{
+	req->next = t->head;
+	t->head = req;
+	if (!t->tail)
+		t->tail = req;
+	t->deficit += req->cost + req->left;
+	req->left = 0;
+}
+
+/*
+ * Pick the next request by deficit round robin. A tenant keeps being served
+ * while its deficit covers the head request. If no runnable tenant has
+ * enough deficit, every runnable tenant gets the quantum of as many rounds
+ * as the closest one needs, which is what rounds of plain DRR would give.
+ */
+static struct share_req *__pick(struct share_pool *pool)
+{
+	struct share_tenant	*t;
+	size_t	quantum, rounds, min_rounds;
+	int	i, pass;
+
+	if (!pool->cur)
+		return NULL;
+
+	for (pass = 0; pass < 2; pass++) {
+		min_rounds = 0;
+		for (i = 0, t = pool->cur; i < pool->tenant_num;
+		     i++, t = t->next) {
+			if (!__can_run(pool, t))
+				continue;
+			if (t->deficit >= t->head->cost) {
+				struct share_req *req = t->head;
+
+				t->deficit -= req->cost;
+				__dequeue(t);
+				pool->cur = t->deficit ? t : t->next;
+				return req;
+			}
+			quantum = (size_t)t->weight * WD_SHARE_QUANTUM;
+			rounds = (t->head->cost - t->deficit + quantum - 1) /
+				 quantum;
+			if (!min_rounds || rounds < min_rounds)
+				min_rounds = rounds;
+		}
+		if (!min_rounds)
+			return NULL;
+		for (i = 0, t = pool->cur; i < pool->tenant_num;
+		     i++, t = t->next) {
+			if (__can_run(pool, t))
+				t->deficit += min_rounds * t->weight *
+					      WD_SHARE_QUANTUM;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Hand idle instances to the waiting requests, with pool->lock held. If op
+ * is under the limit without an idle instance, the request gets a slot and
+ * creates the instance itself out of the lock.
+ */
+static void __dispatch(struct share_pool *pool)
+{
+	struct share_req	*req;
+	int	op;
+
+	while ((req = __pick(pool))) {
+		op = req->op;
+		req->inst = pool->idle[op];
+		if (req->inst)
+			pool->idle[op] = req->inst->next;
+		else
+			pool->instn[op]++;
+		req->tenant->inflight++;
+		req->done = 1;
+		pthread_cond_signal(&req->cond);
+	}
+}
+
+static int __run(struct share_tenant *t, struct wd_comp_arg *arg, int op)
+{
+	struct share_pool	*pool = t->pool;
+	struct share_req	req;
+	int	ret;
+
+	if (!arg)
+		return -EINVAL;
+
+	memset(&req, 0, sizeof(req));
+	req.tenant = t;
+	req.arg = arg;
+	req.op = op;
+	req.cost = arg->src_len ? arg->src_len : 1;
+	pthread_cond_init(&req.cond, NULL);
+
+	pthread_mutex_lock(&pool->lock);
+	if (t->tail)
+		t->tail->next = &req;
+	else
+		t->head = &req;
+	t->tail = &req;
+	for (;;) {
+		__dispatch(pool);
+		while (!req.done)
+			pthread_cond_wait(&req.cond, &pool->lock);
+		if (req.inst)
+			break;
+		pthread_mutex_unlock(&pool->lock);
+		req.inst = __grow(pool, op);
+		pthread_mutex_lock(&pool->lock);
+		if (req.inst)
+			break;
+		pool->instn[op]--;
+		pool->exhausted[op] = wd_sched_now();
+		t->inflight--;
+		if (!pool->instn[op]) {
+			req.ret = -EBUSY;
+			break;
+		}
+		/* out of queues, wait for a busy instance */
+		__requeue(t, &req);
+		req.done = 0;
+	}
+	if (req.ret)
+		__dispatch(pool);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_cond_destroy(&req.cond);
+	if (req.ret)
+		return req.ret;
+
+	if (op == SHARE_DEFLATE)
+		ret = wd_alg_compress(req.inst->sess, arg);
+	else
+		ret = wd_alg_decompress(req.inst->sess, arg);
+
+	pthread_mutex_lock(&pool->lock);
+	req.inst->next = pool->idle[op];
+	pool->idle[op] = req.inst;
+	t->inflight--;
+	__dispatch(pool);
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+int wd_share_compress(handle_t tenant, struct wd_comp_arg *arg)
+{
+	return __run((struct share_tenant *)tenant, arg, SHARE_DEFLATE);
+}
+
+int wd_share_decompress(handle_t tenant, struct wd_comp_arg *arg)
+{
+	return __run((struct share_tenant *)tenant, arg, SHARE_INFLATE);
+}
+
+/*
+ * Create a pool of at most max_instn sessions for each of compression and
+ * decompression. Sessions are created when they're needed.
+ */
+handle_t wd_share_pool_create(char *alg_name, int max_instn,
+			      wd_dev_mask_t *dev_mask)
+{
+	struct share_pool	*pool;
+
+	if (!alg_name || max_instn <= 0)
+		return 0;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return 0;
+	pool->alg_name = strdup(alg_name);
+	if (!pool->alg_name)
+		goto out;
+	if (dev_mask && dev_mask->len > 0) {
+		pool->dev_mask = calloc(1, sizeof(wd_dev_mask_t));
+		if (!pool->dev_mask)
+			goto out_name;
+		pool->dev_mask->mask = malloc(dev_mask->len);
+		if (!pool->dev_mask->mask)
+			goto out_mask;
+		memcpy(pool->dev_mask->mask, dev_mask->mask, dev_mask->len);
+		pool->dev_mask->len = dev_mask->len;
+		pool->dev_mask->magic = dev_mask->magic;
+	}
+	pool->max_instn = max_instn;
+	pthread_mutex_init(&pool->lock, NULL);
+	return (handle_t)pool;
+
+out_mask:
+	free(pool->dev_mask);
+out_name:
+	free(pool->alg_name);
+out:
+	free(pool);
+	return 0;
+}
+
+/* all tenants must be detached */
+void wd_share_pool_destroy(handle_t handle)
+{
+	struct share_pool	*pool = (struct share_pool *)handle;
+	struct share_inst	*inst;
+	int	op;
+
+	if (!pool)
+		return;
+
+	for (op = 0; op < SHARE_OP_NUM; op++) {
+		while ((inst = pool->idle[op])) {
+			pool->idle[op] = inst->next;
+			__free_inst(inst);
+		}
+	}
+	if (pool->dev_mask) {
+		free(pool->dev_mask->mask);
+		free(pool->dev_mask);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->alg_name);
+	free(pool);
+}
+
+/*
+ * Attach a tenant to the pool. A tenant gets the accelerator time in
+ * proportion to weight when the pool is busy, and has at most max_inflight
+ * requests running at once, or no limit if it's 0.
+ */
+handle_t wd_share_attach(handle_t handle, int weight, int max_inflight)
+{
+	struct share_pool	*pool = (struct share_pool *)handle;
+	struct share_tenant	*t;
+
+	if (!pool || weight <= 0 || max_inflight < 0)
+		return 0;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return 0;
+	t->pool = pool;
+	t->weight = weight;
+	t->max_inflight = max_inflight;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->cur) {
+		/* join at the end of the round */
+		t->next = pool->cur;
+		t->prev = pool->cur->prev;
+		t->prev->next = t;
+		pool->cur->prev = t;
+	} else {
+		t->next = t->prev = t;
+		pool->cur = t;
+	}
+	pool->tenant_num++;
+	pthread_mutex_unlock(&pool->lock);
+	return (handle_t)t;
+}
+
+/* the tenant must have no request running */
+void wd_share_detach(handle_t handle)
+{
+	struct share_tenant	*t = (struct share_tenant *)handle;
+	struct share_pool	*pool;
+
+	if (!t)
+		return;
+
+	pool = t->pool;
+	pthread_mutex_lock(&pool->lock);
+	if (t->next == t) {
+		pool->cur = NULL;
+	} else {
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+		if (pool->cur == t)
+			pool->cur = t->next;
+	}
+	pool->tenant_num--;
+	pthread_mutex_unlock(&pool->lock);
+	free(t);
+}
+
+int wd_share_set_weight(handle_t handle, int weight, int max_inflight)
+{
+	struct share_tenant	*t = (struct share_tenant *)handle;
+
+	if (!t || weight <= 0 || max_inflight < 0)
+		return -EINVAL;
+
+	pthread_mutex_lock(&t->pool->lock);
+	t->weight = weight;
+	t->max_inflight = max_inflight;
+	/* a raised limit may let the waiting requests run */
+	__dispatch(t->pool);
+	pthread_mutex_unlock(&t->pool->lock);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include "bmm.h"
+#include "wd.h"
+#include "wd_shm.h"
+
+#define SHM_MAGIC		0x5744534d	/* "WDSM" */
+#define SHM_PAGE		4096
+#define SHM_CACHELINE		64
+#define WD_MFD_CLOEXEC		1
+
+#define SHM_ALIGN(x, a)		(((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+/*
+ * The head, the references of blocks and the bmm pool are in the memfd.
+ * They're located by offsets, so nothing depends on where it's mapped.
+ */
+struct wd_shm_head {
+	uint32_t	magic;
+	uint32_t	block_size;
+	uint64_t	size;
+	uint64_t	ref_off;
+	uint64_t	pool_off;
+	uint32_t	ref_num;
+};
+
+/* the references of the buffer that starts at the block */
+struct wd_shm_ref {
+	uint32_t	ref;
+	uint32_t	num;	/* blocks of the buffer */
+};
+
+struct wd_shm {
+	int			fd;
+	char			*addr;
+	size_t			size;
+	struct wd_shm_head	*head;
+	struct wd_shm_ref	*refs;
+	void			*pool;
+};
+
+static struct wd_shm *shm_map(int fd, size_t size)
+{
+	struct wd_shm *shm;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm)
+		return NULL;
+	shm->addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+	if (shm->addr == MAP_FAILED) {
+		WD_ERR("fail to map shared pool (%d)\n", errno);
+		free(shm);
+		return NULL;
+	}
+	shm->fd = fd;
+	shm->size = size;
+	shm->head = (struct wd_shm_head *)shm->addr;
+	return shm;
+}
+
+static void shm_setup(struct wd_shm *shm)
+{
+	shm->refs = (struct wd_shm_ref *)(shm->addr + shm->head->ref_off);
+	shm->pool = shm->addr + shm->head->pool_off;
+}
+
+/*
+ * Create a pool of size bytes, which is cut into blocks of block_size. A
+ * buffer takes whole blocks. name is only shown in /proc.
+ */
+struct wd_shm *wd_shm_create(const char *name, size_t size,
+			     unsigned int block_size)
+{
+	struct wd_shm_head *head;
+	struct wd_shm *shm;
+	uint64_t ref_off, pool_off, total;
+	uint32_t ref_num;
+	int fd, ret;
+
+	if (!name || !block_size || size <= block_size || size > UINT32_MAX)
+		return NULL;
+	/* blocks are counted from the start of the pool, plus a partial one */
+	ref_num = size / block_size + 1;
+	ref_off = SHM_ALIGN(sizeof(*head), SHM_CACHELINE);
+	pool_off = SHM_ALIGN(ref_off + ref_num * sizeof(struct wd_shm_ref),
+			     SHM_PAGE);
+	total = SHM_ALIGN(pool_off + size, SHM_PAGE);
+
+	fd = syscall(SYS_memfd_create, name, WD_MFD_CLOEXEC);
+	if (fd < 0) {
+		WD_ERR("fail to create memfd (%d)\n", errno);
+		return NULL;
+	}
+	if (ftruncate(fd, total)) {
+		WD_ERR("fail to size memfd to %lu (%d)\n", total, errno);
+		goto out;
+	}
+	shm = shm_map(fd, total);
+	if (!shm)
+		goto out;
+
+	/* the file is zero filled, so all references are 0 */
+	head = shm->head;
+	head->block_size = block_size;
+	head->size = total;
+	head->ref_off = ref_off;
+	head->pool_off = pool_off;
+	head->ref_num = ref_num;
+	shm_setup(shm);
+	ret = bmm_init_ex(shm->pool, size, block_size, SHM_CACHELINE,
+			  BMM_CONCURRENT);
+	if (ret) {
+		WD_ERR("fail to init shared pool (%d)\n", ret);
+		munmap(shm->addr, shm->size);
+		free(shm);
+		goto out;
+	}
+	/* it's valid to others only when the pool is ready */
+	__atomic_store_n(&head->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+out:
+	close(fd);
+	return NULL;
+}
+
+/* Map the pool of fd from another process. fd is owned by the pool then. */
+struct wd_shm *wd_shm_attach(int fd)
+{
+	struct wd_shm *shm;
+	struct stat st;
+
+	if (fstat(fd, &st) || st.st_size < SHM_PAGE)
+		return NULL;
+	shm = shm_map(fd, st.st_size);
+	if (!shm)
+		return NULL;
+	if (__atomic_load_n(&shm->head->magic, __ATOMIC_ACQUIRE) !=
+	    SHM_MAGIC || shm->head->size != (uint64_t)st.st_size) {
+		WD_ERR("fd %d isn't a shared pool\n", fd);
+		munmap(shm->addr, shm->size);
+		free(shm);
+		return NULL;
+	}
+	shm_setup(shm);
+	return shm;
+}
+
+/* The memory is released when all processes close it. */
+void wd_shm_close(struct wd_shm *shm)
+{
+	if (!shm)
+		return;
+	munmap(shm->addr, shm->size);
+	close(shm->fd);
+	free(shm);
+}
+
+int wd_shm_fd(struct wd_shm *shm)
+{
+	return shm ? shm->fd : -EINVAL;
+}
+
+/* the reference of the buffer at off, or NULL if off isn't a buffer */
+static struct wd_shm_ref *get_ref(struct wd_shm *shm, uint64_t off)
+{
+	struct wd_shm_head *head = shm->head;
+	uint64_t rel;
+
+	if (off <= head->pool_off || off >= head->size)
+		return NULL;
+	rel = off - head->pool_off;
+	if (rel / head->block_size >= head->ref_num)
+		return NULL;
+	return &shm->refs[rel / head->block_size];
+}
+
+/* Allocate a buffer with one reference, return its offset or 0. */
+uint64_t wd_shm_alloc(struct wd_shm *shm, size_t size)
+{
+	struct wd_shm_ref *ref;
+	unsigned int num;
+	char *buf;
+
+	if (!shm || !size)
+		return 0;
+	num = (size + shm->head->block_size - 1) / shm->head->block_size;
+	buf = bmm_alloc_n(shm->pool, num);
+	if (!buf)
+		return 0;
+	ref = get_ref(shm, buf - shm->addr);
+	ref->num = num;
+	__atomic_store_n(&ref->ref, 1, __ATOMIC_RELEASE);
+	return buf - shm->addr;
+}
+
+/* Take one more reference of the buffer, e.g. before it's handed over. */
+int wd_shm_get(struct wd_shm *shm, uint64_t off)
+{
+	struct wd_shm_ref *ref;
+	uint32_t old;
+
+	if (!shm)
+		return -EINVAL;
+	ref = get_ref(shm, off);
+	if (!ref)
+		return -EINVAL;
+	old = __atomic_load_n(&ref->ref, __ATOMIC_RELAXED);
+	do {
+		/* it's freed already */
+		if (!old)
+			return -EINVAL;
+	} while (!__atomic_compare_exchange_n(&ref->ref, &old, old + 1, 1,
+					      __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+	return 0;
+}
+
+/* Put one reference of the buffer, and free it with the last one. */
+int wd_shm_put(struct wd_shm *shm, uint64_t off)
+{
+	struct wd_shm_ref *ref;
+	uint32_t old;
+
+	if (!shm)
+		return -EINVAL;
+	ref = get_ref(shm, off);
+	if (!ref)
+		return -EINVAL;
+	old = __atomic_load_n(&ref->ref, __ATOMIC_RELAXED);
+	do {
+		if (!old)
+			return -EINVAL;
+	} while (!__atomic_compare_exchange_n(&ref->ref, &old, old - 1, 1,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+	if (old == 1)
+		bmm_free_n(shm->pool, shm->addr + off, ref->num);
+	return 0;
+}
+
+/* The address of off in this process, it could be passed to wd_comp. */
+void *wd_shm_ptr(struct wd_shm *shm, uint64_t off)
+{
+	if (!shm || !off || off >= shm->size)
+		return NULL;
+	return shm->addr + off;
+}
+
+uint64_t wd_shm_off(struct wd_shm *shm, void *ptr)
+{
+	if (!shm || (char *)ptr <= shm->addr ||
+	    (char *)ptr >= shm->addr + shm->size)
+		return 0;
+	return (char *)ptr - shm->addr;
+}
+
+int wd_shm_get_stats(struct wd_shm *shm, struct bmm_stats *st)
+{
+	if (!shm)
+		return -EINVAL;
+	return bmm_get_stats(shm->pool, st);
+}
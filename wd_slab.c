@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "bmm.h"
+#include "wd.h"
+#include "wd_slab.h"
+
+#define SLAB_CACHELINE		64
+#define SLAB_PAGE		4096
+/* bmm keeps its head and two bitmaps at the start of the pool */
+#define SLAB_POOL_HEAD		128
+
+#define SLAB_ALIGN(x, a)	(((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct wd_slab_cache {
+	size_t		size;
+	unsigned int	num;
+	char		*start;		/* the bmm pool */
+	char		*end;
+};
+
+struct wd_slab {
+	char			*region;
+	size_t			size;
+	int			mapped;	/* the region is mapped by the slab */
+	int			num;
+	struct wd_slab_cache	caches[WD_SLAB_MAX_CLASS];
+};
+
+static inline size_t class_align(const struct wd_slab_class *cls)
+{
+	return cls->align ? cls->align : SLAB_CACHELINE;
+}
+
+static inline size_t class_obj_size(const struct wd_slab_class *cls)
+{
+	return SLAB_ALIGN(cls->size, class_align(cls));
+}
+
+/* the pool of a class, with room for the bmm head and bitmaps */
+static size_t class_pool_size(const struct wd_slab_class *cls)
+{
+	size_t words = (cls->num + 63) / 64;
+	size_t meta;
+
+	meta = SLAB_POOL_HEAD + (words + (words + 63) / 64) * sizeof(uint64_t);
+	return SLAB_ALIGN(meta, class_align(cls)) +
+	       class_obj_size(cls) * cls->num;
+}
+
+static int check_classes(const struct wd_slab_class *cls, int num)
+{
+	int i;
+
+	if (!cls || num <= 0 || num > WD_SLAB_MAX_CLASS)
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		if (!cls[i].size || !cls[i].num ||
+		    (cls[i].align & (cls[i].align - 1)))
+			return -EINVAL;
+		if (i && cls[i].size <= cls[i - 1].size)
+			return -EINVAL;
+		if (class_pool_size(&cls[i]) > UINT32_MAX)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/* the size of the region to hold all classes, 0 if classes are invalid */
+size_t wd_slab_region_size(const struct wd_slab_class *cls, int num)
+{
+	size_t size = 0;
+	int i;
+
+	if (check_classes(cls, num))
+		return 0;
+	for (i = 0; i < num; i++) {
+		size = SLAB_ALIGN(size, class_align(&cls[i]));
+		size += class_pool_size(&cls[i]);
+	}
+	return SLAB_ALIGN(size, SLAB_PAGE);
+}
+
+static struct wd_slab *slab_create(void *region, size_t size,
+				   const struct wd_slab_class *cls, int num,
+				   int node)
+{
+	struct wd_slab *slab;
+	struct bmm_stats st;
+	size_t need, off = 0;
+	int i, ret;
+
+	need = wd_slab_region_size(cls, num);
+	if (!need)
+		return NULL;
+	if (region && (size < need || ((uintptr_t)region & (SLAB_PAGE - 1))))
+		return NULL;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+	if (!region) {
+		region = mmap(NULL, need, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			      -1, 0);
+		if (region == MAP_FAILED) {
+			WD_ERR("fail to map %zu bytes for slab\n", need);
+			goto out;
+		}
+		slab->mapped = 1;
+		size = need;
+		/* before the pool heads are written */
+		if (node >= 0)
+			wd_numa_bind(region, need, node);
+	}
+	slab->region = region;
+	slab->size = size;
+	slab->num = num;
+
+	for (i = 0; i < num; i++) {
+		off = SLAB_ALIGN(off, class_align(&cls[i]));
+		slab->caches[i].size = class_obj_size(&cls[i]);
+		slab->caches[i].start = slab->region + off;
+		off += class_pool_size(&cls[i]);
+		slab->caches[i].end = slab->region + off;
+		ret = bmm_init_ex(slab->caches[i].start,
+				  class_pool_size(&cls[i]),
+				  slab->caches[i].size, class_align(&cls[i]),
+				  BMM_CONCURRENT);
+		if (ret) {
+			WD_ERR("fail to init slab class %zu (%d)\n",
+			       cls[i].size, ret);
+			goto out_map;
+		}
+		/* bmm may fit more objects than asked in the pool */
+		bmm_get_stats(slab->caches[i].start, &st);
+		slab->caches[i].num = st.size / st.block_size;
+	}
+	return slab;
+
+out_map:
+	if (slab->mapped)
+		munmap(slab->region, slab->size);
+out:
+	free(slab);
+	return NULL;
+}
+
+/*
+ * Create a slab in region, which is page aligned and at least
+ * wd_slab_region_size() long. If region is NULL, the slab maps anonymous
+ * memory for itself, and the pages are only populated when they're used.
+ */
+struct wd_slab *wd_slab_create(void *region, size_t size,
+			       const struct wd_slab_class *cls, int num)
+{
+	return slab_create(region, size, cls, num, -1);
+}
+
+/* Create a slab in anonymous memory that prefers pages on node. */
+struct wd_slab *wd_slab_create_node(const struct wd_slab_class *cls, int num,
+				    int node)
+{
+	return slab_create(NULL, 0, cls, num, node);
+}
+
+/* objects in the slab mustn't be used after it */
+void wd_slab_destroy(struct wd_slab *slab)
+{
+	if (!slab)
+		return;
+	if (slab->mapped)
+		munmap(slab->region, slab->size);
+	free(slab);
+}
+
+/* get an object of the smallest class that holds size */
+void *wd_slab_alloc(struct wd_slab *slab, size_t size)
+{
+	int i;
+
+	for (i = 0; i < slab->num; i++) {
+		if (size <= slab->caches[i].size)
+			return bmm_alloc(slab->caches[i].start);
+	}
+	return NULL;
+}
+
+int wd_slab_owns(struct wd_slab *slab, void *obj)
+{
+	return (char *)obj >= slab->region &&
+	       (char *)obj < slab->region + slab->size;
+}
+
+static void cache_give_back(struct wd_slab_cache *cache, void **objs, int num)
+{
+	while (num--)
+		bmm_free(cache->start, objs[num]);
+}
+
+/*
+ * Populate the pages of num free objects that hold size, so they won't
+ * fault when they're used. Return the number of objects populated.
+ */
+int wd_slab_prefault(struct wd_slab *slab, size_t size, int num)
+{
+	struct wd_slab_cache *cache = NULL;
+	void **objs;
+	size_t off;
+	int i, n;
+
+	for (i = 0; i < slab->num; i++) {
+		if (size <= slab->caches[i].size) {
+			cache = &slab->caches[i];
+			break;
+		}
+	}
+	if (!cache || num <= 0)
+		return 0;
+	objs = malloc(sizeof(void *) * cache->num);
+	if (!objs)
+		return 0;
+	for (n = 0; n < num && n < (int)cache->num; n++) {
+		objs[n] = bmm_alloc(cache->start);
+		if (!objs[n])
+			break;
+		/* zero pages are populated by any write */
+		for (off = 0; off < cache->size; off += SLAB_PAGE)
+			((volatile char *)objs[n])[off] = 0;
+	}
+	cache_give_back(cache, objs, n);
+	free(objs);
+	return n;
+}
+
+/*
+ * Give the pages of free objects back to the system, except for keep bytes
+ * of objects that are populated. Only classes of page sized objects are
+ * trimmed. Free objects are taken one at a time while they're checked, so
+ * the others can still be allocated by other threads. Return the bytes
+ * trimmed.
+ */
+size_t wd_slab_trim(struct wd_slab *slab, size_t keep)
+{
+	struct wd_slab_cache *cache;
+	size_t trimmed = 0;
+	unsigned char vec;
+	unsigned int j;
+	void *obj;
+	int i;
+
+	if (!slab->mapped)
+		return 0;
+	/* large objects are trimmed first */
+	for (i = slab->num - 1; i >= 0; i--) {
+		cache = &slab->caches[i];
+		if (cache->size & (SLAB_PAGE - 1))
+			continue;
+		for (j = 0; j < cache->num; j++) {
+			obj = bmm_alloc_at(cache->start, j);
+			if (!obj)
+				continue;
+			/* the first page is written if anything is */
+			if (!mincore(obj, SLAB_PAGE, &vec) && (vec & 1)) {
+				if (keep >= cache->size)
+					keep -= cache->size;
+				else if (!madvise(obj, cache->size,
+						  MADV_DONTNEED))
+					trimmed += cache->size;
+			}
+			bmm_free(cache->start, obj);
+		}
+	}
+	return trimmed;
+}
+
+/* sum up the statistics of all classes */
+int wd_slab_get_stats(struct wd_slab *slab, struct bmm_stats *st)
+{
+	struct bmm_stats cst;
+	int i, ret;
+
+	if (!slab || !st)
+		return -EINVAL;
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < slab->num; i++) {
+		ret = bmm_get_stats(slab->caches[i].start, &cst);
+		if (ret)
+			return ret;
+		st->size += cst.size;
+		st->used += cst.used;
+		st->free += cst.free;
+		/* the classes may peak at different moments */
+		st->peak_used += cst.peak_used;
+		st->fail_num += cst.fail_num;
+	}
+	return 0;
+}
+
+void wd_slab_free(struct wd_slab *slab, void *obj)
+{
+	int i;
+
+	for (i = 0; i < slab->num; i++) {
+		if ((char *)obj >= slab->caches[i].start &&
+		    (char *)obj < slab->caches[i].end) {
+			bmm_free(slab->caches[i].start, obj);
+			return;
+		}
+	}
+	WD_ERR("slab: free invalid pointer %p\n", obj);
+}